@@ -0,0 +1,60 @@
+/*
+ * The common controls that the files of the POSIX build (see windows.h)
+ * refer to: the I/O list view and the trackbars of the simulated ADCs. As
+ * with the rest of the GUI, these don't do anything.
+ */
+
+#ifndef __POSIX_COMMCTRL_H
+#define __POSIX_COMMCTRL_H
+
+#include <windows.h>
+
+#define LVIF_TEXT           0x0001
+#define LVN_GETDISPINFO     (0U-150U)
+#define LVN_ITEMACTIVATE    (0U-114U)
+#define LVM_REDRAWITEMS     0x1015
+
+typedef struct {
+    UINT    mask;
+    int     iItem;
+    int     iSubItem;
+    UINT    state;
+    UINT    stateMask;
+    LPSTR   pszText;
+    int     cchTextMax;
+    int     iImage;
+    LPARAM  lParam;
+} LVITEM;
+
+typedef struct {
+    NMHDR   hdr;
+    LVITEM  item;
+} NMLVDISPINFO;
+
+typedef struct {
+    NMHDR   hdr;
+    int     iItem;
+    int     iSubItem;
+    UINT    uNewState;
+    UINT    uOldState;
+    UINT    uChanged;
+    POINT   ptAction;
+    LPARAM  lParam;
+    UINT    uKeyFlags;
+} NMITEMACTIVATE;
+
+#define ListView_RedrawItems(hwnd, first, last) \
+    (BOOL)SendMessage((hwnd), LVM_REDRAWITEMS, (WPARAM)(first), (LPARAM)(last))
+
+#define TRACKBAR_CLASS      "msctls_trackbar32"
+#define TBS_AUTOTICKS       0x0001
+#define TBS_VERT            0x0002
+#define TBS_TOOLTIPS        0x0100
+#define TBM_GETPOS          0x0400
+#define TBM_SETPOS          0x0405
+#define TBM_SETRANGE        0x0406
+#define TBM_SETTICFREQ      0x0414
+#define TBM_SETPAGESIZE     0x0415
+#define TBM_SETLINESIZE     0x0417
+
+#endif
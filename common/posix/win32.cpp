@@ -0,0 +1,254 @@
+/*
+ * The Win32 calls declared in our <windows.h>, on POSIX. The console, the
+ * clocks, the heap and the threads work; the windows and dialogs don't
+ * exist, so those calls do nothing and fail.
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+//-----------------------------------------------------------------------------
+// Console and files
+//-----------------------------------------------------------------------------
+HANDLE GetStdHandle(DWORD which)
+{
+    return (HANDLE)stdout;
+}
+
+BOOL WriteFile(HANDLE h, const void *buf, DWORD n, DWORD *written,
+    void *overlapped)
+{
+    size_t done = fwrite(buf, 1, n, (FILE *)h);
+    fflush((FILE *)h);
+    if(written) *written = (DWORD)done;
+    return done == n;
+}
+
+void OutputDebugString(LPCSTR str)
+{
+}
+
+DWORD GetFullPathName(LPCSTR name, DWORD n, LPSTR buf, LPSTR *filePart)
+{
+    char path[PATH_MAX];
+    if(!realpath(name, path)) return 0;
+    if(strlen(path) >= n) return strlen(path) + 1;
+    strcpy(buf, path);
+    if(filePart) {
+        char *c = strrchr(buf, '/');
+        *filePart = c ? c + 1 : buf;
+    }
+    return strlen(buf);
+}
+
+HANDLE CreateFile(LPCSTR name, DWORD access, DWORD share, void *security,
+    DWORD disposition, DWORD flags, HANDLE templateFile)
+{
+    return INVALID_HANDLE_VALUE;
+}
+
+HANDLE CreateFileMapping(HANDLE h, void *security, DWORD protect,
+    DWORD sizeHigh, DWORD sizeLow, LPCSTR name)
+{
+    return NULL;
+}
+
+LPVOID MapViewOfFile(HANDLE h, DWORD access, DWORD offsetHigh,
+    DWORD offsetLow, size_t n)
+{
+    return NULL;
+}
+
+BOOL UnmapViewOfFile(const void *p)
+{
+    return TRUE;
+}
+
+BOOL AnsiToOem(LPCSTR src, LPSTR dest)
+{
+    if(dest != src) strcpy(dest, src);
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Time
+//-----------------------------------------------------------------------------
+DWORD GetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (DWORD)(ts.tv_sec*1000 + ts.tv_nsec/1000000);
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER *t)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t->QuadPart = (LONGLONG)ts.tv_sec*1000000000 + ts.tv_nsec;
+    return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *f)
+{
+    f->QuadPart = 1000000000;
+    return TRUE;
+}
+
+void Sleep(DWORD ms)
+{
+    usleep(ms*1000);
+}
+
+//-----------------------------------------------------------------------------
+// Heap; there is just the one, so the handle doesn't matter.
+//-----------------------------------------------------------------------------
+HANDLE HeapCreate(DWORD flags, size_t initial, size_t max)
+{
+    return (HANDLE)1;
+}
+
+void *HeapAlloc(HANDLE heap, DWORD flags, size_t n)
+{
+    return (flags & HEAP_ZERO_MEMORY) ? calloc(1, n) : malloc(n);
+}
+
+BOOL HeapFree(HANDLE heap, DWORD flags, void *p)
+{
+    free(p);
+    return TRUE;
+}
+
+BOOL HeapValidate(HANDLE heap, DWORD flags, const void *p)
+{
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Threads. A thread's handle is its pthread_t, which WaitForMultipleObjects()
+// joins; so it can only wait for all of them, with no timeout, which is all
+// that we ever do.
+//-----------------------------------------------------------------------------
+typedef struct {
+    pthread_t   thread;
+    DWORD     (WINAPI *start)(LPVOID);
+    LPVOID      param;
+    BOOL        joined;
+} Thread;
+
+static void *ThreadStart(void *p)
+{
+    Thread *t = (Thread *)p;
+    t->start(t->param);
+    return NULL;
+}
+
+HANDLE CreateThread(void *security, size_t stack,
+    DWORD (WINAPI *start)(LPVOID), LPVOID param, DWORD flags, DWORD *id)
+{
+    Thread *t = (Thread *)calloc(1, sizeof(Thread));
+    if(!t) return NULL;
+    t->start = start;
+    t->param = param;
+    if(pthread_create(&t->thread, NULL, ThreadStart, t) != 0) {
+        free(t);
+        return NULL;
+    }
+    return (HANDLE)t;
+}
+
+DWORD WaitForMultipleObjects(DWORD n, const HANDLE *h, BOOL all, DWORD ms)
+{
+    DWORD i;
+    for(i = 0; i < n; i++) {
+        Thread *t = (Thread *)h[i];
+        if(!t->joined) {
+            pthread_join(t->thread, NULL);
+            t->joined = TRUE;
+        }
+    }
+    return 0;
+}
+
+BOOL CloseHandle(HANDLE h)
+{
+    Thread *t = (Thread *)h;
+    if(!t->joined) pthread_detach(t->thread);
+    free(t);
+    return TRUE;
+}
+
+LONG InterlockedIncrement(volatile LONG *p)
+{
+    return __sync_add_and_fetch(p, 1);
+}
+
+void GetSystemInfo(SYSTEM_INFO *si)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    si->dwNumberOfProcessors = n > 0 ? n : 1;
+}
+
+HMODULE LoadLibrary(LPCSTR name)
+{
+    return NULL;
+}
+
+void *GetProcAddress(HMODULE module, LPCSTR name)
+{
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Windows, dialogs and messages; there aren't any.
+//-----------------------------------------------------------------------------
+WORD RegisterClassEx(const WNDCLASSEX *wc) { return 0; }
+HWND CreateWindowEx(DWORD exStyle, LPCSTR className, LPCSTR name,
+    DWORD style, int x, int y, int w, int h, HWND parent, HMENU menu,
+    HINSTANCE instance, LPVOID param) { return NULL; }
+BOOL DestroyWindow(HWND hwnd) { return FALSE; }
+BOOL ShowWindow(HWND hwnd, int show) { return FALSE; }
+BOOL UpdateWindow(HWND hwnd) { return FALSE; }
+BOOL EnableWindow(HWND hwnd, BOOL enable) { return FALSE; }
+BOOL MoveWindow(HWND hwnd, int x, int y, int w, int h, BOOL repaint)
+    { return FALSE; }
+BOOL SetWindowPos(HWND hwnd, HWND after, int x, int y, int w, int h,
+    UINT flags) { return FALSE; }
+BOOL GetClientRect(HWND hwnd, RECT *r) { memset(r, 0, sizeof(*r)); return FALSE; }
+BOOL GetWindowRect(HWND hwnd, RECT *r) { memset(r, 0, sizeof(*r)); return FALSE; }
+HWND GetDesktopWindow(void) { return NULL; }
+HWND GetForegroundWindow(void) { return NULL; }
+HWND SetFocus(HWND hwnd) { return NULL; }
+BOOL InvalidateRect(HWND hwnd, const RECT *r, BOOL erase) { return FALSE; }
+LONG_PTR SetWindowLongPtr(HWND hwnd, int index, LONG_PTR value) { return 0; }
+LRESULT SendMessage(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+    { return 0; }
+LRESULT DefWindowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+    { return 0; }
+LRESULT CallWindowProc(WNDPROC proc, HWND hwnd, UINT msg, WPARAM wParam,
+    LPARAM lParam) { return 0; }
+BOOL GetMessage(MSG *msg, HWND hwnd, UINT from, UINT to) { return FALSE; }
+BOOL TranslateMessage(const MSG *msg) { return FALSE; }
+LRESULT DispatchMessage(const MSG *msg) { return 0; }
+BOOL IsDialogMessage(HWND hwnd, MSG *msg) { return FALSE; }
+UINT_PTR SetTimer(HWND hwnd, UINT_PTR id, UINT ms, TIMERPROC proc)
+    { return 0; }
+BOOL KillTimer(HWND hwnd, UINT_PTR id) { return FALSE; }
+SHORT GetAsyncKeyState(int key) { return 0; }
+BOOL GetCursorPos(POINT *p) { p->x = p->y = 0; return FALSE; }
+BOOL SystemParametersInfo(UINT action, UINT param, void *p, UINT flags)
+    { return FALSE; }
+int MessageBox(HWND hwnd, LPCSTR text, LPCSTR caption, UINT type)
+    { return 0; }
+HCURSOR LoadCursor(HINSTANCE instance, LPCSTR name) { return NULL; }
+HANDLE LoadImage(HINSTANCE instance, LPCSTR name, UINT type, int w, int h,
+    UINT flags) { return NULL; }
+HFONT CreateFont(int h, int w, int escapement, int orientation, int weight,
+    DWORD italic, DWORD underline, DWORD strikeOut, DWORD charSet,
+    DWORD outPrecision, DWORD clipPrecision, DWORD quality,
+    DWORD pitchAndFamily, LPCSTR face) { return NULL; }
+HGDIOBJ GetStockObject(int i) { return NULL; }
@@ -0,0 +1,306 @@
+/*
+ * Just enough of <windows.h> to build the non-GUI parts of LDmicro (the
+ * loader, the intermediate code and the simulator) on a POSIX system, for
+ * the batch simulator. The console, timing, heap and thread calls are
+ * really implemented, in win32.cpp; the window and dialog calls that those
+ * files also make for the GUI are no-ops, since the batch simulator never
+ * reaches them.
+ */
+
+#ifndef __POSIX_WINDOWS_H
+#define __POSIX_WINDOWS_H
+
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <strings.h>
+
+//-----------------------------------------------------------------------------
+// Types and calling conventions
+//-----------------------------------------------------------------------------
+typedef int             BOOL;
+typedef unsigned char   BYTE;
+typedef unsigned short  WORD;
+typedef unsigned long   DWORD;
+typedef unsigned int    UINT;
+typedef int             INT;
+typedef short           SHORT;
+typedef unsigned short  USHORT;
+typedef long            LONG;
+typedef unsigned long   ULONG;
+typedef char            CHAR;
+typedef long long       LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef unsigned long long DWORD64;
+typedef intptr_t        LONG_PTR;
+typedef uintptr_t       UINT_PTR;
+typedef uintptr_t       WPARAM;
+typedef intptr_t        LPARAM;
+typedef intptr_t        LRESULT;
+typedef char           *LPSTR;
+typedef const char     *LPCSTR;
+typedef void           *LPVOID;
+typedef unsigned long   COLORREF;
+
+typedef void *HANDLE;
+typedef void *HWND;
+typedef void *HDC;
+typedef void *HINSTANCE;
+typedef void *HMODULE;
+typedef void *HMENU;
+typedef void *HFONT;
+typedef void *HBRUSH;
+typedef void *HPEN;
+typedef void *HICON;
+typedef void *HCURSOR;
+typedef void *HGDIOBJ;
+typedef void *HBITMAP;
+
+#define WINAPI
+#define CALLBACK
+
+#define TRUE    1
+#define FALSE   0
+
+#define MAX_PATH 260
+
+#define LOWORD(l)       ((WORD)((DWORD)(l) & 0xffff))
+#define HIWORD(l)       ((WORD)(((DWORD)(l) >> 16) & 0xffff))
+#define MAKELONG(a, b)  ((LONG)(((WORD)(a)) | ((DWORD)((WORD)(b))) << 16))
+#define MAKEINTRESOURCE(i) ((LPCSTR)(intptr_t)(i))
+
+typedef struct { LONG left, top, right, bottom; } RECT;
+typedef struct { LONG x, y; } POINT;
+typedef struct { DWORD dwLowDateTime, dwHighDateTime; } FILETIME, *PFILETIME;
+typedef union {
+    struct { DWORD LowPart; LONG HighPart; };
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+//-----------------------------------------------------------------------------
+// Console, files, time, heap and threads: implemented in win32.cpp
+//-----------------------------------------------------------------------------
+#define INVALID_HANDLE_VALUE    ((HANDLE)(LONG_PTR)-1)
+#define STD_OUTPUT_HANDLE       ((DWORD)-11)
+#define GENERIC_READ            0x80000000
+#define GENERIC_WRITE           0x40000000
+#define OPEN_ALWAYS             4
+#define FILE_ATTRIBUTE_NORMAL   0x80
+#define PAGE_READWRITE          0x04
+#define FILE_MAP_WRITE          0x02
+#define HEAP_ZERO_MEMORY        0x08
+#define INFINITE                0xffffffff
+#define MAXIMUM_WAIT_OBJECTS    64
+
+typedef struct {
+    DWORD   dwNumberOfProcessors;
+} SYSTEM_INFO;
+
+HANDLE GetStdHandle(DWORD which);
+BOOL WriteFile(HANDLE h, const void *buf, DWORD n, DWORD *written, void *overlapped);
+void OutputDebugString(LPCSTR str);
+DWORD GetFullPathName(LPCSTR name, DWORD n, LPSTR buf, LPSTR *filePart);
+
+// The simulated EEPROM is only backed by a file in the GUI, so these fail.
+HANDLE CreateFile(LPCSTR name, DWORD access, DWORD share, void *security,
+    DWORD disposition, DWORD flags, HANDLE templateFile);
+HANDLE CreateFileMapping(HANDLE h, void *security, DWORD protect,
+    DWORD sizeHigh, DWORD sizeLow, LPCSTR name);
+LPVOID MapViewOfFile(HANDLE h, DWORD access, DWORD offsetHigh,
+    DWORD offsetLow, size_t n);
+BOOL UnmapViewOfFile(const void *p);
+
+DWORD GetTickCount(void);
+BOOL QueryPerformanceCounter(LARGE_INTEGER *t);
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *f);
+void Sleep(DWORD ms);
+
+HANDLE HeapCreate(DWORD flags, size_t initial, size_t max);
+void *HeapAlloc(HANDLE heap, DWORD flags, size_t n);
+BOOL HeapFree(HANDLE heap, DWORD flags, void *p);
+BOOL HeapValidate(HANDLE heap, DWORD flags, const void *p);
+
+HANDLE CreateThread(void *security, size_t stack,
+    DWORD (WINAPI *start)(LPVOID), LPVOID param, DWORD flags, DWORD *id);
+DWORD WaitForMultipleObjects(DWORD n, const HANDLE *h, BOOL all, DWORD ms);
+BOOL CloseHandle(HANDLE h);
+LONG InterlockedIncrement(volatile LONG *p);
+void GetSystemInfo(SYSTEM_INFO *si);
+
+HMODULE LoadLibrary(LPCSTR name);
+void *GetProcAddress(HMODULE module, LPCSTR name);
+
+BOOL AnsiToOem(LPCSTR src, LPSTR dest);
+
+//-----------------------------------------------------------------------------
+// Windows, dialogs and messages: no-ops. The values of the constants don't
+// matter, only that they are distinct.
+//-----------------------------------------------------------------------------
+typedef LRESULT (CALLBACK *WNDPROC)(HWND, UINT, WPARAM, LPARAM);
+typedef void (CALLBACK *TIMERPROC)(HWND, UINT, UINT_PTR, DWORD);
+
+typedef struct {
+    HWND    hwnd;
+    UINT    message;
+    WPARAM  wParam;
+    LPARAM  lParam;
+    DWORD   time;
+    POINT   pt;
+} MSG;
+
+typedef struct {
+    UINT    cbSize;
+    UINT    style;
+    WNDPROC lpfnWndProc;
+    int     cbClsExtra;
+    int     cbWndExtra;
+    HINSTANCE hInstance;
+    HICON   hIcon;
+    HCURSOR hCursor;
+    HBRUSH  hbrBackground;
+    LPCSTR  lpszMenuName;
+    LPCSTR  lpszClassName;
+    HICON   hIconSm;
+} WNDCLASSEX;
+
+typedef struct {
+    UINT    cbSize;
+    UINT    fMask;
+    int     nMin;
+    int     nMax;
+    UINT    nPage;
+    int     nPos;
+    int     nTrackPos;
+} SCROLLINFO;
+
+typedef struct {
+    HWND    hwndFrom;
+    UINT_PTR idFrom;
+    UINT    code;
+} NMHDR;
+
+#define WM_DESTROY          0x0002
+#define WM_SIZE             0x0005
+#define WM_ACTIVATE         0x0006
+#define WM_SETTEXT          0x000c
+#define WM_GETTEXT          0x000d
+#define WM_CLOSE            0x0010
+#define WM_SETFONT          0x0030
+#define WM_NOTIFY           0x004e
+#define WM_KEYDOWN          0x0100
+#define WM_CHAR             0x0102
+#define WM_COMMAND          0x0111
+#define WM_RBUTTONDOWN      0x0204
+#define WA_INACTIVE         0
+
+#define VK_RETURN           0x0d
+#define VK_CONTROL          0x11
+#define VK_ESCAPE           0x1b
+#define VK_F8               0x77
+#define VK_F9               0x78
+
+#define WS_OVERLAPPED       0x00000000
+#define WS_TABSTOP          0x00010000
+#define WS_MAXIMIZEBOX      0x00010000
+#define WS_MINIMIZEBOX      0x00020000
+#define WS_SIZEBOX          0x00040000
+#define WS_SYSMENU          0x00080000
+#define WS_DLGFRAME         0x00400000
+#define WS_VSCROLL          0x00200000
+#define WS_CLIPSIBLINGS     0x04000000
+#define WS_VISIBLE          0x10000000
+#define WS_CHILD            0x40000000
+#define WS_POPUP            0x80000000
+#define WS_EX_CLIENTEDGE    0x00000200
+#define WS_EX_TOOLWINDOW    0x00000080
+#define WS_EX_APPWINDOW     0x00040000
+
+#define CS_BYTEALIGNCLIENT  0x1000
+#define CS_BYTEALIGNWINDOW  0x2000
+#define CS_OWNDC            0x0020
+#define CS_DBLCLKS          0x0008
+#define COLOR_BTNSHADOW     16
+#define IDC_ARROW           MAKEINTRESOURCE(32512)
+#define IMAGE_ICON          1
+#define SYSTEM_FONT         13
+#define GWLP_WNDPROC        (-4)
+#define HWND_TOP            ((HWND)0)
+#define SPI_GETWORKAREA     0x0030
+
+#define WC_BUTTON           "Button"
+#define WC_EDIT             "Edit"
+#define WC_LISTBOX          "ListBox"
+#define WC_STATIC           "Static"
+
+#define BS_DEFPUSHBUTTON    0x0001
+#define BN_CLICKED          0
+#define ES_MULTILINE        0x0004
+#define ES_AUTOVSCROLL      0x0040
+#define ES_AUTOHSCROLL      0x0080
+#define EM_LINESCROLL       0x00b6
+#define SS_RIGHT            0x0002
+#define LBS_NOTIFY          0x0001
+#define LBN_DBLCLK          2
+#define LB_ADDSTRING        0x0180
+#define LB_GETTEXT          0x0189
+#define LB_SETCURSEL        0x0186
+#define LB_GETCURSEL        0x0188
+#define LB_GETCOUNT         0x018b
+#define LB_ERR              (-1)
+
+#define MB_OK               0x0000
+#define MB_ICONERROR        0x0010
+#define MB_ICONWARNING      0x0030
+#define MB_ICONINFORMATION  0x0040
+
+#define FW_REGULAR          400
+#define ANSI_CHARSET        0
+#define OUT_DEFAULT_PRECIS  0
+#define CLIP_DEFAULT_PRECIS 0
+#define DEFAULT_QUALITY     0
+#define FF_DONTCARE         0
+
+WORD RegisterClassEx(const WNDCLASSEX *wc);
+HWND CreateWindowEx(DWORD exStyle, LPCSTR className, LPCSTR name,
+    DWORD style, int x, int y, int w, int h, HWND parent, HMENU menu,
+    HINSTANCE instance, LPVOID param);
+BOOL DestroyWindow(HWND hwnd);
+BOOL ShowWindow(HWND hwnd, int show);
+BOOL UpdateWindow(HWND hwnd);
+BOOL EnableWindow(HWND hwnd, BOOL enable);
+BOOL MoveWindow(HWND hwnd, int x, int y, int w, int h, BOOL repaint);
+BOOL SetWindowPos(HWND hwnd, HWND after, int x, int y, int w, int h,
+    UINT flags);
+BOOL GetClientRect(HWND hwnd, RECT *r);
+BOOL GetWindowRect(HWND hwnd, RECT *r);
+HWND GetDesktopWindow(void);
+HWND GetForegroundWindow(void);
+HWND SetFocus(HWND hwnd);
+BOOL InvalidateRect(HWND hwnd, const RECT *r, BOOL erase);
+LONG_PTR SetWindowLongPtr(HWND hwnd, int index, LONG_PTR value);
+LRESULT SendMessage(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
+LRESULT DefWindowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
+LRESULT CallWindowProc(WNDPROC proc, HWND hwnd, UINT msg, WPARAM wParam,
+    LPARAM lParam);
+BOOL GetMessage(MSG *msg, HWND hwnd, UINT from, UINT to);
+BOOL TranslateMessage(const MSG *msg);
+LRESULT DispatchMessage(const MSG *msg);
+BOOL IsDialogMessage(HWND hwnd, MSG *msg);
+UINT_PTR SetTimer(HWND hwnd, UINT_PTR id, UINT ms, TIMERPROC proc);
+BOOL KillTimer(HWND hwnd, UINT_PTR id);
+SHORT GetAsyncKeyState(int key);
+BOOL GetCursorPos(POINT *p);
+BOOL SystemParametersInfo(UINT action, UINT param, void *p, UINT flags);
+int MessageBox(HWND hwnd, LPCSTR text, LPCSTR caption, UINT type);
+HCURSOR LoadCursor(HINSTANCE instance, LPCSTR name);
+HANDLE LoadImage(HINSTANCE instance, LPCSTR name, UINT type, int w, int h,
+    UINT flags);
+HFONT CreateFont(int h, int w, int escapement, int orientation, int weight,
+    DWORD italic, DWORD underline, DWORD strikeOut, DWORD charSet,
+    DWORD outPrecision, DWORD clipPrecision, DWORD quality,
+    DWORD pitchAndFamily, LPCSTR face);
+HGDIOBJ GetStockObject(int i);
+
+#endif
@@ -105,6 +105,33 @@ static void DeclareInt(FILE *f, char *str)
     fprintf(f, "\n");
 }
 
+//-----------------------------------------------------------------------------
+// The C names of the ring that holds the stages of a shift register, and of
+// the index of its stage 0; see UseShiftRegisterRings().
+//-----------------------------------------------------------------------------
+static char *RingSym(char *name)
+{
+    char str[MAX_NAME_LEN+10];
+    sprintf(str, "$ring_%s", name);
+    return MapSym(str, ASINT);
+}
+
+static char *RingHeadSym(char *name)
+{
+    char str[MAX_NAME_LEN+10];
+    sprintf(str, "$head_%s", name);
+    return MapSym(str, ASINT);
+}
+
+static void DeclareRing(FILE *f, char *name, int stages)
+{
+    char *ring = RingSym(name);
+    if(SeenVariable(ring)) return;
+    fprintf(f, "STATIC SWORD %s[%d];\n", ring, stages);
+    fprintf(f, "STATIC SWORD %s = 0;\n", RingHeadSym(name));
+    fprintf(f, "\n");
+}
+
 //-----------------------------------------------------------------------------
 // Generate a declaration for a bit var; three cases, input, output, and
 // internal relay. An internal relay is just a BOOL variable, but for an
@@ -154,15 +181,44 @@ static void GenerateDeclarations(FILE *f)
                 bitVar2 = IntCode[i].name2;
                 break;
 
+            case INT_AND_BIT_TERM:
+            case INT_OR_BIT_TERM: {
+                char *names[MAX_TERM_BITS];
+                BOOL negated[MAX_TERM_BITS];
+                int j, n = BitTermBits(IntCode[i].name2, names, negated);
+                for(j = 0; j < n; j++) {
+                    char *b = MapSym(names[j], ASBIT);
+                    if(!SeenVariable(b)) DeclareBit(f, b);
+                }
+                bitVar1 = IntCode[i].name1;
+                break;
+            }
+
             case INT_SET_VARIABLE_TO_LITERAL:
                 intVar1 = IntCode[i].name1;
                 break;
 
             case INT_SET_VARIABLE_TO_VARIABLE:
+            case INT_LOOK_UP_TABLE:
+            case INT_PIECEWISE_LINEAR:
                 intVar1 = IntCode[i].name1;
                 intVar2 = IntCode[i].name2;
                 break;
 
+            case INT_SHIFT_REGISTER:
+                DeclareRing(f, IntCode[i].name1, IntCode[i].literal);
+                break;
+
+            case INT_RING_READ:
+                DeclareRing(f, IntCode[i].name2, IntCode[i].literal2);
+                intVar1 = IntCode[i].name1;
+                break;
+
+            case INT_RING_WRITE:
+                DeclareRing(f, IntCode[i].name1, IntCode[i].literal2);
+                intVar2 = IntCode[i].name2;
+                break;
+
             case  INT_READ_SFR_LITERAL:
             case  INT_WRITE_SFR_LITERAL:
             case  INT_SET_SFR_LITERAL:
@@ -268,6 +324,25 @@ static void GenerateDeclarations(FILE *f)
     }
 }
 
+//-----------------------------------------------------------------------------
+// The C expression for the term of an INT_AND_BIT_TERM or INT_OR_BIT_TERM,
+// true when all of its bits match.
+//-----------------------------------------------------------------------------
+static char *BitTermExpr(char *term)
+{
+    static char expr[MAX_TERM_BITS * (MAX_NAME_LEN + 40)];
+    char *names[MAX_TERM_BITS];
+    BOOL negated[MAX_TERM_BITS];
+    int i, n = BitTermBits(term, names, negated);
+
+    expr[0] = '\0';
+    for(i = 0; i < n; i++) {
+        sprintf(expr + strlen(expr), "%s%sRead_%s()", i ? " && " : "",
+            negated[i] ? "!" : "", MapSym(names[i], ASBIT));
+    }
+    return expr;
+}
+
 //-----------------------------------------------------------------------------
 // printf-like comment function
 //-----------------------------------------------------------------------------
@@ -320,6 +395,18 @@ static void GenerateAnsiC(FILE *f)
                     MapSym(IntCode[i].name2, ASBIT));
                 break;
 
+            case INT_AND_BIT_TERM:
+                fprintf(f, "if(!(%s)) Write_%s(0);\n",
+                    BitTermExpr(IntCode[i].name2),
+                    MapSym(IntCode[i].name1, ASBIT));
+                break;
+
+            case INT_OR_BIT_TERM:
+                fprintf(f, "if(%s) Write_%s(1);\n",
+                    BitTermExpr(IntCode[i].name2),
+                    MapSym(IntCode[i].name1, ASBIT));
+                break;
+
             case INT_SET_VARIABLE_TO_LITERAL:
                 fprintf(f, "%s = %d;\n", MapSym(IntCode[i].name1, ASINT),
                     IntCode[i].literal);
@@ -330,6 +417,87 @@ static void GenerateAnsiC(FILE *f)
                                          MapSym(IntCode[i].name2, ASINT));
                 break;
 
+            case INT_SHIFT_REGISTER: {
+                // move the head back one, and keep what was in stage 0
+                char *ring = RingSym(IntCode[i].name1);
+                char *head = RingHeadSym(IntCode[i].name1);
+                fprintf(f, "%s = %s ? %s - 1 : %d;\n", head, head, head,
+                    IntCode[i].literal - 1);
+                doIndent(f, i);
+                fprintf(f, "%s[%s] = %s[(%s + 1) %% %d];\n", ring, head, ring,
+                    head, IntCode[i].literal);
+                break;
+            }
+
+            case INT_RING_READ:
+                fprintf(f, "%s = %s[(%s + %d) %% %d];\n",
+                    MapSym(IntCode[i].name1, ASINT), RingSym(IntCode[i].name2),
+                    RingHeadSym(IntCode[i].name2), IntCode[i].literal,
+                    IntCode[i].literal2);
+                break;
+
+            case INT_RING_WRITE:
+                fprintf(f, "%s[(%s + %d) %% %d] = %s;\n",
+                    RingSym(IntCode[i].name1), RingHeadSym(IntCode[i].name1),
+                    IntCode[i].literal, IntCode[i].literal2,
+                    MapSym(IntCode[i].name2, ASINT));
+                break;
+
+            case INT_LOOK_UP_TABLE: {
+                char *index = MapSym(IntCode[i].name2, ASINT);
+                int j;
+                fprintf(f, "{\n");
+                doIndent(f, i);
+                fprintf(f, "    static const SWORD Table[%d] = {",
+                    IntCode[i].literal);
+                for(j = 0; j < IntCode[i].literal; j++)
+                    fprintf(f, "%s%d", j ? ", " : " ", IntCode[i].data[j]);
+                fprintf(f, " };\n");
+                doIndent(f, i);
+                fprintf(f, "    if(%s >= 0 && %s < %d) %s = Table[%s];\n",
+                    index, index, IntCode[i].literal,
+                    MapSym(IntCode[i].name1, ASINT), index);
+                doIndent(f, i);
+                fprintf(f, "}\n");
+                break;
+            }
+
+            case INT_PIECEWISE_LINEAR: {
+                // binary search for the first segment that ends at or past
+                // the input, then interpolate on that one segment, with the
+                // difference and the product cut to 16 bits as the AVR and
+                // PIC code does
+                char *x = MapSym(IntCode[i].name2, ASINT);
+                int j, n = IntCode[i].literal;
+                fprintf(f, "{\n");
+                doIndent(f, i);
+                fprintf(f, "    static const SWORD Pwl[%d] = {", 2*n);
+                for(j = 0; j < 2*n; j++)
+                    fprintf(f, "%s%d", j ? ", " : " ", IntCode[i].data[j]);
+                fprintf(f, " };\n");
+                doIndent(f, i);
+                fprintf(f, "    if(%s <= Pwl[%d]) {\n", x, 2*(n-1));
+                doIndent(f, i);
+                fprintf(f, "        int lo = 1, hi = %d;\n", n-1);
+                doIndent(f, i);
+                fprintf(f, "        while(lo < hi) {\n");
+                doIndent(f, i);
+                fprintf(f, "            int mid = (lo + hi) / 2;\n");
+                doIndent(f, i);
+                fprintf(f, "            if(%s <= Pwl[mid*2]) hi = mid; else lo = mid + 1;\n", x);
+                doIndent(f, i);
+                fprintf(f, "        }\n");
+                doIndent(f, i);
+                fprintf(f, "        %s = Pwl[lo*2-1] + (SWORD)((SWORD)(%s - Pwl[lo*2-2])*"
+                    "(Pwl[lo*2+1] - Pwl[lo*2-1]))/(Pwl[lo*2] - Pwl[lo*2-2]);\n",
+                    MapSym(IntCode[i].name1, ASINT), x);
+                doIndent(f, i);
+                fprintf(f, "    }\n");
+                doIndent(f, i);
+                fprintf(f, "}\n");
+                break;
+            }
+
             {
             char op;
             case INT_SET_VARIABLE_ADD: op = '+'; goto arith;
@@ -504,6 +672,8 @@ void CompileAnsiC(char *dest, int compile_ISA)
     );
     return;
   }
+    UseShiftRegisterRings();
+
     _compile_ISA = compile_ISA;
     SeenVariablesCount = 0;
 
@@ -205,6 +205,18 @@ static DWORD EepromHighByteWaitingAddr; // obsolete
 static int   EepromHighByteWaitingBit;  // obsolete
 static DWORD EepromHighBytesCounter;
 
+// The rings that hold the stages of the shift registers, sov bytes a stage,
+// with stage k at (head + k) mod stages; see UseShiftRegisterRings().
+typedef struct AvrRingTag {
+    char   *name;
+    int     stages;
+    int     sov;
+    DWORD   addr;
+    DWORD   head;
+} AvrRing;
+static AvrRing Rings[MAX_IO];
+static int RingCount;
+
 // Some useful registers, unfortunately many of which are in different places
 // on different AVRs! I consider this a terrible design choice by Atmel.
 // 0 means not defined.
@@ -2176,6 +2188,15 @@ static void CopyVarToRegs(int reg, char *var, int sovRegs)
             Instruction(OP_LDI, reg+2, 0xff);
         }
     }
+    if(sovRegs >= 4) {
+        if(sov >= 4)
+            Instruction(OP_LD_XP, reg+3);
+        else {
+            Instruction(OP_LDI, reg+3, 0);
+            Instruction(OP_SBRC, reg+2, BIT7);
+            Instruction(OP_LDI, reg+3, 0xff);
+        }
+    }
 }
 //-----------------------------------------------------------------------------
 static void _CopyRegsToVar(int l, char *f, char *args, char *var, int reg, int sovRegs)
@@ -2205,6 +2226,15 @@ static void _CopyRegsToVar(int l, char *f, char *args, char *var, int reg, int s
             Instruction(OP_LDI, reg+2, 0xff);
         }
     }
+    if(sov >= 4) {
+        if(sovRegs >= 4)
+            Instruction(OP_ST_XP, reg+3);
+        else {
+            Instruction(OP_LDI, reg+3, 0);
+            Instruction(OP_SBRC, reg+2, BIT7);
+            Instruction(OP_LDI, reg+3, 0xff);
+        }
+    }
 }
 
 #define CopyRegsToVar(...) _CopyRegsToVar(__LINE__, __FILE__, #__VA_ARGS__, __VA_ARGS__)
@@ -2360,6 +2390,119 @@ is described in an article available on line at http://www.parallax.com/dl/docs/
 */
 
 
+//-----------------------------------------------------------------------------
+// Return the ring of the shift register with the given name, allocating it
+// the first time that it is asked for.
+//-----------------------------------------------------------------------------
+static AvrRing *RingFor(char *name, int stages)
+{
+    int i;
+    for(i = 0; i < RingCount; i++)
+        if(Rings[i].name == name) return &Rings[i];
+    if(RingCount >= MAX_IO) {
+        Error(_("Internal limit exceeded (number of vars)"));
+        CompileError();
+    }
+    AvrRing *r = &Rings[RingCount++];
+    r->name = name;
+    r->stages = stages;
+    r->sov = SizeOfVar(name);
+    r->addr = AllocOctetRam(stages * r->sov);
+    r->head = AllocOctetRam();
+    return r;
+}
+
+//-----------------------------------------------------------------------------
+// Point X at stage k of a ring, addr + sov*((head + k) mod stages).
+//-----------------------------------------------------------------------------
+static void LoadRingXAddr(AvrRing *r, int k)
+//used rX, r16, r17, r18, r19
+{
+    int i;
+    LoadXAddr(r->head);
+    Instruction(OP_LD_X, r16);
+    Instruction(OP_LDI, r17, 0);
+    if(k) {
+        // head + k < 2*stages, so one subtract brings it back into range
+        DWORD inRange = AllocFwdAddr();
+        Instruction(OP_SUBI, r16, (-k) & 0xff);
+        Instruction(OP_SBCI, r17, ((-k) >> 8) & 0xff);
+        Instruction(OP_LDI, r18, (r->stages >> 8) & 0xff);
+        Instruction(OP_CPI, r16, r->stages & 0xff);
+        Instruction(OP_CPC, r17, r18);
+        Instruction(OP_BRLO, inRange);
+        Instruction(OP_SUBI, r16, r->stages & 0xff);
+        Instruction(OP_SBCI, r17, (r->stages >> 8) & 0xff);
+        FwdAddrIsNow(inRange);
+    }
+    Instruction(OP_MOV, r18, r16);
+    Instruction(OP_MOV, r19, r17);
+    for(i = 1; i < r->sov; i++) {
+        Instruction(OP_ADD, r16, r18);
+        Instruction(OP_ADC, r17, r19);
+    }
+    Instruction(OP_SUBI, r16, (-(int)r->addr) & 0xff);
+    Instruction(OP_SBCI, r17, ((-(int)r->addr) >> 8) & 0xff);
+    Instruction(OP_MOV, r26, r16);
+    Instruction(OP_MOV, r27, r17);
+}
+
+//-----------------------------------------------------------------------------
+// Jump to notTrue unless all the bits of the term of an INT_AND_BIT_TERM or
+// INT_OR_BIT_TERM match. The bits that share a byte are tested together,
+// with one mask and compare.
+//-----------------------------------------------------------------------------
+static void IfNotBitTerm(char *term, DWORD notTrue)
+//used ZL, r25
+{
+    char *names[MAX_TERM_BITS];
+    BOOL negated[MAX_TERM_BITS];
+    DWORD addrs[MAX_TERM_BITS];
+    BYTE mask[MAX_TERM_BITS];
+    BYTE want[MAX_TERM_BITS];
+    int groups = 0;
+    int i, j;
+
+    int n = BitTermBits(term, names, negated);
+    for(i = 0; i < n; i++) {
+        DWORD addr;
+        int bit;
+        MemForSingleBit(names[i], TRUE, &addr, &bit);
+        for(j = 0; j < groups; j++)
+            if(addrs[j] == addr) break;
+        if(j == groups) {
+            addrs[groups] = addr;
+            mask[groups] = 0;
+            want[groups] = 0;
+            groups++;
+        }
+        mask[j] |= 1 << bit;
+        if(!negated[i]) want[j] |= 1 << bit;
+    }
+
+    for(j = 0; j < groups; j++) {
+        if((mask[j] & (mask[j] - 1)) == 0) {
+            int bit = 0;
+            while(!(mask[j] & (1 << bit))) bit++;
+            if(want[j])
+                IfBitClear(addrs[j], bit);
+            else
+                IfBitSet(addrs[j], bit);
+            Instruction(OP_RJMP, notTrue);
+        } else {
+            DWORD match = AllocFwdAddr();
+            LoadZAddr(addrs[j]);
+            Instruction(OP_LD_Z, r25);
+            Instruction(OP_ANDI, r25, mask[j]);
+            if(want[j])
+                Instruction(OP_CPI, r25, want[j]);
+            Instruction(OP_BREQ, match);
+            Instruction(OP_RJMP, notTrue);
+            FwdAddrIsNow(match);
+        }
+    }
+}
+
 //-----------------------------------------------------------------------------
 // Compile the intermediate code to AVR native code.
 //-----------------------------------------------------------------------------
@@ -2394,6 +2537,27 @@ static void CompileFromIntermediate(void)
                 CopyBit(addr, bit, addr2, bit2, a->name1, a->name2);
                 break;
 
+            case INT_AND_BIT_TERM: {
+                DWORD notTrue = AllocFwdAddr();
+                DWORD done = AllocFwdAddr();
+                IfNotBitTerm(a->name2, notTrue);
+                Instruction(OP_RJMP, done);
+                FwdAddrIsNow(notTrue);
+                MemForSingleBit(a->name1, FALSE, &addr, &bit);
+                ClearBit(addr, bit, a->name1);
+                FwdAddrIsNow(done);
+                break;
+            }
+
+            case INT_OR_BIT_TERM: {
+                DWORD notTrue = AllocFwdAddr();
+                IfNotBitTerm(a->name2, notTrue);
+                MemForSingleBit(a->name1, FALSE, &addr, &bit);
+                SetBit(addr, bit, a->name1);
+                FwdAddrIsNow(notTrue);
+                break;
+            }
+
             #ifdef NEW_FEATURE
             case INT_COPY_VAR_BIT_TO_VAR_BIT:
                 break;
@@ -2851,6 +3015,118 @@ static void CompileFromIntermediate(void)
                 CopyRegsToVar(a->name1, r16, SizeOfVar(a->name2));
                 break;
 
+            case INT_SHIFT_REGISTER: {
+                // Move the head back one, so that each stage is now where
+                // the one before it was, and give the new stage 0 the value
+                // of the old one, which is now stage 1.
+                AvrRing *r = RingFor(a->name1, a->literal);
+                int k;
+                DWORD noWrap = AllocFwdAddr();
+                LoadXAddr(r->head);
+                Instruction(OP_LD_X, r16);
+                Instruction(OP_SUBI, r16, 1);
+                Instruction(OP_BRCC, noWrap);
+                Instruction(OP_LDI, r16, (r->stages - 1) & 0xff);
+                FwdAddrIsNow(noWrap);
+                Instruction(OP_ST_X, r16);
+                LoadRingXAddr(r, 1);
+                for(k = 0; k < r->sov; k++)
+                    Instruction(OP_LD_XP, r20 + k);
+                LoadRingXAddr(r, 0);
+                for(k = 0; k < r->sov; k++)
+                    Instruction(OP_ST_XP, r20 + k);
+                break;
+            }
+
+            case INT_RING_READ: {
+                AvrRing *r = RingFor(a->name2, a->literal2);
+                int k;
+                LoadRingXAddr(r, a->literal);
+                for(k = 0; k < r->sov; k++)
+                    Instruction(OP_LD_XP, r20 + k);
+                CopyRegsToVar(a->name1, r20, r->sov);
+                break;
+            }
+
+            case INT_RING_WRITE: {
+                AvrRing *r = RingFor(a->name1, a->literal2);
+                int k;
+                CopyVarToRegs(r20, a->name2, r->sov);
+                LoadRingXAddr(r, a->literal);
+                for(k = 0; k < r->sov; k++)
+                    Instruction(OP_ST_XP, r20 + k);
+                break;
+            }
+
+            case INT_LOOK_UP_TABLE: {
+                // The values go in flash right here, sov bytes each, and we
+                // jump over them; then index them with Z and read with LPM.
+                int n = a->literal;
+                int sovI = SizeOfVar(a->name2);
+                int i, k;
+                if(n <= 0) break;
+                sov = SizeOfVar(a->name1);
+
+                DWORD overTable = AllocFwdAddr();
+                DWORD outOfRange = AllocFwdAddr();
+                Instruction(OP_RJMP, overTable);
+                DWORD table = AvrProgWriteP;
+                BYTE bytes[MAX_LOOK_UP_TABLE_LEN*4 + 1];
+                for(i = 0; i < n; i++)
+                    for(k = 0; k < sov; k++)
+                        bytes[i*sov + k] = BYTE((a->data[i] >> (8*k)) & 0xff);
+                bytes[n*sov] = 0;
+                for(i = 0; i < n*sov; i += 2)
+                    Instruction(OP_DB2, bytes[i], bytes[i+1]);
+                FwdAddrIsNow(overTable);
+                if(2*table + n*sov > 0xffff) {
+                    Error(_("Look-up table '%s' is beyond 64K of flash."), a->name1);
+                    CompileError();
+                }
+
+                // unsigned compare, so a negative index is out of range too
+                CopyVarToRegs(r16, a->name2, sovI);
+                Instruction(OP_LDI, r21, 0);
+                Instruction(OP_CPI, r16, n);
+                if(sovI >= 2)
+                    Instruction(OP_CPC, r17, r21);
+                if(sovI >= 3)
+                    Instruction(OP_CPC, r18, r21);
+                if(sovI >= 4)
+                    Instruction(OP_CPC, r19, r21);
+                Instruction(OP_BRCC, outOfRange);
+
+                // now index < 64, so index*sov fits in r16
+                if(sov == 2) {
+                    Instruction(OP_LSL, r16);
+                } else if(sov == 3) {
+                    Instruction(OP_MOV, r17, r16);
+                    Instruction(OP_LSL, r16);
+                    Instruction(OP_ADD, r16, r17);
+                } else if(sov == 4) {
+                    Instruction(OP_LSL, r16);
+                    Instruction(OP_LSL, r16);
+                }
+                Instruction(OP_LDI, ZL, (2*table) & 0xff);
+                Instruction(OP_LDI, ZH, (2*table) >> 8);
+                Instruction(OP_LDI, r17, 0);
+                Instruction(OP_ADD, ZL, r16);
+                Instruction(OP_ADC, ZH, r17);
+                for(k = 0; k < sov; k++) {
+                    if(Prog.mcu->core >= EnhancedCore8K) {
+                        Instruction(OP_LPM_ZP, r20 + k);
+                    } else {
+                        Instruction(OP_LPM_0Z);
+                        Instruction(OP_MOV, r20 + k, r0);
+                        Instruction(OP_SUBI, ZL, 0xff);
+                        Instruction(OP_SBCI, ZH, 0xff);
+                    }
+                }
+                CopyRegsToVar(a->name1, r20, sov);
+                FwdAddrIsNow(outOfRange);
+                break;
+            }
+
             #ifdef NEW_FEATURE
             case INT_SET_VARIABLE_MOD:
             #endif
@@ -3793,6 +4069,9 @@ static void DivideRoutine8(void)
 //-----------------------------------------------------------------------------
 void CompileAvr(char *outFile)
 {
+    ExpandPiecewiseLinear();
+    UseShiftRegisterRings();
+
     rungNow = -100;
     FILE *f = fopen(outFile, "w");
     if(!f) {
@@ -4282,6 +4561,7 @@ void CompileAvr(char *outFile)
 
     rungNow = -80;
     AllocStart();
+    RingCount = 0;
 
     rungNow = -70;
     if(EepromFunctionUsed()) {
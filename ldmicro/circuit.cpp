@@ -626,6 +626,9 @@ void AddPersist(void)
     }
     ElemLeaf *t = AllocLeaf();
     strcpy(t->d.persist.var, "saved");
+    t->d.persist.interval = 0;
+    t->d.persist.copies = 1;
+    t->d.persist.idle = 0;
     AddLeaf(ELEM_PERSIST, t);
 }
 
@@ -940,6 +943,7 @@ void FreeEntireProgram(void)
     Prog.cycleTime = 10000;
     Prog.mcuClock = 16000000;
     Prog.baudRate = 9600;
+    Prog.timeStampTimers = FALSE;
     Prog.io.count = 0;
     Prog.mcu = NULL;
 }
@@ -35,6 +35,7 @@ static HWND CrystalTextbox;
 static HWND CycleTextbox;
 static HWND TimerTextbox;
 static HWND YPlcCycleDutyCheckbox;
+static HWND TimeStampTimersCheckbox;
 static HWND BaudTextbox;
 
 static LONG_PTR PrevCrystalProc;
@@ -114,6 +115,12 @@ static void MakeControls(void)
         185, 72, 75, 21, ConfDialog, NULL, Instance, NULL);
     NiceFont(BaudTextbox);
 
+    TimeStampTimersCheckbox = CreateWindowEx(0, WC_BUTTON,
+        _("Time-stamp timers"),
+        WS_CHILD | BS_AUTOCHECKBOX | WS_TABSTOP | WS_VISIBLE,
+        270, 72, 190, 20, ConfDialog, NULL, Instance, NULL);
+    NiceFont(TimeStampTimersCheckbox);
+
     if(!UartFunctionUsed()) {
         EnableWindow(BaudTextbox, FALSE);
         EnableWindow(textLabel3, FALSE);
@@ -277,6 +284,10 @@ void ShowConfDialog(void)
         SendMessage(YPlcCycleDutyCheckbox, BM_SETCHECK, BST_CHECKED, 0);
     }
 
+    if(Prog.timeStampTimers) {
+        SendMessage(TimeStampTimersCheckbox, BM_SETCHECK, BST_CHECKED, 0);
+    }
+
     sprintf(buf, "%.6f", Prog.mcuClock / 1e6); //Hz show as MHz
     SendMessage(CrystalTextbox, WM_SETTEXT, 0, (LPARAM)buf);
 
@@ -330,6 +341,12 @@ void ShowConfDialog(void)
             Prog.cycleDuty = 0;
         }
 
+        if(SendMessage(TimeStampTimersCheckbox, BM_GETSTATE, 0, 0) & BST_CHECKED) {
+            Prog.timeStampTimers = TRUE;
+        } else {
+            Prog.timeStampTimers = FALSE;
+        }
+
         SendMessage(CrystalTextbox, WM_GETTEXT, (WPARAM)sizeof(buf),
             (LPARAM)(buf));
         Prog.mcuClock = (int)(1e6*atof(buf) + 0.5);
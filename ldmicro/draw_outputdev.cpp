@@ -67,6 +67,14 @@ int ScrollYOffsetMax;
 // Is the cursor currently drawn? We XOR it so this gets toggled.
 static BOOL CursorDrawn;
 
+// Where each rung started (in rows, cy) the last time that we drew all of
+// them, and the vertical scroll at the time; lets the simulator ask for just
+// the rungs that changed to be redrawn. RungRowTop[Prog.numRungs] is the end
+// of the last rung.
+static int RungRowTop[MAX_RUNGS + 1];
+static int RungRowTopCount = -1;
+static int RungRowTopScroll;
+
 // Colours with which to do syntax highlighting, configurable
 SyntaxHighlightingColours HighlightColours;
 
@@ -216,6 +224,39 @@ int ScreenRowsAvailable(void)
     return (IoListTop - Y_PADDING - adj + FONT_HEIGHT) / (POS_HEIGHT*FONT_HEIGHT);
 }
 
+//-----------------------------------------------------------------------------
+// Invalidate just the band of the window that holds each of the given rungs,
+// so that the next paint redraws only those. If we don't know where the rungs
+// are yet then invalidate everything.
+//-----------------------------------------------------------------------------
+void InvalidateRungs(int *rungs, int n)
+{
+    if(RungRowTopCount != Prog.numRungs || RungRowTopScroll != ScrollYOffset) {
+        InvalidateRect(MainWindow, NULL, FALSE);
+        return;
+    }
+
+    RECT r;
+    GetClientRect(MainWindow, &r);
+    int i;
+    for(i = 0; i < n; i++) {
+        int rung = rungs[i];
+        if(rung < 0 || rung >= Prog.numRungs) continue;
+
+        // a row's worth of margin either way, for the wires that are drawn
+        // half a row outside of the element
+        r.top = (RungRowTop[rung] - ScrollYOffset*POS_HEIGHT)*FONT_HEIGHT +
+            Y_PADDING - FONT_HEIGHT;
+        r.bottom = (RungRowTop[rung + 1] - ScrollYOffset*POS_HEIGHT)*FONT_HEIGHT
+            + Y_PADDING + FONT_HEIGHT;
+        if(r.top < 0) r.top = 0;
+        if(r.bottom > IoListTop) r.bottom = IoListTop;
+        if(r.top >= r.bottom) continue;
+
+        InvalidateRect(MainWindow, &r, FALSE);
+    }
+}
+
 //-----------------------------------------------------------------------------
 // Paint the ladder logic program to the screen. Also figure out where the
 // cursor should go and fill in coordinates for BlinkCursor. Not allowed to
@@ -251,11 +292,21 @@ void PaintWindow(void)
         SelectObject(BackDc, BackBitmap);
     }
     paintDc = Hdc;
+
+    // While simulating, the layout does not change, so if only a band of the
+    // window needs painting (because the simulator invalidated just the rungs
+    // that changed) then the back buffer still holds the rest of it, and we
+    // need only draw the rungs that cross that band.
+    RECT clip;
+    GetClipBox(paintDc, &clip);
+    BOOL partial = InSimulationMode && RungRowTopCount == Prog.numRungs &&
+        RungRowTopScroll == ScrollYOffset && (clip.top > 0 || clip.bottom < bh);
+
     Hdc = BackDc;
 
     RECT fi;
-    fi.left = 0; fi.top = 0;
-    fi.right = BitmapWidth; fi.bottom = bh;
+    fi.left = 0; fi.top = partial ? clip.top : 0;
+    fi.right = BitmapWidth; fi.bottom = partial ? clip.bottom : bh;
     FillRect(Hdc, &fi, InSimulationMode ? SimBgBrush : BgBrush);
 
     // now figure out how we should draw the ladder logic
@@ -263,9 +314,11 @@ void PaintWindow(void)
     if(ColsAvailable < ScreenColsAvailable()) {
         ColsAvailable = ScreenColsAvailable();
     }
-    memset(DisplayMatrix, 0, sizeof(DisplayMatrix));
-    SelectionActive = FALSE;
-    memset(&Cursor, 0, sizeof(Cursor));
+    if(!partial) {
+        memset(DisplayMatrix, 0, sizeof(DisplayMatrix));
+        SelectionActive = FALSE;
+        memset(&Cursor, 0, sizeof(Cursor));
+    }
 
     DrawChars = DrawCharsToScreen;
 
@@ -275,16 +328,27 @@ void PaintWindow(void)
     int cy = 0;
     int rowsAvailable = ScreenRowsAvailable();
     for(i = 0; i < Prog.numRungs; i++) {
-        int thisHeight = POS_HEIGHT*CountHeightOfElement(ELEM_SERIES_SUBCKT,
-            Prog.rungs[i]);
-
-        // For speed, there is no need to draw everything all the time, but
-        // we still must draw a bit above and below so that the DisplayMatrix
-        // is filled in enough to make it possible to reselect using the
-        // cursor keys.
-        if(((cy + thisHeight) >= (ScrollYOffset - 8)*POS_HEIGHT) &&
-            (cy < (ScrollYOffset + rowsAvailable + 8)*POS_HEIGHT))
-        {
+        int thisHeight;
+        BOOL draw;
+        if(partial) {
+            thisHeight = RungRowTop[i + 1] - RungRowTop[i];
+            int top = (cy - ScrollYOffset*POS_HEIGHT)*FONT_HEIGHT + Y_PADDING;
+            int bottom = top + thisHeight*FONT_HEIGHT;
+            draw = (bottom + FONT_HEIGHT > clip.top) &&
+                (top - FONT_HEIGHT < clip.bottom);
+        } else {
+            thisHeight = POS_HEIGHT*CountHeightOfElement(ELEM_SERIES_SUBCKT,
+                Prog.rungs[i]);
+            RungRowTop[i] = cy;
+
+            // For speed, there is no need to draw everything all the time,
+            // but we still must draw a bit above and below so that the
+            // DisplayMatrix is filled in enough to make it possible to
+            // reselect using the cursor keys.
+            draw = ((cy + thisHeight) >= (ScrollYOffset - 8)*POS_HEIGHT) &&
+                (cy < (ScrollYOffset + rowsAvailable + 8)*POS_HEIGHT);
+        }
+        if(draw) {
             SetBkColor(Hdc, InSimulationMode ? HighlightColours.simBg :
                 HighlightColours.bg);
             SetTextColor(Hdc, InSimulationMode ? HighlightColours.simRungNum :
@@ -323,6 +387,11 @@ void PaintWindow(void)
 //      cy += POS_HEIGHT; // OR one empty Rung between Rungs
 // // //cy += 1;          // OR one empty text line between Rungs
     }
+    if(!partial) {
+        RungRowTop[Prog.numRungs] = cy;
+        RungRowTopCount = Prog.numRungs;
+        RungRowTopScroll = ScrollYOffset;
+    }
     DrawEndRung(0, cy);
 
     y = Y_PADDING + FONT_HEIGHT*cy;
@@ -345,7 +414,9 @@ void PaintWindow(void)
 
     SetTextColor(Hdc, prev);
 
-    if(SelectedGxAfterNextPaint >= 0) {
+    if(partial) {
+        // the cursor and the selection are as they were
+    } else if(SelectedGxAfterNextPaint >= 0) {
         int gx=SelectedGxAfterNextPaint, gy=SelectedGyAfterNextPaint;
         MoveCursorNear(&gx, &gy);
         InvalidateRect(MainWindow, NULL, FALSE);
@@ -0,0 +1,124 @@
+//-----------------------------------------------------------------------------
+// This file is part of LDmicro.
+//
+// LDmicro is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LDmicro is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LDmicro.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// The entry point of ldmicro-batch, the batch simulator without the GUI; see
+// Makefile_linux. It takes the same `/s' and `/x' command lines as ldmicro
+// (see simbatch.cpp and simcheck.cpp), and links the loader, the
+// intermediate code and the simulator with the Win32 calls of
+// common/posix/win32.cpp instead of the GUI. This file has what the GUI would
+// otherwise have provided to those: the globals of the program and of the
+// editor, and the calls back into the windows, which never have anything to
+// do since there aren't any.
+//-----------------------------------------------------------------------------
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <locale.h>
+
+#include "ldmicro.h"
+#include "freeze.h"
+#include "mcutable.h"
+
+// ldmicro.cpp
+HINSTANCE   Instance;
+HWND        MainWindow;
+char CurrentLdPath[MAX_PATH];
+char CurrentSaveFile[MAX_PATH];
+char CurrentCompileFile[MAX_PATH];
+ULONGLONG PrevWriteTime = 0;
+ULONGLONG LastWriteTime = 0;
+PlcProgram Prog;
+
+void ProgramChanged(void) {}
+
+// maincontrols.cpp
+HWND IoList;
+char IoListSelectionName[MAX_NAME_LEN] = "";
+
+void RefreshStatusBar(void) {}
+void StartSimulation(void) {}
+void StopSimulation(void) {}
+void ToggleSimulationMode(void)
+{
+    InSimulationMode = !InSimulationMode;
+}
+
+// schematic.cpp
+BOOL CanInsertEnd;
+BOOL CanInsertOther;
+BOOL CanInsertComment;
+ElemLeaf *Selected;
+int SelectedWhich;
+
+BOOL FindSelected(int *gx, int *gy) { return FALSE; }
+BOOL StaySameElem(int Which) { return FALSE; }
+BOOL EndOfRungElem(int Which) { return FALSE; }
+void WhatCanWeDoFromCursorAndTopology(void) {}
+void ForgetFromGrid(void *p) {}
+void ForgetEverything(void) {}
+BOOL MoveCursorNear(int *gx, int *gy) { return FALSE; }
+
+// draw_outputdev.cpp
+BOOL ScrollSelectedIntoViewAfterNextPaint;
+
+void InvalidateRungs(int *rungs, int n) {}
+BOOL tGetLastWriteTime(char *FileName, FILETIME *ftWrite) { return FALSE; }
+
+// undoredo.cpp
+void UndoRemember(void) {}
+void UndoFlush(void) {}
+
+// simpledialog.cpp
+void ShowSizeOfVarDialog(PlcProgramSingleIo *io) {}
+
+// freeze.cpp; there is no registry, so the settings are always the defaults.
+void FreezeDWORDF(DWORD val, char *subKey, char *name) {}
+DWORD ThawDWORDF(DWORD val, char *subKey, char *name) { return val; }
+
+//-----------------------------------------------------------------------------
+// Entry point into the program; put the arguments back together into the
+// command line that WinMain() would have had.
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    static char cmdLine[4096];
+    int i;
+
+    for(i = 1; i < argc; i++) {
+        if(strlen(cmdLine) + strlen(argv[i]) + 2 > sizeof(cmdLine)) {
+            fprintf(stderr, "ldmicro-batch: command line too long\n");
+            return EXIT_FAILURE;
+        }
+        if(i > 1) strcat(cmdLine, " ");
+        strcat(cmdLine, argv[i]);
+    }
+
+    if(memcmp(cmdLine, "/s", 2)!=0 && memcmp(cmdLine, "/x", 2)!=0) {
+        fprintf(stderr, "usage: ldmicro-batch /s[f][p][o][t] src.ld cycles "
+            "[stimulus.txt [trace.txt [wave.vcd]]]\n"
+            "       ldmicro-batch /s[f][o][t] src.ld cycles @list.txt\n"
+            "       ldmicro-batch /x src.ld cycles rules.txt\n");
+        return EXIT_FAILURE;
+    }
+
+    MainHeap = HeapCreate(0, 1024*64, 0);
+    setlocale(LC_ALL,"");
+    RunningInBatchMode = TRUE;
+
+    SimulateFromCommandLine(cmdLine);
+    return EXIT_SUCCESS;
+}
@@ -68,12 +68,33 @@ int asm_discover_names = 0;
 //                       4- l_0009:     bcf  REG_PCLATH,     4 ; 0xa ; 10
 //-----------------------------------------------------------------------------
 
-IntOp IntCode[MAX_INT_OPS];
+// The ops, appended by NewOp(); IntCodeMax is how many there is room for,
+// which doubles whenever it runs out.
+IntOp *IntCode;
 int IntCodeLen = 0;
+static int IntCodeMax;
 int ProgWriteP = 0;
 int rungNow = -INT_MAX;
 static int whichNow = INT_MAX;
 
+// The operand names and source file tags of the ops, each kept just once,
+// in chunks of SymbolText; SymbolHash finds them. They are kept from one
+// compile to the next, since the names hardly change between compiles.
+#define SYMBOL_TEXT_CHUNK (64*1024)
+static char **SymbolHash;
+static int SymbolHashSize; // a power of two
+static int SymbolCount;
+static char *SymbolText;
+static int SymbolTextFree;
+
+// The values of the look-up tables, kept once each like the names above.
+typedef struct InternedTableTag {
+    struct InternedTableTag *next;
+    int     count;
+    SDWORD  vals[1];
+} InternedTable;
+static InternedTable *Tables;
+
 static DWORD GenSymCountParThis;
 static DWORD GenSymCountParOut;
 static DWORD GenSymCountOneShot;
@@ -83,6 +104,21 @@ static DWORD GenSymCountStepper;
 DWORD EepromAddrFree;
 int   RomSection;
 
+// Where the `Make Persistent' variables ended up in EEPROM, for the listing.
+typedef struct PersistLayoutTag {
+    char    var[MAX_NAME_LEN];
+    DWORD   addr;
+    int     bytes;
+    int     copies;
+    SDWORD  interval;
+    SDWORD  idle;
+} PersistLayout;
+static PersistLayout PersistMap[MAX_IO];
+static int PersistMapCount;
+
+// The ops in each rung before OptimizeIntermediateCode(), for the listing.
+static DWORD OpsBeforeOptimizing[MAX_RUNGS];
+
 //-----------------------------------------------------------------------------
 static void CheckConstantInRange(SDWORD v)
 {
@@ -134,6 +170,16 @@ void IntDumpListing(char *outFile)
                     IntCode[i].name2);
                 break;
 
+            case INT_AND_BIT_TERM:
+                fprintf(f, "let bit '%s' &= '%s'", IntCode[i].name1,
+                    IntCode[i].name2);
+                break;
+
+            case INT_OR_BIT_TERM:
+                fprintf(f, "let bit '%s' |= '%s'", IntCode[i].name1,
+                    IntCode[i].name2);
+                break;
+
             case INT_SET_VARIABLE_TO_LITERAL:
                 fprintf(f, "let var '%s' := %d", IntCode[i].name1,
                     IntCode[i].literal);
@@ -309,6 +355,40 @@ void IntDumpListing(char *outFile)
                     IntCode[i].name2); indent++;
                 break;
 
+            case INT_LOOK_UP_TABLE: {
+                fprintf(f, "let var '%s' := {", IntCode[i].name1);
+                for(j = 0; j < IntCode[i].literal; j++)
+                    fprintf(f, "%s%d", j ? ", " : "", IntCode[i].data[j]);
+                fprintf(f, "}['%s']", IntCode[i].name2);
+                break;
+            }
+
+            case INT_PIECEWISE_LINEAR: {
+                fprintf(f, "let var '%s' := pwl(", IntCode[i].name1);
+                for(j = 0; j < IntCode[i].literal; j++)
+                    fprintf(f, "%s(%d, %d)", j ? ", " : "",
+                        IntCode[i].data[j*2], IntCode[i].data[j*2 + 1]);
+                fprintf(f, ")['%s']", IntCode[i].name2);
+                break;
+            }
+
+            case INT_SHIFT_REGISTER:
+                fprintf(f, "shift vars '%s0'..'%s%d' up by one", IntCode[i].name1,
+                    IntCode[i].name1, IntCode[i].literal - 1);
+                break;
+
+            case INT_RING_READ:
+                fprintf(f, "let var '%s' := ring '%s'[%d of %d]",
+                    IntCode[i].name1, IntCode[i].name2, IntCode[i].literal,
+                    IntCode[i].literal2);
+                break;
+
+            case INT_RING_WRITE:
+                fprintf(f, "let var ring '%s'[%d of %d] := '%s'",
+                    IntCode[i].name1, IntCode[i].literal, IntCode[i].literal2,
+                    IntCode[i].name2);
+                break;
+
             case INT_END_IF:
                 fprintf(f, "}");
                 break;
@@ -386,6 +466,40 @@ void IntDumpListing(char *outFile)
             fprintf(f, "\n");
         fflush(f);
     }
+
+    if(PersistMapCount > 0) {
+        fprintf(f, "\nEEPROM layout (%d bytes used):\n", EepromAddrFree);
+        for(i = 0; i < PersistMapCount; i++) {
+            PersistLayout *p = &PersistMap[i];
+            int size = p->bytes * p->copies;
+            fprintf(f, "  0x%04x..0x%04x  '%s'", p->addr, p->addr + size - 1,
+                p->var);
+            if(p->copies > 1) {
+                fprintf(f, ", %d copies of %d bytes, status at 0x%04x..0x%04x",
+                    p->copies, p->bytes, p->addr + size,
+                    p->addr + 2*size - 1);
+            }
+            if(p->interval > 0)
+                fprintf(f, ", written at most every %d ms", p->interval);
+            if(p->idle > 0)
+                fprintf(f, ", written once unchanged for %d ms", p->idle);
+            fprintf(f, "\n");
+        }
+    }
+
+    if(OptimizeIntCode) {
+        DWORD before = 0, after = 0;
+        fprintf(f, "\nOps per rung, before and after optimizing:\n");
+        for(i = 0; i < Prog.numRungs && i < MAX_RUNGS; i++) {
+            before += OpsBeforeOptimizing[i];
+            after += Prog.OpsInRung[i];
+            if(OpsBeforeOptimizing[i] != Prog.OpsInRung[i]) {
+                fprintf(f, "  rung %4d: %5d -> %5d\n", i+1,
+                    OpsBeforeOptimizing[i], Prog.OpsInRung[i]);
+            }
+        }
+        fprintf(f, "  total:     %5d -> %5d\n", before, after);
+    }
     fclose(f);
 }
 
@@ -449,23 +563,117 @@ static void GenSymStepper(char *dest, char *name)
 //-----------------------------------------------------------------------------
 // Compile an instruction to the program.
 //-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+// Return the one copy of a name (NULL counts as ""), adding it if it is new.
+//-----------------------------------------------------------------------------
+static DWORD SymbolBucket(char **hash, int size, char *name)
+{
+    DWORD h = 2166136261u;
+    char *p;
+    for(p = name; *p; p++) {
+        h ^= (BYTE)*p;
+        h *= 16777619;
+    }
+    h &= size - 1;
+    while(hash[h] && strcmp(hash[h], name) != 0)
+        h = (h + 1) & (size - 1);
+    return h;
+}
+
+char *InternSymbol(char *name)
+{
+    if(!name) name = "";
+
+    if(2*(SymbolCount + 1) > SymbolHashSize) {
+        int size = SymbolHashSize ? 2*SymbolHashSize : 4096;
+        char **hash = (char **)CheckMalloc(size * sizeof(char *));
+        int i;
+        for(i = 0; i < SymbolHashSize; i++) {
+            if(SymbolHash[i])
+                hash[SymbolBucket(hash, size, SymbolHash[i])] = SymbolHash[i];
+        }
+        if(SymbolHash) CheckFree(SymbolHash);
+        SymbolHash = hash;
+        SymbolHashSize = size;
+    }
+
+    DWORD h = SymbolBucket(SymbolHash, SymbolHashSize, name);
+    if(SymbolHash[h]) return SymbolHash[h];
+
+    int len = strlen(name) + 1;
+    if(len > SymbolTextFree) {
+        SymbolTextFree = len > SYMBOL_TEXT_CHUNK ? len : SYMBOL_TEXT_CHUNK;
+        SymbolText = (char *)CheckMalloc(SymbolTextFree);
+    }
+    char *s = SymbolText;
+    memcpy(s, name, len);
+    SymbolText += len;
+    SymbolTextFree -= len;
+    SymbolHash[h] = s;
+    SymbolCount++;
+    return s;
+}
+
+//-----------------------------------------------------------------------------
+// Return the one copy of a table of values, adding it if it is new.
+//-----------------------------------------------------------------------------
+static SDWORD *InternTable(SDWORD *vals, int count)
+{
+    InternedTable *t;
+    for(t = Tables; t; t = t->next) {
+        if(t->count == count && memcmp(t->vals, vals, count * sizeof(SDWORD)) == 0)
+            return t->vals;
+    }
+    t = (InternedTable *)CheckMalloc(sizeof(InternedTable) + count * sizeof(SDWORD));
+    t->next = Tables;
+    t->count = count;
+    memcpy(t->vals, vals, count * sizeof(SDWORD));
+    Tables = t;
+    return t->vals;
+}
+
+//-----------------------------------------------------------------------------
+// Return a blank op at the end of IntCode[], making room for it if need be.
+// The op after it is blanked too, since some of the code generators look one
+// op ahead.
+//-----------------------------------------------------------------------------
+static void BlankOp(IntOp *a)
+{
+    memset(a, 0, sizeof(*a));
+    a->name1 = a->name2 = a->name3 = a->f = InternSymbol("");
+}
+
+static IntOp *NewOp(void)
+{
+    if(IntCodeLen + 2 > IntCodeMax) {
+        int n = IntCodeMax ? 2*IntCodeMax : 4096;
+        IntOp *ops = (IntOp *)CheckMalloc(n * sizeof(IntOp));
+        if(IntCode) {
+            memcpy(ops, IntCode, IntCodeLen * sizeof(IntOp));
+            CheckFree(IntCode);
+        }
+        IntCode = ops;
+        IntCodeMax = n;
+    }
+    BlankOp(&IntCode[IntCodeLen]);
+    BlankOp(&IntCode[IntCodeLen + 1]);
+    return &IntCode[IntCodeLen];
+}
+
 static void _Op(int l, char *f, char *args, int op, char *name1, char *name2, char *name3, char *name4, char *name5, char *name6, SDWORD lit, SDWORD lit2)
 {
-    IntCode[IntCodeLen].op = op;
-    if(name1) strcpy(IntCode[IntCodeLen].name1, name1);
-    if(name2) strcpy(IntCode[IntCodeLen].name2, name2);
-    if(name3) strcpy(IntCode[IntCodeLen].name3, name3);
-    IntCode[IntCodeLen].literal = lit;
-    IntCode[IntCodeLen].literal2 = lit2;
-    IntCode[IntCodeLen].rung = rungNow;
-    IntCode[IntCodeLen].which = whichNow;
-    IntCode[IntCodeLen].l = l;
-    strcpy(IntCode[IntCodeLen].f, f);
+    IntOp *a = NewOp();
+    a->op = op;
+    a->name1 = InternSymbol(name1);
+    a->name2 = InternSymbol(name2);
+    a->name3 = InternSymbol(name3);
+    a->literal = lit;
+    a->literal2 = lit2;
+    a->rung = rungNow;
+    a->which = whichNow;
+    a->l = l;
+    a->f = InternSymbol(f);
     IntCodeLen++;
-    if(IntCodeLen >= MAX_INT_OPS) {
-        Error(_("Internal limit exceeded (MAX_INT_OPS)"));
-        CompileError();
-    }
 }
 
 static void _Op(int l, char *f, char *args, int op, char *name1, char *name2, SDWORD lit)
@@ -518,16 +726,428 @@ static void _Op(int l, char *f, char *args, int op, char *name1, char *name2, ch
 //-----------------------------------------------------------------------------
 static void SimState(BOOL *b, char *name)
 {
-    IntCode[IntCodeLen].op = INT_SIMULATE_NODE_STATE;
-    strcpy(IntCode[IntCodeLen].name1, name);
-    IntCode[IntCodeLen].poweredAfter = b;
-    IntCode[IntCodeLen].rung = rungNow;
-    IntCode[IntCodeLen].which = whichNow;
+    IntOp *a = NewOp();
+    a->op = INT_SIMULATE_NODE_STATE;
+    a->name1 = InternSymbol(name);
+    a->poweredAfter = b;
+    a->rung = rungNow;
+    a->which = whichNow;
     IntCodeLen++;
-    if(IntCodeLen >= MAX_INT_OPS) {
-        Error(_("Internal limit exceeded (MAX_INT_OPS)"));
-        CompileError();
+}
+
+//-----------------------------------------------------------------------------
+// Compile a look-up table: dest := vals[index], if index is in 0..count-1,
+// else dest is left as it was.
+//-----------------------------------------------------------------------------
+static void LookUpTable(char *dest, char *index, SDWORD *vals, int count)
+{
+    Op(INT_LOOK_UP_TABLE, dest, index, count);
+    IntCode[IntCodeLen - 1].data = InternTable(vals, count);
+}
+
+//-----------------------------------------------------------------------------
+// Compile a piecewise linear table of count (x, y) points, x increasing:
+// dest := the y on the first segment whose right end is at or past index.
+// Past the last point dest is left as it was.
+//-----------------------------------------------------------------------------
+static void PiecewiseLinear(char *dest, char *index, SDWORD *vals, int count)
+{
+    Op(INT_PIECEWISE_LINEAR, dest, index, count);
+    IntCode[IntCodeLen - 1].data = InternTable(vals, 2*count);
+}
+
+//-----------------------------------------------------------------------------
+// Rebuild IntCode[], letting expand() write whatever it likes in place of
+// each op of the given kind.
+//-----------------------------------------------------------------------------
+static void ExpandOps(int op, void (*expand)(IntOp *a))
+{
+    int i, n = IntCodeLen;
+    for(i = 0; i < n; i++)
+        if(IntCode[i].op == op) break;
+    if(i >= n) return;
+
+    IntOp *old = (IntOp *)CheckMalloc(n * sizeof(IntOp));
+    memcpy(old, IntCode, n * sizeof(IntOp));
+    int rungWas = rungNow, whichWas = whichNow;
+
+    IntCodeLen = 0;
+    for(i = 0; i < n; i++) {
+        IntOp *a = &old[i];
+        if(a->op != op) {
+            *NewOp() = *a;
+            IntCodeLen++;
+            continue;
+        }
+        rungNow = a->rung;
+        whichNow = a->which;
+        expand(a);
+    }
+
+    rungNow = rungWas;
+    whichNow = whichWas;
+    CheckFree(old);
+}
+
+static void ExpandLookUpTable(IntOp *a)
+{
+    int j;
+    for(j = 0; j < a->literal; j++) {
+        Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch", j);
+        Op(INT_IF_VARIABLE_EQUALS_VARIABLE, a->name2, "$scratch");
+            Op(INT_SET_VARIABLE_TO_LITERAL, a->name1, a->data[j]);
+        Op(INT_END_IF);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Rewrite each INT_LOOK_UP_TABLE as a chain of compares, for the targets
+// that have no table op of their own.
+//-----------------------------------------------------------------------------
+void ExpandLookUpTables(void)
+{
+    ExpandOps(INT_LOOK_UP_TABLE, ExpandLookUpTable);
+}
+
+//-----------------------------------------------------------------------------
+// Pick the segment, one of lo..hi, by a binary search on the x values, and
+// load its start and slope into the scratch variables. The compare only sets
+// a bit, and the bit picks the branch, since the AVR's conditional branches
+// can't reach past a long if.
+//-----------------------------------------------------------------------------
+static void PiecewiseLinearSearch(IntOp *a, int lo, int hi)
+{
+    SDWORD *v = a->data;
+    if(lo == hi) {
+        Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch", v[(lo-1)*2]);
+        Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch1", v[(lo-1)*2 + 1]);
+        Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch2", v[lo*2] - v[(lo-1)*2]);
+        Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch3", v[lo*2 + 1] - v[(lo-1)*2 + 1]);
+        return;
+    }
+    int mid = (lo + hi) / 2;
+    Op(INT_CLEAR_BIT, "$scratch");
+    Op(INT_IF_VARIABLE_LES_LITERAL, a->name2, v[mid*2] + 1);
+        Op(INT_SET_BIT, "$scratch");
+    Op(INT_END_IF);
+    Op(INT_IF_BIT_SET, "$scratch");
+        PiecewiseLinearSearch(a, lo, mid);
+    Op(INT_ELSE);
+        PiecewiseLinearSearch(a, mid + 1, hi);
+    Op(INT_END_IF);
+}
+
+static void ExpandPiecewiseLinearOp(IntOp *a)
+{
+    // yout = y[i-1] + (xin - x[i-1])*dy/dx, as it always was
+    Op(INT_CLEAR_BIT, "$scratch");
+    Op(INT_IF_VARIABLE_LES_LITERAL, a->name2, a->data[(a->literal - 1)*2] + 1);
+        Op(INT_SET_BIT, "$scratch");
+    Op(INT_END_IF);
+    Op(INT_IF_BIT_SET, "$scratch");
+        PiecewiseLinearSearch(a, 1, a->literal - 1);
+        Op(INT_SET_VARIABLE_SUBTRACT, "$scratch", a->name2, "$scratch");
+        Op(INT_SET_VARIABLE_MULTIPLY, a->name1, "$scratch", "$scratch3");
+        Op(INT_SET_VARIABLE_DIVIDE, a->name1, a->name1, "$scratch2");
+        Op(INT_SET_VARIABLE_ADD, a->name1, a->name1, "$scratch1");
+    Op(INT_END_IF);
+}
+
+//-----------------------------------------------------------------------------
+// Rewrite each INT_PIECEWISE_LINEAR as ordinary ops, for the targets that
+// have no such op of their own. The search picks one segment, so only that
+// one multiply and divide is done.
+//-----------------------------------------------------------------------------
+void ExpandPiecewiseLinear(void)
+{
+    ExpandOps(INT_PIECEWISE_LINEAR, ExpandPiecewiseLinearOp);
+}
+
+static void ExpandShiftRegister(IntOp *a)
+{
+    int i;
+    for(i = a->literal - 2; i >= 0; i--) {
+        char dest[MAX_NAME_LEN], src[MAX_NAME_LEN];
+        sprintf(src, "%s%d", a->name1, i);
+        sprintf(dest, "%s%d", a->name1, i+1);
+        Op(INT_SET_VARIABLE_TO_VARIABLE, dest, src);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Rewrite each INT_SHIFT_REGISTER as a move of every stage to the next, for
+// the targets that keep each stage in a variable of its own.
+//-----------------------------------------------------------------------------
+void ExpandShiftRegisters(void)
+{
+    ExpandOps(INT_SHIFT_REGISTER, ExpandShiftRegister);
+}
+
+//-----------------------------------------------------------------------------
+// The shift registers that UseShiftRegisterRings() keeps in a ring; a shift
+// only moves the head of the ring, so stage k lives at (head + k) mod stages,
+// and every op that names a stage must read and write it through the ring.
+//-----------------------------------------------------------------------------
+typedef struct ShiftRingTag {
+    char   *name;
+    int     stages;
+    BOOL    ok;
+} ShiftRing;
+
+static ShiftRing *ShiftRings;
+static int ShiftRingCount;
+
+// Which ring, and which stage of it, does this name mean? NULL if none. A
+// name that could be a stage of two of them (`a12' of `a' and of `a1') makes
+// neither of them a ring, since with the moves those two stages were one.
+static ShiftRing *StageOfRing(char *name, int *stage)
+{
+    ShiftRing *found = NULL;
+    int i;
+    for(i = 0; i < ShiftRingCount; i++) {
+        ShiftRing *r = &ShiftRings[i];
+        int len = strlen(r->name);
+        char *s = name + len;
+        if(strncmp(name, r->name, len) != 0 || !isdigit(*s)) continue;
+        if(*s == '0' && s[1]) continue;
+        char *end;
+        long k = strtol(s, &end, 10);
+        if(*end || k >= r->stages) continue;
+        if(found) {
+            found->ok = FALSE;
+            r->ok = FALSE;
+        }
+        found = r;
+        *stage = (int)k;
+    }
+    return found;
+}
+
+// The ops that may name a stage of a ring, and whether they read and write
+// name1; name2 and name3 are only ever read. A stage named by any other op
+// keeps its ring from being used.
+static BOOL RingOperands(int op, BOOL *read1, BOOL *write1)
+{
+    switch(op) {
+        case INT_SET_VARIABLE_TO_LITERAL:
+        case INT_SET_VARIABLE_TO_VARIABLE:
+        case INT_LOOK_UP_TABLE:
+        case INT_SET_VARIABLE_ADD:
+        case INT_SET_VARIABLE_SUBTRACT:
+        case INT_SET_VARIABLE_MULTIPLY:
+        case INT_SET_VARIABLE_DIVIDE:
+            *read1 = FALSE;
+            *write1 = TRUE;
+            return TRUE;
+
+        case INT_INCREMENT_VARIABLE:
+        case INT_DECREMENT_VARIABLE:
+            *read1 = TRUE;
+            *write1 = TRUE;
+            return TRUE;
+
+        case INT_IF_VARIABLE_LES_LITERAL:
+        case INT_IF_VARIABLE_EQUALS_VARIABLE:
+        case INT_IF_VARIABLE_GRT_VARIABLE:
+            *read1 = TRUE;
+            *write1 = FALSE;
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static ShiftRing *FindShiftRing(char *name)
+{
+    int i;
+    for(i = 0; i < ShiftRingCount; i++)
+        if(ShiftRings[i].name == name) return &ShiftRings[i];
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// For the targets that can index their RAM: keep the stages of each shift
+// register in a ring, so that a shift is a move of the head and not of every
+// stage. Each op that names a stage gets it through a scratch variable, read
+// from the ring before it and written back after it. A shift register that
+// can't be done that way (a stage named by an op that we don't rewrite, or
+// two of them by the same name but of different lengths), or that has more
+// than maxStages stages, gets its moves.
+//-----------------------------------------------------------------------------
+void UseShiftRegisterRings(int maxStages)
+{
+    int i, j, n = IntCodeLen;
+
+    ShiftRingCount = 0;
+    for(i = 0; i < n; i++) {
+        IntOp *a = &IntCode[i];
+        if(a->op != INT_SHIFT_REGISTER) continue;
+        ShiftRing *r = FindShiftRing(a->name1);
+        if(r) {
+            if(r->stages != a->literal) r->ok = FALSE;
+            continue;
+        }
+        if(!ShiftRings)
+            ShiftRings = (ShiftRing *)CheckMalloc(n * sizeof(ShiftRing));
+        r = &ShiftRings[ShiftRingCount++];
+        r->name = a->name1;
+        r->stages = a->literal;
+        r->ok = (a->literal <= maxStages);
+    }
+    if(ShiftRingCount == 0) return;
+
+    for(i = 0; i < ShiftRingCount; i++) {
+        for(j = 0; j < ShiftRings[i].stages; j++) {
+            char name[MAX_NAME_LEN];
+            int k;
+            sprintf(name, "%s%d", ShiftRings[i].name, j);
+            StageOfRing(name, &k);
+        }
+    }
+    for(i = 0; i < n; i++) {
+        IntOp *a = &IntCode[i];
+        if(a->op == INT_SHIFT_REGISTER) continue;
+        char *names[3] = { a->name1, a->name2, a->name3 };
+        BOOL read1, write1;
+        BOOL rewritable = RingOperands(a->op, &read1, &write1);
+        for(j = 0; j < 3; j++) {
+            int k;
+            ShiftRing *r = StageOfRing(names[j], &k);
+            if(r && !rewritable) r->ok = FALSE;
+        }
+    }
+
+    IntOp *old = (IntOp *)CheckMalloc(n * sizeof(IntOp));
+    memcpy(old, IntCode, n * sizeof(IntOp));
+    int rungWas = rungNow, whichWas = whichNow;
+
+    IntCodeLen = 0;
+    for(i = 0; i < n; i++) {
+        IntOp *a = &old[i];
+        rungNow = a->rung;
+        whichNow = a->which;
+
+        if(a->op == INT_SHIFT_REGISTER) {
+            if(FindShiftRing(a->name1)->ok) {
+                *NewOp() = *a;
+                IntCodeLen++;
+            } else {
+                ExpandShiftRegister(a);
+            }
+            continue;
+        }
+
+        char **names[3] = { &a->name1, &a->name2, &a->name3 };
+        ShiftRing *rings[3];
+        int stages[3];
+        char scratch[3][MAX_NAME_LEN];
+        BOOL read1 = FALSE, write1 = FALSE, any = FALSE;
+        RingOperands(a->op, &read1, &write1);
+        for(j = 0; j < 3; j++) {
+            rings[j] = StageOfRing(*names[j], &stages[j]);
+            if(rings[j] && !rings[j]->ok) rings[j] = NULL;
+            if(rings[j]) any = TRUE;
+        }
+        if(!any) {
+            *NewOp() = *a;
+            IntCodeLen++;
+            continue;
+        }
+
+        // One scratch per stage named, and read each one that is read.
+        IntOp b = *a;
+        char **bnames[3] = { &b.name1, &b.name2, &b.name3 };
+        for(j = 0; j < 3; j++) {
+            if(!rings[j]) continue;
+            int m;
+            for(m = 0; m < j; m++)
+                if(rings[m] && *names[m] == *names[j]) break;
+            sprintf(scratch[j], "$stage%d", (m < j) ? m + 1 : j + 1);
+            *bnames[j] = InternSymbol(scratch[j]);
+            if(m < j) continue;
+            BOOL read = (j > 0) || read1;
+            for(m = j + 1; m < 3; m++)
+                if(*names[m] == *names[j]) read = TRUE;
+            if(read)
+                Op(INT_RING_READ, scratch[j], rings[j]->name, NULL, stages[j],
+                    rings[j]->stages);
+        }
+        *NewOp() = b;
+        IntCodeLen++;
+        if(write1 && rings[0])
+            Op(INT_RING_WRITE, rings[0]->name, scratch[0], NULL, stages[0],
+                rings[0]->stages);
+    }
+
+    rungNow = rungWas;
+    whichNow = whichWas;
+    CheckFree(old);
+    CheckFree(ShiftRings);
+    ShiftRings = NULL;
+    ShiftRingCount = 0;
+}
+
+void UseShiftRegisterRings(void)
+{
+    UseShiftRegisterRings(INT_MAX);
+}
+
+//-----------------------------------------------------------------------------
+// Split the term of an INT_AND_BIT_TERM or INT_OR_BIT_TERM, which is the
+// names of its bits joined by `&', each with a `!' in front if that bit must
+// be clear. Return the number of bits.
+//-----------------------------------------------------------------------------
+int BitTermBits(char *term, char **names, BOOL *negated)
+{
+    char buf[MAX_NAME_LEN];
+    int n = 0;
+
+    while(*term) {
+        if(n >= MAX_TERM_BITS) oops();
+        negated[n] = (*term == '!');
+        if(negated[n]) term++;
+        int len = strcspn(term, "&");
+        if(len >= MAX_NAME_LEN) oops();
+        memcpy(buf, term, len);
+        buf[len] = '\0';
+        names[n++] = InternSymbol(buf);
+        term += len;
+        if(*term == '&') term++;
     }
+    return n;
+}
+
+static void ExpandAndBitTerm(IntOp *a)
+{
+    char *names[MAX_TERM_BITS];
+    BOOL negated[MAX_TERM_BITS];
+    int i, n = BitTermBits(a->name2, names, negated);
+    for(i = 0; i < n; i++) {
+        Op(negated[i] ? INT_IF_BIT_SET : INT_IF_BIT_CLEAR, names[i]);
+          Op(INT_CLEAR_BIT, a->name1);
+        Op(INT_END_IF);
+    }
+}
+
+static void ExpandOrBitTerm(IntOp *a)
+{
+    char *names[MAX_TERM_BITS];
+    BOOL negated[MAX_TERM_BITS];
+    int i, n = BitTermBits(a->name2, names, negated);
+    for(i = 0; i < n; i++)
+        Op(negated[i] ? INT_IF_BIT_CLEAR : INT_IF_BIT_SET, names[i]);
+    Op(INT_SET_BIT, a->name1);
+    for(i = 0; i < n; i++)
+        Op(INT_END_IF);
+}
+
+//-----------------------------------------------------------------------------
+// Rewrite each INT_AND_BIT_TERM and INT_OR_BIT_TERM as an if on each of its
+// bits, for the targets that test one bit at a time.
+//-----------------------------------------------------------------------------
+void ExpandBitTerms(void)
+{
+    ExpandOps(INT_AND_BIT_TERM, ExpandAndBitTerm);
+    ExpandOps(INT_OR_BIT_TERM, ExpandOrBitTerm);
 }
 
 //-----------------------------------------------------------------------------
@@ -588,9 +1208,208 @@ static SDWORD TimerPeriod(ElemLeaf *l)
         Error("%s\r\n%s\r\n%s", s1, s2, s3);
         CompileError();
     }
+    if(Prog.timeStampTimers && period >= (1 << 15) - 1) {
+        // The elapsed time is compared against period+1, which must still
+        // fit in a signed 16-bit literal.
+        char s2[1024];
+        sprintf(s2, _("Timer '%s'=%.3f ms needs %d PLC cycle times."), l->d.timer.name, 1.0*l->d.timer.delay/1000, period);
+        Error("%s\r\n%s", _("Time-stamp timer period too long (max 32766 "
+            "times cycle time); use a slower cycle time."), s2);
+        CompileError();
+    }
     return period;
 }
 
+//-----------------------------------------------------------------------------
+// With Prog.timeStampTimers a timer that is counting, which its "$Tname_running"
+// bit says, holds the value of the "$tick" scan counter (incremented at the
+// start of every scan) from when it started, instead of counting up once per
+// scan. The time elapsed is then $tick - timer, which the 16-bit subtraction
+// keeps correct across the wrap. Between scans $tick - timer equals the count
+// that the classic timer would hold, so the elapsed value seen inside a scan
+// is that count plus one. A timer that is not counting holds that count, as a
+// classic timer does, so that an idle or finished timer costs no more than a
+// test, and a RES is the same as for a classic timer wherever it is.
+//
+// Any other element that uses the timer's variable (a compare, a move, some
+// math, a formatted string) would see the start instead of the count, so the
+// timers that are used so are counted the classic way, once per scan;
+// GenerateIntermediateCode() finds them with FindCountedTimers().
+//-----------------------------------------------------------------------------
+static char *CountedTimers[MAX_IO];
+static int CountedTimerCount;
+
+static BOOL TimeStampTimer(char *name)
+{
+    if(!Prog.timeStampTimers)
+        return FALSE;
+    name = InternSymbol(name);
+    int i;
+    for(i = 0; i < CountedTimerCount; i++)
+        if(CountedTimers[i] == name)
+            return FALSE;
+    return TRUE;
+}
+
+static BOOL IsTimerElem(int which)
+{
+    return which == ELEM_TON || which == ELEM_TOF || which == ELEM_RTO
+        || which == ELEM_TCY;
+}
+
+//-----------------------------------------------------------------------------
+// Find the timers whose variables the ops of elements other than timers and
+// RES use, from the ops just generated. Return TRUE if they are not the
+// CountedTimers[] that the ops were generated with, which are then set to
+// them, so that the rungs must be generated again.
+//-----------------------------------------------------------------------------
+static BOOL FindCountedTimers(void)
+{
+    static char *timers[MAX_IO];
+    static char *used[MAX_IO];
+    int nTimers = 0, nUsed = 0;
+    int i, j, k;
+    if(!Prog.timeStampTimers)
+        return FALSE;
+
+    // The names that the user gave never start with '$'; the ones that the
+    // timers make for themselves all do.
+    for(i = 0; i < IntCodeLen; i++) {
+        IntOp *a = &IntCode[i];
+        if(!IsTimerElem(a->which))
+            continue;
+        char *names[3] = { a->name1, a->name2, a->name3 };
+        for(k = 0; k < 3; k++) {
+            if(names[k][0] == '\0' || names[k][0] == '$')
+                continue;
+            for(j = 0; j < nTimers; j++)
+                if(timers[j] == names[k])
+                    break;
+            if(j == nTimers && nTimers < MAX_IO)
+                timers[nTimers++] = names[k];
+        }
+    }
+    if(nTimers > 0) {
+        for(i = 0; i < IntCodeLen; i++) {
+            IntOp *a = &IntCode[i];
+            if(IsTimerElem(a->which) || a->which == ELEM_RES
+            || a->op == INT_COMMENT)
+                continue;
+            char *names[3] = { a->name1, a->name2, a->name3 };
+            for(k = 0; k < 3; k++) {
+                for(j = 0; j < nTimers; j++)
+                    if(timers[j] == names[k])
+                        break;
+                if(j == nTimers)
+                    continue;
+                for(j = 0; j < nUsed; j++)
+                    if(used[j] == names[k])
+                        break;
+                if(j == nUsed)
+                    used[nUsed++] = names[k];
+            }
+        }
+    }
+
+    BOOL same = (nUsed == CountedTimerCount);
+    for(i = 0; same && i < nUsed; i++) {
+        for(j = 0; j < CountedTimerCount; j++)
+            if(CountedTimers[j] == used[i])
+                break;
+        if(j == CountedTimerCount)
+            same = FALSE;
+    }
+    if(same)
+        return FALSE;
+    memcpy(CountedTimers, used, nUsed * sizeof(char *));
+    CountedTimerCount = nUsed;
+    return TRUE;
+}
+
+static char *TimerRunning(char *name, char *dest)
+{
+    sprintf(dest, "$%s_running", name);
+    return dest;
+}
+
+static void TimerElapsed(char *name)
+{
+    Op(INT_SET_VARIABLE_SUBTRACT, "$scratch", "$tick", name);
+}
+
+// Switch a timer between its count and its start; within a scan the one is
+// $tick - 1 - the other, both ways.
+static void TimerFlip(char *name)
+{
+    TimerElapsed(name);
+    Op(INT_SET_VARIABLE_TO_VARIABLE, name, "$scratch");
+    Op(INT_DECREMENT_VARIABLE, name);
+}
+
+//-----------------------------------------------------------------------------
+// Number of PLC cycles in ms, the write interval or the idle time of a
+// persistent variable, or 0 if there is none.
+//-----------------------------------------------------------------------------
+static SDWORD PersistPeriod(ElemLeaf *l, SDWORD ms)
+{
+    SDWORD period = (SDWORD)((long long)ms * 1000 / Prog.cycleTime);
+    if(period < 1)
+        return 0;
+    if(period >= (1 << 15)) {
+        Error(_("Write interval of persistent variable '%s' too long (max "
+            "32767 times cycle time); use a slower cycle time."),
+            l->d.persist.var);
+        CompileError();
+    }
+    return period;
+}
+
+//-----------------------------------------------------------------------------
+// Hold back an EEPROM write of a persistent variable until `wait' has counted
+// up to the write interval, and `idle' to the idle time, whichever of them
+// there are. Returns how many ifs that opened, for PersistGateEnd().
+//-----------------------------------------------------------------------------
+static int PersistGate(char *wait, SDWORD period, char *idle, SDWORD idlePeriod)
+{
+    int n = 0;
+    if(period) {
+        Op(INT_IF_VARIABLE_LES_LITERAL, wait, period);
+        Op(INT_ELSE);
+        n++;
+    }
+    if(idlePeriod) {
+        Op(INT_IF_VARIABLE_LES_LITERAL, idle, idlePeriod);
+        Op(INT_ELSE);
+        n++;
+    }
+    return n;
+}
+
+static void PersistGateEnd(int n)
+{
+    for(; n > 0; n--)
+        Op(INT_END_IF);
+}
+
+//-----------------------------------------------------------------------------
+// The EEPROM ops only take a literal address, so to reach the copy of a
+// rotated persistent variable picked at run time by `slot' we need a chain
+// of compares over all the copies.
+//-----------------------------------------------------------------------------
+static void PersistOpOnSlot(int op, char *name, char *slot, DWORD base,
+    int stride, int copies)
+{
+    int k;
+    for(k = 0; k < copies - 1; k++) {
+        Op(INT_IF_VARIABLE_LES_LITERAL, slot, (SDWORD)(k + 1));
+          Op(op, name, (SDWORD)(base + k*stride));
+        Op(INT_ELSE);
+    }
+    Op(op, name, (SDWORD)(base + (copies - 1)*stride));
+    for(k = 0; k < copies - 1; k++)
+        Op(INT_END_IF);
+}
+
 //-----------------------------------------------------------------------------
 // Is an expression that could be either a variable name or a number a number?
 //-----------------------------------------------------------------------------
@@ -732,6 +1551,39 @@ SDWORD hobatoi(char *str)
     return val;
 }
 
+//-----------------------------------------------------------------------------
+// Report an error if a var doesn't fit in 8-16-24 bits.
+//-----------------------------------------------------------------------------
+void CheckVarInRange(char *name, char *str, SDWORD v)
+{
+    SDWORD val = hobatoi(str);
+    if(val != v) oops();
+    int radix = getradix(str);
+
+    int sov = SizeOfVar(name);
+    if (sov == 1) {
+        if((v < -128 || v > 127) && (radix == 10))
+            Error(_("Variable %s=%d out of range: -128 to 127 inclusive."), name, v);
+        else if((v < 0 || v > 0xff) && (radix != 10))
+            Error(_("Variable %s=0x%X out range : 0 to 0xFF inclusive."), str, v, name);
+    } else if((sov == 2) || (sov == 0)){
+        if((v < -32768 || v > 32767) && (radix == 10))
+            Error(_("Variable %s=%d out of range: -32768 to 32767 inclusive."), name, v);
+        else if((v < 0 || v > 0xffff) && (radix != 10))
+            Error(_("Variable %s=0x%X out range : 0 to 0xFFFF inclusive."), str, v, name);
+    } else if(sov == 3) {
+        if((v < -8388608 || v > 8388607) && (radix == 10))
+            Error(_("Variable %s=%d out of range: -8388608 to 8388607 inclusive."), name, v);
+        else if((v < 0 || v > 0xffffff) && (radix != 10))
+            Error(_("Variable %s=0x%X out range : 0 to 0xffFFFF inclusive."), str, v, name);
+    } else if(sov == 4) {
+        if((v < -2147483648LL || v > 2147483647LL) && (radix == 10))
+            Error(_("Variable %s=%d out of range: -2147483648 to 2147483647 inclusive."), name, v);
+        else if((v < 0 || v > 0xffffFFFF) && (radix != 10))
+            Error(_("Variable %s=0x%X out range : 0 to 0xffffFFFF inclusive."), str, v, name);
+    } else ooops("Variable '%s' size=%d value=%d", name, sov, v);
+}
+
 //-----------------------------------------------------------------------------
 // Try to turn a string into a constant, and raise an error if
 // something bad happens when we do so (e.g. out of range).
@@ -787,7 +1639,7 @@ static BOOL CheckStaySameElem(int which, void *elem)
 }
 
 //-----------------------------------------------------------------------------
-static BOOL CheckEndOfRungElem(int which, void *elem)
+BOOL CheckEndOfRungElem(int which, void *elem)
 {
     ElemLeaf *l = (ElemLeaf *)elem;
 
@@ -954,20 +1806,212 @@ static void InitTablesCircuit(int which, void *elem)
         default:
             break;
     }
-#endif
+#endif
+}
+
+//-----------------------------------------------------------------------------
+static void InitTables(void)
+{
+#ifdef NEW_FEATURE
+    Comment("INIT_TABLES");
+      int i;
+      for(i = 0; i < Prog.numRungs; i++) {
+          rungNow = i;
+          InitTablesCircuit(ELEM_SERIES_SUBCKT, Prog.rungs[i]);
+      }
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// A run of contacts, shorts and opens, in series and in parallel, is just a
+// boolean function of the bits that the contacts name. It is written as a
+// sum of products (an OR of terms, each an AND of bits) so that a target can
+// test all the bits of one byte with a single mask and compare, instead of
+// one if and one clear per contact. A circuit whose sum would have more than
+// MAX_BOOL_TERMS terms, or a term more than MAX_TERM_BITS bits, is compiled
+// the usual way.
+//-----------------------------------------------------------------------------
+#define MAX_BOOL_TERMS 8
+
+typedef struct BoolTermTag {
+    int     n;
+    char   *name[MAX_TERM_BITS];
+    BOOL    negated[MAX_TERM_BITS];
+} BoolTerm;
+
+typedef struct BoolSumTag {
+    int         n;
+    BoolTerm    term[MAX_BOOL_TERMS];
+} BoolSum;
+
+static BOOL IsBoolElem(int which, void *any)
+{
+    ElemLeaf *l = (ElemLeaf *)any;
+    int i;
+
+    switch(which) {
+        case ELEM_SERIES_SUBCKT: {
+            ElemSubcktSeries *s = (ElemSubcktSeries *)any;
+            for(i = 0; i < s->count; i++)
+                if(!IsBoolElem(s->contents[i].which, s->contents[i].d.any))
+                    return FALSE;
+            return TRUE;
+        }
+        case ELEM_PARALLEL_SUBCKT: {
+            ElemSubcktParallel *p = (ElemSubcktParallel *)any;
+            for(i = 0; i < p->count; i++)
+                if(!IsBoolElem(p->contents[i].which, p->contents[i].d.any))
+                    return FALSE;
+            return TRUE;
+        }
+        case ELEM_CONTACTS:
+            // The optimizer does not look inside the terms for the `$' bits.
+            return l->d.contacts.name[0] != '$';
+        case ELEM_SHORT:
+        case ELEM_OPEN:
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// s := s AND c. Return FALSE if the result is too big.
+static BOOL AndBoolSums(BoolSum *s, BoolSum *c)
+{
+    static BoolSum r;
+    int i, j, k, m;
+
+    r.n = 0;
+    for(i = 0; i < s->n; i++) {
+        for(j = 0; j < c->n; j++) {
+            BoolTerm t = s->term[i];
+            BoolTerm *u = &c->term[j];
+            BOOL never = FALSE;
+            for(k = 0; k < u->n && !never; k++) {
+                for(m = 0; m < t.n; m++)
+                    if(t.name[m] == u->name[k]) break;
+                if(m < t.n) {
+                    // a bit and its negation, so this term is never true
+                    if(t.negated[m] != u->negated[k]) never = TRUE;
+                    continue;
+                }
+                if(t.n >= MAX_TERM_BITS) return FALSE;
+                t.name[t.n] = u->name[k];
+                t.negated[t.n] = u->negated[k];
+                t.n++;
+            }
+            if(never) continue;
+            if(r.n >= MAX_BOOL_TERMS) return FALSE;
+            r.term[r.n++] = t;
+        }
+    }
+    *s = r;
+    return TRUE;
+}
+
+static BOOL BoolSumOf(int which, void *any, BoolSum *s)
+{
+    ElemLeaf *l = (ElemLeaf *)any;
+    BoolSum c;
+    int i, j;
+
+    switch(which) {
+        case ELEM_SERIES_SUBCKT: {
+            ElemSubcktSeries *ss = (ElemSubcktSeries *)any;
+            s->n = 1;
+            s->term[0].n = 0;
+            for(i = 0; i < ss->count; i++) {
+                if(!BoolSumOf(ss->contents[i].which, ss->contents[i].d.any, &c))
+                    return FALSE;
+                if(!AndBoolSums(s, &c)) return FALSE;
+            }
+            return TRUE;
+        }
+        case ELEM_PARALLEL_SUBCKT: {
+            ElemSubcktParallel *p = (ElemSubcktParallel *)any;
+            s->n = 0;
+            for(i = 0; i < p->count; i++) {
+                if(!BoolSumOf(p->contents[i].which, p->contents[i].d.any, &c))
+                    return FALSE;
+                for(j = 0; j < c.n; j++) {
+                    if(c.term[j].n == 0) {
+                        // a branch that always conducts
+                        s->n = 1;
+                        s->term[0].n = 0;
+                        return TRUE;
+                    }
+                    if(s->n >= MAX_BOOL_TERMS) return FALSE;
+                    s->term[s->n++] = c.term[j];
+                }
+            }
+            return TRUE;
+        }
+        case ELEM_CONTACTS:
+            s->n = 1;
+            s->term[0].n = 1;
+            s->term[0].name[0] = InternSymbol(l->d.contacts.name);
+            s->term[0].negated[0] = l->d.contacts.negated;
+            return TRUE;
+        case ELEM_SHORT:
+            s->n = 1;
+            s->term[0].n = 0;
+            return TRUE;
+        case ELEM_OPEN:
+            s->n = 0;
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static char *BitTermName(BoolTerm *t, char *dest)
+{
+    int i;
+    dest[0] = '\0';
+    for(i = 0; i < t->n; i++) {
+        if(i > 0) strcat(dest, "&");
+        if(t->negated[i]) strcat(dest, "!");
+        strcat(dest, t->name[i]);
+    }
+    return dest;
 }
 
 //-----------------------------------------------------------------------------
-static void InitTables(void)
+// Compile the elements from..to-1 of a series subcircuit, which must all be
+// IsBoolElem(), as bit terms. Return FALSE, having compiled nothing, if they
+// make too big a sum.
+//-----------------------------------------------------------------------------
+static BOOL BitTermsFromSeries(ElemSubcktSeries *ss, int from, int to,
+    char *stateInOut)
 {
-#ifdef NEW_FEATURE
-    Comment("INIT_TABLES");
-      int i;
-      for(i = 0; i < Prog.numRungs; i++) {
-          rungNow = i;
-          InitTablesCircuit(ELEM_SERIES_SUBCKT, Prog.rungs[i]);
-      }
-#endif
+    BoolSum s, c;
+    char term[MAX_TERM_BITS * (MAX_NAME_LEN + 2)];
+    int i;
+
+    s.n = 1;
+    s.term[0].n = 0;
+    for(i = from; i < to; i++) {
+        if(!BoolSumOf(ss->contents[i].which, ss->contents[i].d.any, &c))
+            return FALSE;
+        if(!AndBoolSums(&s, &c)) return FALSE;
+    }
+
+    Comment(3, "BIT TERMS");
+    if(s.n == 0) {
+        Op(INT_CLEAR_BIT, stateInOut);
+        return TRUE;
+    }
+    for(i = 0; i < s.n; i++) {
+        if(s.term[i].n == 0) return TRUE; // always conducts
+    }
+    if(s.n == 1) {
+        Op(INT_AND_BIT_TERM, stateInOut, BitTermName(&s.term[0], term));
+        return TRUE;
+    }
+    Op(INT_IF_BIT_SET, stateInOut);
+      Op(INT_CLEAR_BIT, stateInOut);
+      for(i = 0; i < s.n; i++)
+        Op(INT_OR_BIT_TERM, stateInOut, BitTermName(&s.term[i], term));
+    Op(INT_END_IF);
+    return TRUE;
 }
 
 //-----------------------------------------------------------------------------
@@ -999,9 +2043,31 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut, int rung)
             ElemSubcktSeries *s = (ElemSubcktSeries *)any;
 
             Comment("start series [");
-            for(i = 0; i < s->count; i++) {
-                IntCodeFromCircuit(s->contents[i].which, s->contents[i].d.any,
-                    stateInOut, rung);
+            // The simulator shows which of the contacts conduct, so it
+            // needs an op per contact; it gets no bit terms.
+            for(i = 0; i < s->count; ) {
+                int j = i;
+                while(!InSimulationMode && j < s->count &&
+                    IsBoolElem(s->contents[j].which, s->contents[j].d.any))
+                {
+                    j++;
+                }
+                if(j > i && BitTermsFromSeries(s, i, j, stateInOut)) {
+                    i = j;
+                    continue;
+                }
+                // too big together; try them one at a time
+                if(j == i) j = i + 1;
+                for(; i < j; i++) {
+                    if(!InSimulationMode &&
+                        IsBoolElem(s->contents[i].which, s->contents[i].d.any)
+                        && BitTermsFromSeries(s, i, i + 1, stateInOut))
+                    {
+                        continue;
+                    }
+                    IntCodeFromCircuit(s->contents[i].which,
+                        s->contents[i].d.any, stateInOut, rung);
+                }
             }
             Comment("] finish series");
             break;
@@ -1152,6 +2218,42 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut, int rung)
             Comment(3, "ELEM_RTO");
             SDWORD period = TimerPeriod(l);
 
+            if(TimeStampTimer(l->d.timer.name)) {
+              // Counting only while the input is on; a count is kept
+              // while it is off.
+              char running[MAX_NAME_LEN];
+              TimerRunning(l->d.timer.name, running);
+              Op(INT_IF_BIT_SET, running);
+                Op(INT_IF_BIT_CLEAR, stateInOut);
+                  Op(INT_CLEAR_BIT, running);
+                  TimerFlip(l->d.timer.name);
+                Op(INT_END_IF);
+              Op(INT_ELSE);
+                Op(INT_IF_BIT_SET, stateInOut);
+                  Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
+                    Op(INT_SET_BIT, running);
+                    TimerFlip(l->d.timer.name);
+                  Op(INT_END_IF);
+                Op(INT_END_IF);
+              Op(INT_END_IF);
+
+              Op(INT_IF_BIT_SET, running);
+                TimerElapsed(l->d.timer.name);
+                Op(INT_IF_VARIABLE_LES_LITERAL, "$scratch", period + 1);
+                  Op(INT_CLEAR_BIT, stateInOut);
+                Op(INT_ELSE);
+                  Op(INT_CLEAR_BIT, running);
+                  Op(INT_SET_VARIABLE_TO_LITERAL, l->d.timer.name, period);
+                Op(INT_END_IF);
+              Op(INT_ELSE);
+                Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
+                Op(INT_ELSE);
+                  Op(INT_SET_BIT, stateInOut);
+                Op(INT_END_IF);
+              Op(INT_END_IF);
+              break;
+            }
+
             Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
 
               Op(INT_IF_BIT_SET, stateInOut);
@@ -1171,6 +2273,11 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut, int rung)
             Comment(3, "ELEM_RES");
             Op(INT_IF_BIT_SET, stateInOut);
               Op(INT_SET_VARIABLE_TO_LITERAL, l->d.reset.name, (SDWORD)0);
+              if(l->d.reset.name[0] == 'T' && TimeStampTimer(l->d.reset.name)) {
+                // a zero count; the timer starts again from it
+                char running[MAX_NAME_LEN];
+                Op(INT_CLEAR_BIT, TimerRunning(l->d.reset.name, running));
+              }
             Op(INT_END_IF);
             break;
         case ELEM_TCY: {
@@ -1180,6 +2287,34 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut, int rung)
             char store[MAX_NAME_LEN];
             GenSymOneShot(store, "TCY", l->d.timer.name);
 
+            if(TimeStampTimer(l->d.timer.name)) {
+              char running[MAX_NAME_LEN];
+              TimerRunning(l->d.timer.name, running);
+              Op(INT_IF_BIT_SET, stateInOut);
+                Op(INT_IF_BIT_CLEAR, running);
+                  Op(INT_SET_BIT, running);
+                  TimerFlip(l->d.timer.name);
+                Op(INT_END_IF);
+                TimerElapsed(l->d.timer.name);
+                Op(INT_IF_VARIABLE_LES_LITERAL, "$scratch", period + 1);
+                Op(INT_ELSE);
+                  Op(INT_SET_VARIABLE_TO_VARIABLE, l->d.timer.name, "$tick");
+                  Op(INT_IF_BIT_CLEAR, store);
+                    Op(INT_SET_BIT, store);
+                  Op(INT_ELSE);
+                    Op(INT_CLEAR_BIT, store);
+                  Op(INT_END_IF);
+                Op(INT_END_IF);
+                Op(INT_IF_BIT_CLEAR, store);
+                  Op(INT_CLEAR_BIT, stateInOut);
+                Op(INT_END_IF);
+              Op(INT_ELSE);
+                Op(INT_CLEAR_BIT, running);
+                Op(INT_SET_VARIABLE_TO_LITERAL, l->d.timer.name, (SDWORD)0);
+              Op(INT_END_IF);
+              break;
+            }
+
             Op(INT_IF_BIT_SET, stateInOut);
               Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
                 Op(INT_INCREMENT_VARIABLE, l->d.timer.name);
@@ -1203,6 +2338,32 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut, int rung)
             Comment(3, "ELEM_TON");
             SDWORD period = TimerPeriod(l);
 
+            if(TimeStampTimer(l->d.timer.name)) {
+              char running[MAX_NAME_LEN];
+              TimerRunning(l->d.timer.name, running);
+              Op(INT_IF_BIT_SET, stateInOut);
+                Op(INT_IF_BIT_CLEAR, running);
+                  Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
+                    Op(INT_SET_BIT, running);
+                    TimerFlip(l->d.timer.name);
+                  Op(INT_END_IF);
+                Op(INT_END_IF);
+                Op(INT_IF_BIT_SET, running);
+                  TimerElapsed(l->d.timer.name);
+                  Op(INT_IF_VARIABLE_LES_LITERAL, "$scratch", period + 1);
+                    Op(INT_CLEAR_BIT, stateInOut);
+                  Op(INT_ELSE);
+                    Op(INT_CLEAR_BIT, running);
+                    Op(INT_SET_VARIABLE_TO_LITERAL, l->d.timer.name, period);
+                  Op(INT_END_IF);
+                Op(INT_END_IF);
+              Op(INT_ELSE);
+                Op(INT_CLEAR_BIT, running);
+                Op(INT_SET_VARIABLE_TO_LITERAL, l->d.timer.name, (SDWORD)0);
+              Op(INT_END_IF);
+              break;
+            }
+
             Op(INT_IF_BIT_SET, stateInOut);
 
               Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
@@ -1228,6 +2389,37 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut, int rung)
             // people expect, so add a special case to fix that up.
             char antiGlitchName[MAX_NAME_LEN];
             sprintf(antiGlitchName, "$%s_antiglitch", l->d.timer.name);
+            if(TimeStampTimer(l->d.timer.name)) {
+              char running[MAX_NAME_LEN];
+              TimerRunning(l->d.timer.name, running);
+              Op(INT_IF_BIT_CLEAR, antiGlitchName);
+                Op(INT_SET_VARIABLE_TO_LITERAL, l->d.timer.name, period);
+              Op(INT_END_IF);
+              Op(INT_SET_BIT, antiGlitchName);
+
+              Op(INT_IF_BIT_CLEAR, stateInOut);
+                Op(INT_IF_BIT_CLEAR, running);
+                  Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
+                    Op(INT_SET_BIT, running);
+                    TimerFlip(l->d.timer.name);
+                  Op(INT_END_IF);
+                Op(INT_END_IF);
+                Op(INT_IF_BIT_SET, running);
+                  TimerElapsed(l->d.timer.name);
+                  Op(INT_IF_VARIABLE_LES_LITERAL, "$scratch", period + 1);
+                    Op(INT_SET_BIT, stateInOut);
+                  Op(INT_ELSE);
+                    Op(INT_CLEAR_BIT, running);
+                    Op(INT_SET_VARIABLE_TO_LITERAL, l->d.timer.name, period);
+                  Op(INT_END_IF);
+                Op(INT_END_IF);
+              Op(INT_ELSE);
+                Op(INT_CLEAR_BIT, running);
+                Op(INT_SET_VARIABLE_TO_LITERAL, l->d.timer.name, (SDWORD)0);
+              Op(INT_END_IF);
+              break;
+            }
+
             Op(INT_IF_BIT_CLEAR, antiGlitchName);
               Op(INT_SET_VARIABLE_TO_LITERAL, l->d.timer.name, period);
             Op(INT_END_IF);
@@ -1794,17 +2986,54 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut, int rung)
 
             case ELEM_PERSIST: {
               Comment(3, "ELEM_PERSIST");
+              char *var = l->d.persist.var;
+              int bytes = SizeOfVar(var);
+              int copies = l->d.persist.copies > 1 ? l->d.persist.copies : 1;
+              SDWORD period = PersistPeriod(l, l->d.persist.interval);
+              SDWORD idlePeriod = PersistPeriod(l, l->d.persist.idle);
+              DWORD base = EepromAddrFree;
+              int gate;
+
+              // With a write interval, count the cycles since the last
+              // write and hold back the next one until it has elapsed.
+              char wait[MAX_NAME_LEN];
+              sprintf(wait, "$persist_%s_wait", var);
+              // With an idle time, count the cycles since the value last
+              // changed, against a copy of it, and write only once it has
+              // stayed the same that long.
+              char idle[MAX_NAME_LEN];
+              char last[MAX_NAME_LEN];
+              sprintf(idle, "$persist_%s_idle", var);
+              sprintf(last, "$persist_%s_last", var);
+
               Op(INT_IF_BIT_SET, stateInOut);
 
+                if(period) {
+                    Op(INT_IF_VARIABLE_LES_LITERAL, wait, period);
+                        Op(INT_INCREMENT_VARIABLE, wait);
+                    Op(INT_END_IF);
+                }
+                if(idlePeriod) {
+                    Op(INT_IF_VARIABLE_EQUALS_VARIABLE, last, var);
+                        Op(INT_IF_VARIABLE_LES_LITERAL, idle, idlePeriod);
+                            Op(INT_INCREMENT_VARIABLE, idle);
+                        Op(INT_END_IF);
+                    Op(INT_ELSE);
+                        Op(INT_SET_VARIABLE_TO_VARIABLE, last, var);
+                        Op(INT_SET_VARIABLE_TO_LITERAL, idle, (SDWORD)0);
+                    Op(INT_END_IF);
+                }
+
+              if(copies == 1) {
                 // At startup, get the persistent variable from flash.
                 char isInit[MAX_NAME_LEN];
-                GenSymOneShot(isInit, "PERSIST", l->d.persist.var);
+                GenSymOneShot(isInit, "PERSIST", var);
                 Op(INT_IF_BIT_CLEAR, isInit);
                     Op(INT_CLEAR_BIT, "$scratch");
                     Op(INT_EEPROM_BUSY_CHECK, "$scratch");
                     Op(INT_IF_BIT_CLEAR, "$scratch");
                         Op(INT_SET_BIT, isInit);
-                        Op(INT_EEPROM_READ, l->d.persist.var, EepromAddrFree);
+                        Op(INT_EEPROM_READ, var, base);
                     Op(INT_END_IF);
                 Op(INT_END_IF);
 
@@ -1814,17 +3043,111 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut, int rung)
                 Op(INT_CLEAR_BIT, "$scratch");
                 Op(INT_EEPROM_BUSY_CHECK, "$scratch");
                 Op(INT_IF_BIT_CLEAR, "$scratch");
-                    Op(INT_EEPROM_READ, "$scratch", EepromAddrFree);
-                    Op(INT_IF_VARIABLE_EQUALS_VARIABLE, "$scratch",
-                        l->d.persist.var);
+                  gate = PersistGate(wait, period, idle, idlePeriod);
+                    Op(INT_EEPROM_READ, "$scratch", base);
+                    Op(INT_IF_VARIABLE_EQUALS_VARIABLE, "$scratch", var);
+                    Op(INT_ELSE);
+                        Op(INT_EEPROM_WRITE, var, base);
+                        if(period)
+                            Op(INT_SET_VARIABLE_TO_LITERAL, wait, (SDWORD)0);
+                    Op(INT_END_IF);
+                  PersistGateEnd(gate);
+                Op(INT_END_IF);
+              } else {
+                // Rotate the writes across `copies' slots to spread the
+                // wear. Each slot has a status word that counts up by one,
+                // modulo 256, from slot to slot; the newest slot is the one
+                // whose successor breaks the count. A new value goes to the
+                // next slot first and only then is its status bumped, so a
+                // reset in between leaves the previous value current.
+                DWORD status = base + copies*bytes;
+                char slot[MAX_NAME_LEN];
+                char seq[MAX_NAME_LEN];
+                char mark[MAX_NAME_LEN];
+                sprintf(slot, "$persist_%s_slot", var);
+                sprintf(seq, "$persist_%s_seq", var);
+                sprintf(mark, "$persist_%s_mark", var);
+
+                char isInit[MAX_NAME_LEN];
+                GenSymOneShot(isInit, "PERSIST", var);
+                Op(INT_IF_BIT_CLEAR, isInit);
+                    Op(INT_CLEAR_BIT, "$scratch");
+                    Op(INT_EEPROM_BUSY_CHECK, "$scratch");
+                    Op(INT_IF_BIT_CLEAR, "$scratch");
+                        Op(INT_SET_BIT, isInit);
+                        Op(INT_SET_VARIABLE_TO_LITERAL, slot, (SDWORD)0);
+                        Op(INT_EEPROM_READ, seq, status);
+                        // Search downwards, so that the first break wins.
+                        int i;
+                        for(i = copies - 1; i >= 0; i--) {
+                            DWORD here = status + i*bytes;
+                            DWORD next = status + ((i + 1) % copies)*bytes;
+                            Op(INT_EEPROM_READ, "$scratch", here);
+                            Op(INT_EEPROM_READ, "$scratch2", next);
+                            Op(INT_INCREMENT_VARIABLE, "$scratch");
+                            Op(INT_IF_VARIABLE_LES_LITERAL, "$scratch", (SDWORD)256);
+                            Op(INT_ELSE);
+                                Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch", (SDWORD)0);
+                            Op(INT_END_IF);
+                            Op(INT_IF_VARIABLE_EQUALS_VARIABLE, "$scratch", "$scratch2");
+                            Op(INT_ELSE);
+                                Op(INT_SET_VARIABLE_TO_LITERAL, slot, (SDWORD)i);
+                                Op(INT_EEPROM_READ, seq, here);
+                            Op(INT_END_IF);
+                        }
+                        PersistOpOnSlot(INT_EEPROM_READ, var, slot, base,
+                            bytes, copies);
+                    Op(INT_END_IF);
+                Op(INT_END_IF);
+
+                Op(INT_CLEAR_BIT, "$scratch");
+                Op(INT_EEPROM_BUSY_CHECK, "$scratch");
+                Op(INT_IF_BIT_CLEAR, "$scratch");
+                    Op(INT_IF_BIT_SET, mark);
+                        // The new value is in; make its slot the current one.
+                        PersistOpOnSlot(INT_EEPROM_WRITE, seq, slot, status,
+                            bytes, copies);
+                        Op(INT_CLEAR_BIT, mark);
                     Op(INT_ELSE);
-                        Op(INT_EEPROM_WRITE, l->d.persist.var, EepromAddrFree);
+                      gate = PersistGate(wait, period, idle, idlePeriod);
+                        PersistOpOnSlot(INT_EEPROM_READ, "$scratch", slot,
+                            base, bytes, copies);
+                        Op(INT_IF_VARIABLE_EQUALS_VARIABLE, "$scratch", var);
+                        Op(INT_ELSE);
+                            Op(INT_INCREMENT_VARIABLE, slot);
+                            Op(INT_IF_VARIABLE_LES_LITERAL, slot, (SDWORD)copies);
+                            Op(INT_ELSE);
+                                Op(INT_SET_VARIABLE_TO_LITERAL, slot, (SDWORD)0);
+                            Op(INT_END_IF);
+                            Op(INT_INCREMENT_VARIABLE, seq);
+                            Op(INT_IF_VARIABLE_LES_LITERAL, seq, (SDWORD)256);
+                            Op(INT_ELSE);
+                                Op(INT_SET_VARIABLE_TO_LITERAL, seq, (SDWORD)0);
+                            Op(INT_END_IF);
+                            PersistOpOnSlot(INT_EEPROM_WRITE, var, slot, base,
+                                bytes, copies);
+                            Op(INT_SET_BIT, mark);
+                            if(period)
+                                Op(INT_SET_VARIABLE_TO_LITERAL, wait, (SDWORD)0);
+                        Op(INT_END_IF);
+                      PersistGateEnd(gate);
                     Op(INT_END_IF);
                 Op(INT_END_IF);
+              }
 
               Op(INT_END_IF);
 
-              EepromAddrFree += SizeOfVar(l->d.persist.var);
+              if(PersistMapCount < MAX_IO) {
+                  PersistLayout *p = &PersistMap[PersistMapCount++];
+                  strcpy(p->var, var);
+                  p->addr = base;
+                  p->bytes = bytes;
+                  p->copies = copies;
+                  p->interval = l->d.persist.interval;
+                  p->idle = l->d.persist.idle;
+              }
+              // Each copy has a status word of the same size next to it.
+              EepromAddrFree += (copies > 1 ? 2*copies : 1) * bytes;
               break;
             }
             case ELEM_UART_SEND:
@@ -1926,13 +3249,9 @@ math:   {
             GenSymOneShot(storeName, "SHIFT_REGISTER", l->d.shiftRegister.name);
             Op(INT_IF_BIT_SET, stateInOut);
                 Op(INT_IF_BIT_CLEAR, storeName);
-                    int i;
-                    for(i = (l->d.shiftRegister.stages-2); i >= 0; i--) {
-                        char dest[MAX_NAME_LEN], src[MAX_NAME_LEN];
-                        sprintf(src, "%s%d", l->d.shiftRegister.name, i);
-                        sprintf(dest, "%s%d", l->d.shiftRegister.name, i+1);
-                        Op(INT_SET_VARIABLE_TO_VARIABLE, dest, src);
-                    }
+                    if(l->d.shiftRegister.stages >= 2)
+                        Op(INT_SHIFT_REGISTER, l->d.shiftRegister.name,
+                            l->d.shiftRegister.stages);
                 Op(INT_END_IF);
             Op(INT_END_IF);
             Op(INT_COPY_BIT_TO_BIT, storeName, stateInOut);
@@ -1940,17 +3259,9 @@ math:   {
         }
         case ELEM_LOOK_UP_TABLE: {
             Comment(3, "ELEM_LOOK_UP_TABLE");
-            // God this is stupid; but it will have to do, at least until I
-            // add new int code instructions for this.
-            int i;
-            Op(INT_IF_BIT_SET, stateInOut);
             ElemLookUpTable *t = &(l->d.lookUpTable);
-            for(i = 0; i < t->count; i++) {
-                Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch", i);
-                Op(INT_IF_VARIABLE_EQUALS_VARIABLE, t->index, "$scratch");
-                    Op(INT_SET_VARIABLE_TO_LITERAL, t->dest, t->vals[i]);
-                Op(INT_END_IF);
-            }
+            Op(INT_IF_BIT_SET, stateInOut);
+                LookUpTable(t->dest, t->index, t->vals, t->count);
             Op(INT_END_IF);
             break;
         }
@@ -1974,7 +3285,6 @@ math:   {
                 }
                 xThis = t->vals[i*2];
             }
-            Op(INT_IF_BIT_SET, stateInOut);
             for(i = t->count - 1; i >= 1; i--) {
                 int thisDx = t->vals[i*2] - t->vals[(i-1)*2];
                 int thisDy = t->vals[i*2 + 1] - t->vals[(i-1)*2 + 1];
@@ -1992,26 +3302,10 @@ math:   {
                         "See the help file for details."));
                     CompileError();
                 }
-
-                // Hack to avoid AVR brge issue again, since long jumps break
-                Op(INT_CLEAR_BIT, "$scratch");
-                Op(INT_IF_VARIABLE_LES_LITERAL, t->index, t->vals[i*2]+1);
-                    Op(INT_SET_BIT, "$scratch");
-                Op(INT_END_IF);
-
-                Op(INT_IF_BIT_SET, "$scratch");
-                Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch", t->vals[(i-1)*2]);
-                Op(INT_SET_VARIABLE_SUBTRACT, "$scratch", t->index, "$scratch");
-                Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch2", thisDx);
-                Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch3", thisDy);
-                Op(INT_SET_VARIABLE_MULTIPLY, t->dest, "$scratch", "$scratch3");
-                Op(INT_SET_VARIABLE_DIVIDE, t->dest, t->dest, "$scratch2");
-
-                Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch",
-                    t->vals[(i-1)*2 + 1]);
-                Op(INT_SET_VARIABLE_ADD, t->dest, t->dest, "$scratch");
-                Op(INT_END_IF);
             }
+            Op(INT_IF_BIT_SET, stateInOut);
+                if(t->count >= 2)
+                    PiecewiseLinear(t->dest, t->index, t->vals, t->count);
             Op(INT_END_IF);
             break;
         }
@@ -2389,14 +3683,373 @@ static BOOL CheckMasterRelay(void)
 
 //-----------------------------------------------------------------------------
 void WipeIntMemory(void)
+{
+    // The ops are blanked as they are added again, and the memory is kept
+    // for the next compile.
+    IntCodeLen = 0;
+    if(IntCode) BlankOp(&IntCode[0]);
+}
+
+//-----------------------------------------------------------------------------
+// Count the ops in each rung, not the node states.
+//-----------------------------------------------------------------------------
+static void CountOpsInRungs(DWORD *counts)
 {
     int i;
+    for(i = 0; i < MAX_RUNGS; i++)
+        counts[i] = 0;
     for(i = 0; i < IntCodeLen; i++) {
-//    if(IntCode[i].data)
-//      CheckFree(IntCode[i].data); //???
+        //dbp("IntPc=%d rung=%d ELEM_%x", i, IntCode[i].rung, IntCode[i].which);
+        if((IntCode[i].rung >= 0)
+        && (IntCode[i].rung < MAX_RUNGS)
+        && (IntCode[i].op != INT_SIMULATE_NODE_STATE))
+            counts[IntCode[i].rung]++;
     }
-    IntCodeLen = 0;
-    memset(IntCode, 0, sizeof(IntCode));
+}
+
+//-----------------------------------------------------------------------------
+// The ops of each rung as last generated, kept from one compile to the next
+// under a hash of the rung's elements, so that only the rungs that changed
+// have to be generated again. The elements are kept too, as the bytes that
+// were hashed, so that two rungs with the same hash are never taken for
+// each other. The ops are kept as they were before
+// OptimizeIntermediateCode(), with the node states of the simulator as the
+// index of the leaf, in the order the rung is walked, and the names that
+// GenSym*() made as they were numbered then.
+//-----------------------------------------------------------------------------
+#define GENSYM_KINDS 5
+
+typedef struct RungCacheTag {
+    unsigned long long hash;
+    BYTE       *key;
+    int         keyLen;
+    int         leaves;
+    DWORD       genSymFrom[GENSYM_KINDS];
+    DWORD       genSymUsed[GENSYM_KINDS];
+    int         n;
+    IntOp      *ops;
+    int        *leafOf;
+    BOOL        used;
+} RungCache;
+static RungCache *RungCaches;
+static int RungCacheCount;
+static int RungCacheMax;
+
+// What the ops of a rung depend on besides its elements; the cache is
+// flushed when any of it changes.
+static long long RungCacheCycleTime;
+static int RungCacheTimeStamp;
+static BOOL RungCacheMasterRelay;
+static int RungCacheCommentLevel = -1;
+static BOOL RungCacheSimulation;
+
+// The leaves of all the rungs, in the order they were hashed, and the bytes
+// that were hashed, with where each rung's are; HashRungs() fills them in
+// once per compile, for the rung cache and for CheckVariableNames().
+static ElemLeaf **RungLeaves;
+static int RungLeafCount;
+static int RungLeafMax;
+static BYTE *RungKey;
+static int RungKeyLen;
+static int RungKeyMax;
+static struct {
+    unsigned long long hash;
+    int     keyFrom;
+    int     keyLen;
+    int     leafFrom;
+    int     leaves;
+    BOOL    cacheable;
+} RungHashes[MAX_RUNGS];
+
+static const char *GenSymPrefix[GENSYM_KINDS] = {
+    "$parThis_", "$parOut_", "$oneShot_", "$fmtdStr_", "$stepper_"
+};
+
+static void GenSymCounts(DWORD *counts)
+{
+    counts[0] = GenSymCountParThis;
+    counts[1] = GenSymCountParOut;
+    counts[2] = GenSymCountOneShot;
+    counts[3] = GenSymCountFormattedString;
+    counts[4] = GenSymCountStepper;
+}
+
+static void HashBytes(unsigned long long *h, void *p, int n)
+{
+    BYTE *b = (BYTE *)p;
+    int i;
+    for(i = 0; i < n; i++) {
+        *h ^= b[i];
+        *h *= 1099511628211ull;
+    }
+
+    if(RungKeyLen + n > RungKeyMax) {
+        int m = RungKeyMax ? 2*RungKeyMax : 64*1024;
+        while(RungKeyLen + n > m)
+            m *= 2;
+        BYTE *key = (BYTE *)CheckMalloc(m);
+        if(RungKey) {
+            memcpy(key, RungKey, RungKeyLen);
+            CheckFree(RungKey);
+        }
+        RungKey = key;
+        RungKeyMax = m;
+    }
+    memcpy(RungKey + RungKeyLen, b, n);
+    RungKeyLen += n;
+}
+
+//-----------------------------------------------------------------------------
+// Hash a rung, and list its leaves. Return FALSE if its ops depend on more
+// than the rung itself, so that it must always be generated: the EEPROM
+// addresses of `Make Persistent' are given out in program order. The whole
+// rung is hashed either way.
+//-----------------------------------------------------------------------------
+static BOOL HashRung(int which, void *any, unsigned long long *h)
+{
+    BOOL cacheable = TRUE;
+    HashBytes(h, &which, sizeof(which));
+    switch(which) {
+        case ELEM_SERIES_SUBCKT: {
+            ElemSubcktSeries *s = (ElemSubcktSeries *)any;
+            int i;
+            HashBytes(h, &s->count, sizeof(s->count));
+            for(i = 0; i < s->count; i++)
+                if(!HashRung(s->contents[i].which, s->contents[i].d.any, h))
+                    cacheable = FALSE;
+            break;
+        }
+        case ELEM_PARALLEL_SUBCKT: {
+            ElemSubcktParallel *p = (ElemSubcktParallel *)any;
+            int i;
+            HashBytes(h, &p->count, sizeof(p->count));
+            for(i = 0; i < p->count; i++)
+                if(!HashRung(p->contents[i].which, p->contents[i].d.any, h))
+                    cacheable = FALSE;
+            break;
+        }
+        default: {
+            ElemLeaf *l = (ElemLeaf *)any;
+            if(which == ELEM_PERSIST)
+                cacheable = FALSE;
+            HashBytes(h, &l->d, sizeof(l->d));
+            if(RungLeafCount >= RungLeafMax) {
+                int n = RungLeafMax ? 2*RungLeafMax : 256;
+                ElemLeaf **leaves = (ElemLeaf **)CheckMalloc(n * sizeof(ElemLeaf *));
+                if(RungLeaves) {
+                    memcpy(leaves, RungLeaves, RungLeafCount * sizeof(ElemLeaf *));
+                    CheckFree(RungLeaves);
+                }
+                RungLeaves = leaves;
+                RungLeafMax = n;
+            }
+            RungLeaves[RungLeafCount++] = l;
+            break;
+        }
+    }
+    return cacheable;
+}
+
+//-----------------------------------------------------------------------------
+// Hash every rung of the program, one after the other.
+//-----------------------------------------------------------------------------
+static void HashRungs(void)
+{
+    int rung;
+    RungLeafCount = 0;
+    RungKeyLen = 0;
+    for(rung = 0; rung < Prog.numRungs; rung++) {
+        RungHashes[rung].hash = 14695981039346656037ull;
+        RungHashes[rung].keyFrom = RungKeyLen;
+        RungHashes[rung].leafFrom = RungLeafCount;
+        RungHashes[rung].cacheable = HashRung(ELEM_SERIES_SUBCKT,
+            Prog.rungs[rung], &RungHashes[rung].hash);
+        RungHashes[rung].keyLen = RungKeyLen - RungHashes[rung].keyFrom;
+        RungHashes[rung].leaves = RungLeafCount - RungHashes[rung].leafFrom;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// The hash of what a rung holds, and the bytes that were hashed, as the
+// GenerateIntermediateCode() under way found them; for CheckVariableNames(),
+// which keeps what it found in each rung by what the rung holds.
+//-----------------------------------------------------------------------------
+unsigned long long RungContents(int rung, BYTE **key, int *keyLen)
+{
+    *key = RungKey + RungHashes[rung].keyFrom;
+    *keyLen = RungHashes[rung].keyLen;
+    return RungHashes[rung].hash;
+}
+
+//-----------------------------------------------------------------------------
+// Number a name that GenSym*() made as it would be numbered now, when the
+// cached ops were made with the counters at from[] and they are at to[].
+//-----------------------------------------------------------------------------
+static char *RenumberGenSym(char *name, DWORD *from, DWORD *to)
+{
+    if(name[0] != '$')
+        return name;
+    int k;
+    for(k = 0; k < GENSYM_KINDS; k++) {
+        int len = strlen(GenSymPrefix[k]);
+        if(strncmp(name, GenSymPrefix[k], len) == 0) {
+            char buf[3*MAX_NAME_LEN + 32];
+            char *end;
+            DWORD n = strtoul(name + len, &end, 16);
+            sprintf(buf, "%s%04x%s", GenSymPrefix[k], n - from[k] + to[k], end);
+            return InternSymbol(buf);
+        }
+    }
+    return name;
+}
+
+static void FlushRungCache(void)
+{
+    int i;
+    for(i = 0; i < RungCacheCount; i++) {
+        CheckFree(RungCaches[i].key);
+        CheckFree(RungCaches[i].ops);
+        CheckFree(RungCaches[i].leafOf);
+    }
+    RungCacheCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Append the cached ops of a rung to IntCode[], as if they had just been
+// generated for the rung now being compiled. Return FALSE if they are not
+// cached.
+//-----------------------------------------------------------------------------
+static BOOL OpsFromRungCache(int rung)
+{
+    unsigned long long hash = RungHashes[rung].hash;
+    BYTE *key = RungKey + RungHashes[rung].keyFrom;
+    int keyLen = RungHashes[rung].keyLen;
+    ElemLeaf **leaves = RungLeaves + RungHashes[rung].leafFrom;
+    int i, j;
+    for(i = 0; i < RungCacheCount; i++) {
+        RungCache *c = &RungCaches[i];
+        if(c->hash != hash || c->leaves != RungHashes[rung].leaves
+        || c->keyLen != keyLen || memcmp(c->key, key, keyLen) != 0)
+            continue;
+
+        DWORD now[GENSYM_KINDS];
+        GenSymCounts(now);
+        BOOL renumber = memcmp(now, c->genSymFrom, sizeof(now)) != 0;
+        for(j = 0; j < c->n; j++) {
+            IntOp *a = NewOp();
+            *a = c->ops[j];
+            if(renumber) {
+                a->name1 = RenumberGenSym(a->name1, c->genSymFrom, now);
+                a->name2 = RenumberGenSym(a->name2, c->genSymFrom, now);
+                a->name3 = RenumberGenSym(a->name3, c->genSymFrom, now);
+            }
+            if(c->leafOf[j] >= 0)
+                a->poweredAfter = &(leaves[c->leafOf[j]]->poweredAfter);
+            a->rung = rung;
+            IntCodeLen++;
+        }
+        GenSymCountParThis += c->genSymUsed[0];
+        GenSymCountParOut += c->genSymUsed[1];
+        GenSymCountOneShot += c->genSymUsed[2];
+        GenSymCountFormattedString += c->genSymUsed[3];
+        GenSymCountStepper += c->genSymUsed[4];
+        c->used = TRUE;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// Keep the ops from start on, just generated for a rung, in the cache.
+//-----------------------------------------------------------------------------
+static void RungToCache(int rung, int start, DWORD *genSymFrom)
+{
+    ElemLeaf **leaves = RungLeaves + RungHashes[rung].leafFrom;
+    int leafCount = RungHashes[rung].leaves;
+    int n = IntCodeLen - start;
+    int *leafOf = (int *)CheckMalloc((n ? n : 1) * sizeof(int));
+    int i, j;
+    for(i = 0; i < n; i++) {
+        BOOL *b = IntCode[start + i].poweredAfter;
+        leafOf[i] = -1;
+        if(!b)
+            continue;
+        for(j = 0; j < leafCount; j++)
+            if(b == &(leaves[j]->poweredAfter))
+                break;
+        if(j >= leafCount) {
+            CheckFree(leafOf);
+            return;
+        }
+        leafOf[i] = j;
+    }
+
+    if(RungCacheCount >= RungCacheMax) {
+        int m = RungCacheMax ? 2*RungCacheMax : 64;
+        RungCache *caches = (RungCache *)CheckMalloc(m * sizeof(RungCache));
+        if(RungCaches) {
+            memcpy(caches, RungCaches, RungCacheCount * sizeof(RungCache));
+            CheckFree(RungCaches);
+        }
+        RungCaches = caches;
+        RungCacheMax = m;
+    }
+    RungCache *c = &RungCaches[RungCacheCount++];
+    c->hash = RungHashes[rung].hash;
+    c->keyLen = RungHashes[rung].keyLen;
+    c->key = (BYTE *)CheckMalloc(c->keyLen ? c->keyLen : 1);
+    memcpy(c->key, RungKey + RungHashes[rung].keyFrom, c->keyLen);
+    c->leaves = leafCount;
+    memcpy(c->genSymFrom, genSymFrom, sizeof(c->genSymFrom));
+    DWORD now[GENSYM_KINDS];
+    GenSymCounts(now);
+    for(i = 0; i < GENSYM_KINDS; i++)
+        c->genSymUsed[i] = now[i] - genSymFrom[i];
+    c->n = n;
+    c->ops = (IntOp *)CheckMalloc((n ? n : 1) * sizeof(IntOp));
+    memcpy(c->ops, &IntCode[start], n * sizeof(IntOp));
+    c->leafOf = leafOf;
+    c->used = TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Drop the rungs that the last compile did not use, which have been edited
+// or deleted.
+//-----------------------------------------------------------------------------
+static void TrimRungCache(void)
+{
+    int i, j = 0;
+    for(i = 0; i < RungCacheCount; i++) {
+        if(RungCaches[i].used) {
+            RungCaches[i].used = FALSE;
+            RungCaches[j++] = RungCaches[i];
+        } else {
+            CheckFree(RungCaches[i].key);
+            CheckFree(RungCaches[i].ops);
+            CheckFree(RungCaches[i].leafOf);
+        }
+    }
+    RungCacheCount = j;
+}
+
+//-----------------------------------------------------------------------------
+// Generate the ops of a rung, or take them from the cache if the rung is
+// as it was.
+//-----------------------------------------------------------------------------
+static void IntCodeFromRung(int rung)
+{
+    if(!RungHashes[rung].cacheable) {
+        IntCodeFromCircuit(ELEM_SERIES_SUBCKT, Prog.rungs[rung], "$rung_top", rung);
+        return;
+    }
+    if(OpsFromRungCache(rung))
+        return;
+
+    int start = IntCodeLen;
+    DWORD genSymFrom[GENSYM_KINDS];
+    GenSymCounts(genSymFrom);
+    IntCodeFromCircuit(ELEM_SERIES_SUBCKT, Prog.rungs[rung], "$rung_top", rung);
+    RungToCache(rung, start, genSymFrom);
 }
 
 //-----------------------------------------------------------------------------
@@ -2418,6 +4071,7 @@ BOOL GenerateIntermediateCode(void)
     // The EEPROM addresses for the `Make Persistent' op are assigned at
     // int code generation time.
     EepromAddrFree = 0;
+    PersistMapCount = 0;
 
     rungNow = -100;//INT_MAX;
     whichNow = INT_MAX;
@@ -2426,6 +4080,7 @@ BOOL GenerateIntermediateCode(void)
 
     AllocStart();
 
+    HashRungs();
     CheckVariableNames();
 
     InitVars();
@@ -2438,11 +4093,36 @@ BOOL GenerateIntermediateCode(void)
     if (ExistMasterRelay)
       Op(INT_SET_BIT, "$mcr");
 
+    if(Prog.timeStampTimers)
+      Op(INT_INCREMENT_VARIABLE, "$tick");
+
+    if(Prog.cycleTime != RungCacheCycleTime
+    || Prog.timeStampTimers != RungCacheTimeStamp
+    || ExistMasterRelay != RungCacheMasterRelay
+    || int_comment_level != RungCacheCommentLevel
+    || InSimulationMode != RungCacheSimulation) {
+        FlushRungCache();
+        RungCacheCycleTime = Prog.cycleTime;
+        RungCacheTimeStamp = Prog.timeStampTimers;
+        RungCacheMasterRelay = ExistMasterRelay;
+        RungCacheCommentLevel = int_comment_level;
+        RungCacheSimulation = InSimulationMode;
+    }
+
     rungNow++;
     char s1[MAX_COMMENT_LEN];
     char *s2;
     ElemLeaf *l;
     int rung;
+
+    // Where the rungs start, to generate them again from there when
+    // FindCountedTimers() finds other timers to count the classic way.
+    int opsFrom = IntCodeLen;
+    DWORD genSymFrom[GENSYM_KINDS];
+    GenSymCounts(genSymFrom);
+    DWORD eepromFrom = EepromAddrFree;
+    int persistFrom = PersistMapCount;
+generate:
     for(rung = 0; rung <= Prog.numRungs; rung++) {
         rungNow = rung;
         whichNow = INT_MAX;
@@ -2492,20 +4172,28 @@ BOOL GenerateIntermediateCode(void)
 
         SimState(&(Prog.rungPowered[rung]), "$rung_top");
 
-        IntCodeFromCircuit(ELEM_SERIES_SUBCKT, Prog.rungs[rung], "$rung_top", rung);
+        IntCodeFromRung(rung);
     }
+    if(FindCountedTimers()) {
+        FlushRungCache();
+        IntCodeLen = opsFrom;
+        if(IntCode) BlankOp(&IntCode[IntCodeLen]);
+        GenSymCountParThis = genSymFrom[0];
+        GenSymCountParOut = genSymFrom[1];
+        GenSymCountOneShot = genSymFrom[2];
+        GenSymCountFormattedString = genSymFrom[3];
+        GenSymCountStepper = genSymFrom[4];
+        EepromAddrFree = eepromFrom;
+        PersistMapCount = persistFrom;
+        goto generate;
+    }
+    TrimRungCache();
     rungNow++;
-    //Calculate amount of intermediate codes in rungs
-    int i;
-    for(i = 0; i < MAX_RUNGS; i++)
-        Prog.OpsInRung[i] = 0;
-    for(i = 0; i < IntCodeLen; i++) {
-        //dbp("IntPc=%d rung=%d ELEM_%x", i, IntCode[i].rung, IntCode[i].which);
-        if((IntCode[i].rung >= 0)
-        && (IntCode[i].rung < MAX_RUNGS)
-        && (IntCode[i].op != INT_SIMULATE_NODE_STATE))
-            Prog.OpsInRung[IntCode[i].rung]++;
+    if(OptimizeIntCode) {
+        CountOpsInRungs(OpsBeforeOptimizing);
+        OptimizeIntermediateCode();
     }
+    CountOpsInRungs(Prog.OpsInRung);
 
     //Listing of intermediate codes
     char CurrentPlFile[MAX_PATH] = "temp.pl";
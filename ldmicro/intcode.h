@@ -31,6 +31,8 @@
 #define INT_SET_BIT                              1
 #define INT_CLEAR_BIT                            2
 #define INT_COPY_BIT_TO_BIT                      3
+#define INT_AND_BIT_TERM                         3001 // clear bit name1 unless all the bits of term name2 match
+#define INT_OR_BIT_TERM                          3002 // set bit name1 if all the bits of term name2 match
 #define INT_SET_VARIABLE_TO_LITERAL              4
 #define INT_SET_VARIABLE_TO_VARIABLE             5
 #define INT_SET_BIN2BCD                          5001
@@ -76,8 +78,13 @@
 #ifdef NEW_FEATURE
 #define INT_PRINTF_STRING                       23 // printf() out to console
 #endif
+#define INT_SHIFT_REGISTER                      24 // name1 stages 1..literal-1 := stages 0..literal-2
+#define INT_RING_READ                           2401 // name1 := stage literal of ring name2, literal2 stages
+#define INT_RING_WRITE                          2402 // stage literal of ring name1 := name2, literal2 stages
 #define INT_VARIABLE_SET_BIT                    25
 #define INT_VARIABLE_CLEAR_BIT                  26
+#define INT_LOOK_UP_TABLE                       27 // name1 := data[name2], literal entries
+#define INT_PIECEWISE_LINEAR                    28 // name1 := pwl(name2), literal (x, y) in data
 
 #define INT_SET_VARIABLE_AND                    30
 #define INT_SET_VARIABLE_OR                     31
@@ -180,22 +187,28 @@
 #define INT_END_OF_PROGRAM                     255
 
 #if !defined(INTCODE_H_CONSTANTS_ONLY)
+    // The names are interned (see InternSymbol() in intcode.cpp), so they
+    // are never NULL, must not be written to, and two ops use the same name
+    // if and only if they have the same pointer.
     typedef struct IntOpTag {
         int         op;
-        char        name1[MAX_NAME_LEN];
-        char        name2[MAX_NAME_LEN];
-        char        name3[MAX_NAME_LEN];
+        char       *name1;
+        char       *name2;
+        char       *name3;
         SDWORD      literal;
         SDWORD      literal2;
+        SDWORD     *data;        //the table of an INT_LOOK_UP_TABLE or INT_PIECEWISE_LINEAR
         BOOL       *poweredAfter;
         int         rung;        //this IntOp located in rung,
         int         which;       //this IntOp refers to the ELEM_<which>
-        char        f[MAX_PATH]; //in .c source file name
+        char       *f;           //in .c source file name
         int         l;           //and line in file
     } IntOp;
 
+    // IntCode[] grows as needed; MAX_INT_OPS is only the limit on the
+    // programs that the interpretable targets take.
     #define MAX_INT_OPS     (1024*16)
-    extern IntOp IntCode[MAX_INT_OPS];
+    extern IntOp *IntCode;
     extern int IntCodeLen;
     extern int ProgWriteP;
 #endif
@@ -84,6 +84,17 @@ static void Write(FILE *f, BinOp *op)
 
 void CompileInterpreted(char *outFile)
 {
+    // ldinterpret.c has no piecewise linear, ring or bit term ops, and its
+    // format is fixed; a ring would need an op that indexes the variables.
+    ExpandPiecewiseLinear();
+    ExpandShiftRegisters();
+    ExpandBitTerms();
+
+    if(IntCodeLen >= MAX_INT_OPS) {
+        Error(_("Program too long for an interpretable target (%d ops, max %d)."),
+            IntCodeLen, MAX_INT_OPS - 1);
+        return;
+    }
     FILE *f = fopen(outFile, "w");
     if(!f) {
         Error(_("Couldn't write to '%s'"), outFile);
@@ -136,6 +147,31 @@ void CompileInterpreted(char *outFile)
                 op.name2 = AddrForVariable(IntCode[ipc].name2);
                 break;
 
+            case INT_LOOK_UP_TABLE: {
+                // The count goes in name3, and the values follow the op, one
+                // per BinOp, in the literal of an INT_COMMENT.
+                int j, n = IntCode[ipc].literal;
+                if(outPc + 1 + n + (IntCodeLen - ipc - 1) >= MAX_INT_OPS) {
+                    Error(_("Program too long for an interpretable target (%d ops, max %d)."),
+                        outPc + 1 + n + (IntCodeLen - ipc - 1), MAX_INT_OPS - 1);
+                    fclose(f);
+                    return;
+                }
+                op.name1 = AddrForVariable(IntCode[ipc].name1);
+                op.name2 = AddrForVariable(IntCode[ipc].name2);
+                op.name3 = n;
+                memcpy(&OutProg[outPc], &op, sizeof(op));
+                outPc++;
+                for(j = 0; j < n; j++) {
+                    memset(&op, 0, sizeof(op));
+                    op.op = INT_COMMENT;
+                    op.literal = IntCode[ipc].data[j];
+                    memcpy(&OutProg[outPc], &op, sizeof(op));
+                    outPc++;
+                }
+                continue;
+            }
+
             case INT_DECREMENT_VARIABLE:
             case INT_INCREMENT_VARIABLE:
                 op.name1 = AddrForVariable(IntCode[ipc].name1);
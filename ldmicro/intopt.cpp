@@ -0,0 +1,561 @@
+//-----------------------------------------------------------------------------
+// This file is part of LDmicro.
+//
+// LDmicro is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LDmicro is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LDmicro.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Optional clean-up passes over the intermediate code, run at the end of
+// GenerateIntermediateCode() so that the simulator and all of the code
+// generators see the result. The code straight from the circuit sets bits
+// only to test them on the next op, writes `$parThis' bits that are written
+// again before anything reads them, and so on; these passes take that out:
+//
+//  - a bit with a known value (just set or cleared, or inside an if on it)
+//    is propagated, so that copies of it become sets and clears, and ifs on
+//    it, or on two constants, are decided at compile time;
+//  - a write to a `$' bit that is written again before anything reads it is
+//    dropped;
+//  - ifs with nothing in them go, and so do elses with nothing in them;
+//  - an if right after an if on the same condition, with nothing in the
+//    first that could change that condition, is merged into it.
+//
+// Only the bits and variables that are just memory are reasoned about: not
+// the inputs and outputs, whose pins can change under us, and not the SFRs.
+// A node state for the simulator counts as a read of its bit, so every node
+// still shows the same. A program that uses ops which open a block other
+// than the ifs (the SFR tests, the goto's) is left as it is.
+//-----------------------------------------------------------------------------
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ldmicro.h"
+#include "intcode.h"
+
+BOOL OptimizeIntCode;
+
+#define MAX_OPT_FACTS       32  // bits with a known value, at once
+#define MAX_OPT_DEPTH       64  // ifs nested deeper than this, we give up
+#define MAX_OPT_LOOKAHEAD   64  // ops to look at for a dead store
+#define MAX_OPT_ROUNDS      8   // times to run all of the passes
+
+typedef struct OptFactsTag {
+    char   *name[MAX_OPT_FACTS];
+    BOOL    val[MAX_OPT_FACTS];
+    int     n;
+} OptFacts;
+
+// Per op, whether it goes when the pass is done, and for each if and else
+// the index of its else or end if.
+static BYTE *Dead;
+static int *Match;
+static int OptSize;
+
+//-----------------------------------------------------------------------------
+// Is this name just memory, so that nothing but the ops that name it can
+// change it? The bits that we track must also be bits, `$' or relays.
+//-----------------------------------------------------------------------------
+static BOOL IsMemoryName(char *name)
+{
+    switch(name[0]) {
+        case '\0':
+        case 'X':
+        case 'Y':
+        case '#':
+            return FALSE;
+    }
+    return !IsNumber(name);
+}
+
+static BOOL IsTrackedBit(char *name)
+{
+    return (name[0] == '$') || (name[0] == 'R');
+}
+
+static BOOL IsSmallNumber(char *name, SDWORD *v)
+{
+    if(!IsNumber(name)) return FALSE;
+    *v = CheckMakeNumber(name);
+    // Fold only what has the same value in a variable of any width.
+    return (*v >= -128) && (*v <= 127);
+}
+
+//-----------------------------------------------------------------------------
+// The bits that we know the value of, at some point in the program.
+//-----------------------------------------------------------------------------
+static int FindFact(OptFacts *f, char *name)
+{
+    int i;
+    for(i = 0; i < f->n; i++)
+        if(f->name[i] == name) return i;
+    return -1;
+}
+
+static void KillFact(OptFacts *f, char *name)
+{
+    int i = FindFact(f, name);
+    if(i < 0) return;
+    f->n--;
+    memmove(&f->name[i], &f->name[i+1], (f->n - i)*sizeof(f->name[0]));
+    memmove(&f->val[i], &f->val[i+1], (f->n - i)*sizeof(f->val[0]));
+}
+
+static void SetFact(OptFacts *f, char *name, BOOL val)
+{
+    if(!IsTrackedBit(name)) return;
+    KillFact(f, name);
+    if(f->n >= MAX_OPT_FACTS) {
+        // forget the oldest
+        KillFact(f, f->name[0]);
+    }
+    f->name[f->n] = name;
+    f->val[f->n] = val;
+    f->n++;
+}
+
+// Keep only the facts that hold on the other path too.
+static void MeetFacts(OptFacts *f, OptFacts *g)
+{
+    int i;
+    for(i = f->n - 1; i >= 0; i--) {
+        int j = FindFact(g, f->name[i]);
+        if(j < 0 || g->val[j] != f->val[i])
+            KillFact(f, f->name[i]);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Find the else or end if of each if, and the end if of each else. Return
+// FALSE if the program is not one that we can work on.
+//-----------------------------------------------------------------------------
+static BOOL MatchBlocks(void)
+{
+    int stack[MAX_OPT_DEPTH];
+    int depth = 0;
+    int i;
+
+    for(i = 0; i < IntCodeLen; i++) {
+        int op = IntCode[i].op;
+        Match[i] = -1;
+        if(op >= INT_READ_SFR_LITERAL && op <= INT_TEST_C_SFR_VARIABLE_L)
+            return FALSE;
+#ifdef NEW_FEATURE
+        if(op >= INT_AllocKnownAddr && op <= INT_GotoRung)
+            return FALSE;
+#endif
+        if(INT_IF_GROUP(op)) {
+            if(depth >= MAX_OPT_DEPTH) return FALSE;
+            stack[depth++] = i;
+        } else if(op == INT_ELSE) {
+            if(depth == 0 || IntCode[stack[depth-1]].op == INT_ELSE)
+                return FALSE;
+            Match[stack[depth-1]] = i;
+            stack[depth-1] = i;
+        } else if(op == INT_END_IF) {
+            if(depth == 0) return FALSE;
+            Match[stack[--depth]] = i;
+        }
+    }
+    return depth == 0;
+}
+
+//-----------------------------------------------------------------------------
+// Take out the ops marked dead, and blank the op after the end like NewOp()
+// does. Return TRUE if there were any.
+//-----------------------------------------------------------------------------
+static BOOL Compact(void)
+{
+    int i, n = 0;
+    for(i = 0; i < IntCodeLen; i++) {
+        if(!Dead[i]) IntCode[n++] = IntCode[i];
+    }
+    if(n == IntCodeLen) return FALSE;
+
+    IntCode[n] = IntCode[IntCodeLen];
+    IntCodeLen = n;
+    memset(Dead, 0, IntCodeLen);
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Ops that write variables but never a bit, so they leave what we know about
+// the bits as it was. Anything not listed here, we assume might write any
+// bit.
+//-----------------------------------------------------------------------------
+static BOOL WritesNoBits(int op)
+{
+    switch(op) {
+        case INT_SET_VARIABLE_TO_LITERAL:
+        case INT_SET_VARIABLE_TO_VARIABLE:
+        case INT_LOOK_UP_TABLE:
+        case INT_PIECEWISE_LINEAR:
+        case INT_INCREMENT_VARIABLE:
+        case INT_DECREMENT_VARIABLE:
+        case INT_SET_VARIABLE_ADD:
+        case INT_SET_VARIABLE_SUBTRACT:
+        case INT_SET_VARIABLE_MULTIPLY:
+        case INT_SET_VARIABLE_DIVIDE:
+        case INT_SIMULATE_NODE_STATE:
+        case INT_COMMENT:
+            return TRUE;
+    }
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// Is the condition of this if known, from the facts or because it compares
+// constants? If so say what it is.
+//-----------------------------------------------------------------------------
+static BOOL KnownCondition(IntOp *a, OptFacts *f, BOOL *val)
+{
+    SDWORD x, y;
+    int i;
+
+    switch(a->op) {
+        case INT_IF_BIT_SET:
+        case INT_IF_BIT_CLEAR:
+            if((i = FindFact(f, a->name1)) < 0) return FALSE;
+            *val = (a->op == INT_IF_BIT_SET) ? f->val[i] : !f->val[i];
+            return TRUE;
+
+        case INT_IF_VARIABLE_LES_LITERAL:
+            if(!IsSmallNumber(a->name1, &x)) return FALSE;
+            if(a->literal < -128 || a->literal > 127) return FALSE;
+            *val = (x < a->literal);
+            return TRUE;
+
+        case INT_IF_VARIABLE_EQUALS_VARIABLE:
+        case INT_IF_VARIABLE_GRT_VARIABLE:
+            if(IsSmallNumber(a->name1, &x) && IsSmallNumber(a->name2, &y)) {
+                // two constants
+            } else if(a->name1 == a->name2 && IsMemoryName(a->name1)) {
+                x = y = 0;
+            } else {
+                return FALSE;
+            }
+            *val = (a->op == INT_IF_VARIABLE_EQUALS_VARIABLE) ? (x == y) :
+                (x > y);
+            return TRUE;
+    }
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// Propagate the bits with a known value forwards through the program, in the
+// order it runs: copies of a known bit become sets or clears, and ifs whose
+// condition is known lose the branch that never runs.
+//-----------------------------------------------------------------------------
+#define FRAME_IF        0
+#define FRAME_ELSE      1
+#define FRAME_FOLDED    2
+
+typedef struct OptFrameTag {
+    int         kind;
+    OptFacts    elseIn;     // what we know going into the else, or past
+                            // the if when the condition is false
+    OptFacts    thenOut;    // what we knew at the end of the then-part
+} OptFrame;
+
+static BOOL PropagateBits(void)
+{
+    static OptFrame frames[MAX_OPT_DEPTH];
+    OptFacts f;
+    BOOL changed = FALSE;
+    BOOL val;
+    int depth = 0;
+    int i, k;
+
+    f.n = 0;
+    for(i = 0; i < IntCodeLen; i++) {
+        IntOp *a = &IntCode[i];
+        OptFrame *fr;
+
+        if(INT_IF_GROUP(a->op)) {
+            if(KnownCondition(a, &f, &val)) {
+                changed = TRUE;
+                Dead[i] = TRUE;
+                if(val) {
+                    // the then-part always runs; the else, if any, never
+                    frames[depth++].kind = FRAME_FOLDED;
+                } else {
+                    // the then-part never runs
+                    for(k = i; k <= Match[i]; k++) Dead[k] = TRUE;
+                    if(IntCode[Match[i]].op == INT_ELSE)
+                        frames[depth++].kind = FRAME_FOLDED;
+                    i = Match[i];
+                }
+                continue;
+            }
+            fr = &frames[depth++];
+            fr->kind = FRAME_IF;
+            fr->elseIn = f;
+            if(a->op == INT_IF_BIT_SET || a->op == INT_IF_BIT_CLEAR) {
+                SetFact(&f, a->name1, a->op == INT_IF_BIT_SET);
+                SetFact(&fr->elseIn, a->name1, a->op == INT_IF_BIT_CLEAR);
+            }
+            continue;
+        }
+
+        switch(a->op) {
+            case INT_ELSE:
+                fr = &frames[depth-1];
+                if(fr->kind == FRAME_FOLDED) {
+                    // the else-part of an if that was always true
+                    for(k = i; k <= Match[i]; k++) Dead[k] = TRUE;
+                    depth--;
+                    i = Match[i];
+                    break;
+                }
+                fr->kind = FRAME_ELSE;
+                fr->thenOut = f;
+                f = fr->elseIn;
+                break;
+
+            case INT_END_IF:
+                fr = &frames[--depth];
+                if(fr->kind == FRAME_FOLDED) {
+                    Dead[i] = TRUE;
+                } else if(fr->kind == FRAME_ELSE) {
+                    MeetFacts(&f, &fr->thenOut);
+                } else {
+                    MeetFacts(&f, &fr->elseIn);
+                }
+                break;
+
+            case INT_SET_BIT:
+            case INT_CLEAR_BIT:
+                SetFact(&f, a->name1, a->op == INT_SET_BIT);
+                break;
+
+            case INT_AND_BIT_TERM:
+            case INT_OR_BIT_TERM:
+                KillFact(&f, a->name1);
+                break;
+
+            case INT_COPY_BIT_TO_BIT:
+                if((k = FindFact(&f, a->name2)) >= 0) {
+                    val = f.val[k];
+                    a->op = val ? INT_SET_BIT : INT_CLEAR_BIT;
+                    a->name2 = InternSymbol("");
+                    changed = TRUE;
+                    SetFact(&f, a->name1, val);
+                } else {
+                    KillFact(&f, a->name1);
+                }
+                break;
+
+            default:
+                if(!WritesNoBits(a->op)) f.n = 0;
+                break;
+        }
+    }
+    return changed;
+}
+
+//-----------------------------------------------------------------------------
+// Drop the writes to `$' bits that are written again, in the same run of
+// straight-line code, before anything reads them.
+//-----------------------------------------------------------------------------
+static BOOL IsBitWrite(IntOp *a)
+{
+    return (a->op == INT_SET_BIT) || (a->op == INT_CLEAR_BIT) ||
+        (a->op == INT_COPY_BIT_TO_BIT);
+}
+
+// The bit terms read and write their name1, and read the bits of their term,
+// which are never `$' bits.
+static BOOL IsBitTerm(IntOp *a)
+{
+    return (a->op == INT_AND_BIT_TERM) || (a->op == INT_OR_BIT_TERM);
+}
+
+static BOOL DropDeadStores(void)
+{
+    BOOL changed = FALSE;
+    int i, j;
+
+    for(i = 0; i < IntCodeLen; i++) {
+        IntOp *a = &IntCode[i];
+        if(Dead[i] || !IsBitWrite(a) || a->name1[0] != '$') continue;
+
+        for(j = i + 1; j < IntCodeLen && j <= i + MAX_OPT_LOOKAHEAD; j++) {
+            IntOp *b = &IntCode[j];
+            if(Dead[j] || b->op == INT_COMMENT) continue;
+            if(IsBitWrite(b) && b->name1 == a->name1 && b->name2 != a->name1) {
+                Dead[i] = TRUE;
+                changed = TRUE;
+                break;
+            }
+            if(b->name1 == a->name1 || b->name2 == a->name1 ||
+                b->name3 == a->name1)
+            {
+                break;
+            }
+            if(!IsBitWrite(b) && !IsBitTerm(b) && !WritesNoBits(b->op)) break;
+        }
+    }
+    return changed;
+}
+
+//-----------------------------------------------------------------------------
+// Take out the ifs with nothing in them, and the elses with nothing in them.
+// An if on a bit with an empty then-part becomes the opposite if on that
+// bit. The ifs are done from the last one back, so that the outer ones see
+// the inner ones gone.
+//-----------------------------------------------------------------------------
+static BOOL IsEmpty(int from, int to)
+{
+    int i;
+    for(i = from; i < to; i++) {
+        if(!Dead[i] && IntCode[i].op != INT_COMMENT) return FALSE;
+    }
+    return TRUE;
+}
+
+static BOOL DropEmptyBlocks(void)
+{
+    BOOL changed = FALSE;
+    int i, k;
+
+    for(i = IntCodeLen - 1; i >= 0; i--) {
+        IntOp *a = &IntCode[i];
+        if(Dead[i] || !INT_IF_GROUP(a->op)) continue;
+
+        int e = Match[i];
+        int end = (IntCode[e].op == INT_ELSE) ? Match[e] : e;
+
+        if(IsEmpty(i + 1, end)) {
+            for(k = i; k <= end; k++) Dead[k] = TRUE;
+            changed = TRUE;
+        } else if(e != end && IsEmpty(e + 1, end)) {
+            Dead[e] = TRUE;
+            changed = TRUE;
+        } else if(e != end && IsEmpty(i + 1, e) &&
+            (a->op == INT_IF_BIT_SET || a->op == INT_IF_BIT_CLEAR))
+        {
+            a->op = (a->op == INT_IF_BIT_SET) ? INT_IF_BIT_CLEAR :
+                INT_IF_BIT_SET;
+            Dead[e] = TRUE;
+            changed = TRUE;
+        }
+    }
+    return changed;
+}
+
+//-----------------------------------------------------------------------------
+// Merge an if into the if just before it when the conditions are the same
+// and nothing in the first one writes what the condition looks at. All of
+// the ops that we let through write only their name1, if anything.
+//-----------------------------------------------------------------------------
+static BOOL SameCondition(IntOp *a, IntOp *b)
+{
+    return (a->op == b->op) && (a->name1 == b->name1) &&
+        (a->name2 == b->name2) && (a->name3 == b->name3) &&
+        (a->literal == b->literal) && (a->literal2 == b->literal2);
+}
+
+static BOOL ConditionIsMemory(IntOp *a)
+{
+    if(a->name1[0] && !IsNumber(a->name1) && !IsMemoryName(a->name1))
+        return FALSE;
+    if(a->name2[0] && !IsNumber(a->name2) && !IsMemoryName(a->name2))
+        return FALSE;
+    return TRUE;
+}
+
+static BOOL MayWrite(IntOp *b, char *name)
+{
+    switch(b->op) {
+        case INT_ELSE:
+        case INT_END_IF:
+        case INT_SIMULATE_NODE_STATE:
+        case INT_COMMENT:
+            return FALSE;
+    }
+    if(INT_IF_GROUP(b->op)) return FALSE;
+    if(IsBitWrite(b) || IsBitTerm(b) || WritesNoBits(b->op))
+        return name[0] && (b->name1 == name);
+    return TRUE;
+}
+
+static BOOL MergeIfs(void)
+{
+    BOOL changed = FALSE;
+    int i, j, k;
+
+    for(i = 0; i < IntCodeLen; i++) {
+        IntOp *a = &IntCode[i];
+        if(Dead[i] || !INT_IF_GROUP(a->op) || !ConditionIsMemory(a))
+            continue;
+
+        while(IntCode[Match[i]].op == INT_END_IF) {
+            int e = Match[i];
+            for(j = e + 1; j < IntCodeLen; j++) {
+                if(!Dead[j] && IntCode[j].op != INT_COMMENT) break;
+            }
+            if(j >= IntCodeLen || !SameCondition(a, &IntCode[j])) break;
+
+            for(k = i + 1; k < e; k++) {
+                if(Dead[k]) continue;
+                if(MayWrite(&IntCode[k], a->name1) ||
+                    MayWrite(&IntCode[k], a->name2)) break;
+            }
+            if(k < e) break;
+
+            Dead[e] = TRUE;
+            Dead[j] = TRUE;
+            Match[i] = Match[j];
+            changed = TRUE;
+        }
+    }
+    return changed;
+}
+
+//-----------------------------------------------------------------------------
+// Run all of the passes over IntCode[] until none of them finds anything
+// more to do.
+//-----------------------------------------------------------------------------
+void OptimizeIntermediateCode(void)
+{
+    if(IntCodeLen + 1 > OptSize) {
+        if(Dead) CheckFree(Dead);
+        if(Match) CheckFree(Match);
+        OptSize = 2*IntCodeLen + 1;
+        Dead = (BYTE *)CheckMalloc(OptSize);
+        Match = (int *)CheckMalloc(OptSize * sizeof(int));
+    }
+    memset(Dead, 0, IntCodeLen);
+
+    int round;
+    for(round = 0; round < MAX_OPT_ROUNDS; round++) {
+        BOOL changed = FALSE;
+
+        if(!MatchBlocks()) return;
+        if(PropagateBits()) changed = TRUE;
+        if(Compact()) MatchBlocks();
+
+        if(DropDeadStores()) changed = TRUE;
+        Compact();
+
+        if(!MatchBlocks()) return;
+        if(DropEmptyBlocks()) changed = TRUE;
+        if(Compact()) MatchBlocks();
+
+        if(MergeIfs()) changed = TRUE;
+        Compact();
+
+        if(!changed) break;
+    }
+}
@@ -44,15 +44,11 @@ static struct {
 } IoSeenPreviously[MAX_IO_SEEN_PREVIOUSLY];
 static int IoSeenPreviouslyCount;
 
-// stuff for the dialog box that lets you choose pin assignments
-static BOOL DialogDone;
-static BOOL DialogCancel;
-
+// stuff for the dialog box that lets you choose pin assignments; the
+// buttons and DialogDone/DialogCancel are the ones common to all the dialogs
 static HWND IoDialog;
 
 static HWND PinList;
-static HWND OkButton;
-static HWND CancelButton;
 static HWND ModbusSlave;
 static HWND ModbusRegister;
 
@@ -1054,7 +1050,8 @@ void ShowIoDialog(int item)
             goto cant_use_this_io;
         }
 #endif
-        int type = Prog.io.assignment[item].type;
+        int type;
+        type = Prog.io.assignment[item].type;
         if((type == IO_TYPE_INT_INPUT) && (!IsInterruptPin(Prog.mcu->pinInfo[i].pin)))
             goto cant_use_this_io;
 
@@ -205,6 +205,16 @@ void Disassemble(void)
                 printf("int16s[%03x] := int16s[%03x]", p->name1, p->name2);
                 break;
 
+            case INT_LOOK_UP_TABLE: {
+                int i;
+                printf("int16s[%03x] := {", p->name1);
+                for(i = 0; i < p->name3; i++)
+                    printf("%s%d", i ? ", " : "", Program[pc+1+i].literal);
+                printf("}[int16s[%03x]]", p->name2);
+                pc += p->name3;
+                break;
+            }
+
             case INT_INCREMENT_VARIABLE:
                 printf("(int16s[%03x])++", p->name1);
                 break;
@@ -294,6 +304,13 @@ void InterpretOneCycle(void)
                 Integers[p->name1] = Integers[p->name2];
                 break;
 
+            case INT_LOOK_UP_TABLE:
+                // the values are in the ops that follow
+                if(Integers[p->name2] >= 0 && Integers[p->name2] < p->name3)
+                    Integers[p->name1] = Program[pc+1+Integers[p->name2]].literal;
+                pc += p->name3;
+                break;
+
             case INT_INCREMENT_VARIABLE:
                 (Integers[p->name1])++;
                 break;
@@ -71,6 +71,12 @@ ULONGLONG LastWriteTime = 0;
 char CurrentCompileFile[MAX_PATH];
 
 #define TXT_PATTERN  "Text Files (*.txt)\0*.txt\0All files\0*\0\0"
+#define VCD_PATTERN  "Waveform Files (*.vcd)\0*.vcd\0All files\0*\0\0"
+#define SNAP_PATTERN "Simulation Snapshots (*.snap)\0*.snap\0All files\0*\0\0"
+#define PROFILE_PATTERN \
+    "Profile Reports (*.txt)\0*.txt\0JSON Files (*.json)\0*.json\0\0"
+#define WEAR_PATTERN "EEPROM Wear Reports (*.wear)\0*.wear\0All files\0*\0\0"
+#define CSV_PATTERN  "CSV Files (*.csv)\0*.csv\0All files\0*\0\0"
 
 // Everything relating to the PLC's program, I/O configuration, processor
 // choice, and so on--basically everything that would be saved in the
@@ -107,101 +113,186 @@ static BOOL SaveAsDialog(void)
     }
 }
 
-//---------------------------------------------------------------------------
-char *ExtractFileDir(char *dest) // without last backslash
+//-----------------------------------------------------------------------------
+// Get a filename with a common dialog box and then export the program as
+// an ASCII art drawing.
+//-----------------------------------------------------------------------------
+static void ExportDialog(void)
 {
-    char *c;
-    if(strlen(dest)) {
-        c = strrchr(dest,'\\');
-        if(c)
-            *c = '\0';
-    };
-    return dest;
-}
+    char exportFile[MAX_PATH];
+    OPENFILENAME ofn;
 
-char *ExtractFilePath(char *dest) // with last backslash
-{
-    char *c;
-    if(strlen(dest)) {
-        c = strrchr(dest,'\\');
-        if(c)
-            c[1] = '\0';
-    };
-    return dest;
+    exportFile[0] = '\0';
+    SetExt(exportFile, CurrentSaveFile, "txt");
+
+    memset(&ofn, 0, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hInstance = Instance;
+    ofn.lpstrFilter = TXT_PATTERN;
+    ofn.lpstrFile = exportFile;
+    ofn.lpstrTitle = _("Export As Text");
+    ofn.nMaxFile = sizeof(exportFile);
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT;
+
+    if(!GetSaveFileName(&ofn))
+        return;
+
+    ExportDrawingAsText(exportFile);
 }
 
-//---------------------------------------------------------------------------
-char *ExtractFileName(char *src) // with .ext
+//-----------------------------------------------------------------------------
+// Get a filename with a common dialog box and then save what the simulator
+// has recorded as a VCD waveform.
+//-----------------------------------------------------------------------------
+static void SaveWaveformDialog(void)
 {
-    char *c;
-    if(strlen(src)) {
-        c = strrchr(src,'\\');
-        if(c)
-            return &c[1];
+    char waveFile[MAX_PATH];
+    OPENFILENAME ofn;
+
+    waveFile[0] = '\0';
+    SetExt(waveFile, CurrentSaveFile, "vcd");
+
+    memset(&ofn, 0, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hInstance = Instance;
+    ofn.lpstrFilter = VCD_PATTERN;
+    ofn.lpstrFile = waveFile;
+    ofn.lpstrTitle = _("Save Waveform");
+    ofn.nMaxFile = sizeof(waveFile);
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT;
+
+    if(!GetSaveFileName(&ofn))
+        return;
+
+    if(!SaveWaveformAsVcd(waveFile)) {
+        Error(_("Couldn't write to '%s'."), waveFile);
     }
-    return src;
 }
 
-//---------------------------------------------------------------------------
-char *GetFileName(char *dest, char *src) // without .ext
+//-----------------------------------------------------------------------------
+// Get a filename with a common dialog box and then save what the profiler
+// has counted, as a report or as JSON depending on the type chosen.
+//-----------------------------------------------------------------------------
+static void SaveProfileDialog(void)
 {
-    dest[0] = '\0';
-    char *c;
-    strcpy(dest, ExtractFileName(src));
-    if(strlen(dest)) {
-        c = strrchr(dest,'.');
-        if(c)
-            c[0] = '\0';
+    char profileFile[MAX_PATH];
+    OPENFILENAME ofn;
+
+    profileFile[0] = '\0';
+    SetExt(profileFile, CurrentSaveFile, "txt");
+
+    memset(&ofn, 0, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hInstance = Instance;
+    ofn.lpstrFilter = PROFILE_PATTERN;
+    ofn.lpstrFile = profileFile;
+    ofn.lpstrTitle = _("Save Profile");
+    ofn.nMaxFile = sizeof(profileFile);
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT;
+
+    if(!GetSaveFileName(&ofn))
+        return;
+
+    if(!SaveProfile(profileFile, ofn.nFilterIndex == 2)) {
+        Error(_("Couldn't write to '%s'."), profileFile);
     }
-    return dest;
 }
 
 //-----------------------------------------------------------------------------
-char *SetExt(char *dest, const char *src, const char *ext)
+// Get a filename with a common dialog box and then save how many times the
+// simulated EEPROM has been written, for each persistent variable.
+//-----------------------------------------------------------------------------
+static void SaveEepromWearDialog(void)
 {
-    char *c;
-    if(strlen(src))
-        strcpy(dest, src);
-    if(strlen(dest)) {
-        c = strrchr(dest,'.');
-        if(c)
-            c[0] = '\0';
-    };
-    if(!strlen(dest))
-        strcat(dest, "new");
-
-    if(strlen(ext))
-        if(!strchr(ext,'.'))
-            strcat(dest, ".");
-
-    return strcat(dest, ext);
+    char wearFile[MAX_PATH];
+    OPENFILENAME ofn;
+
+    wearFile[0] = '\0';
+    SetExt(wearFile, CurrentSaveFile, "wear");
+
+    memset(&ofn, 0, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hInstance = Instance;
+    ofn.lpstrFilter = WEAR_PATTERN;
+    ofn.lpstrFile = wearFile;
+    ofn.lpstrTitle = _("Save EEPROM Wear");
+    ofn.nMaxFile = sizeof(wearFile);
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT;
+
+    if(!GetSaveFileName(&ofn))
+        return;
+
+    if(!SaveEepromWear(wearFile)) {
+        Error(_("Couldn't write to '%s'."), wearFile);
+    }
 }
 
 //-----------------------------------------------------------------------------
-// Get a filename with a common dialog box and then export the program as
-// an ASCII art drawing.
+// Get a CSV file of recorded samples with a common dialog box, and replay it
+// into the READ ADCs from the current cycle on.
 //-----------------------------------------------------------------------------
-static void ExportDialog(void)
+static void ReplayAdcDialog(void)
 {
-    char exportFile[MAX_PATH];
+    char csvFile[MAX_PATH];
     OPENFILENAME ofn;
 
-    exportFile[0] = '\0';
-    SetExt(exportFile, CurrentSaveFile, "txt");
+    csvFile[0] = '\0';
 
     memset(&ofn, 0, sizeof(ofn));
     ofn.lStructSize = sizeof(ofn);
     ofn.hInstance = Instance;
-    ofn.lpstrFilter = TXT_PATTERN;
-    ofn.lpstrFile = exportFile;
-    ofn.lpstrTitle = _("Export As Text");
-    ofn.nMaxFile = sizeof(exportFile);
-    ofn.Flags = OFN_PATHMUSTEXIST | OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT;
+    ofn.lpstrFilter = CSV_PATTERN;
+    ofn.lpstrDefExt = "csv";
+    ofn.lpstrFile = csvFile;
+    ofn.lpstrTitle = _("Replay ADC Samples");
+    ofn.nMaxFile = sizeof(csvFile);
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST | OFN_HIDEREADONLY;
 
-    if(!GetSaveFileName(&ofn))
+    if(!GetOpenFileName(&ofn))
         return;
 
-    ExportDrawingAsText(exportFile);
+    ReplayAdcSamples(csvFile);
+}
+
+//-----------------------------------------------------------------------------
+// Save the state of the simulation to a snapshot file, or go back to one,
+// with a common dialog box to get the filename.
+//-----------------------------------------------------------------------------
+static void SnapshotDialog(BOOL save)
+{
+    char snapFile[MAX_PATH];
+    OPENFILENAME ofn;
+
+    snapFile[0] = '\0';
+    SetExt(snapFile, CurrentSaveFile, "snap");
+
+    memset(&ofn, 0, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hInstance = Instance;
+    ofn.lpstrFilter = SNAP_PATTERN;
+    ofn.lpstrDefExt = "snap";
+    ofn.lpstrFile = snapFile;
+    ofn.nMaxFile = sizeof(snapFile);
+
+    if(save) {
+        ofn.lpstrTitle = _("Save Snapshot");
+        ofn.Flags = OFN_PATHMUSTEXIST | OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT;
+        if(!GetSaveFileName(&ofn))
+            return;
+        if(!SaveSimSnapshot(snapFile)) {
+            Error(_("Couldn't write to '%s'."), snapFile);
+        }
+    } else {
+        ofn.lpstrTitle = _("Load Snapshot");
+        ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST | OFN_HIDEREADONLY;
+        if(!GetOpenFileName(&ofn))
+            return;
+        if(LoadSimSnapshot(snapFile)) {
+            InvalidateRect(MainWindow, NULL, FALSE);
+            ListView_RedrawItems(IoList, 0, Prog.io.count - 1);
+            RefreshStatusBar();
+        }
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -1070,6 +1161,53 @@ cmp:
             SimulateOneCycle(TRUE);
             break;
 
+        case MNU_THREADED_SIMULATION:
+            ToggleThreadedSimulation();
+            break;
+
+        case MNU_RECORD_WAVEFORM:
+            ToggleWaveformRecording();
+            break;
+
+        case MNU_SAVE_WAVEFORM:
+            SaveWaveformDialog();
+            break;
+
+        case MNU_PROFILE_SIMULATION:
+            ToggleProfiling();
+            break;
+
+        case MNU_OPTIMIZE_INTCODE:
+            ToggleIntCodeOptimizer();
+            break;
+
+        case MNU_SAVE_PROFILE:
+            SaveProfileDialog();
+            break;
+
+        case MNU_SAVE_EEPROM_WEAR:
+            SaveEepromWearDialog();
+            break;
+
+        case MNU_REPLAY_ADC:
+            ReplayAdcDialog();
+            break;
+
+        case MNU_ADD_BREAKPOINT: {
+            static char spec[MAX_NAME_LEN] = "";
+            if(ShowBreakpointDialog(spec)) AddSimBreakpoint(spec);
+            break;
+        }
+        case MNU_CLEAR_BREAKPOINTS:
+            ClearSimBreakpoints();
+            UpdateMainWindowTitleBar();
+            break;
+
+        case MNU_SAVE_SNAPSHOT:
+        case MNU_LOAD_SNAPSHOT:
+            SnapshotDialog(code == MNU_SAVE_SNAPSHOT);
+            break;
+
         case MNU_COMPILE_ANSIC:
         case MNU_COMPILE_IHEX:
         case MNU_COMPILE_ARDUINO:
@@ -2367,6 +2505,11 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
         doexit(EXIT_SUCCESS);
     }
 
+    if(memcmp(lpCmdLine, "/s", 2)==0 || memcmp(lpCmdLine, "/x", 2)==0) {
+        RunningInBatchMode = TRUE;
+        SimulateFromCommandLine(lpCmdLine);
+    }
+
     // We are running interactively, or we would already have exited. We
     // can therefore show the window now, and otherwise set up the GUI.
 
@@ -203,6 +203,17 @@ typedef signed long SDWORD;
 #define MNU_START_SIMULATION    0x61
 #define MNU_STOP_SIMULATION     0x62
 #define MNU_SINGLE_CYCLE        0x63
+#define MNU_THREADED_SIMULATION 0x64
+#define MNU_RECORD_WAVEFORM     0x65
+#define MNU_SAVE_WAVEFORM       0x66
+#define MNU_SAVE_SNAPSHOT       0x67
+#define MNU_LOAD_SNAPSHOT       0x68
+#define MNU_PROFILE_SIMULATION  0x69
+#define MNU_SAVE_PROFILE        0x6a
+#define MNU_SAVE_EEPROM_WEAR    0x6b
+#define MNU_REPLAY_ADC          0x6c
+#define MNU_ADD_BREAKPOINT      0x6d
+#define MNU_CLEAR_BREAKPOINTS   0x6e
 
 #define MNU_INSERT_BUS          0x6501
 #define MNU_INSERT_7SEG         0x6507
@@ -219,6 +230,7 @@ typedef signed long SDWORD;
 #define MNU_COMPILE_PASCAL      0x75
 #define MNU_COMPILE_ARDUINO     0x76
 #define MNU_COMPILE_CAVR        0x77
+#define MNU_OPTIMIZE_INTCODE    0x78
 #define MNU_FLASH_BAT           0x7E
 #define MNU_READ_BAT            0x7F
 
@@ -447,6 +459,7 @@ typedef signed long SDWORD;
 #define MAX_COMMENT_LEN             384
 #define MAX_LOOK_UP_TABLE_LEN        64
 #define MAX_SHIFT_REGISTER_STAGES   256
+#define MAX_PERSIST_COPIES           16
 #define MAX_STRING_LEN              256
 
 typedef struct ElemSubckParallelTag ElemSubcktParallel;
@@ -612,6 +625,9 @@ typedef struct ElemFormattedStringTag {
 
 typedef struct ElemPerisistTag {
     char    var[MAX_NAME_LEN];
+    SDWORD  interval; // ms, minimum time between two EEPROM writes
+    int     copies;   // EEPROM copies the writes are rotated across
+    SDWORD  idle;     // ms the value must stay the same before it is written
 } ElemPersist;
 
 #define SELECTED_NONE       0
@@ -727,6 +743,7 @@ typedef struct PlcProgramTag {
     int           cycleTimer; // 1 or 0
 #define YPlcCycleDuty "YPlcCycleDuty"
     int           cycleDuty; //if TRUE, "YPlcCycleDuty" pin set to 1 at begin and to 0 at end of PLC cycle
+    int           timeStampTimers; //if TRUE, timers hold the value of "$tick" when they started
     int           mcuClock;  // Hz
     int           baudRate;  // Hz
     char          LDversion[512];
@@ -958,11 +975,6 @@ void ScrollUp();
 void ScrollPgUp();
 void RollHome();
 void RollEnd();
-char *ExtractFileDir(char *dest);
-char *ExtractFilePath(char *dest);
-char *ExtractFileName(char *src); // with .ext
-char *GetFileName(char *dest, char *src); // without .ext
-char *SetExt(char *dest, const char *src, const char *ext);
 extern char CurrentLdPath[MAX_PATH];
 
 // maincontrols.cpp
@@ -979,6 +991,10 @@ void ToggleSimulationMode(void);
 void StopSimulation(void);
 void StartSimulation(void);
 void UpdateMainWindowTitleBar(void);
+void ToggleThreadedSimulation(void);
+void ToggleWaveformRecording(void);
+void ToggleProfiling(void);
+void ToggleIntCodeOptimizer(void);
 extern int ScrollWidth;
 extern int ScrollHeight;
 extern BOOL NeedHoriz;
@@ -1002,6 +1018,7 @@ extern BOOL ThisHighlighted;
 extern void (*DrawChars)(int, int, char *);
 void CALLBACK BlinkCursor(HWND hwnd, UINT msg, UINT_PTR id, DWORD time);
 void PaintWindow(void);
+void InvalidateRungs(int *rungs, int n);
 BOOL tGetLastWriteTime(char *CurrentSaveFile, FILETIME *sFileTime);
 void ExportDrawingAsText(char *file);
 void InitForDrawing(void);
@@ -1149,14 +1166,14 @@ void ShowContactsDialog(BOOL *negated, BOOL *set1, char *name);
 // coildialog.cpp
 void ShowCoilDialog(BOOL *negated, BOOL *setOnly, BOOL *resetOnly, BOOL *ttrigger, char *name);
 // simpledialog.cpp
-void CheckVarInRange(char *name, char *str, SDWORD v);
 void ShowTimerDialog(int which, SDWORD *delay, char *name);
 void ShowCounterDialog(int which, char *minV, char *maxV, char *name);
 void ShowVarBitDialog(int which, char *dest, char *src);
 void ShowMoveDialog(int which, char *dest, char *src);
 void ShowReadAdcDialog(char *name);
 void ShowSetPwmDialog(void *e);
-void ShowPersistDialog(char *var);
+void ShowPersistDialog(char *var, SDWORD *interval, int *copies, SDWORD *idle);
+BOOL ShowBreakpointDialog(char *spec);
 void ShowUartDialog(int which, char *name);
 void ShowCmpDialog(int which, char *op1, char *op2);
 void ShowSFRDialog(int which, char *op1, char *op2);
@@ -1251,6 +1268,7 @@ void ShowHelpDialog(BOOL about);
 void doexit(int status);
 void dbp(char *str, ...);
 void Error(char *str, ...);
+void ConsolePrintf(char *str, ...);
 void *CheckMalloc(size_t n);
 void CheckFree(void *p);
 extern HANDLE MainHeap;
@@ -1291,11 +1309,27 @@ size_t strlenalnum(const char *str);
 void CopyBit(DWORD *Dest, int bitDest, DWORD Src, int bitSrc);
 char *strDelSpace(char *dest, char *src);
 char *strDelSpace(char *dest);
+char *ExtractFileDir(char *dest);
+char *ExtractFilePath(char *dest);
+char *ExtractFileName(char *src); // with .ext
+char *GetFileName(char *dest, char *src); // without .ext
+char *SetExt(char *dest, const char *src, const char *ext);
 
 // lang.cpp
 char *_(char *in);
 
 // simulate.cpp
+typedef struct SimContextTag SimContext;
+typedef struct BatchRunTag BatchRun;
+// The simulator can also run SIM_LANES instances at once, bit-sliced: each
+// single bit is then a mask with one bit per instance.
+#define SIM_LANE_WORDS  4
+#define SIM_LANES       (64*SIM_LANE_WORDS)
+typedef struct LaneMaskTag {
+    ULONGLONG   w[SIM_LANE_WORDS];
+} LaneMask;
+// Deepest that the simulated UART's receive and transmit FIFOs can be.
+#define SIM_UART_FIFO_MAX   256
 void MarkInitedVariable(char *name);
 void SimulateOneCycle(BOOL forceRefresh);
 void CALLBACK PlcCycleTimer(HWND hwnd, UINT msg, UINT_PTR id, DWORD time);
@@ -1308,16 +1342,71 @@ void SimulationToggleContact(char *name);
 BOOL GetSingleBit(char *name);
 void SetAdcShadow(char *name, SWORD val);
 SWORD GetAdcShadow(char *name);
+int FindAdcShadowSlot(char *name, int *bucket);
+int AdcShadowSlot(char *name);
+void SetAdcShadowSlot(int slot, SWORD val);
+BOOL ReplayAdcSamples(char *filename);
+BOOL AddSimBreakpoint(char *spec);
+void ClearSimBreakpoints(void);
+char *SimulationBreakText(void);
 void DestroyUartSimulationWindow(void);
 void ShowUartSimulationWindow(void);
 extern BOOL InSimulationMode;
+extern BOOL ThreadedSimulation;
+extern BOOL RecordingWaveform;
+extern BOOL FastForwardSimulation;
+extern BOOL ProfilingSimulation;
 //extern BOOL SimulateRedrawAfterNextCycle;
-extern DWORD CyclesCount;
+DWORD SimulationCycles(void);
 void SetSimulationVariable(char *name, SDWORD val);
 SDWORD GetSimulationVariable(char *name, BOOL forIoList);
 SDWORD GetSimulationVariable(char *name);
 void SetSimulationStr(char *name, char *val);
 char *GetSimulationStr(char *name);
+void SetSingleBit(char *name, BOOL state);
+int SimulationSlot(char *name, BOOL *isBit);
+SDWORD SimulationSlotValue(int slot, BOOL isBit);
+int AddSimulationSlot(char *name, BOOL isBit);
+void SetSimulationSlotValue(int slot, BOOL isBit, SDWORD val);
+BOOL QueueUartCharacter(BYTE b);
+int UartLineBytesDue(int waiting);
+BOOL SetUartFifoSizes(int rx, int tx);
+void RecordWaveform(BOOL on);
+BOOL SaveWaveformAsVcd(char *filename);
+DWORD FastForwardCycles(DWORD max);
+SimContext *NewSimContext(BatchRun *batch);
+void ResetSimContext(SimContext *c, BatchRun *batch);
+void FreeSimContext(SimContext *c);
+void UseSimContext(SimContext *c);
+BOOL SaveSimSnapshot(char *filename);
+BOOL LoadSimSnapshot(char *filename);
+void ResetProfile(void);
+BOOL SaveProfile(char *filename, BOOL json);
+void CloseSimulationEeprom(void);
+BOOL SaveEepromWear(char *filename);
+BOOL PrepareLaneSimulation(void);
+void ResetLanes(void);
+LaneMask *LaneBitSlot(int slot);
+BOOL SimulateLanesCycle(void);
+
+// simadc.cpp
+typedef struct AdcStimTag AdcStim;
+AdcStim *OpenAdcStim(char *filename, char *map);
+BOOL StepAdcStim(AdcStim *a);
+BOOL AdcStimDone(AdcStim *a);
+DWORD AdcStimNextCycle(AdcStim *a);
+void CloseAdcStim(AdcStim *a);
+
+// simbatch.cpp
+BOOL SimulateBatch(DWORD cycles, char *stimulus, char *trace, char *wave);
+BOOL SimulateBatchList(DWORD cycles, char *list);
+void SimulateFromCommandLine(char *cmdLine);
+void BatchUartSend(BatchRun *r, BYTE b);
+void BatchBreak(BatchRun *r, char *what);
+void BatchHalt(BatchRun *r, char *why);
+
+// simcheck.cpp
+BOOL CheckAllInputs(DWORD cycles, char *rules);
 
 // Assignment of the `variables,' used for timers, counters, arithmetic, and
 // other more general things. Allocate 2 octets (16 bits) per.
@@ -1532,6 +1621,7 @@ int isVarInited(char *name);
 int isPinAssigned(char *name);
 void AllocStart(void);
 DWORD AllocOctetRam(void);
+DWORD AllocOctetRam(int bytes);
 void AllocBitRam(DWORD *addr, int *bit);
 void MemForVariable(char *name, DWORD *addrl, DWORD *addrh);
 int MemForVariable(char *name, DWORD *addrl);
@@ -1575,6 +1665,21 @@ BOOL MultiplyRoutineUsed(void);
 BOOL DivideRoutineUsed(void);
 void GenSymOneShot(char *dest, char *name1, char *name2);
 int getradix(char *str);
+void CheckVarInRange(char *name, char *str, SDWORD v);
+char *InternSymbol(char *name);
+void ExpandLookUpTables(void);
+void ExpandPiecewiseLinear(void);
+void ExpandShiftRegisters(void);
+void UseShiftRegisterRings(int maxStages);
+void UseShiftRegisterRings(void);
+#define MAX_TERM_BITS 16
+int BitTermBits(char *term, char **names, BOOL *negated);
+void ExpandBitTerms(void);
+unsigned long long RungContents(int rung, BYTE **key, int *keyLen);
+
+// intopt.cpp
+extern BOOL OptimizeIntCode;
+void OptimizeIntermediateCode(void);
 
 // pic16.cpp
 void CompilePic16(char *outFile);
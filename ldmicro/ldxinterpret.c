@@ -182,6 +182,16 @@ void Disassemble(void)
                 pc += 3;
                 break;
 
+            case INT_LOOK_UP_TABLE: {
+                int i;
+                printf("int16s[%s] := {", Symbols[Program[pc+1]]);
+                for(i = 0; i < Program[pc+3]; i++)
+                    printf("%s%d", i ? ", " : "", (SWORD)(Program[pc+4+2*i] + (Program[pc+5+2*i] << 8)));
+                printf("}[int16s[%s]]", Symbols[Program[pc+2]]);
+                pc += 4 + 2*Program[pc+3];
+                break;
+            }
+
             case INT_INCREMENT_VARIABLE:
                 printf("(int16s[%s])++", Symbols[Program[pc+1]]);
                 pc += 2;
@@ -292,6 +302,15 @@ void InterpretOneCycle(void)
             pc += 3;
             break;
 
+        case INT_LOOK_UP_TABLE: {
+            // the count, then the values, follow the operands
+            SWORD i = READ_INT(Program[pc + 2]);
+            if (i >= 0 && i < Program[pc + 3])
+                WRITE_INT(Program[pc + 1], Program[pc + 4 + 2*i] + (Program[pc + 5 + 2*i] << 8));
+            pc += 4 + 2*Program[pc + 3];
+            break;
+        }
+
         case INT_INCREMENT_VARIABLE:
             WRITE_INT(Program[pc + 1], READ_INT(Program[pc + 1]) + 1);
             pc += 2;
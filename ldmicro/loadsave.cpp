@@ -279,7 +279,19 @@ static BOOL LoadLeafFromFile(char *line, void **any, int *which)
         *which = ELEM_UART_RECV;
     } else if(sscanf(line, "UART_SEND %s", l->d.uart.name)==1) {
         *which = ELEM_UART_SEND;
+    } else if(sscanf(line, "PERSIST %s %d %d %d", l->d.persist.var,
+        &l->d.persist.interval, &l->d.persist.copies, &l->d.persist.idle)==4)
+    {
+        *which = ELEM_PERSIST;
+    } else if(sscanf(line, "PERSIST %s %d %d", l->d.persist.var,
+        &l->d.persist.interval, &l->d.persist.copies)==3)
+    {
+        l->d.persist.idle = 0;
+        *which = ELEM_PERSIST;
     } else if(sscanf(line, "PERSIST %s", l->d.persist.var)==1) {
+        l->d.persist.interval = 0;
+        l->d.persist.copies = 1;
+        l->d.persist.idle = 0;
         *which = ELEM_PERSIST;
     } else if(sscanf(line, "FORMATTED_STRING %s %d", l->d.fmtdStr.var,
         &x)==2)
@@ -574,6 +586,8 @@ BOOL LoadProjectFromFile(char *filename)
             Prog.cycleDuty = 0;
         } else if(sscanf(line, "BAUD=%d", &baud)) {
             Prog.baudRate = baud;
+        } else if(strcmp(line, "TIMERS=TIME STAMP\n")==0) {
+            Prog.timeStampTimers = TRUE;
         } else if(memcmp(line, "COMPILED=", 9)==0) {
             line[strlen(line)-1] = '\0';
             strcpy(CurrentCompileFile, line+9);
@@ -599,7 +613,8 @@ BOOL LoadProjectFromFile(char *filename)
     }
     if(strcmp(line, "PROGRAM\n") != 0) goto failed;
 
-    int rung = -2;
+    int rung;
+    rung = -2;
     for(rung = 0;;) {
         if(!fgets(line, sizeof(line), f)) break;
         if(!strlen(strspace(line))) continue;
@@ -889,7 +904,15 @@ void SaveElemToFile(FILE *f, int which, void *any, int depth, int rung)
             break;
 
         case ELEM_PERSIST:
-            fprintf(f, "PERSIST %s\n", l->d.persist.var);
+            if(l->d.persist.idle)
+                fprintf(f, "PERSIST %s %d %d %d\n", l->d.persist.var,
+                    l->d.persist.interval, l->d.persist.copies,
+                    l->d.persist.idle);
+            else if(l->d.persist.interval || (l->d.persist.copies > 1))
+                fprintf(f, "PERSIST %s %d %d\n", l->d.persist.var,
+                    l->d.persist.interval, l->d.persist.copies);
+            else
+                fprintf(f, "PERSIST %s\n", l->d.persist.var);
             break;
 
         case ELEM_CPRINTF:      s = "CPRINTF"; goto cprintf;
@@ -1020,6 +1043,9 @@ BOOL SaveProjectToFile(char *filename)
     fprintf(f, "CYCLE=%lld us at Timer%d, YPlcCycleDuty:%d\n", Prog.cycleTime, Prog.cycleTimer, Prog.cycleDuty);
     fprintf(f, "CRYSTAL=%d Hz\n", Prog.mcuClock);
     fprintf(f, "BAUD=%d Hz\n", Prog.baudRate);
+    if(Prog.timeStampTimers) {
+        fprintf(f, "TIMERS=TIME STAMP\n");
+    }
     if(strlen(CurrentCompileFile) > 0) {
         fprintf(f, "COMPILED=%s\n", CurrentCompileFile);
     }
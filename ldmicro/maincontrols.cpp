@@ -134,6 +134,9 @@ void UpdateMainWindowTitleBar(void)
     if(InSimulationMode) {
         if(RealTimeSimulationRunning) {
             strcpy(line, _("LDmicro - Simulation (Running)"));
+        } else if(SimulationBreakText()) {
+            sprintf(line, _("LDmicro - Simulation (Stopped at %s)"),
+                SimulationBreakText());
         } else {
             strcpy(line, _("LDmicro - Simulation (Stopped)"));
         }
@@ -607,6 +610,30 @@ HMENU MakeMainWindowMenus(void)
         _("&Halt Simulation\tCtrl+H or F9"));
     AppendMenu(SimulateMenu, MF_STRING | MF_GRAYED, MNU_SINGLE_CYCLE,
         _("Single &Cycle\tSpace"));
+    AppendMenu(SimulateMenu, MF_SEPARATOR, 0, "");
+    AppendMenu(SimulateMenu, MF_STRING, MNU_THREADED_SIMULATION,
+        _("&Threaded Simulation Engine"));
+    AppendMenu(SimulateMenu, MF_STRING, MNU_RECORD_WAVEFORM,
+        _("Record &Waveform"));
+    AppendMenu(SimulateMenu, MF_STRING, MNU_SAVE_WAVEFORM,
+        _("Save Waveform As &VCD..."));
+    AppendMenu(SimulateMenu, MF_STRING, MNU_PROFILE_SIMULATION,
+        _("&Profile Scan Time"));
+    AppendMenu(SimulateMenu, MF_STRING, MNU_SAVE_PROFILE,
+        _("Save Pro&file..."));
+    AppendMenu(SimulateMenu, MF_STRING | MF_GRAYED, MNU_SAVE_EEPROM_WEAR,
+        _("Save &EEPROM Wear..."));
+    AppendMenu(SimulateMenu, MF_STRING | MF_GRAYED, MNU_REPLAY_ADC,
+        _("Replay A&DC Samples..."));
+    AppendMenu(SimulateMenu, MF_STRING | MF_GRAYED, MNU_ADD_BREAKPOINT,
+        _("Add &Breakpoint..."));
+    AppendMenu(SimulateMenu, MF_STRING | MF_GRAYED, MNU_CLEAR_BREAKPOINTS,
+        _("Clear Brea&kpoints"));
+    AppendMenu(SimulateMenu, MF_SEPARATOR, 0, "");
+    AppendMenu(SimulateMenu, MF_STRING | MF_GRAYED, MNU_SAVE_SNAPSHOT,
+        _("Save Sn&apshot..."));
+    AppendMenu(SimulateMenu, MF_STRING | MF_GRAYED, MNU_LOAD_SNAPSHOT,
+        _("&Load Snapshot..."));
 
     compile = CreatePopupMenu();
     AppendMenu(compile, MF_STRING, MNU_COMPILE,         _("&Compile\tF5"));
@@ -618,6 +645,10 @@ HMENU MakeMainWindowMenus(void)
     AppendMenu(compile, MF_STRING, MNU_COMPILE_CAVR,    _("DONE: Compile C for AVR GCC, CodeVisionAVR, IAR AVR"));
     AppendMenu(compile, MF_STRING, MNU_COMPILE_IHEXDONE,_("DONE: Compile HEX->ASM"));
     AppendMenu(compile, MF_STRING, MNU_COMPILE_PASCAL,  _("DONE: Compile PASCAL"));
+    AppendMenu(compile, MF_SEPARATOR, 0, "");
+    AppendMenu(compile, MF_STRING | (OptimizeIntCode ? MF_CHECKED : 0),
+        MNU_OPTIMIZE_INTCODE, _("&Optimize Intermediate Code"));
+    AppendMenu(compile, MF_SEPARATOR, 0, "");
     AppendMenu(compile, MF_STRING, MNU_FLASH_BAT,       _("Call flashMcu.bat\tF6"));
     AppendMenu(compile, MF_STRING, MNU_READ_BAT,        _("Call readMcu.bat\tCtrl+F6"));
 
@@ -797,10 +828,10 @@ void RefreshStatusBar(void)
     double F2=SIprefix(1000000.0/Prog.cycleTime/2, F2units);
 
     char TNunits[3];
-    double TN=SIprefix(1.0*Prog.cycleTime*CyclesCount/1000000, TNunits);
+    double TN=SIprefix(1.0*Prog.cycleTime*SimulationCycles()/1000000, TNunits);
 
     sprintf(buf, "Tcycle=%.6g %ss F=%.6g %sHz F/2=%.6g %sHz Ncycle=%d T=%.6g %ss",
-        T,Tunits, F,Funits, F2,F2units, CyclesCount, TN,TNunits);
+        T,Tunits, F,Funits, F2,F2units, SimulationCycles(), TN,TNunits);
     SendMessage(StatusBar, SB_SETTEXT, 3, (LPARAM)buf);
 
     if(Prog.mcu && (Prog.mcu->whichIsa == ISA_ANSIC ||
@@ -954,6 +985,12 @@ void ToggleSimulationMode(BOOL doSimulateOneRung)
     if(InSimulationMode) {
         EnableMenuItem(SimulateMenu, MNU_START_SIMULATION, MF_ENABLED);
         EnableMenuItem(SimulateMenu, MNU_SINGLE_CYCLE, MF_ENABLED);
+        EnableMenuItem(SimulateMenu, MNU_SAVE_SNAPSHOT, MF_ENABLED);
+        EnableMenuItem(SimulateMenu, MNU_LOAD_SNAPSHOT, MF_ENABLED);
+        EnableMenuItem(SimulateMenu, MNU_SAVE_EEPROM_WEAR, MF_ENABLED);
+        EnableMenuItem(SimulateMenu, MNU_REPLAY_ADC, MF_ENABLED);
+        EnableMenuItem(SimulateMenu, MNU_ADD_BREAKPOINT, MF_ENABLED);
+        EnableMenuItem(SimulateMenu, MNU_CLEAR_BREAKPOINTS, MF_ENABLED);
 
         EnableMenuItem(FileMenu, MNU_OPEN, MF_GRAYED);
         EnableMenuItem(FileMenu, MNU_SAVE, MF_GRAYED);
@@ -983,6 +1020,12 @@ void ToggleSimulationMode(BOOL doSimulateOneRung)
         EnableMenuItem(SimulateMenu, MNU_START_SIMULATION, MF_GRAYED);
         EnableMenuItem(SimulateMenu, MNU_STOP_SIMULATION, MF_GRAYED);
         EnableMenuItem(SimulateMenu, MNU_SINGLE_CYCLE, MF_GRAYED);
+        EnableMenuItem(SimulateMenu, MNU_SAVE_SNAPSHOT, MF_GRAYED);
+        EnableMenuItem(SimulateMenu, MNU_LOAD_SNAPSHOT, MF_GRAYED);
+        EnableMenuItem(SimulateMenu, MNU_SAVE_EEPROM_WEAR, MF_GRAYED);
+        EnableMenuItem(SimulateMenu, MNU_REPLAY_ADC, MF_GRAYED);
+        EnableMenuItem(SimulateMenu, MNU_ADD_BREAKPOINT, MF_GRAYED);
+        EnableMenuItem(SimulateMenu, MNU_CLEAR_BREAKPOINTS, MF_GRAYED);
 
         EnableMenuItem(FileMenu, MNU_OPEN, MF_ENABLED);
         EnableMenuItem(FileMenu, MNU_SAVE, MF_ENABLED);
@@ -1000,6 +1043,8 @@ void ToggleSimulationMode(BOOL doSimulateOneRung)
         if(UartFunctionUsed()) {
             DestroyUartSimulationWindow();
         }
+        CloseSimulationEeprom();
+        ReplayAdcSamples(NULL);
     }
 
     UpdateMainWindowTitleBar();
@@ -1014,6 +1059,52 @@ void ToggleSimulationMode()
     ToggleSimulationMode(FALSE);
 }
 
+//-----------------------------------------------------------------------------
+// Switch between the two simulation engines. Both run from the same state,
+// so this can be done at any time, even in the middle of a simulation, to
+// compare what they do cycle by cycle.
+//-----------------------------------------------------------------------------
+void ToggleThreadedSimulation(void)
+{
+    ThreadedSimulation = !ThreadedSimulation;
+    CheckMenuItem(SimulateMenu, MNU_THREADED_SIMULATION,
+        ThreadedSimulation ? MF_CHECKED : MF_UNCHECKED);
+}
+
+//-----------------------------------------------------------------------------
+// Start or stop profiling the simulated program; starting clears what was
+// counted before.
+//-----------------------------------------------------------------------------
+void ToggleProfiling(void)
+{
+    ProfilingSimulation = !ProfilingSimulation;
+    if(ProfilingSimulation) ResetProfile();
+    CheckMenuItem(SimulateMenu, MNU_PROFILE_SIMULATION,
+        ProfilingSimulation ? MF_CHECKED : MF_UNCHECKED);
+}
+
+//-----------------------------------------------------------------------------
+// Turn the passes over the intermediate code on or off. This takes effect at
+// the next compile, or the next time the simulation is started.
+//-----------------------------------------------------------------------------
+void ToggleIntCodeOptimizer(void)
+{
+    OptimizeIntCode = !OptimizeIntCode;
+    CheckMenuItem(TopMenu, MNU_OPTIMIZE_INTCODE,
+        OptimizeIntCode ? MF_CHECKED : MF_UNCHECKED);
+}
+
+//-----------------------------------------------------------------------------
+// Start or stop recording the signals of the simulated program, so that they
+// can be saved as a waveform afterwards.
+//-----------------------------------------------------------------------------
+void ToggleWaveformRecording(void)
+{
+    RecordWaveform(!RecordingWaveform);
+    CheckMenuItem(SimulateMenu, MNU_RECORD_WAVEFORM,
+        RecordingWaveform ? MF_CHECKED : MF_UNCHECKED);
+}
+
 //-----------------------------------------------------------------------------
 // Start real-time simulation. Have to update the controls grayed status
 // to reflect this.
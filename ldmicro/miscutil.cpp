@@ -87,6 +87,76 @@ void doexit(int status)
 {
     exit(status);
 }
+//---------------------------------------------------------------------------
+char *ExtractFileDir(char *dest) // without last backslash
+{
+    char *c;
+    if(strlen(dest)) {
+        c = strrchr(dest,'\\');
+        if(c)
+            *c = '\0';
+    };
+    return dest;
+}
+
+char *ExtractFilePath(char *dest) // with last backslash
+{
+    char *c;
+    if(strlen(dest)) {
+        c = strrchr(dest,'\\');
+        if(c)
+            c[1] = '\0';
+    };
+    return dest;
+}
+
+//---------------------------------------------------------------------------
+char *ExtractFileName(char *src) // with .ext
+{
+    char *c;
+    if(strlen(src)) {
+        c = strrchr(src,'\\');
+        if(c)
+            return &c[1];
+    }
+    return src;
+}
+
+//---------------------------------------------------------------------------
+char *GetFileName(char *dest, char *src) // without .ext
+{
+    dest[0] = '\0';
+    char *c;
+    strcpy(dest, ExtractFileName(src));
+    if(strlen(dest)) {
+        c = strrchr(dest,'.');
+        if(c)
+            c[0] = '\0';
+    }
+    return dest;
+}
+
+//-----------------------------------------------------------------------------
+char *SetExt(char *dest, const char *src, const char *ext)
+{
+    char *c;
+    if(strlen(src))
+        strcpy(dest, src);
+    if(strlen(dest)) {
+        c = strrchr(dest,'.');
+        if(c)
+            c[0] = '\0';
+    };
+    if(!strlen(dest))
+        strcat(dest, "new");
+
+    if(strlen(ext))
+        if(!strchr(ext,'.'))
+            strcat(dest, ".");
+
+    return strcat(dest, ext);
+}
+
 //-----------------------------------------------------------------------------
 // For error messages to the user; printf-like, to a message box.
 // For warning messages use ' ' in *str[0], see avr.cpp INT_SET_NPULSE.
@@ -121,6 +191,24 @@ void Error(char *str, ...)
     }
 }
 
+//-----------------------------------------------------------------------------
+// printf-like, to the console that started us; for the non-interactive
+// modes, which have nowhere else to report to.
+//-----------------------------------------------------------------------------
+void ConsolePrintf(char *str, ...)
+{
+    va_list f;
+    char buf[1024];
+    va_start(f, str);
+    vsprintf(buf, str, f);
+    va_end(f);
+
+    AttachConsoleDynamic(ATTACH_PARENT_PROCESS);
+    HANDLE h = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD written;
+    WriteFile(h, buf, strlen(buf), &written, NULL);
+}
+
 //-----------------------------------------------------------------------------
 // A standard format for showing a message that indicates that a compile
 // was successful.
@@ -979,6 +979,17 @@ static void writeStringOp(BinOp * Op, OpcodeMeta * pMeta, FILE * f = NULL)
 
 void CompileNetzer(char *outFile)
 {
+	// The Netzer firmware has no table, ring or bit term ops.
+	ExpandLookUpTables();
+	ExpandPiecewiseLinear();
+	ExpandShiftRegisters();
+	ExpandBitTerms();
+
+	if(IntCodeLen >= MAX_INT_OPS) {
+		Error(_("Program too long for an interpretable target (%d ops, max %d)."),
+			IntCodeLen, MAX_INT_OPS - 1);
+		return;
+	}
 	char projectname[MAX_PROJECTNAME_LENGTH+1];
 	NetzerMetaInformation_t meta;
 	int opcodes;
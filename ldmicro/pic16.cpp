@@ -151,6 +151,19 @@ static DWORD EepromHighByte;
 static DWORD EepromHighByteWaitingAddr;
 static int EepromHighByteWaitingBit;
 
+// The rings that hold the stages of the shift registers, two bytes a stage,
+// with stage k at (head + k) mod stages; see UseShiftRegisterRings(). Each
+// one is in a single bank, where FSR can index it, with its head in the byte
+// after it, counting in bytes.
+typedef struct PicRingTag {
+    char   *name;
+    int     stages;
+    DWORD   addr;
+    DWORD   head;
+} PicRing;
+static PicRing Rings[MAX_IO];
+static int RingCount;
+
 // Subroutines to do multiply/divide
 static DWORD MultiplyRoutineAddress8;
 static DWORD MultiplyRoutineAddress;
@@ -200,6 +213,8 @@ static DWORD FwdAddrCount;
 #define     BSR2      BIT2
 #define     BSR1      BIT1
 #define     BSR0      BIT0
+// and the high byte of FSR0 instead REG_STATUS(STATUS_IPR)
+#define REG_FSR0H     0x05
 
 
 // These move around from device to device.
@@ -355,6 +370,7 @@ static int IsCoreRegister(DWORD reg)
             case REG_PCLATH:
             case REG_INTCON:
             case REG_BSR:
+            case REG_FSR0H:
                 return 1; // in all banks same, dont need to change banks
             default:
                 return 0;
@@ -427,7 +443,9 @@ static int IsOperation(PicOp op)
         case OP_NOP_:
         case OP_COMMENT_:
 //      case OP_SUBLW:
+        case OP_ANDLW:
         case OP_IORLW:
+        case OP_XORLW:
         case OP_OPTION:
             return IS_ANY_BANK; // not need to change bank
         case OP_RETURN:
@@ -1341,11 +1359,21 @@ static DWORD Assemble(DWORD addrAt, PicOp op, DWORD arg1, DWORD arg2)
             discoverName(addrAt, arg1s, arg1comm);
             return 0x0c00 | (arg2 << 7) | arg1;
 
+        case OP_ANDLW:
+            CHECK(arg1, 8); CHECK(arg2, 0);
+            discoverName(addrAt, arg1s, arg1comm);
+            return 0x3900 | arg1;
+
         case OP_IORLW:
             CHECK(arg1, 8); CHECK(arg2, 0);
             discoverName(addrAt, arg1s, arg1comm);
             return 0x3800 | arg1;
 
+        case OP_XORLW:
+            CHECK(arg1, 8); CHECK(arg2, 0);
+            discoverName(addrAt, arg1s, arg1comm);
+            return 0x3A00 | arg1;
+
         case OP_SUBWF:
             CHECK(arg1, 7); CHECK(arg2, 1);
             discoverName(addrAt, arg1s, arg1comm);
@@ -1514,10 +1542,20 @@ static DWORD Assemble12(DWORD addrAt, PicOp op, DWORD arg1, DWORD arg2)
             discoverName(addrAt, arg1s, arg1comm);
             return 0x300 | (arg2 << 5) | arg1;
 
+        case OP_ANDLW:
+            CHECK(arg1, 8); CHECK(arg2, 0);
+            discoverName(addrAt, arg1s, arg1comm);
+            return 0xE00 | arg1;
+
         case OP_IORLW:
             CHECK(arg1, 8); CHECK(arg2, 0);
             discoverName(addrAt, arg1s, arg1comm);
             return 0xD00 | arg1;
+
+        case OP_XORLW:
+            CHECK(arg1, 8); CHECK(arg2, 0);
+            discoverName(addrAt, arg1s, arg1comm);
+            return 0xF00 | arg1;
 /*
         case OP_SUBLW:
             CHECK(arg1, 8); CHECK(arg2, 0);
@@ -2025,6 +2063,17 @@ void AllocBitsVars()
                 MemForSingleBit(a->name1, TRUE, &addr, &bit);
                 break;
 
+            case INT_AND_BIT_TERM:
+            case INT_OR_BIT_TERM: {
+                char *names[MAX_TERM_BITS];
+                BOOL negated[MAX_TERM_BITS];
+                int i, n = BitTermBits(a->name2, names, negated);
+                for(i = 0; i < n; i++)
+                    MemForSingleBit(names[i], TRUE, &addr, &bit);
+                MemForSingleBit(a->name1, FALSE, &addr, &bit);
+                break;
+            }
+
             case INT_UART_SEND_BUSY:
                 MemForSingleBit(a->name1, TRUE, &addr, &bit);
                 break;
@@ -2057,6 +2106,123 @@ void AllocBitsVars()
     }
 }
 
+//-----------------------------------------------------------------------------
+// Jump to notTrue unless all the bits of the term of an INT_AND_BIT_TERM or
+// INT_OR_BIT_TERM match. Three or more bits that share a byte are tested
+// together, with one mask and compare; fewer are cheaper one at a time.
+//-----------------------------------------------------------------------------
+static void IfNotBitTerm(char *term, DWORD notTrue)
+{
+    char *names[MAX_TERM_BITS];
+    BOOL negated[MAX_TERM_BITS];
+    DWORD addrs[MAX_TERM_BITS];
+    BYTE mask[MAX_TERM_BITS];
+    BYTE want[MAX_TERM_BITS];
+    int count[MAX_TERM_BITS];
+    int groups = 0;
+    int i, j, bit;
+
+    int n = BitTermBits(term, names, negated);
+    for(i = 0; i < n; i++) {
+        DWORD addr;
+        MemForSingleBit(names[i], TRUE, &addr, &bit);
+        for(j = 0; j < groups; j++)
+            if(addrs[j] == addr) break;
+        if(j == groups) {
+            addrs[groups] = addr;
+            mask[groups] = 0;
+            want[groups] = 0;
+            count[groups] = 0;
+            groups++;
+        }
+        mask[j] |= 1 << bit;
+        if(!negated[i]) want[j] |= 1 << bit;
+        count[j]++;
+    }
+
+    for(j = 0; j < groups; j++) {
+        if(count[j] >= 3) {
+            Instruction(OP_MOVF, addrs[j], DEST_W);
+            Instruction(OP_ANDLW, mask[j]);
+            if(want[j])
+                Instruction(OP_XORLW, want[j]);
+            Instruction(OP_BTFSS, REG_STATUS, STATUS_Z);
+            Instruction(OP_GOTO, notTrue, 0);
+            continue;
+        }
+        for(bit = 0; bit < 8; bit++) {
+            if(!(mask[j] & (1 << bit))) continue;
+            if(want[j] & (1 << bit))
+                IfBitClear(addrs[j], bit);
+            else
+                IfBitSet(addrs[j], bit);
+            Instruction(OP_GOTO, notTrue, 0);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Return the ring of the shift register with the given name, allocating it
+// the first time that it is asked for. AllocOctetRam() never splits a block
+// over two sections, and no section spans two banks.
+//-----------------------------------------------------------------------------
+static PicRing *RingFor(char *name, int stages)
+{
+    int i;
+    for(i = 0; i < RingCount; i++)
+        if(Rings[i].name == name) return &Rings[i];
+    if(RingCount >= MAX_IO) {
+        Error(_("Internal limit exceeded (number of vars)"));
+        CompileError();
+    }
+    PicRing *r = &Rings[RingCount++];
+    r->name = name;
+    r->stages = stages;
+    r->addr = AllocOctetRam(2 * stages + 1);
+    r->head = r->addr + 2 * stages;
+    return r;
+}
+
+//-----------------------------------------------------------------------------
+// Set IRP, or FSR0H, for FSR to index the bank of a ring.
+//-----------------------------------------------------------------------------
+static void RingBank(PicRing *r)
+{
+    if(Prog.mcu->core == EnhancedMidrangeCore14bit) {
+        Instruction(OP_MOVLW, (r->addr >> 8) & 0xff);
+        Instruction(OP_MOVWF, REG_FSR0H);
+    } else if(r->addr & 0x100) {
+        Instruction(OP_BSF, REG_STATUS, STATUS_IPR);
+    } else {
+        Instruction(OP_BCF, REG_STATUS, STATUS_IPR);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Point FSR (and IRP, or FSR0H) at the low byte of stage k of a ring,
+// addr + (head + 2*k) mod 2*stages.
+//-----------------------------------------------------------------------------
+static void LoadRingFsr(PicRing *r, int k)
+//used Scratch0
+{
+    Instruction(OP_MOVF, r->head, DEST_W, r->name);
+    if(k) {
+        // head + 2*k < 4*stages, so one subtract brings it back into range
+        Instruction(OP_MOVWF, Scratch0);
+        Instruction(OP_MOVLW, 2 * k);
+        Instruction(OP_ADDWF, Scratch0, DEST_F);
+        Instruction(OP_MOVLW, 2 * r->stages);
+        Instruction(OP_SUBWF, Scratch0, DEST_W);
+        IfBitClear(REG_STATUS, STATUS_C);
+        Instruction(OP_MOVF, Scratch0, DEST_W);
+    }
+    Instruction(OP_MOVWF, Scratch0);
+    Instruction(OP_MOVLW, r->addr & 0xff);
+    Instruction(OP_ADDWF, Scratch0, DEST_W);
+    Instruction(OP_MOVWF, REG_FSR);
+    RingBank(r);
+}
+
 //-----------------------------------------------------------------------------
 // Compile the intermediate code to PIC16 native code.
 //-----------------------------------------------------------------------------
@@ -2117,6 +2283,27 @@ static void CompileFromIntermediate(BOOL topLevel)
                 CopyBit(addr, bit, addr2, bit2);
                 break;
 
+            case INT_AND_BIT_TERM: {
+                DWORD notTrue = AllocFwdAddr();
+                DWORD done = AllocFwdAddr();
+                IfNotBitTerm(a->name2, notTrue);
+                Instruction(OP_GOTO, done, 0);
+                FwdAddrIsNow(notTrue);
+                MemForSingleBit(a->name1, FALSE, &addr, &bit);
+                ClearBit(addr, bit, a->name1);
+                FwdAddrIsNow(done);
+                break;
+            }
+
+            case INT_OR_BIT_TERM: {
+                DWORD notTrue = AllocFwdAddr();
+                IfNotBitTerm(a->name2, notTrue);
+                MemForSingleBit(a->name1, FALSE, &addr, &bit);
+                SetBit(addr, bit, a->name1);
+                FwdAddrIsNow(notTrue);
+                break;
+            }
+
             case INT_SET_VARIABLE_TO_LITERAL:
                 MemForVariable(a->name1, &addr);
                 sprintf(comment, "%s=%d==0x%X", a->name1, a->literal, a->literal);
@@ -2321,6 +2508,95 @@ static void CompileFromIntermediate(BOOL topLevel)
                 Instruction(OP_MOVWF, addrh, 0, a->name1);
                 break;
 
+            case INT_SHIFT_REGISTER: {
+                // Move the head back one, so that each stage is now where
+                // the one before it was, and give the new stage 0 the value
+                // of the old one, which is now stage 1.
+                PicRing *r = RingFor(a->name1, a->literal);
+                Instruction(OP_MOVLW, 2);
+                Instruction(OP_SUBWF, r->head, DEST_F, a->name1);
+                Instruction(OP_MOVLW, 2 * r->stages);
+                IfBitClear(REG_STATUS, STATUS_C);
+                Instruction(OP_ADDWF, r->head, DEST_F, a->name1);
+                LoadRingFsr(r, 1);
+                Instruction(OP_MOVF, REG_INDF, DEST_W);
+                Instruction(OP_MOVWF, Scratch1);
+                Instruction(OP_INCF, REG_FSR, DEST_F);
+                Instruction(OP_MOVF, REG_INDF, DEST_W);
+                Instruction(OP_MOVWF, Scratch2);
+                LoadRingFsr(r, 0);
+                Instruction(OP_MOVF, Scratch1, DEST_W);
+                Instruction(OP_MOVWF, REG_INDF);
+                Instruction(OP_INCF, REG_FSR, DEST_F);
+                Instruction(OP_MOVF, Scratch2, DEST_W);
+                Instruction(OP_MOVWF, REG_INDF);
+                break;
+            }
+
+            case INT_RING_READ: {
+                PicRing *r = RingFor(a->name2, a->literal2);
+                MemForVariable(a->name1, &addrl, &addrh);
+                LoadRingFsr(r, a->literal);
+                Instruction(OP_MOVF, REG_INDF, DEST_W);
+                Instruction(OP_MOVWF, addrl, 0, a->name1);
+                Instruction(OP_INCF, REG_FSR, DEST_F);
+                Instruction(OP_MOVF, REG_INDF, DEST_W);
+                Instruction(OP_MOVWF, addrh, 0, a->name1);
+                break;
+            }
+
+            case INT_RING_WRITE: {
+                PicRing *r = RingFor(a->name1, a->literal2);
+                MemForVariable(a->name2, &addrl2, &addrh2);
+                LoadRingFsr(r, a->literal);
+                Instruction(OP_MOVF, addrl2, DEST_W, a->name2);
+                Instruction(OP_MOVWF, REG_INDF);
+                Instruction(OP_INCF, REG_FSR, DEST_F);
+                Instruction(OP_MOVF, addrh2, DEST_W, a->name2);
+                Instruction(OP_MOVWF, REG_INDF);
+                break;
+            }
+
+            case INT_LOOK_UP_TABLE: {
+                // A computed RETLW table would have to sit at a known
+                // address, but the bank and page correction move the code
+                // after we emit it. So keep the index in W and XOR in each
+                // entry number in turn (W is index^i after the i-th XOR, zero
+                // at the entry that matches); three words per entry.
+                DWORD entry[MAX_LOOK_UP_TABLE_LEN];
+                DWORD done = AllocFwdAddr();
+                int n = a->literal;
+                int i, k;
+                MemForVariable(a->name1, &addr);
+                MemForVariable(a->name2, &addrl2, &addrh2);
+                sov = SizeOfVar(a->name1);
+
+                // out of range unless the high byte is zero
+                Instruction(OP_MOVF, addrh2, DEST_W, a->name2);
+                IfBitClear(REG_STATUS, STATUS_Z);
+                Instruction(OP_GOTO, done, 0);
+
+                Instruction(OP_MOVF, addrl2, DEST_W, a->name2);
+                for(i = 0; i < n; i++) {
+                    entry[i] = AllocFwdAddr();
+                    Instruction(OP_XORLW, i ? i ^ (i - 1) : 0);
+                    IfBitSet(REG_STATUS, STATUS_Z);
+                    Instruction(OP_GOTO, entry[i], 0);
+                }
+                Instruction(OP_GOTO, done, 0);
+
+                for(i = 0; i < n; i++) {
+                    FwdAddrIsNow(entry[i]);
+                    sprintf(comment, "%s=%d==0x%X", a->name1, a->data[i], a->data[i]);
+                    for(k = 0; k < sov; k++)
+                        WriteRegister(addr + k, BYTE((a->data[i] >> (8*k)) & 0xff), comment);
+                    if(i < n - 1)
+                        Instruction(OP_GOTO, done, 0);
+                }
+                FwdAddrIsNow(done);
+                break;
+            }
+
 
             // The add and subtract routines must be written to return correct
             // results if the destination and one of the operands happen to
@@ -3474,6 +3750,18 @@ static void WriteDivideRoutine(void)
 //-----------------------------------------------------------------------------
 void CompilePic16(char *outFile)
 {
+    ExpandPiecewiseLinear();
+    // A ring has to be in one bank for FSR to index it, and the baseline
+    // core has no IRP to reach the upper banks with.
+    int ringStages = 0;
+    if(Prog.mcu->core != BaselineCore12bit) {
+        int i;
+        for(i = 0; i < MAX_RAM_SECTIONS; i++)
+            if((Prog.mcu->ram[i].len - 2) / 2 > ringStages)
+                ringStages = (Prog.mcu->ram[i].len - 2) / 2;
+    }
+    UseShiftRegisterRings(ringStages);
+
     if(McuAs("Microchip PIC16F628 ")
     || McuAs("Microchip PIC16F88 " )
     || McuAs("Microchip PIC16F819 ")
@@ -3909,6 +4197,7 @@ void CompilePic16(char *outFile)
     WipeMemory();
 
     AllocStart();
+    RingCount = 0;
 
     AllocBitsVars(); // first
 
@@ -3933,6 +4222,12 @@ void CompilePic16(char *outFile)
     EepromHighByte = AllocOctetRam();
     AllocBitRam(&EepromHighByteWaitingAddr, &EepromHighByteWaitingBit);
 
+    // The rings now, so that we can clear them at the start.
+    int ring;
+    for(ring = 0; ring < IntCodeLen; ring++)
+        if(IntCode[ring].op == INT_SHIFT_REGISTER)
+            RingFor(IntCode[ring].name1, IntCode[ring].literal);
+
     DWORD progStart = AllocFwdAddr();
     // Our boot vectors; not necessary to do it like this, but it lets
     // bootloaders rewrite the beginning of the program to do their magic.
@@ -4004,6 +4299,23 @@ void CompilePic16(char *outFile)
       }
     }
 
+    // The loop above leaves IRP clear, so clear each ring and its head on
+    // its own, through FSR, since it may be in a bank beyond that.
+    for(i = 0; i < RingCount; i++) {
+        DWORD clearRing;
+        Comment("Clear the ring of shift register %s", Rings[i].name);
+        Instruction(OP_MOVLW, Rings[i].addr & 0xff);
+        Instruction(OP_MOVWF, REG_FSR);
+        RingBank(&Rings[i]);
+        clearRing = PicProgWriteP;
+        Instruction(OP_CLRF, REG_INDF);
+        Instruction(OP_INCF, REG_FSR, DEST_F);
+        Instruction(OP_MOVF, REG_FSR, DEST_W);
+        Instruction(OP_XORLW, (Rings[i].head + 1) & 0xff);
+        IfBitClear(REG_STATUS, STATUS_Z);
+        Instruction(OP_GOTO, clearRing);
+    }
+
     #ifndef MOVE_TO_PAGE_0
     DivideRoutineAddress = AllocFwdAddr();
     #endif
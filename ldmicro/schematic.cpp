@@ -738,7 +738,9 @@ void EditSelectedElement(void)
             break;
 
         case ELEM_PERSIST:
-            ShowPersistDialog(Selected->d.persist.var);
+            ShowPersistDialog(Selected->d.persist.var,
+                &Selected->d.persist.interval, &Selected->d.persist.copies,
+                &Selected->d.persist.idle);
             break;
 
         case ELEM_SHIFT_REGISTER:
@@ -0,0 +1,306 @@
+//-----------------------------------------------------------------------------
+// This file is part of LDmicro.
+//
+// LDmicro is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LDmicro is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LDmicro.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Replay samples recorded in a CSV file into the shadows of the READ ADC
+// variables, for simulating a program against real sensor data. The file is
+// read a row at a time as the simulation gets to it, so it can be as long as
+// you like, or a pipe.
+//
+// The first line names the columns. If the first name is `cycle', `ms' or
+// `s' then that column says when the row applies: as a cycle number, or as
+// a time that is converted to cycles with the cycle time of the program,
+// counting from when the file was opened. Otherwise each row applies to one
+// cycle, one after the other. Without a map, the other columns go to the
+// READ ADC of the same name, and the ones that match none are ignored; a map
+// like `temp=Atemp 3=Apress' sends columns, by name or by number counting
+// from 1, to the READ ADCs given, and the rest are ignored. Fields are split
+// by commas, semicolons or tabs; an empty field leaves the shadow as it was.
+// Blank lines and lines that start with `#' are skipped.
+//-----------------------------------------------------------------------------
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ldmicro.h"
+
+#define ADC_STIM_MAX_COLUMNS    64
+#define ADC_STIM_MAX_LINE       4096
+
+struct AdcStimTag {
+    FILE       *f;
+    char        filename[MAX_PATH];
+    int         line;
+
+    // How the first column gives when a row applies: 0 if it doesn't (one
+    // row per cycle), else microseconds per unit, or -1 for cycles.
+    SDWORD      timeUnit;
+    DWORD       start;
+    DWORD       rows;
+
+    int         columns;
+    int         slot[ADC_STIM_MAX_COLUMNS]; // -1 if the column is ignored
+
+    // The next row, read ahead of time so that we know when to apply it.
+    BOOL        valid;
+    DWORD       cycle;
+    BOOL        has[ADC_STIM_MAX_COLUMNS];
+    SWORD       val[ADC_STIM_MAX_COLUMNS];
+};
+
+//-----------------------------------------------------------------------------
+// Read the next line that isn't blank or a comment, and split it into
+// fields, in place. Returns the number of fields, 0 at the end of the file,
+// or -1 if the line is too long.
+//-----------------------------------------------------------------------------
+static int ReadCsvLine(AdcStim *a, char *buf, char **fields)
+{
+    for(;;) {
+        if(!fgets(buf, ADC_STIM_MAX_LINE, a->f)) return 0;
+        a->line++;
+
+        int len = strlen(buf);
+        if(len > 0 && buf[len-1] != '\n' && !feof(a->f)) return -1;
+        while(len > 0 && (buf[len-1] == '\n' || buf[len-1] == '\r'))
+            buf[--len] = '\0';
+
+        char *s = buf;
+        while(*s == ' ') s++;
+        if(*s == '\0' || *s == '#') continue;
+
+        int n = 0;
+        for(;;) {
+            while(*s == ' ') s++;
+            if(n < ADC_STIM_MAX_COLUMNS) fields[n++] = s;
+            while(*s && *s != ',' && *s != ';' && *s != '\t') s++;
+            char *end = s;
+            while(end > fields[n-1] && end[-1] == ' ') end--;
+            if(*s == '\0') {
+                *end = '\0';
+                break;
+            }
+            *end = '\0';
+            s++;
+        }
+        return n;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Read the next row into a->val, and work out when it applies; at the end of
+// the file a->valid is left FALSE. Returns FALSE on a bad row.
+//-----------------------------------------------------------------------------
+static BOOL ReadAdcRow(AdcStim *a)
+{
+    char buf[ADC_STIM_MAX_LINE];
+    char *fields[ADC_STIM_MAX_COLUMNS];
+
+    a->valid = FALSE;
+    int n = ReadCsvLine(a, buf, fields);
+    if(n == 0) return TRUE;
+    if(n < 0) {
+        Error("%s line %d: line too long", a->filename, a->line);
+        return FALSE;
+    }
+
+    DWORD cycle = a->start + a->rows;
+    if(a->timeUnit != 0) {
+        char *end;
+        double v = strtod(fields[0], &end);
+        if(end == fields[0] || *end != '\0' || v < 0) {
+            Error("%s line %d: bad time '%s'", a->filename, a->line,
+                fields[0]);
+            return FALSE;
+        }
+        if(a->timeUnit > 0) v = v * a->timeUnit / Prog.cycleTime;
+        cycle = a->start + (DWORD)(v + 0.5);
+        if(a->rows > 0 && cycle < a->cycle) {
+            Error("%s line %d: rows out of order", a->filename, a->line);
+            return FALSE;
+        }
+    }
+
+    int i;
+    for(i = 0; i < a->columns; i++) {
+        a->has[i] = FALSE;
+        if(a->slot[i] < 0 || i >= n || *fields[i] == '\0') continue;
+        char *end;
+        double v = strtod(fields[i], &end);
+        if(end == fields[i] || *end != '\0') {
+            Error("%s line %d: bad sample '%s'", a->filename, a->line,
+                fields[i]);
+            return FALSE;
+        }
+        if(v > 32767) v = 32767;
+        if(v < -32768) v = -32768;
+        a->val[i] = (SWORD)floor(v + 0.5);
+        a->has[i] = TRUE;
+    }
+
+    a->cycle = cycle;
+    a->rows++;
+    a->valid = TRUE;
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Find a column by its name in the header, or by its number.
+//-----------------------------------------------------------------------------
+static int FindColumn(char **header, int n, char *name)
+{
+    char *end;
+    long k = strtol(name, &end, 10);
+    if(end != name && *end == '\0') {
+        return (k >= 1 && k <= n) ? (int)k - 1 : -1;
+    }
+    int i;
+    for(i = 0; i < n; i++) {
+        if(strcmp(header[i], name)==0) return i;
+    }
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Open a CSV file of samples, to be replayed from the current cycle on, with
+// the columns going to the READ ADCs as the map (or, if it is NULL, the
+// header) says. Returns NULL, after an error message, if it can't be done.
+//-----------------------------------------------------------------------------
+AdcStim *OpenAdcStim(char *filename, char *map)
+{
+    AdcStim *a = (AdcStim *)CheckMalloc(sizeof(AdcStim));
+    memset(a, 0, sizeof(*a));
+    strncpy(a->filename, filename, sizeof(a->filename) - 1);
+
+    if(strcmp(filename, "-") == 0) {
+        a->f = stdin;
+    } else {
+        a->f = fopen(filename, "r");
+    }
+    if(!a->f) {
+        Error(_("Couldn't open '%s'."), filename);
+        CheckFree(a);
+        return NULL;
+    }
+
+    char buf[ADC_STIM_MAX_LINE];
+    char *header[ADC_STIM_MAX_COLUMNS];
+    int n = ReadCsvLine(a, buf, header);
+    if(n <= 0) {
+        Error("%s: no header line", a->filename);
+        goto bad;
+    }
+    a->columns = n;
+
+    int i;
+    if(strcmp(header[0], "cycle")==0) {
+        a->timeUnit = -1;
+    } else if(strcmp(header[0], "ms")==0) {
+        a->timeUnit = 1000;
+    } else if(strcmp(header[0], "s")==0) {
+        a->timeUnit = 1000000;
+    }
+    for(i = 0; i < n; i++) {
+        a->slot[i] = -1;
+    }
+
+    if(map && *map) {
+        char m[MAX_COMMENT_LEN];
+        strncpy(m, map, sizeof(m) - 1);
+        m[sizeof(m) - 1] = '\0';
+        char *tok;
+        for(tok = strtok(m, " ,"); tok; tok = strtok(NULL, " ,")) {
+            char *eq = strchr(tok, '=');
+            if(!eq) {
+                Error("%s: expected 'column=name', not '%s'", a->filename,
+                    tok);
+                goto bad;
+            }
+            *eq = '\0';
+            int c = FindColumn(header, n, tok);
+            if(c < 0 || (c == 0 && a->timeUnit != 0)) {
+                Error("%s: no column '%s'", a->filename, tok);
+                goto bad;
+            }
+            a->slot[c] = FindAdcShadowSlot(eq + 1, NULL);
+            if(a->slot[c] < 0) {
+                Error("%s: '%s' is not read by a READ ADC", a->filename,
+                    eq + 1);
+                goto bad;
+            }
+        }
+    } else {
+        BOOL any = FALSE;
+        for(i = (a->timeUnit != 0) ? 1 : 0; i < n; i++) {
+            a->slot[i] = FindAdcShadowSlot(header[i], NULL);
+            if(a->slot[i] >= 0) any = TRUE;
+        }
+        if(!any) {
+            Error("%s: no column is named for a READ ADC", a->filename);
+            goto bad;
+        }
+    }
+
+    a->start = SimulationCycles();
+    if(!ReadAdcRow(a)) goto bad;
+    return a;
+
+bad:
+    CloseAdcStim(a);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Apply the rows that are due by the cycle that is about to be simulated.
+// Returns FALSE, after an error message, on a bad row.
+//-----------------------------------------------------------------------------
+BOOL StepAdcStim(AdcStim *a)
+{
+    DWORD now = SimulationCycles();
+    while(a->valid && a->cycle <= now) {
+        int i;
+        for(i = 0; i < a->columns; i++) {
+            if(a->has[i]) SetAdcShadowSlot(a->slot[i], a->val[i]);
+        }
+        if(!ReadAdcRow(a)) return FALSE;
+    }
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Is the whole file applied?
+//-----------------------------------------------------------------------------
+BOOL AdcStimDone(AdcStim *a)
+{
+    return !a->valid;
+}
+
+//-----------------------------------------------------------------------------
+// The cycle at which the next row applies, so that fast-forward doesn't skip
+// over it; 0xffffffff if there is none.
+//-----------------------------------------------------------------------------
+DWORD AdcStimNextCycle(AdcStim *a)
+{
+    return a->valid ? a->cycle : 0xffffffff;
+}
+
+//-----------------------------------------------------------------------------
+void CloseAdcStim(AdcStim *a)
+{
+    if(a->f && a->f != stdin) fclose(a->f);
+    CheckFree(a);
+}
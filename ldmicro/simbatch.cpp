@@ -0,0 +1,984 @@
+//-----------------------------------------------------------------------------
+// This file is part of LDmicro.
+//
+// LDmicro is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LDmicro is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LDmicro.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Run the simulator without the GUI, for regression tests on a build server:
+// `ldmicro /s src.ld cycles [stimulus.txt [trace.txt [wave.vcd]]]'. The
+// program is run for the given number of PLC cycles as fast as we can go,
+// with the inputs driven from the stimulus file; every change of an output,
+// relay or variable, and every byte sent by the UART, is written to the trace
+// file. If a wave file is given then the waveform recorder is on, and what it
+// holds at the end (the most recent changes, as many as fit) is saved there.
+// With `/sf' the simulator fast-forwards over cycles in which nothing happens
+// but timers counting; the trace is the same, only faster to get. With `/sp'
+// the run is profiled, and the report goes next to the trace, as trace.prof
+// and as trace.json. If the program uses the EEPROM, which starts blank, a
+// report of the wear on it goes next to the trace as trace.wear.
+//
+// If the stimulus argument is `@list.txt' then list.txt names one stimulus
+// file per line, and the program is run once for each of them, with as many
+// runs at a time as there are processors; each trace goes next to its
+// stimulus file, with the extension .trace.
+//
+// The stimulus file is plain text, one event per line, `#' starts a comment:
+//
+//      <when> <name> <value>       set a contact/relay (0 or 1), the shadow
+//                                  of a READ ADC, or any other variable
+//      <when> uart <bytes>         send bytes to the program's UART; either
+//                                  numbers or a "quoted string" with C escapes
+//      <when> uartfile <file>      send the whole of a file, or of a pipe, or
+//                                  of standard input if the name is `-'
+//      <when> uartfifo <rx> <tx>   make the UART's receive and transmit FIFOs
+//                                  that deep (1 and 1 to start with)
+//      <when> adcfile <file> [<map>]
+//                                  replay samples from a CSV file (or `-')
+//                                  into the READ ADCs, from now on; see
+//                                  simadc.cpp for the format and the map
+//      <when> break rung <n> [if <cond>]
+//      <when> break op <n> [if <cond>]
+//      <when> watch <cond>         write a `break' line to the trace whenever
+//                                  the breakpoint or watchpoint is hit; see
+//                                  AddSimBreakpoint() for the syntax
+//      <when> unbreak              remove all of them
+//      <when> snapshot <file>      save the whole state of the simulation
+//      <when> restore <file>       go back to a saved state, cycle count and
+//                                  all; to fork many runs from one state
+//
+// <when> is a cycle number, or a time like `250ms' that is converted to
+// cycles with the cycle time of the program. Events must be in order.
+//
+// The bytes sent to the UART go over the line one after the other, at the
+// baud rate of the program, so several may arrive in one cycle; one that
+// arrives when the receive FIFO is full is lost, and written to the trace as
+// an overrun.
+//-----------------------------------------------------------------------------
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "ldmicro.h"
+
+// Everything about one run of the program, so that several can go at once.
+struct BatchRunTag {
+    FILE       *stimulusFile;
+    int         stimulusLine;
+
+    // The next event from the stimulus file, read ahead of time so that we
+    // know at which cycle to apply it.
+    struct {
+        BOOL    valid;
+        DWORD   cycle;
+        char    name[MAX_NAME_LEN];
+        char    value[MAX_COMMENT_LEN];
+    } nextEvent;
+
+    // Bytes waiting to go over the line to the program's UART; when they
+    // run low they are topped up from the `uartfile', if there is one.
+    BYTE        uartPending[4096];
+    int         uartPendingHead;
+    int         uartPendingCount;
+    FILE       *uartFile;
+
+    // Samples being replayed into the READ ADCs, from an `adcfile'.
+    AdcStim    *adcStim;
+
+    FILE       *traceFile;
+
+    // The I/O list items that we write to the trace whenever they change.
+    struct {
+        int     io;
+        int     slot;
+        BOOL    isBit;
+        SDWORD  val;
+    } traced[MAX_IO];
+    int         tracedCount;
+
+    SimContext *sim;
+
+    // How it went; halted is why the program stopped before the end, if it
+    // did, or else empty.
+    BOOL        ok;
+    char        halted[MAX_COMMENT_LEN];
+    DWORD       cycles;
+    DWORD       skipped;
+    double      secs;
+};
+
+static void TraceChanges(BatchRun *r, BOOL all);
+
+//-----------------------------------------------------------------------------
+// Convert a time from the stimulus file to a cycle number.
+//-----------------------------------------------------------------------------
+static BOOL ParseWhen(char *s, DWORD *cycle)
+{
+    char *end;
+    double v = strtod(s, &end);
+    if(end == s || v < 0) return FALSE;
+    if(strcmp(end, "ms") == 0) {
+        v = v * 1000.0 / Prog.cycleTime;
+    } else if(strcmp(end, "s") == 0) {
+        v = v * 1000000.0 / Prog.cycleTime;
+    } else if(*end != '\0') {
+        return FALSE;
+    }
+    *cycle = (DWORD)(v + 0.5);
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Read the next event from the stimulus file into r->nextEvent; at the end of
+// the file r->nextEvent.valid is left FALSE. Returns FALSE on a syntax error.
+//-----------------------------------------------------------------------------
+static BOOL ReadNextEvent(BatchRun *r)
+{
+    char line[MAX_COMMENT_LEN];
+
+    r->nextEvent.valid = FALSE;
+    if(!r->stimulusFile) return TRUE;
+
+    while(fgets(line, sizeof(line), r->stimulusFile)) {
+        r->stimulusLine++;
+
+        char *s = line;
+        while(isspace(*s)) s++;
+        if(*s == '\0' || *s == '#') continue;
+
+        char when[MAX_NAME_LEN];
+        int n = strlen(s);
+        if(sscanf(s, "%s %s %n", when, r->nextEvent.name, &n) < 2) {
+            Error("Stimulus line %d: expected '<when> <name> <value>'",
+                r->stimulusLine);
+            return FALSE;
+        }
+        s += n;
+        // The value is the rest of the line; a string may contain spaces.
+        strcpy(r->nextEvent.value, s);
+        for(n = strlen(r->nextEvent.value) - 1;
+            n >= 0 && isspace(r->nextEvent.value[n]); n--)
+        {
+            r->nextEvent.value[n] = '\0';
+        }
+
+        DWORD cycle;
+        if(!ParseWhen(when, &cycle)) {
+            Error("Stimulus line %d: bad time '%s'", r->stimulusLine, when);
+            return FALSE;
+        }
+        if(cycle < r->nextEvent.cycle) {
+            Error("Stimulus line %d: events are not in order", r->stimulusLine);
+            return FALSE;
+        }
+        r->nextEvent.cycle = cycle;
+        r->nextEvent.valid = TRUE;
+        return TRUE;
+    }
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Is an event one of ours, rather than a value for an item in the I/O list?
+//-----------------------------------------------------------------------------
+static BOOL SpecialEvent(char *name)
+{
+    static char *Special[] = { "uart", "uartfile", "adcfile", "uartfifo",
+        "break", "watch", "unbreak", "snapshot", "restore" };
+    int i;
+    for(i = 0; i < (int)(sizeof(Special)/sizeof(Special[0])); i++) {
+        if(strcmp(Special[i], name)==0) return TRUE;
+    }
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// Find the item in the I/O list that an event sets, or -1 if it isn't there.
+//-----------------------------------------------------------------------------
+static int EventIo(char *name)
+{
+    int i;
+    for(i = 0; i < Prog.io.count; i++) {
+        if(strcmp(Prog.io.assignment[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Read through a stimulus file and give every item that it sets a slot, so
+// that the runs only have to look them up. The lists of names are shared by
+// all the instances, so this must happen on the main thread, before any run
+// starts. Returns FALSE if the file is bad or sets something that isn't in
+// the I/O list.
+//-----------------------------------------------------------------------------
+static BOOL ResolveStimulusNames(char *stimulus)
+{
+    if(!stimulus || !*stimulus) return TRUE;
+
+    BatchRun *r = (BatchRun *)CheckMalloc(sizeof(BatchRun));
+    if(!r) return FALSE;
+    r->stimulusFile = fopen(stimulus, "r");
+    if(!r->stimulusFile) {
+        Error("Couldn't open stimulus file '%s'", stimulus);
+        CheckFree(r);
+        return FALSE;
+    }
+    r->stimulusLine = 0;
+    r->nextEvent.cycle = 0;
+
+    BOOL ok = TRUE;
+    for(;;) {
+        if(!ReadNextEvent(r)) {
+            ok = FALSE;
+            break;
+        }
+        if(!r->nextEvent.valid) break;
+        if(SpecialEvent(r->nextEvent.name)) continue;
+
+        int i = EventIo(r->nextEvent.name);
+        if(i < 0) {
+            Error("%s line %d: '%s' is not in the I/O list", stimulus,
+                r->stimulusLine, r->nextEvent.name);
+            ok = FALSE;
+            break;
+        }
+        int slot;
+        switch(Prog.io.assignment[i].type) {
+            case IO_TYPE_INT_INPUT:
+            case IO_TYPE_DIG_INPUT:
+            case IO_TYPE_DIG_OUTPUT:
+            case IO_TYPE_INTERNAL_RELAY:
+            case IO_TYPE_MODBUS_COIL:
+            case IO_TYPE_MODBUS_CONTACT:
+                slot = AddSimulationSlot(r->nextEvent.name, TRUE);
+                break;
+
+            case IO_TYPE_READ_ADC:
+                slot = AdcShadowSlot(r->nextEvent.name);
+                break;
+
+            default:
+                slot = AddSimulationSlot(r->nextEvent.name, FALSE);
+                break;
+        }
+        if(slot < 0) {
+            Error("%s line %d: too many items to simulate", stimulus,
+                r->stimulusLine);
+            ok = FALSE;
+            break;
+        }
+    }
+
+    fclose(r->stimulusFile);
+    CheckFree(r);
+    return ok;
+}
+
+//-----------------------------------------------------------------------------
+// Queue the bytes from a `uart' event: numbers, or a quoted string.
+//-----------------------------------------------------------------------------
+static BOOL QueueUartByte(BatchRun *r, BYTE b)
+{
+    if(r->uartPendingCount >= (int)sizeof(r->uartPending)) return FALSE;
+    r->uartPending[(r->uartPendingHead + r->uartPendingCount++) %
+        sizeof(r->uartPending)] = b;
+    return TRUE;
+}
+
+static BOOL QueueUartBytes(BatchRun *r, char *s)
+{
+    while(*s) {
+        BYTE b;
+        if(*s == '"') {
+            s++;
+            while(*s && *s != '"') {
+                if(*s == '\\') {
+                    s++;
+                    switch(*s) {
+                        case 'r': b = '\r'; break;
+                        case 'n': b = '\n'; break;
+                        case 't': b = '\t'; break;
+                        case '0': b = '\0'; break;
+                        case 'x': b = (BYTE)strtol(s + 1, &s, 16); s--; break;
+                        default:  b = *s; break;
+                    }
+                } else {
+                    b = *s;
+                }
+                s++;
+                if(!QueueUartByte(r, b)) return FALSE;
+            }
+            if(*s != '"') return FALSE;
+            s++;
+        } else if(isspace(*s)) {
+            s++;
+        } else {
+            char *end;
+            b = (BYTE)strtol(s, &end, 0);
+            if(end == s) return FALSE;
+            s = end;
+            if(!QueueUartByte(r, b)) return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Start sending a file (or a pipe, or standard input) to the UART, after
+// whatever is already waiting.
+//-----------------------------------------------------------------------------
+static void CloseUartFile(BatchRun *r)
+{
+    if(r->uartFile && r->uartFile != stdin) fclose(r->uartFile);
+    r->uartFile = NULL;
+}
+
+static BOOL OpenUartFile(BatchRun *r, char *name)
+{
+    CloseUartFile(r);
+    if(strcmp(name, "-") == 0) {
+        r->uartFile = stdin;
+    } else {
+        r->uartFile = fopen(name, "rb");
+    }
+    return r->uartFile != NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Put what the line brings in during this cycle into the program's UART,
+// tracing any byte that there is no room for.
+//-----------------------------------------------------------------------------
+static void FeedUart(BatchRun *r)
+{
+    int size = sizeof(r->uartPending);
+
+    if(r->uartFile && r->uartPendingCount < size/2) {
+        // the free part of the ring, up to where it wraps
+        int tail = (r->uartPendingHead + r->uartPendingCount) % size;
+        int room = (tail >= r->uartPendingHead || r->uartPendingCount == 0) ?
+            size - tail : r->uartPendingHead - tail;
+        int n = fread(r->uartPending + tail, 1, room, r->uartFile);
+        r->uartPendingCount += n;
+        if(n < room) CloseUartFile(r);
+    }
+
+    int n = UartLineBytesDue(r->uartPendingCount);
+    while(n-- > 0) {
+        BYTE b = r->uartPending[r->uartPendingHead];
+        r->uartPendingHead = (r->uartPendingHead + 1) % size;
+        r->uartPendingCount--;
+        if(!QueueUartCharacter(b) && r->traceFile) {
+            fprintf(r->traceFile, "%lu uart overrun 0x%02x\n",
+                SimulationCycles(), b);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Apply one event from the stimulus file to the simulation.
+//-----------------------------------------------------------------------------
+static BOOL ApplyEvent(BatchRun *r)
+{
+    if(strcmp(r->nextEvent.name, "uart") == 0) {
+        if(!QueueUartBytes(r, r->nextEvent.value)) {
+            Error("Stimulus line %d: bad UART bytes '%s'", r->stimulusLine,
+                r->nextEvent.value);
+            return FALSE;
+        }
+        return TRUE;
+    }
+    if(strcmp(r->nextEvent.name, "uartfile") == 0) {
+        if(!OpenUartFile(r, r->nextEvent.value)) {
+            Error("Stimulus line %d: couldn't open '%s'", r->stimulusLine,
+                r->nextEvent.value);
+            return FALSE;
+        }
+        return TRUE;
+    }
+    if(strcmp(r->nextEvent.name, "adcfile") == 0) {
+        char file[MAX_PATH];
+        int n;
+        if(sscanf(r->nextEvent.value, "%259s%n", file, &n) != 1) {
+            Error("Stimulus line %d: expected 'adcfile <file> [<map>]'",
+                r->stimulusLine);
+            return FALSE;
+        }
+        if(r->adcStim) CloseAdcStim(r->adcStim);
+        r->adcStim = OpenAdcStim(file, r->nextEvent.value + n);
+        return r->adcStim != NULL;
+    }
+    if(strcmp(r->nextEvent.name, "uartfifo") == 0) {
+        int rx, tx;
+        if(sscanf(r->nextEvent.value, "%d %d", &rx, &tx) != 2 ||
+            !SetUartFifoSizes(rx, tx))
+        {
+            Error("Stimulus line %d: expected 'uartfifo <rx> <tx>', each "
+                "from 1 to %d", r->stimulusLine, SIM_UART_FIFO_MAX);
+            return FALSE;
+        }
+        return TRUE;
+    }
+    if(strcmp(r->nextEvent.name, "break") == 0 ||
+        strcmp(r->nextEvent.name, "watch") == 0)
+    {
+        char spec[MAX_COMMENT_LEN + 8];
+        if(strcmp(r->nextEvent.name, "watch") == 0) {
+            sprintf(spec, "watch %s", r->nextEvent.value);
+        } else {
+            strcpy(spec, r->nextEvent.value);
+        }
+        return AddSimBreakpoint(spec);
+    }
+    if(strcmp(r->nextEvent.name, "unbreak") == 0) {
+        ClearSimBreakpoints();
+        return TRUE;
+    }
+    if(strcmp(r->nextEvent.name, "snapshot") == 0) {
+        if(!SaveSimSnapshot(r->nextEvent.value)) {
+            Error("Stimulus line %d: couldn't write snapshot '%s'",
+                r->stimulusLine, r->nextEvent.value);
+            return FALSE;
+        }
+        return TRUE;
+    }
+    if(strcmp(r->nextEvent.name, "restore") == 0) {
+        if(!LoadSimSnapshot(r->nextEvent.value)) return FALSE;
+        // The trace goes on from the restored state.
+        TraceChanges(r, TRUE);
+        return TRUE;
+    }
+
+    int i = EventIo(r->nextEvent.name);
+    if(i < 0) {
+        Error("Stimulus line %d: '%s' is not in the I/O list", r->stimulusLine,
+            r->nextEvent.name);
+        return FALSE;
+    }
+    char *end;
+    SDWORD v = strtol(r->nextEvent.value, &end, 0);
+    if(end == r->nextEvent.value) {
+        Error("Stimulus line %d: bad value '%s'", r->stimulusLine,
+            r->nextEvent.value);
+        return FALSE;
+    }
+
+    // The slots were all given out by ResolveStimulusNames(), so here we
+    // only look them up; the lists may not grow while other runs read them.
+    int slot;
+    BOOL isBit;
+    if(Prog.io.assignment[i].type == IO_TYPE_READ_ADC) {
+        slot = FindAdcShadowSlot(r->nextEvent.name, NULL);
+        if(slot >= 0) SetAdcShadowSlot(slot, (SWORD)v);
+    } else {
+        slot = SimulationSlot(r->nextEvent.name, &isBit);
+        if(slot >= 0) SetSimulationSlotValue(slot, isBit, v);
+    }
+    if(slot < 0) oops();
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Called by the simulator instead of updating the terminal window when the
+// program sends a byte with UART SEND.
+//-----------------------------------------------------------------------------
+void BatchUartSend(BatchRun *r, BYTE b)
+{
+    if(!r->traceFile) return;
+    DWORD cycle = SimulationCycles();
+    if(b >= ' ' && b < 0x7f && b != '\'' && b != '\\') {
+        fprintf(r->traceFile, "%lu uart 0x%02x '%c'\n", cycle, b, b);
+    } else {
+        fprintf(r->traceFile, "%lu uart 0x%02x\n", cycle, b);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Called by the simulator when a breakpoint or watchpoint is hit; a batch
+// run doesn't stop, but says where in the trace.
+//-----------------------------------------------------------------------------
+void BatchBreak(BatchRun *r, char *what)
+{
+    if(!r->traceFile) return;
+    fprintf(r->traceFile, "%lu break %s\n", SimulationCycles(), what);
+}
+
+//-----------------------------------------------------------------------------
+// Called by the simulator when the program can't go on (a division by zero).
+// Only this run stops; it fails, and says why in its trace and its report.
+//-----------------------------------------------------------------------------
+void BatchHalt(BatchRun *r, char *why)
+{
+    if(r->halted[0]) return;
+    strncpy(r->halted, why, sizeof(r->halted) - 1);
+    r->halted[sizeof(r->halted) - 1] = '\0';
+    r->ok = FALSE;
+    if(!r->traceFile) return;
+    fprintf(r->traceFile, "%lu halt %s\n", SimulationCycles(), why);
+}
+
+//-----------------------------------------------------------------------------
+// Pick the I/O list items that go to the trace: the ones that the program
+// drives, but not the timers, which would change every cycle.
+//-----------------------------------------------------------------------------
+static void FindTracedItems(BatchRun *r)
+{
+    int i;
+    r->tracedCount = 0;
+    for(i = 0; i < Prog.io.count; i++) {
+        switch(Prog.io.assignment[i].type) {
+            case IO_TYPE_DIG_OUTPUT:
+            case IO_TYPE_INTERNAL_RELAY:
+            case IO_TYPE_MODBUS_COIL:
+            case IO_TYPE_GENERAL:
+            case IO_TYPE_PERSIST:
+            case IO_TYPE_COUNTER:
+            case IO_TYPE_MODBUS_HREG:
+            case IO_TYPE_PORT_OUTPUT:
+            case IO_TYPE_UART_RX:
+                break;
+
+            default:
+                continue;
+        }
+        int slot = SimulationSlot(Prog.io.assignment[i].name,
+            &r->traced[r->tracedCount].isBit);
+        if(slot < 0) continue;
+        r->traced[r->tracedCount].io = i;
+        r->traced[r->tracedCount].slot = slot;
+        r->traced[r->tracedCount].val = SimulationSlotValue(slot,
+            r->traced[r->tracedCount].isBit);
+        r->tracedCount++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Write the traced items that changed during the last cycle; all of them if
+// all is TRUE.
+//-----------------------------------------------------------------------------
+static void TraceChanges(BatchRun *r, BOOL all)
+{
+    int i;
+    for(i = 0; i < r->tracedCount; i++) {
+        SDWORD v = SimulationSlotValue(r->traced[i].slot, r->traced[i].isBit);
+        if(v != r->traced[i].val || all) {
+            r->traced[i].val = v;
+            fprintf(r->traceFile, "%lu %s %ld\n", SimulationCycles(),
+                Prog.io.assignment[r->traced[i].io].name, v);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Run the program once, for the given number of cycles, in the instance of
+// the run (which must be fresh). The outcome is left in the run. Returns
+// FALSE if a file could not be opened or the stimulus file is bad.
+//-----------------------------------------------------------------------------
+static BOOL RunBatch(BatchRun *r, DWORD cycles, char *stimulus, char *trace,
+    char *wave)
+{
+    clock_t start;
+    DWORD n;
+
+    r->stimulusFile = NULL;
+    r->stimulusLine = 0;
+    r->nextEvent.valid = FALSE;
+    r->nextEvent.cycle = 0;
+    r->uartPendingHead = 0;
+    r->uartPendingCount = 0;
+    r->uartFile = NULL;
+    r->adcStim = NULL;
+    r->ok = TRUE;
+    r->halted[0] = '\0';
+    r->cycles = 0;
+    r->skipped = 0;
+    r->secs = 0;
+
+    if(stimulus && *stimulus) {
+        r->stimulusFile = fopen(stimulus, "r");
+        if(!r->stimulusFile) {
+            Error("Couldn't open stimulus file '%s'", stimulus);
+            r->ok = FALSE;
+            return FALSE;
+        }
+    }
+    r->traceFile = fopen(trace, "w");
+    if(!r->traceFile) {
+        Error("Couldn't write trace file '%s'", trace);
+        if(r->stimulusFile) fclose(r->stimulusFile);
+        r->ok = FALSE;
+        return FALSE;
+    }
+
+    UseSimContext(r->sim);
+    FindTracedItems(r);
+    TraceChanges(r, TRUE);
+
+    if(!ReadNextEvent(r)) {
+        r->ok = FALSE;
+        goto done;
+    }
+
+    start = clock();
+    for(n = 0; n < cycles; n++) {
+        while(r->nextEvent.valid && r->nextEvent.cycle <= SimulationCycles()) {
+            if(!ApplyEvent(r) || !ReadNextEvent(r)) {
+                r->ok = FALSE;
+                goto done;
+            }
+        }
+        if(r->adcStim && !StepAdcStim(r->adcStim)) {
+            r->ok = FALSE;
+            goto done;
+        }
+        FeedUart(r);
+
+        SimulateOneCycle(FALSE);
+        TraceChanges(r, FALSE);
+        if(r->halted[0]) {
+            n++;
+            break;
+        }
+
+        // Never skip past the next event or ADC sample, or while there is
+        // UART input to feed in.
+        if(FastForwardSimulation && r->uartPendingCount == 0 && !r->uartFile) {
+            DWORD max = cycles - n - 1;
+            if(r->nextEvent.valid) {
+                DWORD until = r->nextEvent.cycle > SimulationCycles() ?
+                    r->nextEvent.cycle - SimulationCycles() : 0;
+                if(until < max) max = until;
+            }
+            if(r->adcStim) {
+                DWORD next = AdcStimNextCycle(r->adcStim);
+                DWORD until = next > SimulationCycles() ?
+                    next - SimulationCycles() : 0;
+                if(until < max) max = until;
+            }
+            DWORD k = FastForwardCycles(max);
+            n += k;
+            r->skipped += k;
+        }
+    }
+    r->secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    r->cycles = n;
+
+    if(wave && !SaveWaveformAsVcd(wave)) {
+        Error("Couldn't write waveform file '%s'", wave);
+        r->ok = FALSE;
+    }
+    if(EepromFunctionUsed()) {
+        char wear[MAX_PATH];
+        SetExt(wear, trace, "wear");
+        if(!SaveEepromWear(wear)) {
+            Error("Couldn't write EEPROM wear report '%s'", wear);
+            r->ok = FALSE;
+        }
+    }
+
+done:
+    ClearSimBreakpoints();
+    UseSimContext(NULL);
+    CloseUartFile(r);
+    if(r->adcStim) CloseAdcStim(r->adcStim);
+    r->adcStim = NULL;
+    fclose(r->traceFile);
+    r->traceFile = NULL;
+    if(r->stimulusFile) fclose(r->stimulusFile);
+    r->stimulusFile = NULL;
+    return r->ok;
+}
+
+//-----------------------------------------------------------------------------
+// Run the loaded program for the given number of cycles. Returns FALSE if
+// the simulation could not be started or the stimulus file is bad.
+//-----------------------------------------------------------------------------
+BOOL SimulateBatch(DWORD cycles, char *stimulus, char *trace, char *wave)
+{
+    static BatchRun Run;
+    BOOL ok = FALSE;
+
+    InSimulationMode = TRUE;
+    RecordingWaveform = (wave && *wave);
+    if(!ClearSimulationData()) goto done;
+    if(!ResolveStimulusNames(stimulus)) goto done;
+
+    Run.sim = NewSimContext(&Run);
+    if(!Run.sim) goto done;
+    ok = RunBatch(&Run, cycles, stimulus, trace, RecordingWaveform ? wave :
+        NULL);
+    FreeSimContext(Run.sim);
+    if(Run.halted[0])
+        ConsolePrintf("halted at cycle %lu: %s\n", Run.cycles, Run.halted);
+    if(!ok) goto done;
+
+    ConsolePrintf("simulated %lu cycles in %.3f s, %.0f cycles/s\n",
+        Run.cycles, Run.secs, Run.secs > 0 ? Run.cycles / Run.secs : 0.0);
+    if(FastForwardSimulation)
+        ConsolePrintf("%lu of them fast-forwarded\n", Run.skipped);
+
+    if(ProfilingSimulation) {
+        char profile[MAX_PATH];
+        SetExt(profile, trace, "prof");
+        if(!SaveProfile(profile, FALSE)) {
+            Error("Couldn't write profile '%s'", profile);
+            ok = FALSE;
+        }
+        SetExt(profile, trace, "json");
+        if(!SaveProfile(profile, TRUE)) {
+            Error("Couldn't write profile '%s'", profile);
+            ok = FALSE;
+        }
+    }
+
+done:
+    InSimulationMode = FALSE;
+    return ok;
+}
+
+//-----------------------------------------------------------------------------
+// The runs of a list of stimulus files, shared by the worker threads, which
+// each take the next one that no one has started yet.
+//-----------------------------------------------------------------------------
+typedef struct ListRunTag {
+    char    stimulus[MAX_PATH];
+    BOOL    ok;
+    char    halted[MAX_COMMENT_LEN];
+    DWORD   cycles;
+    DWORD   skipped;
+} ListRun;
+static ListRun *ListRuns;
+static int ListRunsCount;
+static volatile LONG ListRunsNext;
+static DWORD ListCycles;
+
+static DWORD WINAPI BatchWorker(LPVOID param)
+{
+    BatchRun *r = (BatchRun *)param;
+    for(;;) {
+        LONG i = InterlockedIncrement(&ListRunsNext) - 1;
+        if(i >= ListRunsCount) break;
+
+        char trace[MAX_PATH];
+        SetExt(trace, ListRuns[i].stimulus, "trace");
+        ResetSimContext(r->sim, r);
+        RunBatch(r, ListCycles, ListRuns[i].stimulus, trace, NULL);
+        ListRuns[i].ok = r->ok;
+        strcpy(ListRuns[i].halted, r->halted);
+        ListRuns[i].cycles = r->cycles;
+        ListRuns[i].skipped = r->skipped;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Read the next stimulus file name from a list; FALSE at the end of it.
+//-----------------------------------------------------------------------------
+static BOOL ReadListLine(FILE *f, char *name)
+{
+    char line[MAX_PATH];
+    while(fgets(line, sizeof(line), f)) {
+        char *s = line;
+        while(isspace(*s)) s++;
+        int n;
+        for(n = strlen(s); n > 0 && isspace(s[n - 1]); n--)
+            s[n - 1] = '\0';
+        if(*s == '\0' || *s == '#') continue;
+        strcpy(name, s);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// Run the loaded program once for each stimulus file named in a list, each
+// run in an instance of its own, spread over one thread per processor.
+// Returns FALSE if any of the runs failed.
+//-----------------------------------------------------------------------------
+BOOL SimulateBatchList(DWORD cycles, char *list)
+{
+    BOOL ok = FALSE;
+    HANDLE thread[MAXIMUM_WAIT_OBJECTS];
+    BatchRun *run[MAXIMUM_WAIT_OBJECTS];
+    int threads = 0;
+    SYSTEM_INFO si;
+    DWORD startTime;
+    double secs;
+    DWORD total = 0;
+    int failed = 0;
+    char name[MAX_PATH];
+    int i;
+
+    FILE *f = fopen(list, "r");
+    if(!f) {
+        Error("Couldn't open stimulus list '%s'", list);
+        return FALSE;
+    }
+    ListRunsCount = 0;
+    while(ReadListLine(f, name))
+        ListRunsCount++;
+    ListRuns = (ListRun *)CheckMalloc((ListRunsCount + 1) * sizeof(ListRun));
+    rewind(f);
+    for(i = 0; i < ListRunsCount && ReadListLine(f, name); i++) {
+        strcpy(ListRuns[i].stimulus, name);
+    }
+    fclose(f);
+
+    InSimulationMode = TRUE;
+    RecordingWaveform = FALSE;
+    if(!ClearSimulationData()) goto done;
+    for(i = 0; i < ListRunsCount; i++) {
+        if(!ResolveStimulusNames(ListRuns[i].stimulus)) goto done;
+    }
+
+    GetSystemInfo(&si);
+    threads = si.dwNumberOfProcessors;
+    if(threads > ListRunsCount) threads = ListRunsCount;
+    if(threads > MAXIMUM_WAIT_OBJECTS) threads = MAXIMUM_WAIT_OBJECTS;
+
+    ListCycles = cycles;
+    ListRunsNext = 0;
+    startTime = GetTickCount();
+    for(i = 0; i < threads; i++) {
+        run[i] = (BatchRun *)CheckMalloc(sizeof(BatchRun));
+        if(!run[i]) break;
+        run[i]->sim = NewSimContext(run[i]);
+        if(!run[i]->sim) {
+            CheckFree(run[i]);
+            break;
+        }
+        thread[i] = CreateThread(NULL, 0, BatchWorker, run[i], 0, NULL);
+        if(!thread[i]) {
+            FreeSimContext(run[i]->sim);
+            CheckFree(run[i]);
+            break;
+        }
+    }
+    threads = i;
+    if(threads == 0 && ListRunsCount > 0) {
+        Error("Couldn't start any simulation threads");
+        goto done;
+    }
+    if(threads > 0)
+        WaitForMultipleObjects(threads, thread, TRUE, INFINITE);
+    secs = (GetTickCount() - startTime) / 1000.0;
+    for(i = 0; i < threads; i++) {
+        CloseHandle(thread[i]);
+        FreeSimContext(run[i]->sim);
+        CheckFree(run[i]);
+    }
+
+    for(i = 0; i < ListRunsCount; i++) {
+        ConsolePrintf("%s: %s, %lu cycles", ListRuns[i].stimulus,
+            ListRuns[i].ok ? "ok" : "FAILED", ListRuns[i].cycles);
+        if(FastForwardSimulation)
+            ConsolePrintf(" (%lu fast-forwarded)", ListRuns[i].skipped);
+        if(ListRuns[i].halted[0])
+            ConsolePrintf(", halted: %s", ListRuns[i].halted);
+        ConsolePrintf("\n");
+        if(!ListRuns[i].ok) failed++;
+        total += ListRuns[i].cycles;
+    }
+    ConsolePrintf("%d runs, %d failed, on %d threads; simulated %lu cycles "
+        "in %.3f s, %.0f cycles/s\n", ListRunsCount, failed, threads, total,
+        secs, secs > 0 ? total / secs : 0.0);
+    ok = (failed == 0);
+
+done:
+    InSimulationMode = FALSE;
+    CheckFree(ListRuns);
+    ListRuns = NULL;
+    return ok;
+}
+
+//-----------------------------------------------------------------------------
+// Handle a command line of `/s[f][p][o][t] src.ld cycles [...]' or `/x src.ld
+// cycles rules.txt', from WinMain() or from the headless main() of the POSIX
+// build (headless.cpp). Never returns; exits with the result of the run.
+//-----------------------------------------------------------------------------
+void SimulateFromCommandLine(char *cmdLine)
+{
+    BOOL check = (memcmp(cmdLine, "/x", 2)==0);
+    char *err =
+        "Bad command line arguments: run 'ldmicro /s[f][p][o][t] src.ld cycles [stimulus.txt [trace.txt [wave.vcd]]]' or 'ldmicro /s[f][o][t] src.ld cycles @list.txt'";
+    if(check)
+        err = "Bad command line arguments: run 'ldmicro /x src.ld cycles rules.txt'";
+
+    char *args[5] = { NULL, NULL, NULL, NULL, NULL };
+    char *s = cmdLine + 2;
+    for(; *s && !isspace(*s); s++) {
+        if(check) {
+            Error(err); doexit(EXIT_FAILURE);
+        } else if(*s == 'f') {
+            FastForwardSimulation = TRUE;
+        } else if(*s == 'p') {
+            ProfilingSimulation = TRUE;
+        } else if(*s == 'o') {
+            OptimizeIntCode = TRUE;
+        } else if(*s == 't') {
+            ThreadedSimulation = TRUE;
+        } else {
+            Error(err); doexit(EXIT_FAILURE);
+        }
+    }
+    int n;
+    for(n = 0; n < (check ? 3 : 5); n++) {
+        while(isspace(*s)) {
+            s++;
+        }
+        if(*s == '\0') break;
+        args[n] = s;
+        while(!isspace(*s) && *s) {
+            s++;
+        }
+        if(*s) {
+            *s = '\0'; s++;
+        }
+    }
+    if(n < (check ? 3 : 2) || !isdigit(*args[1])) {
+        Error(err); doexit(EXIT_FAILURE);
+    }
+    if(!LoadProjectFromFile(args[0])) {
+        Error("Couldn't open '%s', running non-interactively.", args[0]);
+        doexit(EXIT_FAILURE);
+    }
+    GetFullPathName(args[0], sizeof(CurrentSaveFile), CurrentSaveFile, &s);
+
+    GenerateIoList(-1);
+    DWORD cycles = strtoul(args[1], NULL, 10);
+    if(check) {
+        if(!CheckAllInputs(cycles, args[2]))
+            doexit(EXIT_FAILURE);
+        doexit(EXIT_SUCCESS);
+    }
+    if(args[2] && args[2][0] == '@') {
+        // A list of stimulus files, each with its own trace.
+        if(args[3] || ProfilingSimulation) {
+            Error(err); doexit(EXIT_FAILURE);
+        }
+        if(!SimulateBatchList(cycles, args[2] + 1))
+            doexit(EXIT_FAILURE);
+        doexit(EXIT_SUCCESS);
+    }
+
+    char traceFile[MAX_PATH];
+    if(args[3]) {
+        strcpy(traceFile, args[3]);
+    } else {
+        SetExt(traceFile, args[0], "trace");
+    }
+    if(!SimulateBatch(cycles, args[2], traceFile, args[4]))
+        doexit(EXIT_FAILURE);
+    doexit(EXIT_SUCCESS);
+}
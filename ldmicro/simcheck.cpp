@@ -0,0 +1,278 @@
+//-----------------------------------------------------------------------------
+// This file is part of LDmicro.
+//
+// LDmicro is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LDmicro is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LDmicro.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Try a program with every combination of some of its inputs, to check its
+// interlocks: `ldmicro /x src.ld cycles rules.txt'. Each combination is held
+// for the given number of cycles, starting from where the simulator always
+// starts, and the rules are checked at the end of every cycle. This uses the
+// bit-sliced simulator, so SIM_LANES combinations go at once.
+//
+// The rules file is plain text, one item per line, `#' starts a comment:
+//
+//      input <name>            a contact (or any other single bit) to try
+//                              both ways
+//      never <name> ...        single bits that must never all be on at
+//                              once; `!name' means that one is off
+//
+// For each rule we report how many combinations broke it, and the first one
+// that did.
+//-----------------------------------------------------------------------------
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ldmicro.h"
+
+#define MAX_CHECK_INPUTS    30
+#define MAX_CHECK_RULES     64
+#define MAX_RULE_TERMS      16
+
+static struct {
+    char    name[MAX_NAME_LEN];
+    int     slot;
+} Inputs[MAX_CHECK_INPUTS];
+static int InputsCount;
+
+static struct {
+    char    text[MAX_COMMENT_LEN];  // as written, for the report
+    int     slot[MAX_RULE_TERMS];
+    BOOL    on[MAX_RULE_TERMS];
+    int     terms;
+
+    DWORD   brokenBy;               // how many combinations broke it
+    BOOL    found;                  // and the first one that did
+    DWORD   firstCombination;
+    DWORD   firstCycle;
+} Rules[MAX_CHECK_RULES];
+static int RulesCount;
+
+//-----------------------------------------------------------------------------
+// Find the slot of a single bit named in the rules file.
+//-----------------------------------------------------------------------------
+static BOOL RuleBitSlot(char *name, int line, int *slot)
+{
+    BOOL isBit;
+    *slot = SimulationSlot(name, &isBit);
+    if(*slot < 0 || !isBit) {
+        Error("Rules line %d: '%s' is not a single bit of the program", line,
+            name);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Read the inputs and the rules. Call after ClearSimulationData(), so that
+// the names have their slots.
+//-----------------------------------------------------------------------------
+static BOOL ReadRules(char *file)
+{
+    static const char *blank = " \t\r\n";
+    char line[MAX_COMMENT_LEN];
+    int n = 0;
+    BOOL ok = FALSE;
+
+    FILE *f = fopen(file, "r");
+    if(!f) {
+        Error("Couldn't open rules file '%s'", file);
+        return FALSE;
+    }
+    InputsCount = 0;
+    RulesCount = 0;
+    while(fgets(line, sizeof(line), f)) {
+        n++;
+        char *s = strchr(line, '#');
+        if(s) *s = '\0';
+
+        char *word = strtok(line, blank);
+        if(!word) continue;
+        if(strcmp(word, "input") == 0) {
+            char *name = strtok(NULL, blank);
+            if(!name || strtok(NULL, blank)) {
+                Error("Rules line %d: expected 'input <name>'", n);
+                goto done;
+            }
+            if(InputsCount >= MAX_CHECK_INPUTS) {
+                Error("Rules line %d: too many inputs, at most %d", n,
+                    MAX_CHECK_INPUTS);
+                goto done;
+            }
+            strcpy(Inputs[InputsCount].name, name);
+            if(!RuleBitSlot(name, n, &Inputs[InputsCount].slot)) goto done;
+            InputsCount++;
+        } else if(strcmp(word, "never") == 0) {
+            if(RulesCount >= MAX_CHECK_RULES) {
+                Error("Rules line %d: too many rules, at most %d", n,
+                    MAX_CHECK_RULES);
+                goto done;
+            }
+            Rules[RulesCount].text[0] = '\0';
+            Rules[RulesCount].terms = 0;
+            Rules[RulesCount].brokenBy = 0;
+            Rules[RulesCount].found = FALSE;
+            char *name;
+            while((name = strtok(NULL, blank))) {
+                int t = Rules[RulesCount].terms;
+                if(t >= MAX_RULE_TERMS) {
+                    Error("Rules line %d: too many names, at most %d", n,
+                        MAX_RULE_TERMS);
+                    goto done;
+                }
+                if(t > 0) strcat(Rules[RulesCount].text, " ");
+                strcat(Rules[RulesCount].text, name);
+
+                Rules[RulesCount].on[t] = (*name != '!');
+                if(*name == '!') name++;
+                if(!RuleBitSlot(name, n, &Rules[RulesCount].slot[t]))
+                    goto done;
+                Rules[RulesCount].terms++;
+            }
+            if(Rules[RulesCount].terms == 0) {
+                Error("Rules line %d: expected 'never <name> ...'", n);
+                goto done;
+            }
+            RulesCount++;
+        } else {
+            Error("Rules line %d: unknown keyword '%s'", n, word);
+            goto done;
+        }
+    }
+    if(InputsCount == 0 || RulesCount == 0) {
+        Error("Rules file '%s' needs at least one input and one rule", file);
+        goto done;
+    }
+    ok = TRUE;
+
+done:
+    fclose(f);
+    return ok;
+}
+
+#define LANE_BIT(m, l) (((m).w[(l) >> 6] >> ((l) & 63)) & 1)
+
+static int CountLanes(LaneMask *m)
+{
+    int l, n = 0;
+    for(l = 0; l < SIM_LANES; l++)
+        if(LANE_BIT(*m, l)) n++;
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// Run every combination of the inputs, SIM_LANES at a time; lane l of the
+// pass that starts at base tries combination base + l, in which input i is
+// on if bit i is set.
+//-----------------------------------------------------------------------------
+static BOOL RunAllCombinations(DWORD cycles)
+{
+    DWORD combinations = 1ul << InputsCount;
+    DWORD base;
+    int i, j, l, w;
+
+    for(base = 0; base < combinations; base += SIM_LANES) {
+        LaneMask valid;
+        LaneMask broken[MAX_CHECK_RULES];
+
+        ResetLanes();
+        memset(&valid, 0, sizeof(valid));
+        for(l = 0; l < SIM_LANES && base + l < combinations; l++)
+            valid.w[l >> 6] |= 1ull << (l & 63);
+        for(i = 0; i < InputsCount; i++) {
+            LaneMask *m = LaneBitSlot(Inputs[i].slot);
+            memset(m, 0, sizeof(*m));
+            for(l = 0; l < SIM_LANES; l++) {
+                if(((base + l) >> i) & 1)
+                    m->w[l >> 6] |= 1ull << (l & 63);
+            }
+        }
+        memset(broken, 0, sizeof(broken));
+
+        DWORD cycle;
+        for(cycle = 0; cycle < cycles; cycle++) {
+            if(!SimulateLanesCycle()) return FALSE;
+
+            for(i = 0; i < RulesCount; i++) {
+                LaneMask now = valid;
+                for(j = 0; j < Rules[i].terms; j++) {
+                    LaneMask *m = LaneBitSlot(Rules[i].slot[j]);
+                    for(w = 0; w < SIM_LANE_WORDS; w++)
+                        now.w[w] &= Rules[i].on[j] ? m->w[w] : ~m->w[w];
+                }
+                for(w = 0; w < SIM_LANE_WORDS; w++)
+                    broken[i].w[w] |= now.w[w];
+
+                if(Rules[i].found) continue;
+                for(l = 0; l < SIM_LANES; l++) {
+                    if(LANE_BIT(now, l)) {
+                        Rules[i].found = TRUE;
+                        Rules[i].firstCombination = base + l;
+                        Rules[i].firstCycle = cycle;
+                        break;
+                    }
+                }
+            }
+        }
+        for(i = 0; i < RulesCount; i++)
+            Rules[i].brokenBy += CountLanes(&broken[i]);
+    }
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Check the loaded program against the rules file. Returns FALSE if it could
+// not be checked, or if any rule was broken.
+//-----------------------------------------------------------------------------
+BOOL CheckAllInputs(DWORD cycles, char *rules)
+{
+    BOOL ok = FALSE;
+    clock_t start;
+    double secs;
+    int i, j;
+
+    InSimulationMode = TRUE;
+    if(!ClearSimulationData()) goto done;
+    if(!ReadRules(rules)) goto done;
+    if(!PrepareLaneSimulation()) goto done;
+
+    start = clock();
+    if(!RunAllCombinations(cycles)) goto done;
+    secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    ConsolePrintf("checked %lu combinations of %d inputs for %lu cycles in "
+        "%.3f s\n", 1ul << InputsCount, InputsCount, cycles, secs);
+    ok = TRUE;
+    for(i = 0; i < RulesCount; i++) {
+        ConsolePrintf("never %s: ", Rules[i].text);
+        if(!Rules[i].found) {
+            ConsolePrintf("holds\n");
+            continue;
+        }
+        ok = FALSE;
+        ConsolePrintf("broken by %lu combinations, first at cycle %lu with",
+            Rules[i].brokenBy, Rules[i].firstCycle);
+        for(j = 0; j < InputsCount; j++) {
+            ConsolePrintf(" %s=%d", Inputs[j].name,
+                (Rules[i].firstCombination >> j) & 1);
+        }
+        ConsolePrintf("\n");
+    }
+
+done:
+    InSimulationMode = FALSE;
+    return ok;
+}
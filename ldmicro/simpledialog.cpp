@@ -329,39 +329,6 @@ static void CheckConstantInRange(char *name, char *str, SDWORD v)
     } else ooops("Constant %s Variable '%s' size=%d value=%d", str, name, sov, v);
 }
 
-//-----------------------------------------------------------------------------
-// Report an error if a var doesn't fit in 8-16-24 bits.
-//-----------------------------------------------------------------------------
-void CheckVarInRange(char *name, char *str, SDWORD v)
-{
-    SDWORD val = hobatoi(str);
-    if(val != v) oops();
-    int radix = getradix(str);
-
-    int sov = SizeOfVar(name);
-    if (sov == 1) {
-        if((v < -128 || v > 127) && (radix == 10))
-            Error(_("Variable %s=%d out of range: -128 to 127 inclusive."), name, v);
-        else if((v < 0 || v > 0xff) && (radix != 10))
-            Error(_("Variable %s=0x%X out range : 0 to 0xFF inclusive."), str, v, name);
-    } else if((sov == 2) || (sov == 0)){
-        if((v < -32768 || v > 32767) && (radix == 10))
-            Error(_("Variable %s=%d out of range: -32768 to 32767 inclusive."), name, v);
-        else if((v < 0 || v > 0xffff) && (radix != 10))
-            Error(_("Variable %s=0x%X out range : 0 to 0xFFFF inclusive."), str, v, name);
-    } else if(sov == 3) {
-        if((v < -8388608 || v > 8388607) && (radix == 10))
-            Error(_("Variable %s=%d out of range: -8388608 to 8388607 inclusive."), name, v);
-        else if((v < 0 || v > 0xffffff) && (radix != 10))
-            Error(_("Variable %s=0x%X out range : 0 to 0xffFFFF inclusive."), str, v, name);
-    } else if(sov == 4) {
-        if((v < -2147483648LL || v > 2147483647LL) && (radix == 10))
-            Error(_("Variable %s=%d out of range: -2147483648 to 2147483647 inclusive."), name, v);
-        else if((v < 0 || v > 0xffffFFFF) && (radix != 10))
-            Error(_("Variable %s=0x%X out range : 0 to 0xffffFFFF inclusive."), str, v, name);
-    } else ooops("Variable '%s' size=%d value=%d", name, sov, v);
-}
-
 //-----------------------------------------------------------------------------
 void ShowCounterDialog(int which, char *minV, char *maxV, char *name)
 {
@@ -1147,9 +1114,46 @@ void ShowCprintfDialog(int which, void *e)
     NoCheckingOnBox[4] = FALSE;
 }
 
-void ShowPersistDialog(char *var)
+BOOL ShowBreakpointDialog(char *spec)
+{
+    char *labels[] = { _("Break at:") };
+    char *dests[] = { spec };
+    NoCheckingOnBox[0] = TRUE;
+    BOOL ok = ShowSimpleDialog(_("Add Breakpoint"), 1, labels, 0x0, 0x0,
+        0x1, dests);
+    NoCheckingOnBox[0] = FALSE;
+    return ok;
+}
+
+void ShowPersistDialog(char *var, SDWORD *interval, int *copies, SDWORD *idle)
 {
-    char *labels[] = { _("Variable:") };
-    char *dests[] = { var };
-    ShowSimpleDialog(_("Make Persistent"), 1, labels, 0, 1, 1, dests);
+    char intervalStr[20];
+    char copiesStr[20];
+    char idleStr[20];
+    sprintf(intervalStr, "%d", *interval);
+    sprintf(copiesStr, "%d", *copies);
+    sprintf(idleStr, "%d", *idle);
+
+    char *labels[] = { _("Variable:"), _("Min write interval (ms):"),
+        _("EEPROM copies:"), _("Write when unchanged for (ms):") };
+    char *dests[] = { var, intervalStr, copiesStr, idleStr };
+    ShowSimpleDialog(_("Make Persistent"), 4, labels, 0xe, 0x1, 0xf, dests);
+
+    *interval = hobatoi(intervalStr);
+    *copies = hobatoi(copiesStr);
+    *idle = hobatoi(idleStr);
+
+    if(*interval < 0) {
+        Error(_("Not a reasonable write interval."));
+        *interval = 0;
+    }
+    if(*idle < 0) {
+        Error(_("Not a reasonable idle time."));
+        *idle = 0;
+    }
+    if(*copies < 1 || *copies > MAX_PERSIST_COPIES) {
+        Error(_("Number of EEPROM copies must be between 1 and %d."),
+            MAX_PERSIST_COPIES);
+        *copies = 1;
+    }
 }
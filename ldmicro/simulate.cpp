@@ -36,29 +36,187 @@
 
 static struct {
     char name[MAX_NAME_LEN];
-    BOOL powered;
 } SingleBitItems[MAX_IO];
 static int SingleBitItemsCount;
 
 static struct {
     char    name[MAX_NAME_LEN];
-    SDWORD  val;
     char    valstr[MAX_COMMENT_LEN]; // value in simulation mode for STRING types.
     DWORD   usedFlags;
     int     initedRung; // Variable inited in rung.
     DWORD   initedOp;   // Variable inited in Op number.
-    char    usedRungs[MAX_COMMENT_LEN]; // Rungs, where variable is used.
 } Variables[MAX_IO];
-static int VariableCount;
+static int SimVariableCount;
 
-DWORD CyclesCount; // Simulated
+// The rungs where each variable is used, one bit per rung, for the messages
+// of CheckVariableNames().
+#define USED_RUNG_WORDS ((MAX_RUNGS + 31)/32)
+static DWORD UsedRungs[MAX_IO][USED_RUNG_WORDS];
 
 static struct {
     char    name[MAX_NAME_LEN];
-    SWORD   val;
 } AdcShadows[MAX_IO];
 static int AdcShadowsCount;
 
+// Open-addressed hash of the shadow names, holding slot+1 (0 is empty), so
+// that finding one doesn't take comparing against all of them.
+#define ADC_SHADOW_HASH (2*MAX_IO)
+static short AdcShadowHash[ADC_SHADOW_HASH];
+static DWORD Fnv(DWORD h, const void *p, int len);
+
+// And the same for the variable names, which CheckVariableNames() and the
+// simulator look up all the time, and for the single bits.
+#define VARIABLE_HASH (2*MAX_IO)
+static short VariableHash[VARIABLE_HASH];
+#define SINGLE_BIT_HASH (2*MAX_IO)
+static short SingleBitHash[SINGLE_BIT_HASH];
+
+// The values themselves live in flat arrays, indexed by the same slot as
+// the name tables above, so that the simulator never has to look a name up
+// while it runs. Integer slots from MAX_IO upwards hold the numeric
+// literals that appear as operands of the intermediate code.
+#define MAX_LITERAL_SLOTS MAX_IO
+static int LiteralCount;
+
+// For change tracking, single-bit slots count as themselves and variables
+// as CHANGE_VAR + their slot.
+#define CHANGE_VAR      MAX_IO
+#define CHANGE_SLOTS    (2*MAX_IO)
+
+// The UART: what has come in on the line that UART RECV has not taken yet,
+// and what UART SEND has written that has not gone out on the line yet, each
+// in a FIFO of rxSize/txSize bytes (1 and 1 unless a batch run asks for more,
+// like the single data register of the real thing). The line carries a byte
+// of UART_FRAME_BITS at Prog.baudRate; the credits are how far it has got
+// into the next byte, in bit-microseconds.
+#define UART_FRAME_BITS 10      // start bit, 8 data bits, stop bit
+#define UART_BYTE_COST  (UART_FRAME_BITS*1000000LL)
+
+typedef struct SimUartTag {
+    BYTE        rx[SIM_UART_FIFO_MAX];
+    int         rxHead;
+    int         rxCount;
+    int         rxSize;
+    long long   rxCredit;
+    BYTE        tx[SIM_UART_FIFO_MAX];
+    int         txHead;
+    int         txCount;
+    int         txSize;
+    long long   txCredit;
+} SimUart;
+
+// The EEPROM, for ELEM_PERSIST. A write takes EepromWriteCycles() to finish,
+// during which the EEPROM is busy and the old value is still there, as on the
+// real thing; then every byte written counts towards that address's wear.
+#define SIM_EEPROM_SIZE 4096
+
+typedef struct SimEepromTag {
+    BYTE        data[SIM_EEPROM_SIZE];
+    DWORD       writes[SIM_EEPROM_SIZE];
+    int         busy;           // cycles until the write in progress is done
+    int         addr;           // and what it is writing
+    int         bytes;
+    BYTE        value[4];
+} SimEeprom;
+
+typedef struct SimDebugTag SimDebug;
+
+// Everything that changes while the program runs. The name tables above,
+// the intermediate code and its operand slots are shared, so any number of
+// instances of the same program can be simulated at once, each with its own
+// SimContext. The simulator works on the current instance of the calling
+// thread, which is MainSim (the one the GUI shows) unless UseSimContext()
+// says otherwise.
+struct SimContextTag {
+    BOOL        bitVal[MAX_IO];
+    SDWORD      varVal[MAX_IO + MAX_LITERAL_SLOTS];
+    SWORD       adcVal[MAX_IO];     // shadows of the READ ADC variables
+    DWORD       cycles;             // simulated so far
+
+    int         pc;                 // as we evaluate the intermediate code
+    int         resumeAt;           // decoded op to go on from, plus one,
+                                    // after stopping at a breakpoint
+    SimDebug   *debug;              // breakpoints and watchpoints, or NULL
+    BOOL        simulating;         // inside SimulateOneCycle()
+    SimUart     uart;
+    SimEeprom   eeprom;
+    BatchRun   *batch;              // batch run that we belong to, or NULL
+
+    // Slots written during this cycle, and what they were at its start.
+    BOOL        slotTouched[CHANGE_SLOTS];
+    SDWORD      slotBefore[CHANGE_SLOTS];
+    int         dirtySlots[CHANGE_SLOTS];
+    int         dirtyCount;
+    // Variables written this cycle other than by INT_INCREMENT_VARIABLE.
+    BOOL        varAssigned[MAX_IO];
+
+    // Timers that went up by one in a steady cycle, for fast-forward.
+    BOOL        steadyCycle;
+    int         ramping[MAX_IO];
+    int         rampingCount;
+    BOOL        isRamping[MAX_IO + MAX_LITERAL_SLOTS];
+};
+static SimContext MainSim;
+// MainSim as ClearSimulationData() left it, where new instances start.
+static SimContext InitialSim;
+static thread_local SimContext *Sim = &MainSim;
+
+// Operand slots of each op in IntCode[], filled in by ResolveSimulationSlots()
+// once the intermediate code has been generated. Which fields are meaningful
+// depends on the op.
+typedef struct SimSlotsTag {
+    int     bit1;
+    int     bit2;
+    int     var1;
+    int     var2;
+    int     var3;
+    int     adc;
+    int     bytes;      // EEPROM ops: how wide the variable is
+    int     ring;       // shift register ops: which of SimRings[]
+} SimSlots;
+static SimSlots *OpSlots;
+
+// The shift registers that UseShiftRegisterRings() keeps in a ring. The
+// variables of the stages hold the cells of the ring, so stage k of `a' is in
+// the variable of stage (head + k) mod stages, where the head is a variable
+// `$a_head' (of each instance, like the cells). Everything that looks a stage
+// up by its name, the watch list, the traces and the breakpoints, goes
+// through StageSlot() to find it.
+typedef struct SimRingTag {
+    char   *name;
+    int     stages;
+    int     head;       // its variable slot
+    int     cells;      // where the slots of the cells start in RingCells[]
+} SimRing;
+static SimRing SimRings[MAX_IO];
+static int SimRingCount;
+static int RingCells[MAX_IO];
+static int RingCellsCount;
+// For the variable of a cell or of a head, its ring plus one, else zero; and
+// for a cell, the stage that its name means, or -1 for a head.
+static int RingOfVar[MAX_IO];
+static int StageOfVar[MAX_IO];
+
+static inline int RingCell(SimRing *r, SDWORD head, int k)
+{
+    return RingCells[r->cells + (head + k) % r->stages];
+}
+
+static inline int StageSlot(int slot)
+{
+    if(slot >= MAX_IO || !RingOfVar[slot] || StageOfVar[slot] < 0)
+        return slot;
+    SimRing *r = &SimRings[RingOfVar[slot] - 1];
+    return RingCell(r, Sim->varVal[r->head], StageOfVar[slot]);
+}
+
+// OpSlots[] and the other tables with an entry for each op of IntCode[] (or
+// for each if that can be open at once) are allocated by SizeOpTables() to
+// fit the program each time that it is compiled for simulation; this is
+// how many ops they have room for.
+static int OpTablesSize;
+static int *OpenIfs;    // for matching up the ifs, elses and end ifs
+
 #define VAR_FLAG_TON     0x00000001
 #define VAR_FLAG_TOF     0x00000002
 #define VAR_FLAG_RTO     0x00000004
@@ -80,13 +238,10 @@ static int AdcShadowsCount;
 // editing during simulation.
 BOOL InSimulationMode;
 
-// Don't want to redraw the screen unless necessary; track whether a coil
-// changed state or a timer output switched to see if anything could have
-// changed (not just coil, as we show the intermediate steps too).
-static BOOL NeedRedraw;
-// Have to let the effects of a coil change in cycle k appear in cycle k+1,
-// or set by the UI code to indicate that user manually changed an Xfoo
-// input.
+// Don't want to redraw the screen unless necessary; normally just the rungs
+// and I/O list rows that changed are redrawn (see RedrawChanges()). This is
+// set by the UI code to redraw everything after the next cycle, e.g. when
+// the user manually changed an Xfoo input.
 BOOL SimulateRedrawAfterNextCycle;
 
 // Don't want to set a timer every 100 us to simulate a 100 us cycle
@@ -94,9 +249,6 @@ BOOL SimulateRedrawAfterNextCycle;
 // be almost as good, as long as everything runs fast.
 static int CyclesPerTimerTick;
 
-// Program counter as we evaluate the intermediate code.
-static int IntPc;
-
 static FILE *fUART;
 
 // A window to allow simulation with the UART stuff (insert keystrokes into
@@ -105,113 +257,585 @@ static HWND UartSimulationWindow;
 static HWND UartSimulationTextControl;
 static LONG_PTR PrevTextProc;
 
-static int QueuedUartCharacter = -1;
-static int SimulateUartTxCountdown = 0;
+static void UartSent(BYTE b);
+static void FlushUartSimulationTextControl(void);
+
+// The file that holds the EEPROM of the GUI's instance between runs of the
+// simulator, mapped into memory while in simulation mode; the wear counts
+// are kept there too.
+#define EEPROM_FILE_MAGIC "LDEEP1"
 
-static void AppendToUartSimulationTextControl(BYTE b);
+typedef struct EepromImageTag {
+    char        magic[8];
+    BYTE        data[SIM_EEPROM_SIZE];
+    DWORD       writes[SIM_EEPROM_SIZE];
+} EepromImage;
+
+static HANDLE EepromFileHandle;
+static HANDLE EepromMapping;
+static EepromImage *EepromFile;
 
 static void SimulateIntCode(void);
 static char *MarkUsedVariable(char *name, DWORD flag);
 
 //-----------------------------------------------------------------------------
-int isVarInited(char *name)
+// Return where a variable is in VariableHash, or where it would go if it
+// isn't there.
+//-----------------------------------------------------------------------------
+static int VariableBucket(char *name)
 {
-    int i;
-    for(i = 0; i < VariableCount; i++) {
-        if(strcmp(Variables[i].name, name)==0) {
-            break;
-        }
+    int h = Fnv(2166136261u, name, strlen(name)) % VARIABLE_HASH;
+    while(VariableHash[h]) {
+        if(strcmp(Variables[VariableHash[h] - 1].name, name)==0) break;
+        h = (h + 1) % VARIABLE_HASH;
     }
-    if(i >= VariableCount) return -1;
+    return h;
+}
+
+//-----------------------------------------------------------------------------
+// Find a variable in the Variables list; returns its slot, or -1 if it is
+// not there.
+//-----------------------------------------------------------------------------
+static int FindVariable(char *name)
+{
+    return VariableHash[VariableBucket(name)] - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Find a variable in the Variables list, adding it if it is not there yet;
+// returns its slot, or -1 if the list is full.
+//-----------------------------------------------------------------------------
+static int AddVariable(char *name)
+{
+    int h = VariableBucket(name);
+    if(VariableHash[h]) return VariableHash[h] - 1;
+    if(SimVariableCount >= MAX_IO) return -1;
+
+    int i = SimVariableCount++;
+    strcpy(Variables[i].name, name);
+    Variables[i].usedFlags = 0;
+    Variables[i].initedRung = -1;
+    Sim->varVal[i] = 0;
+    memset(UsedRungs[i], 0, sizeof(UsedRungs[i]));
+    VariableHash[h] = i + 1;
+    return i;
+}
+//-----------------------------------------------------------------------------
+int isVarInited(char *name)
+{
+    int i = FindVariable(name);
+    if(i < 0) return -1;
     return Variables[i].initedRung;
 }
 //-----------------------------------------------------------------------------
 DWORD isVarUsed(char *name)
 {
-    int i;
-    for(i = 0; i < VariableCount; i++) {
-        if(strcmp(Variables[i].name, name)==0) {
-            break;
-        }
+    int i = FindVariable(name);
+    if(i < 0) return 0;
+    return Variables[i].usedFlags;
+}
+//-----------------------------------------------------------------------------
+// Return where a single-bit element is in SingleBitHash, or where it would go
+// if it isn't there.
+//-----------------------------------------------------------------------------
+static int SingleBitBucket(char *name)
+{
+    int h = Fnv(2166136261u, name, strlen(name)) % SINGLE_BIT_HASH;
+    while(SingleBitHash[h]) {
+        if(strcmp(SingleBitItems[SingleBitHash[h] - 1].name, name)==0) break;
+        h = (h + 1) % SINGLE_BIT_HASH;
     }
-    if(i >= MAX_IO) return 0;
+    return h;
+}
 
-    return Variables[i].usedFlags;
+//-----------------------------------------------------------------------------
+// Find a single-bit element (relay, digital in, digital out) in the
+// SingleBitItems list; returns its slot, or -1 if it is not there.
+//-----------------------------------------------------------------------------
+static int FindSingleBit(char *name)
+{
+    return SingleBitHash[SingleBitBucket(name)] - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Return the slot of a single-bit item, adding it to the list (and so FALSE)
+// if it is not there already. Returns -1 if the list is full.
+//-----------------------------------------------------------------------------
+static int SingleBitSlot(char *name)
+{
+    int h = SingleBitBucket(name);
+    if(SingleBitHash[h]) return SingleBitHash[h] - 1;
+
+    if(SingleBitItemsCount >= MAX_IO) return -1;
+    int i = SingleBitItemsCount;
+    strcpy(SingleBitItems[i].name, name);
+    Sim->bitVal[i] = FALSE;
+    SingleBitItemsCount++;
+    SingleBitHash[h] = i + 1;
+    return i;
 }
+
 //-----------------------------------------------------------------------------
 // Query the state of a single-bit element (relay, digital in, digital out).
 // Looks in the SingleBitItems list; if an item is not present then it is
 // FALSE by default.
 //-----------------------------------------------------------------------------
 static BOOL SingleBitOn(char *name)
+{
+    int i = FindSingleBit(name);
+    if(i < 0) return FALSE;
+    return Sim->bitVal[i];
+}
+
+BOOL GetSingleBit(char *name)
+{
+    return SingleBitOn(name);
+}
+
+//-----------------------------------------------------------------------------
+// Direct access to the values by slot, for code that watches the same items
+// every cycle and does not want to look their names up each time. Returns
+// the slot of a single-bit item or else of a variable, or -1 if the name is
+// neither. A slot is good until the next ClearSimulationData().
+//-----------------------------------------------------------------------------
+int SimulationSlot(char *name, BOOL *isBit)
+{
+    int i = FindSingleBit(name);
+    *isBit = (i >= 0);
+    if(i >= 0) return i;
+    return FindVariable(name);
+}
+
+SDWORD SimulationSlotValue(int slot, BOOL isBit)
+{
+    return isBit ? Sim->bitVal[slot] : Sim->varVal[StageSlot(slot)];
+}
+
+//-----------------------------------------------------------------------------
+// Change tracking, for the waveform recorder and for fast-forward. While it
+// is on, every slot that is written during a cycle is noted once, along with
+// the value that it had before, so that at the end of the cycle we can look
+// at just the slots that the program touched.
+//-----------------------------------------------------------------------------
+static BOOL TrackingChanges;
+
+static void TouchSlot(int w, SDWORD before)
+{
+    Sim->slotTouched[w] = TRUE;
+    Sim->slotBefore[w] = before;
+    Sim->dirtySlots[Sim->dirtyCount++] = w;
+}
+
+//-----------------------------------------------------------------------------
+// All writes made by the simulated program go through these, so that
+// anything that has to watch the state change has one place to hook in.
+//-----------------------------------------------------------------------------
+static inline void SetBitSlot(int slot, BOOL state)
+{
+    if(TrackingChanges && !Sim->slotTouched[slot])
+        TouchSlot(slot, Sim->bitVal[slot]);
+    Sim->bitVal[slot] = state;
+}
+
+static inline void IncrementVarSlot(int slot)
+{
+    if(TrackingChanges && !Sim->slotTouched[CHANGE_VAR + slot])
+        TouchSlot(CHANGE_VAR + slot, Sim->varVal[slot]);
+    Sim->varVal[slot]++;
+}
+
+static inline void SetVarSlot(int slot, SDWORD val)
+{
+    if(TrackingChanges) {
+        if(!Sim->slotTouched[CHANGE_VAR + slot])
+            TouchSlot(CHANGE_VAR + slot, Sim->varVal[slot]);
+        Sim->varAssigned[slot] = TRUE;
+    }
+    Sim->varVal[slot] = val;
+}
+
+//-----------------------------------------------------------------------------
+// Forget which slots were touched, at the end of a cycle once everyone that
+// is interested has looked at them.
+//-----------------------------------------------------------------------------
+static void ClearChanges(void)
 {
     int i;
-    for(i = 0; i < SingleBitItemsCount; i++) {
-        if(strcmp(SingleBitItems[i].name, name)==0) {
-            return SingleBitItems[i].powered;
+    for(i = 0; i < Sim->dirtyCount; i++) {
+        int w = Sim->dirtySlots[i];
+        Sim->slotTouched[w] = FALSE;
+        if(w >= CHANGE_VAR) Sim->varAssigned[w - CHANGE_VAR] = FALSE;
+    }
+    Sim->dirtyCount = 0;
+}
+
+static SDWORD ChangeSlotValue(int w)
+{
+    return w < CHANGE_VAR ? Sim->bitVal[w] : Sim->varVal[w - CHANGE_VAR];
+}
+
+static char *ChangeSlotName(int w)
+{
+    return w < CHANGE_VAR ? SingleBitItems[w].name :
+        Variables[w - CHANGE_VAR].name;
+}
+
+//-----------------------------------------------------------------------------
+// What the name of a change slot stands for, which for a stage of a ring is
+// in whatever cell holds it now; ChangeSlotValue() is the slot itself, as
+// the change tracking sees it.
+//-----------------------------------------------------------------------------
+static SDWORD ChangeSlotShows(int w)
+{
+    return w < CHANGE_VAR ? Sim->bitVal[w] :
+        Sim->varVal[StageSlot(w - CHANGE_VAR)];
+}
+
+static SDWORD VarSlotBefore(int slot)
+{
+    int w = CHANGE_VAR + slot;
+    return Sim->slotTouched[w] ? Sim->slotBefore[w] : Sim->varVal[slot];
+}
+
+//-----------------------------------------------------------------------------
+// The change slots whose names stand for something else than at the start of
+// the cycle; returns how many. A shift writes just the head of its ring and
+// one cell but moves every stage, so for a ring that was written we look at
+// each of its stages instead.
+//-----------------------------------------------------------------------------
+static int ShownChanges(int *shown)
+{
+    static BOOL ringSeen[MAX_IO];
+    static int seen[MAX_IO];
+    int i, k, n = 0, rings = 0;
+    for(i = 0; i < Sim->dirtyCount; i++) {
+        int w = Sim->dirtySlots[i];
+        int ring = w >= CHANGE_VAR ? RingOfVar[w - CHANGE_VAR] : 0;
+        if(!ring) {
+            if(ChangeSlotValue(w) != Sim->slotBefore[w]) shown[n++] = w;
+            continue;
+        }
+        if(ringSeen[ring - 1]) continue;
+        ringSeen[ring - 1] = TRUE;
+        seen[rings++] = ring - 1;
+
+        SimRing *r = &SimRings[ring - 1];
+        SDWORD head = VarSlotBefore(r->head);
+        for(k = 0; k < r->stages; k++) {
+            int stage = RingCells[r->cells + k];
+            if(Sim->varVal[StageSlot(stage)] !=
+                VarSlotBefore(RingCell(r, head, k)))
+            {
+                shown[n++] = CHANGE_VAR + stage;
+            }
         }
     }
-    return FALSE;
+    for(i = 0; i < rings; i++) ringSeen[seen[i]] = FALSE;
+    return n;
 }
 
 //-----------------------------------------------------------------------------
-// Set the state of a single-bit item. Adds it to the list if it is not there
-// already.
+// Redrawing after a cycle. Rather than repaint the whole window and every row
+// of the I/O list whenever anything changed, we note the rungs whose power
+// states changed, and the rungs and rows that show a variable or a bit that
+// changed, and refresh just those. Only for the main instance in the GUI.
 //-----------------------------------------------------------------------------
-static void SetSingleBit(char *name, BOOL state)
+static BOOL RungDirty[MAX_RUNGS];
+static int DirtyRungs[MAX_RUNGS];
+static int DirtyRungsCount;
+static BOOL IoRowDirty[MAX_IO];
+static int DirtyIoRows[MAX_IO];
+static int DirtyIoRowsCount;
+
+// For each change slot, the rungs that use it, as lists through SlotRungs[],
+// and the row of the I/O list that shows it, or -1.
+static int SlotRungsHead[CHANGE_SLOTS];
+typedef struct SlotRungTag {
+    int     rung;
+    int     next;
+} SlotRung;
+static SlotRung *SlotRungs; // 3*OpTablesSize of them
+static int SlotIoRow[CHANGE_SLOTS];
+
+static void MarkRungDirty(int rung)
 {
-    int i;
-    for(i = 0; i < SingleBitItemsCount; i++) {
-        if(strcmp(SingleBitItems[i].name, name)==0) {
-            SingleBitItems[i].powered = state;
-            return;
+    if(rung < 0 || rung >= Prog.numRungs || RungDirty[rung]) return;
+    RungDirty[rung] = TRUE;
+    DirtyRungs[DirtyRungsCount++] = rung;
+}
+
+//-----------------------------------------------------------------------------
+// Work out which rungs and which row of the I/O list show each slot. The
+// internal `$' items are left out: the rungs show those only through their
+// power states, and the same scratch bit is reused all over the program.
+//-----------------------------------------------------------------------------
+static void FindRedrawSlots(void)
+{
+    int i, j, n = 0;
+    for(i = 0; i < CHANGE_SLOTS; i++) {
+        SlotRungsHead[i] = -1;
+        SlotIoRow[i] = -1;
+    }
+    for(i = 0; i < IntCodeLen; i++) {
+        char *names[3] = { IntCode[i].name1, IntCode[i].name2,
+            IntCode[i].name3 };
+        for(j = 0; j < 3; j++) {
+            BOOL isBit;
+            int w;
+            if(IntCode[i].op == INT_RING_READ ||
+                IntCode[i].op == INT_RING_WRITE)
+            {
+                // the stage that the rung named, in place of the scratch
+                SimRing *r = &SimRings[OpSlots[i].ring];
+                if(j > 0) break;
+                w = CHANGE_VAR + RingCells[r->cells + IntCode[i].literal];
+            } else {
+                if(names[j][0] == '\0' || names[j][0] == '$') continue;
+                w = SimulationSlot(names[j], &isBit);
+                if(w < 0) continue;
+                if(!isBit) w += CHANGE_VAR;
+            }
+            int h = SlotRungsHead[w];
+            if(h >= 0 && SlotRungs[h].rung == IntCode[i].rung) continue;
+            SlotRungs[n].rung = IntCode[i].rung;
+            SlotRungs[n].next = h;
+            SlotRungsHead[w] = n++;
         }
     }
-    if(i < MAX_IO) {
-        strcpy(SingleBitItems[i].name, name);
-        SingleBitItems[i].powered = state;
-        SingleBitItemsCount++;
+    for(i = 0; i < Prog.io.count; i++) {
+        BOOL isBit;
+        int w = SimulationSlot(Prog.io.assignment[i].name, &isBit);
+        if(w < 0) continue;
+        SlotIoRow[isBit ? w : CHANGE_VAR + w] = i;
     }
+    memset(RungDirty, 0, sizeof(RungDirty));
+    memset(IoRowDirty, 0, sizeof(IoRowDirty));
+    DirtyRungsCount = 0;
+    DirtyIoRowsCount = 0;
 }
 
-BOOL GetSingleBit(char *name)
+//-----------------------------------------------------------------------------
+// Note where the slots that changed during the cycle are shown. Called while
+// the changes are still being tracked.
+//-----------------------------------------------------------------------------
+static void NoteRedrawChanges(void)
 {
-    int i;
-    for(i = 0; i < SingleBitItemsCount; i++) {
-        if(strcmp(SingleBitItems[i].name, name)==0) {
-            return SingleBitItems[i].powered;
+    static int shown[CHANGE_SLOTS];
+    int i, j, n = ShownChanges(shown);
+    for(i = 0; i < n; i++) {
+        int w = shown[i];
+        for(j = SlotRungsHead[w]; j >= 0; j = SlotRungs[j].next)
+            MarkRungDirty(SlotRungs[j].rung);
+        int row = SlotIoRow[w];
+        if(row >= 0 && !IoRowDirty[row]) {
+            IoRowDirty[row] = TRUE;
+            DirtyIoRows[DirtyIoRowsCount++] = row;
         }
     }
-    return FALSE;
 }
 
 //-----------------------------------------------------------------------------
-// Count a timer up (i.e. increment its associated count by 1). Must already
-// exist in the table.
+// Refresh what changed since the last time, or everything.
 //-----------------------------------------------------------------------------
-static void IncrementVariable(char *name)
+static void RedrawChanges(BOOL all)
 {
     int i;
-    for(i = 0; i < VariableCount; i++) {
-        if(strcmp(Variables[i].name, name)==0) {
-            (Variables[i].val)++;
-            return;
+    if(all) {
+        InvalidateRect(MainWindow, NULL, FALSE);
+        ListView_RedrawItems(IoList, 0, Prog.io.count - 1);
+    } else {
+        InvalidateRungs(DirtyRungs, DirtyRungsCount);
+        for(i = 0; i < DirtyIoRowsCount; i++) {
+            if(DirtyIoRows[i] < Prog.io.count)
+                ListView_RedrawItems(IoList, DirtyIoRows[i], DirtyIoRows[i]);
         }
     }
-    ooops(name);
+    if(all || DirtyRungsCount > 0 || DirtyIoRowsCount > 0)
+        RefreshStatusBar();
+
+    for(i = 0; i < DirtyRungsCount; i++)
+        RungDirty[DirtyRungs[i]] = FALSE;
+    for(i = 0; i < DirtyIoRowsCount; i++)
+        IoRowDirty[DirtyIoRows[i]] = FALSE;
+    DirtyRungsCount = 0;
+    DirtyIoRowsCount = 0;
 }
 
 //-----------------------------------------------------------------------------
-static void DecrementVariable(char *name)
+// The waveform recorder. At the end of each cycle the slots that really
+// changed go into a ring buffer, so the cost is proportional to what the
+// program does, not to its size.
+//-----------------------------------------------------------------------------
+BOOL RecordingWaveform;
+
+#define WAVE_RECORDS    (64*1024)
+
+static struct {
+    DWORD   cycle;
+    int     slot;
+    SDWORD  val;
+} WaveRecords[WAVE_RECORDS];
+static int WaveHead;
+static int WaveCount;
+
+// The value of every slot just before the oldest record that we still have,
+// and the cycle from which it holds.
+static SDWORD WaveBase[CHANGE_SLOTS];
+static DWORD WaveBaseCycle;
+
+//-----------------------------------------------------------------------------
+// Throw away what has been recorded and start again from the current state.
+//-----------------------------------------------------------------------------
+static void StartWaveform(void)
 {
     int i;
-    for(i = 0; i < VariableCount; i++) {
-        if(strcmp(Variables[i].name, name)==0) {
-            (Variables[i].val)--;
-            return;
+    for(i = 0; i < CHANGE_SLOTS; i++) {
+        WaveBase[i] = ChangeSlotShows(i);
+    }
+    WaveBaseCycle = Sim->cycles;
+    WaveHead = 0;
+    WaveCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+// At the end of a cycle, move the slots that changed into the ring buffer.
+// The internal $ items are not recorded; they are scratch for the compiler
+// and would only crowd out the signals that the user knows about. When the
+// buffer is full the oldest record is folded into the base state.
+//-----------------------------------------------------------------------------
+static void RecordWaveChanges(void)
+{
+    static int shown[CHANGE_SLOTS];
+    int i, n = ShownChanges(shown);
+    for(i = 0; i < n; i++) {
+        int w = shown[i];
+        SDWORD v = ChangeSlotShows(w);
+        if(*ChangeSlotName(w) == '$') continue;
+
+        if(WaveCount >= WAVE_RECORDS) {
+            WaveBase[WaveRecords[WaveHead].slot] = WaveRecords[WaveHead].val;
+            WaveBaseCycle = WaveRecords[WaveHead].cycle;
+            WaveHead = (WaveHead + 1) % WAVE_RECORDS;
+            WaveCount--;
+        }
+        int j = (WaveHead + WaveCount) % WAVE_RECORDS;
+        WaveRecords[j].cycle = Sim->cycles;
+        WaveRecords[j].slot = w;
+        WaveRecords[j].val = v;
+        WaveCount++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Turn the waveform recorder on or off. Turning it on starts a new recording.
+//-----------------------------------------------------------------------------
+void RecordWaveform(BOOL on)
+{
+    if(on) StartWaveform();
+    RecordingWaveform = on;
+    TrackingChanges = RecordingWaveform || FastForwardSimulation ||
+        !RunningInBatchMode;
+    ClearChanges();
+}
+
+//-----------------------------------------------------------------------------
+// VCD identifiers are short strings of the printable characters.
+//-----------------------------------------------------------------------------
+static char *VcdId(int w, char *buf)
+{
+    char *s = buf;
+    do {
+        *s++ = (char)('!' + w % 94);
+        w /= 94;
+    } while(w);
+    *s = '\0';
+    return buf;
+}
+
+static void VcdValue(FILE *f, int w, SDWORD v)
+{
+    char id[8];
+    if(w < CHANGE_VAR) {
+        fprintf(f, "%d%s\n", v ? 1 : 0, VcdId(w, id));
+    } else {
+        char bits[33];
+        int i;
+        for(i = 0; i < 32; i++) {
+            bits[i] = (v & (1u << (31 - i))) ? '1' : '0';
+        }
+        bits[32] = '\0';
+        for(i = 0; i < 31 && bits[i] == '0'; i++)
+            ;
+        fprintf(f, "b%s %s\n", bits + i, VcdId(w, id));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Write what the recorder holds as a Value Change Dump, for GTKWave and the
+// like. One time unit is one microsecond, so the cycle time of the program
+// shows up as it would on the real hardware. Returns FALSE if the file can't
+// be written.
+//-----------------------------------------------------------------------------
+BOOL SaveWaveformAsVcd(char *filename)
+{
+    FILE *f = fopen(filename, "w");
+    if(!f) return FALSE;
+
+    int i, w;
+    char id[8];
+
+    fprintf(f, "$version LDmicro $end\n");
+    fprintf(f, "$timescale 1 us $end\n");
+    fprintf(f, "$scope module plc $end\n");
+    for(w = 0; w < SingleBitItemsCount; w++) {
+        if(SingleBitItems[w].name[0] == '$') continue;
+        fprintf(f, "$var wire 1 %s %s $end\n", VcdId(w, id),
+            SingleBitItems[w].name);
+    }
+    for(i = 0; i < SimVariableCount; i++) {
+        if(Variables[i].name[0] == '$') continue;
+        fprintf(f, "$var integer 32 %s %s $end\n", VcdId(CHANGE_VAR + i, id),
+            Variables[i].name);
+    }
+    fprintf(f, "$upscope $end\n");
+    fprintf(f, "$enddefinitions $end\n");
+
+    fprintf(f, "#%lld\n", WaveBaseCycle * Prog.cycleTime);
+    fprintf(f, "$dumpvars\n");
+    for(w = 0; w < SingleBitItemsCount; w++) {
+        if(SingleBitItems[w].name[0] == '$') continue;
+        VcdValue(f, w, WaveBase[w]);
+    }
+    for(i = 0; i < SimVariableCount; i++) {
+        if(Variables[i].name[0] == '$') continue;
+        VcdValue(f, CHANGE_VAR + i, WaveBase[CHANGE_VAR + i]);
+    }
+    fprintf(f, "$end\n");
+
+    DWORD cycle = WaveBaseCycle;
+    for(i = 0; i < WaveCount; i++) {
+        int j = (WaveHead + i) % WAVE_RECORDS;
+        if(WaveRecords[j].cycle != cycle) {
+            cycle = WaveRecords[j].cycle;
+            fprintf(f, "#%lld\n", cycle * Prog.cycleTime);
         }
+        VcdValue(f, WaveRecords[j].slot, WaveRecords[j].val);
     }
-    ooops(name);
+    if(Sim->cycles != cycle)
+        fprintf(f, "#%lld\n", Sim->cycles * Prog.cycleTime);
+
+    fclose(f);
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Set the state of a single-bit item. Adds it to the list if it is not there
+// already.
+//-----------------------------------------------------------------------------
+void SetSingleBit(char *name, BOOL state)
+{
+    int i = SingleBitSlot(name);
+    if(i >= 0) SetBitSlot(i, state);
 }
 
 //-----------------------------------------------------------------------------
@@ -219,15 +843,38 @@ static void DecrementVariable(char *name)
 //-----------------------------------------------------------------------------
 void SetSimulationVariable(char *name, SDWORD val)
 {
-    int i;
-    for(i = 0; i < VariableCount; i++) {
-        if(strcmp(Variables[i].name, name)==0) {
-            Variables[i].val = val;
-            return;
-        }
+    int i = FindVariable(name);
+    if(i >= 0) {
+        SetVarSlot(StageSlot(i), val);
+        return;
     }
     MarkUsedVariable(name, VAR_FLAG_OTHERWISE_FORGOTTEN);
-    SetSimulationVariable(name, val);
+    if(FindVariable(name) >= 0)
+        SetSimulationVariable(name, val);
+}
+
+//-----------------------------------------------------------------------------
+// The slot of a single bit or a variable, added to its list if it is not
+// there already, for code that will set it by slot. The lists are shared by
+// every instance, so only the main thread may call this, and only while no
+// other instance is running. Returns -1 if the list is full.
+//-----------------------------------------------------------------------------
+int AddSimulationSlot(char *name, BOOL isBit)
+{
+    if(isBit) return SingleBitSlot(name);
+    int i = FindVariable(name);
+    if(i >= 0) return i;
+    MarkUsedVariable(name, VAR_FLAG_OTHERWISE_FORGOTTEN);
+    return FindVariable(name);
+}
+
+void SetSimulationSlotValue(int slot, BOOL isBit, SDWORD val)
+{
+    if(isBit) {
+        SetBitSlot(slot, val != 0);
+    } else {
+        SetVarSlot(StageSlot(slot), val);
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -238,14 +885,13 @@ SDWORD GetSimulationVariable(char *name, BOOL forIoList)
     if(IsNumber(name)) {
         return CheckMakeNumber(name);
     }
-    int i;
-    for(i = 0; i < VariableCount; i++) {
-        if(strcmp(Variables[i].name, name)==0) {
-            return Variables[i].val;
-        }
+    int i = FindVariable(name);
+    if(i >= 0) {
+        return Sim->varVal[StageSlot(i)];
     }
     if(forIoList) return 0;
     MarkUsedVariable(name, VAR_FLAG_OTHERWISE_FORGOTTEN);
+    if(FindVariable(name) < 0) return 0;
     return GetSimulationVariable(name);
 }
 
@@ -255,21 +901,45 @@ SDWORD GetSimulationVariable(char *name)
 }
 
 //-----------------------------------------------------------------------------
-// Set a variable to a value.
+// Return the slot of a variable operand. A numeric literal that is only read
+// gets a constant slot of its own; a variable that is not in the list yet is
+// added, with the same warning as when the simulator first used to touch it.
+// Returns -1 if a table is full.
 //-----------------------------------------------------------------------------
-void SetSimulationStr(char *name, char *val)
+static int VariableSlot(char *name, BOOL write)
 {
     int i;
-    for(i = 0; i < VariableCount; i++) {
-        if(strcmp(Variables[i].name, name)==0) {
-            strcpy(Variables[i].valstr, val);
-            //dbp("VAR '%s':=%s", name, val);
-            return;
+    if(!write && IsNumber(name)) {
+        SDWORD v = CheckMakeNumber(name);
+        for(i = MAX_IO; i < MAX_IO + LiteralCount; i++) {
+            if(Sim->varVal[i] == v) return i;
         }
+        if(LiteralCount >= MAX_LITERAL_SLOTS) return -1;
+        Sim->varVal[i] = v;
+        LiteralCount++;
+        return i;
+    }
+    i = FindVariable(name);
+    if(i >= 0) return i;
+    MarkUsedVariable(name, VAR_FLAG_OTHERWISE_FORGOTTEN);
+    return FindVariable(name);
+}
+
+//-----------------------------------------------------------------------------
+// Set a variable to a value.
+//-----------------------------------------------------------------------------
+void SetSimulationStr(char *name, char *val)
+{
+    int i = FindVariable(name);
+    if(i >= 0) {
+        strcpy(Variables[i].valstr, val);
+        //dbp("VAR '%s':=%s", name, val);
+        return;
     }
     //dbp("SET %s",name);
     MarkUsedVariable(name, VAR_FLAG_OTHERWISE_FORGOTTEN);
-    SetSimulationStr(name, val);
+    if(FindVariable(name) >= 0)
+        SetSimulationStr(name, val);
 }
 
 //-----------------------------------------------------------------------------
@@ -277,35 +947,68 @@ void SetSimulationStr(char *name, char *val)
 //-----------------------------------------------------------------------------
 char *GetSimulationStr(char *name)
 {
-    int i;
-    for(i = 0; i < VariableCount; i++) {
-        if(strcmp(Variables[i].name, name)==0) {
-            //dbp("GET '%s'",name);
-            return Variables[i].valstr;
-        }
+    int i = FindVariable(name);
+    if(i >= 0) {
+        //dbp("GET '%s'",name);
+        return Variables[i].valstr;
     }
     //dbp("GET %s",name);
     MarkUsedVariable(name, VAR_FLAG_OTHERWISE_FORGOTTEN);
+    if(FindVariable(name) < 0) return "";
     return GetSimulationStr(name);
 }
 
 //-----------------------------------------------------------------------------
-// Set the shadow copy of a variable associated with a READ ADC operation. This
-// will get committed to the real copy when the rung-in condition to the
-// READ ADC is true.
+// Return the slot of the ADC shadow for a variable, or -1 if there is none;
+// if bucket is not NULL then it gets where in the hash the name would go.
 //-----------------------------------------------------------------------------
-void SetAdcShadow(char *name, SWORD val)
+int FindAdcShadowSlot(char *name, int *bucket)
 {
-    int i;
-    for(i = 0; i < AdcShadowsCount; i++) {
+    int h = Fnv(2166136261u, name, strlen(name)) % ADC_SHADOW_HASH;
+    while(AdcShadowHash[h]) {
+        int i = AdcShadowHash[h] - 1;
         if(strcmp(AdcShadows[i].name, name)==0) {
-            AdcShadows[i].val = val;
-            return;
+            return i;
         }
+        h = (h + 1) % ADC_SHADOW_HASH;
     }
+    if(bucket) *bucket = h;
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Return the slot of the ADC shadow for a variable, adding it (with a zero
+// value) if it is not there already. Returns -1 if the list is full.
+//-----------------------------------------------------------------------------
+int AdcShadowSlot(char *name)
+{
+    int h;
+    int i = FindAdcShadowSlot(name, &h);
+    if(i >= 0) return i;
+
+    i = AdcShadowsCount;
+    if(i >= MAX_IO) return -1;
     strcpy(AdcShadows[i].name, name);
-    AdcShadows[i].val = val;
+    AdcShadowHash[h] = (short)(i + 1);
+    Sim->adcVal[i] = 0;
     AdcShadowsCount++;
+    return i;
+}
+
+//-----------------------------------------------------------------------------
+// Set the shadow copy of a variable associated with a READ ADC operation. This
+// will get committed to the real copy when the rung-in condition to the
+// READ ADC is true.
+//-----------------------------------------------------------------------------
+void SetAdcShadow(char *name, SWORD val)
+{
+    int i = AdcShadowSlot(name);
+    if(i >= 0) Sim->adcVal[i] = val;
+}
+
+void SetAdcShadowSlot(int slot, SWORD val)
+{
+    Sim->adcVal[slot] = val;
 }
 
 //-----------------------------------------------------------------------------
@@ -314,13 +1017,8 @@ void SetAdcShadow(char *name, SWORD val)
 //-----------------------------------------------------------------------------
 SWORD GetAdcShadow(char *name)
 {
-    int i;
-    for(i = 0; i < AdcShadowsCount; i++) {
-        if(strcmp(AdcShadows[i].name, name)==0) {
-            return AdcShadows[i].val;
-        }
-    }
-    return 0;
+    int i = FindAdcShadowSlot(name, NULL);
+    return i >= 0 ? Sim->adcVal[i] : 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -399,33 +1097,13 @@ static char *Check(char *name, DWORD flag, int i)
 // (e.g. just a TON, an RTO with its reset, etc.). Returns NULL for success,
 // else an error string.
 //-----------------------------------------------------------------------------
-static char *rungsUsed = ""; //local store var for message
-
 static char *MarkUsedVariable(char *name, DWORD flag)
 {
-    int i;
-    for(i = 0; i < VariableCount; i++) {
-        if(strcmp(Variables[i].name, name)==0) {
-            break;
-        }
-    }
-    if(i >= MAX_IO) return "";
+    int i = AddVariable(name);
+    if(i < 0) return "";
 
-    if(i == VariableCount) {
-        strcpy(Variables[i].name, name);
-        Variables[i].usedFlags = 0;
-        Variables[i].val = 0;
-        Variables[i].initedRung = -1; //rungNow;
-        strcpy(Variables[i].usedRungs,"");
-        VariableCount++;
-    }
-
-    char srungNow[MAX_NAME_LEN];
-    sprintf(srungNow," %d ",rungNow+1);
-    if(!strstr(Variables[i].usedRungs, srungNow))
-        strcat(Variables[i].usedRungs, srungNow);
-
-    rungsUsed = Variables[i].usedRungs;
+    if(rungNow >= 0 && rungNow < MAX_RUNGS)
+        UsedRungs[i][rungNow / 32] |= 1u << (rungNow % 32);
 
     char *s = Check(name, flag, i);
     if(s) return s;
@@ -436,35 +1114,68 @@ static char *MarkUsedVariable(char *name, DWORD flag)
 
 void MarkInitedVariable(char *name)
 {
-    int i;
-    for(i = 0; i < VariableCount; i++) {
-        if(strcmp(Variables[i].name, name)==0) {
-            break;
-        }
-    }
-    if(i >= MAX_IO) oops();
+    int i = AddVariable(name);
+    if(i < 0) oops();
 
-    if(i == VariableCount) {
-        strcpy(Variables[i].name, name);
-        Variables[i].usedFlags = 0;
-        Variables[i].val = 0;
-        Variables[i].initedRung = -1; //rungNow;
-        //Variables[i].initedOp = opNow;
-        strcpy(Variables[i].usedRungs,"");
-        VariableCount++;
-    }
     if(Variables[i].initedRung < 0)
         Variables[i].initedRung = rungNow;
 }
 
 //-----------------------------------------------------------------------------
+// List the rungs where a variable is used, as ` 1 5 12', for a message.
+//-----------------------------------------------------------------------------
+static char *UsedRungsText(char *name)
+{
+    static char text[MAX_COMMENT_LEN];
+    text[0] = '\0';
+    int i = FindVariable(name);
+    if(i < 0) return text;
+
+    int n = 0, rung;
+    for(rung = 0; rung < MAX_RUNGS; rung++) {
+        if(!(UsedRungs[i][rung / 32] & (1u << (rung % 32)))) continue;
+        if(n > (int)sizeof(text) - 16) {
+            strcpy(text + n, " ...");
+            break;
+        }
+        n += sprintf(text + n, " %d", rung + 1);
+    }
+    return text;
+}
+
 static void CheckMsg(char *name, char *s)
 {
     if(s) {
-        Error(_("Rung %d: Variable '%s' incorrectly assigned.\n%s.\nSee rungs:%s"), rungNow+1, name, s, rungsUsed);
+        Error(_("Rung %d: Variable '%s' incorrectly assigned.\n%s.\nSee rungs:%s"), rungNow+1, name, s, UsedRungsText(name));
         //CompileError();
     }
 }
+//-----------------------------------------------------------------------------
+// What CheckVariableNamesCircuit() marked in a rung, kept by what the rung
+// holds (as the rung cache of intcode.cpp hashes it), so that a rung that
+// was not edited since the last check is not walked again. Its marks are
+// still made again, in order and with the same checks, because they can
+// clash with an edit somewhere else.
+//-----------------------------------------------------------------------------
+typedef struct CheckedRungTag {
+    unsigned long long hash;
+    BYTE       *key;
+    int         keyLen;
+    int         marks;
+    char      **name;
+    DWORD      *flag;
+    BOOL        used;
+} CheckedRung;
+static CheckedRung *CheckedRungs;
+static int CheckedRungCount;
+static int CheckedRungMax;
+
+// The marks made while walking a rung, to keep for it.
+static char **RungMarkName;
+static DWORD *RungMarkFlag;
+static int RungMarkCount;
+static int RungMarkMax;
+
 //-----------------------------------------------------------------------------
 // Check for duplicate uses of a single variable. For example, there should
 // not be two TONs with the same name. On the other hand, it would be okay
@@ -473,6 +1184,24 @@ static void CheckMsg(char *name, char *s)
 //-----------------------------------------------------------------------------
 static void MarkWithCheck(char *name, int flag)
 {
+    if(RungMarkCount >= RungMarkMax) {
+        int n = RungMarkMax ? 2*RungMarkMax : 256;
+        char **names = (char **)CheckMalloc(n * sizeof(char *));
+        DWORD *flags = (DWORD *)CheckMalloc(n * sizeof(DWORD));
+        if(RungMarkName) {
+            memcpy(names, RungMarkName, RungMarkCount * sizeof(char *));
+            memcpy(flags, RungMarkFlag, RungMarkCount * sizeof(DWORD));
+            CheckFree(RungMarkName);
+            CheckFree(RungMarkFlag);
+        }
+        RungMarkName = names;
+        RungMarkFlag = flags;
+        RungMarkMax = n;
+    }
+    RungMarkName[RungMarkCount] = InternSymbol(name);
+    RungMarkFlag[RungMarkCount] = flag;
+    RungMarkCount++;
+
     char *s = MarkUsedVariable(name, flag);
     CheckMsg(name, s);
 }
@@ -653,6 +1382,7 @@ static void CheckVariableNamesCircuit(int which, void *elem)
         case ELEM_SSFR:
         case ELEM_CSFR:
         case ELEM_TSFR:
+        case ELEM_T_C_SFR:
             break;
 
         default:
@@ -660,60 +1390,141 @@ static void CheckVariableNamesCircuit(int which, void *elem)
     }
 }
 //-----------------------------------------------------------------------------
+// Make the marks of a rung again if it is as it was at a check before;
+// return FALSE if it has to be walked.
+//-----------------------------------------------------------------------------
+static BOOL MarksFromCheckedRung(int rung)
+{
+    BYTE *key;
+    int keyLen;
+    unsigned long long hash = RungContents(rung, &key, &keyLen);
+    int i, j;
+    for(i = 0; i < CheckedRungCount; i++) {
+        CheckedRung *c = &CheckedRungs[i];
+        if(c->hash != hash || c->keyLen != keyLen
+        || memcmp(c->key, key, keyLen) != 0)
+            continue;
+        for(j = 0; j < c->marks; j++)
+            CheckMsg(c->name[j], MarkUsedVariable(c->name[j], c->flag[j]));
+        c->used = TRUE;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// Keep the marks just made for a rung, which was walked.
+//-----------------------------------------------------------------------------
+static void CheckedRungToCache(int rung)
+{
+    if(CheckedRungCount >= CheckedRungMax) {
+        int m = CheckedRungMax ? 2*CheckedRungMax : 64;
+        CheckedRung *c = (CheckedRung *)CheckMalloc(m * sizeof(CheckedRung));
+        if(CheckedRungs) {
+            memcpy(c, CheckedRungs, CheckedRungCount * sizeof(CheckedRung));
+            CheckFree(CheckedRungs);
+        }
+        CheckedRungs = c;
+        CheckedRungMax = m;
+    }
+    CheckedRung *c = &CheckedRungs[CheckedRungCount++];
+    BYTE *key;
+    c->hash = RungContents(rung, &key, &c->keyLen);
+    c->key = (BYTE *)CheckMalloc(c->keyLen ? c->keyLen : 1);
+    memcpy(c->key, key, c->keyLen);
+    c->marks = RungMarkCount;
+    c->name = (char **)CheckMalloc((RungMarkCount ? RungMarkCount : 1) *
+        sizeof(char *));
+    c->flag = (DWORD *)CheckMalloc((RungMarkCount ? RungMarkCount : 1) *
+        sizeof(DWORD));
+    memcpy(c->name, RungMarkName, RungMarkCount * sizeof(char *));
+    memcpy(c->flag, RungMarkFlag, RungMarkCount * sizeof(DWORD));
+    c->used = TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Drop the rungs that this check did not see, which have been edited or
+// deleted.
+//-----------------------------------------------------------------------------
+static void TrimCheckedRungs(void)
+{
+    int i, j = 0;
+    for(i = 0; i < CheckedRungCount; i++) {
+        if(CheckedRungs[i].used) {
+            CheckedRungs[i].used = FALSE;
+            CheckedRungs[j++] = CheckedRungs[i];
+        } else {
+            CheckFree(CheckedRungs[i].key);
+            CheckFree(CheckedRungs[i].name);
+            CheckFree(CheckedRungs[i].flag);
+        }
+    }
+    CheckedRungCount = j;
+}
+
+//-----------------------------------------------------------------------------
+// Check how the variables are used, rung by rung. Called by
+// GenerateIntermediateCode(), once the rungs have been hashed; only the
+// rungs that were edited since the last call are walked.
+//-----------------------------------------------------------------------------
 void CheckVariableNames(void)
 {
     int i;
     for(i = 0; i < Prog.numRungs; i++) {
         rungNow = i; // Ok
+        if(MarksFromCheckedRung(i)) continue;
+        RungMarkCount = 0;
         CheckVariableNamesCircuit(ELEM_SERIES_SUBCKT, Prog.rungs[i]);
+        CheckedRungToCache(i);
     }
+    TrimCheckedRungs();
 
     // reCheck
-    for(i = 0; i < VariableCount; i++)
+    for(i = 0; i < SimVariableCount; i++)
         if(Variables[i].usedFlags & VAR_FLAG_TCY)
              CheckMsg(Variables[i].name, Check(Variables[i].name, VAR_FLAG_TCY, i));
 
-    for(i = 0; i < VariableCount; i++)
+    for(i = 0; i < SimVariableCount; i++)
         if(Variables[i].usedFlags & VAR_FLAG_TON)
              CheckMsg(Variables[i].name, Check(Variables[i].name, VAR_FLAG_TON, i));
 
-    for(i = 0; i < VariableCount; i++)
+    for(i = 0; i < SimVariableCount; i++)
         if(Variables[i].usedFlags & VAR_FLAG_TOF)
              CheckMsg(Variables[i].name, Check(Variables[i].name, VAR_FLAG_TOF, i));
 
-    for(i = 0; i < VariableCount; i++)
+    for(i = 0; i < SimVariableCount; i++)
         if(Variables[i].usedFlags & VAR_FLAG_RTO)
              CheckMsg(Variables[i].name, Check(Variables[i].name, VAR_FLAG_RTO, i));
 
-    for(i = 0; i < VariableCount; i++)
+    for(i = 0; i < SimVariableCount; i++)
         if(Variables[i].usedFlags & VAR_FLAG_CTU)
              CheckMsg(Variables[i].name, Check(Variables[i].name, VAR_FLAG_CTU, i));
 
-    for(i = 0; i < VariableCount; i++)
+    for(i = 0; i < SimVariableCount; i++)
         if(Variables[i].usedFlags & VAR_FLAG_CTD)
              CheckMsg(Variables[i].name, Check(Variables[i].name, VAR_FLAG_CTD, i));
 
-    for(i = 0; i < VariableCount; i++)
+    for(i = 0; i < SimVariableCount; i++)
         if(Variables[i].usedFlags & VAR_FLAG_CTC)
              CheckMsg(Variables[i].name, Check(Variables[i].name, VAR_FLAG_CTC, i));
 
-    for(i = 0; i < VariableCount; i++)
+    for(i = 0; i < SimVariableCount; i++)
         if(Variables[i].usedFlags & VAR_FLAG_CTR)
              CheckMsg(Variables[i].name, Check(Variables[i].name, VAR_FLAG_CTR, i));
 
-    for(i = 0; i < VariableCount; i++)
+    for(i = 0; i < SimVariableCount; i++)
         if(Variables[i].usedFlags & VAR_FLAG_RES)
              CheckMsg(Variables[i].name, Check(Variables[i].name, VAR_FLAG_RES, i));
 
-    for(i = 0; i < VariableCount; i++)
+    for(i = 0; i < SimVariableCount; i++)
         if(Variables[i].usedFlags & VAR_FLAG_TABLE)
              CheckMsg(Variables[i].name, Check(Variables[i].name, VAR_FLAG_TABLE, i));
 
-    for(i = 0; i < VariableCount; i++)
+    for(i = 0; i < SimVariableCount; i++)
         if(Variables[i].usedFlags & VAR_FLAG_ANY)
              CheckMsg(Variables[i].name, Check(Variables[i].name, VAR_FLAG_ANY, i));
 
-    for(i = 0; i < VariableCount; i++)
+    for(i = 0; i < SimVariableCount; i++)
         if(Variables[i].usedFlags & VAR_FLAG_OTHERWISE_FORGOTTEN)
              CheckMsg(Variables[i].name, Check(Variables[i].name, VAR_FLAG_OTHERWISE_FORGOTTEN, i));
 }
@@ -842,6 +1653,76 @@ static void CheckSingleBitNegate(void)
         CheckSingleBitNegateCircuit(ELEM_SERIES_SUBCKT, Prog.rungs[i]);
     }
 }
+//-----------------------------------------------------------------------------
+// The shifts, rotates and logic ops, the same in both engines. The rotates
+// and the unsigned shift work on BITS_OF_LD_VAR bits, as the variables do
+// on the MCU; the result is sign extended again.
+//-----------------------------------------------------------------------------
+static SDWORD BitMathValue(int op, SDWORD a, SDWORD b)
+{
+    DWORD mask = (1ul << BITS_OF_LD_VAR) - 1;
+    DWORD u = (DWORD)a & mask;
+    int n = (int)(b & 0xff) % BITS_OF_LD_VAR;
+    switch(op) {
+        case INT_SET_VARIABLE_ROL:
+            u = ((u << n) | (u >> (BITS_OF_LD_VAR - n))) & mask;
+            break;
+        case INT_SET_VARIABLE_ROR:
+            u = ((u >> n) | (u << (BITS_OF_LD_VAR - n))) & mask;
+            break;
+        case INT_SET_VARIABLE_SR0:
+            u = u >> (b & 0xff);
+            break;
+        case INT_SET_VARIABLE_SHL: return a << (b & 0xff);
+        case INT_SET_VARIABLE_SHR: return a >> (b & 0xff);
+        case INT_SET_VARIABLE_AND: return a & b;
+        case INT_SET_VARIABLE_OR:  return a | b;
+        case INT_SET_VARIABLE_XOR: return a ^ b;
+        case INT_SET_VARIABLE_NOT: return ~a;
+        case INT_SET_VARIABLE_NEG: return -a;
+        default: oops();
+    }
+    if(u & (1ul << (BITS_OF_LD_VAR - 1)))
+        u |= ~mask;
+    return (SDWORD)u;
+}
+
+//-----------------------------------------------------------------------------
+// A division by zero halts the simulation; a batch run is only stopped, with
+// the reason kept for its report, as it may be one of several on threads of
+// their own.
+//-----------------------------------------------------------------------------
+static void DivisionByZero(void)
+{
+    if(Sim->batch) {
+        BatchHalt(Sim->batch, _("Division by zero"));
+    } else {
+        Error(_("Division by zero; halting simulation"));
+        StopSimulation();
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Does the op open a block that an ELSE or END IF closes? The SFR tests do,
+// though they are outside of the INT_IF_GROUP range.
+//-----------------------------------------------------------------------------
+static BOOL OpensBlock(int op)
+{
+    if(INT_IF_GROUP(op)) return TRUE;
+    switch(op) {
+        case INT_TEST_SFR_LITERAL:
+        case INT_TEST_SFR_VARIABLE:
+        case INT_TEST_SFR_LITERAL_L:
+        case INT_TEST_SFR_VARIABLE_L:
+        case INT_TEST_C_SFR_LITERAL:
+        case INT_TEST_C_SFR_VARIABLE:
+        case INT_TEST_C_SFR_LITERAL_L:
+        case INT_TEST_C_SFR_VARIABLE_L:
+            return TRUE;
+    }
+    return FALSE;
+}
+
 //-----------------------------------------------------------------------------
 // The IF condition is true. Execute the body, up until the ELSE or the
 // END IF, and then skip the ELSE if it is present. Called with PC on the
@@ -849,23 +1730,23 @@ static void CheckSingleBitNegate(void)
 //-----------------------------------------------------------------------------
 static void IfConditionTrue(void)
 {
-    IntPc++;
+    Sim->pc++;
     // now PC is on the first statement of the IF body
     SimulateIntCode();
     // now PC is on the ELSE or the END IF
-    if(IntCode[IntPc].op == INT_ELSE) {
+    if(IntCode[Sim->pc].op == INT_ELSE) {
         int nesting = 1;
-        for(; ; IntPc++) {
-            if(IntPc >= IntCodeLen) oops();
+        for(; ; Sim->pc++) {
+            if(Sim->pc >= IntCodeLen) oops();
 
-            if(IntCode[IntPc].op == INT_END_IF) {
+            if(IntCode[Sim->pc].op == INT_END_IF) {
                 nesting--;
-            } else if(INT_IF_GROUP(IntCode[IntPc].op)) {
+            } else if(OpensBlock(IntCode[Sim->pc].op)) {
                 nesting++;
             }
             if(nesting == 0) break;
         }
-    } else if(IntCode[IntPc].op == INT_END_IF) {
+    } else if(IntCode[Sim->pc].op == INT_END_IF) {
         return;
     } else {
         oops();
@@ -880,24 +1761,24 @@ static void IfConditionTrue(void)
 static void IfConditionFalse(void)
 {
     int nesting = 0;
-    for(; ; IntPc++) {
-        if(IntPc >= IntCodeLen) oops();
+    for(; ; Sim->pc++) {
+        if(Sim->pc >= IntCodeLen) oops();
 
-        if(IntCode[IntPc].op == INT_END_IF) {
+        if(IntCode[Sim->pc].op == INT_END_IF) {
             nesting--;
-        } else if(INT_IF_GROUP(IntCode[IntPc].op)) {
+        } else if(OpensBlock(IntCode[Sim->pc].op)) {
             nesting++;
-        } else if(IntCode[IntPc].op == INT_ELSE && nesting == 1) {
+        } else if(IntCode[Sim->pc].op == INT_ELSE && nesting == 1) {
             break;
         }
         if(nesting == 0) break;
     }
 
     // now PC is on the ELSE or the END IF
-    if(IntCode[IntPc].op == INT_ELSE) {
-        IntPc++;
+    if(IntCode[Sim->pc].op == INT_ELSE) {
+        Sim->pc++;
         SimulateIntCode();
-    } else if(IntCode[IntPc].op == INT_END_IF) {
+    } else if(IntCode[Sim->pc].op == INT_END_IF) {
         return;
     } else {
         oops();
@@ -905,211 +1786,781 @@ static void IfConditionFalse(void)
 }
 
 //-----------------------------------------------------------------------------
-// Evaluate a circuit, calling ourselves recursively to evaluate if/else
-// constructs. Updates the on/off state of all the leaf elements in our
-// internal tables. Returns when it reaches an end if or an else construct,
-// or at the end of the program.
+// Profiler, to find the rungs that dominate the scan time. While it is on,
+// SimulateIntCode() counts how many times each op runs and which way each
+// if goes, and times each rung; everything else (ops per rung, per element
+// type) is worked out from those counts for the report. It uses the switch
+// engine, whatever ThreadedSimulation says, and profiles one instance at a
+// time.
 //-----------------------------------------------------------------------------
-static void SimulateIntCode(void)
+BOOL ProfilingSimulation;
+
+// Code from before the first rung or after the last is counted as one more
+// rung, at MAX_RUNGS.
+#define PROFILE_RUNG(r) (((r) >= 0 && (r) < MAX_RUNGS) ? (r) : MAX_RUNGS)
+
+static ULONGLONG *ProfileExecuted;
+static ULONGLONG *ProfileTaken;     // for the ifs
+static LONGLONG ProfileTicks[MAX_RUNGS + 1];
+static DWORD ProfileCycles;
+// The rung that we are in, and when we got there.
+static int ProfileRung;
+static LONGLONG ProfileSince;
+
+void ResetProfile(void)
+{
+    if(OpTablesSize) {
+        memset(ProfileExecuted, 0, OpTablesSize * sizeof(ProfileExecuted[0]));
+        memset(ProfileTaken, 0, OpTablesSize * sizeof(ProfileTaken[0]));
+    }
+    memset(ProfileTicks, 0, sizeof(ProfileTicks));
+    ProfileCycles = 0;
+}
+
+static LONGLONG ProfileNow(void)
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+// Charge the time since the last call to the rung that we were in.
+static void ProfileTime(int rung)
+{
+    LONGLONG now = ProfileNow();
+    ProfileTicks[ProfileRung] += now - ProfileSince;
+    ProfileSince = now;
+    ProfileRung = rung;
+}
+
+static inline void ProfileOp(int pc)
+{
+    int rung = PROFILE_RUNG(IntCode[pc].rung);
+    if(rung != ProfileRung) ProfileTime(rung);
+    ProfileExecuted[pc]++;
+}
+
+static void ProfileStartCycle(void)
+{
+    ProfileRung = MAX_RUNGS;
+    ProfileSince = ProfileNow();
+}
+
+static void ProfileEndCycle(void)
+{
+    ProfileTime(MAX_RUNGS);
+    ProfileCycles++;
+}
+
+//-----------------------------------------------------------------------------
+// Write what the profiler has counted: a report sorted by time, slowest rung
+// first, or the same as JSON. Returns FALSE if the file could not be written.
+//-----------------------------------------------------------------------------
+typedef struct ProfileRungTag {
+    int         rung;
+    LONGLONG    ticks;
+    ULONGLONG   ops;
+    ULONGLONG   taken;
+    ULONGLONG   notTaken;
+} ProfileRungInfo;
+
+typedef struct ProfileElemTag {
+    int         which;
+    ULONGLONG   ops;
+} ProfileElemInfo;
+
+static int CompareProfileRungs(const void *a, const void *b)
+{
+    const ProfileRungInfo *ra = (const ProfileRungInfo *)a;
+    const ProfileRungInfo *rb = (const ProfileRungInfo *)b;
+    if(ra->ticks != rb->ticks) return ra->ticks < rb->ticks ? 1 : -1;
+    if(ra->ops != rb->ops) return ra->ops < rb->ops ? 1 : -1;
+    return ra->rung - rb->rung;
+}
+
+static int CompareProfileElems(const void *a, const void *b)
+{
+    const ProfileElemInfo *ea = (const ProfileElemInfo *)a;
+    const ProfileElemInfo *eb = (const ProfileElemInfo *)b;
+    if(ea->ops != eb->ops) return ea->ops < eb->ops ? 1 : -1;
+    return ea->which - eb->which;
+}
+
+BOOL SaveProfile(char *filename, BOOL json)
+{
+    static ProfileRungInfo rungs[MAX_RUNGS + 1];
+    static ProfileElemInfo *elems;
+    static int elemsSize;
+    int rungCount = 0, elemCount = 0;
+    LONGLONG totalTicks = 0;
+    ULONGLONG totalOps = 0;
+    LARGE_INTEGER freq;
+    int i, j;
+
+    if(elemsSize < IntCodeLen) {
+        if(elems) CheckFree(elems);
+        elems = (ProfileElemInfo *)CheckMalloc(IntCodeLen * sizeof(*elems));
+        elemsSize = IntCodeLen;
+    }
+
+    // Gather the counts of each op by rung and by element type.
+    for(i = 0; i <= MAX_RUNGS; i++) {
+        memset(&rungs[i], 0, sizeof(rungs[i]));
+        rungs[i].rung = i;
+        rungs[i].ticks = ProfileTicks[i];
+        totalTicks += ProfileTicks[i];
+    }
+    for(i = 0; i < IntCodeLen; i++) {
+        if(ProfileExecuted[i] == 0) continue;
+        ProfileRungInfo *r = &rungs[PROFILE_RUNG(IntCode[i].rung)];
+        r->ops += ProfileExecuted[i];
+        if(OpensBlock(IntCode[i].op)) {
+            r->taken += ProfileTaken[i];
+            r->notTaken += ProfileExecuted[i] - ProfileTaken[i];
+        }
+        totalOps += ProfileExecuted[i];
+
+        for(j = 0; j < elemCount; j++)
+            if(elems[j].which == IntCode[i].which) break;
+        if(j == elemCount) {
+            elems[elemCount].which = IntCode[i].which;
+            elems[elemCount].ops = 0;
+            elemCount++;
+        }
+        elems[j].ops += ProfileExecuted[i];
+    }
+    for(i = 0; i <= MAX_RUNGS; i++) {
+        if(rungs[i].ops || rungs[i].ticks)
+            rungs[rungCount++] = rungs[i];
+    }
+    qsort(rungs, rungCount, sizeof(rungs[0]), CompareProfileRungs);
+    qsort(elems, elemCount, sizeof(elems[0]), CompareProfileElems);
+
+    QueryPerformanceFrequency(&freq);
+    double usPerTick = 1e6 / (double)freq.QuadPart;
+    double cycles = ProfileCycles ? (double)ProfileCycles : 1.0;
+
+    FILE *f = fopen(filename, "w");
+    if(!f) return FALSE;
+
+    if(json) {
+        fprintf(f, "{\n  \"cycles\": %lu,\n  \"us\": %.3f,\n  \"ops\": %llu,\n",
+            ProfileCycles, totalTicks * usPerTick, totalOps);
+        fprintf(f, "  \"rungs\": [");
+        for(i = 0; i < rungCount; i++) {
+            ProfileRungInfo *r = &rungs[i];
+            fprintf(f, "%s\n    {\"rung\": %d, \"us\": %.3f, \"ops\": %llu, "
+                "\"opsInRung\": %lu, \"taken\": %llu, \"notTaken\": %llu}",
+                i ? "," : "", r->rung < MAX_RUNGS ? r->rung + 1 : 0,
+                r->ticks * usPerTick, r->ops,
+                r->rung < MAX_RUNGS ? Prog.OpsInRung[r->rung] : 0,
+                r->taken, r->notTaken);
+        }
+        fprintf(f, "\n  ],\n  \"elements\": [");
+        for(i = 0; i < elemCount; i++) {
+            fprintf(f, "%s\n    {\"which\": %d, \"ops\": %llu}", i ? "," : "",
+                elems[i].which, elems[i].ops);
+        }
+        fprintf(f, "\n  ],\n  \"branches\": [");
+        for(i = 0, j = 0; i < IntCodeLen; i++) {
+            if(!INT_IF_GROUP(IntCode[i].op) || ProfileExecuted[i] == 0)
+                continue;
+            fprintf(f, "%s\n    {\"op\": %d, \"rung\": %d, \"which\": %d, "
+                "\"taken\": %llu, \"notTaken\": %llu}", j++ ? "," : "", i,
+                PROFILE_RUNG(IntCode[i].rung) < MAX_RUNGS ?
+                    IntCode[i].rung + 1 : 0,
+                IntCode[i].which, ProfileTaken[i],
+                ProfileExecuted[i] - ProfileTaken[i]);
+        }
+        fprintf(f, "\n  ]\n}\n");
+    } else {
+        fprintf(f, "%lu cycles, %.1f us/cycle, %.1f ops/cycle\n\n",
+            ProfileCycles, totalTicks * usPerTick / cycles, totalOps / cycles);
+        fprintf(f, " rung    time%%   us/cycle  ops/cycle  ops in rung"
+            "      taken  not taken\n");
+        for(i = 0; i < rungCount; i++) {
+            ProfileRungInfo *r = &rungs[i];
+            char rung[20];
+            if(r->rung < MAX_RUNGS) {
+                sprintf(rung, "%5d", r->rung + 1);
+            } else {
+                strcpy(rung, "other");
+            }
+            fprintf(f, "%s  %6.2f  %9.3f  %9.1f  %11lu  %9llu  %9llu\n", rung,
+                totalTicks ? 100.0 * r->ticks / totalTicks : 0.0,
+                r->ticks * usPerTick / cycles, r->ops / cycles,
+                r->rung < MAX_RUNGS ? Prog.OpsInRung[r->rung] : 0,
+                r->taken, r->notTaken);
+        }
+        fprintf(f, "\nelement  ops/cycle    ops%%\n");
+        for(i = 0; i < elemCount; i++) {
+            char which[20];
+            if(elems[i].which != INT_MAX) {
+                sprintf(which, "0x%04x", elems[i].which);
+            } else {
+                strcpy(which, "none"); // code for the rung as a whole
+            }
+            fprintf(f, "%-6s   %9.1f  %6.2f\n", which, elems[i].ops / cycles,
+                totalOps ? 100.0 * elems[i].ops / totalOps : 0.0);
+        }
+    }
+    BOOL ok = !ferror(f);
+    if(fclose(f) != 0) ok = FALSE;
+    return ok;
+}
+
+//-----------------------------------------------------------------------------
+// Return which of SimRings[] is the shift register with the given name,
+// setting it up the first time that it is asked for, with the variables of
+// its stages as its cells. Returns -1 if a table is full.
+//-----------------------------------------------------------------------------
+static int SimRingFor(char *name, int stages)
 {
-    for(; IntPc < IntCodeLen; IntPc++) {
-        IntOp *a = &IntCode[IntPc];
+    int i;
+    for(i = 0; i < SimRingCount; i++)
+        if(strcmp(SimRings[i].name, name) == 0) return i;
+    if(RingCellsCount + stages > MAX_IO) return -1;
+
+    SimRing *r = &SimRings[SimRingCount];
+    char str[MAX_NAME_LEN + 10];
+    sprintf(str, "$%s_head", name);
+    if((r->head = VariableSlot(str, TRUE)) < 0) return -1;
+    RingOfVar[r->head] = SimRingCount + 1;
+    StageOfVar[r->head] = -1;
+    r->name = name;
+    r->stages = stages;
+    r->cells = RingCellsCount;
+    for(i = 0; i < stages; i++) {
+        sprintf(str, "%s%d", name, i);
+        int v = VariableSlot(str, FALSE);
+        if(v < 0) return -1;
+        RingCells[RingCellsCount++] = v;
+        RingOfVar[v] = SimRingCount + 1;
+        StageOfVar[v] = i;
+    }
+    return SimRingCount++;
+}
+
+//-----------------------------------------------------------------------------
+// Bind the operands of every op in IntCode[] to their slots in the flat value
+// arrays, so that SimulateIntCode() never has to look a name up. Must be
+// redone whenever the intermediate code is regenerated. Returns FALSE if one
+// of the tables overflowed.
+//-----------------------------------------------------------------------------
+static BOOL ResolveSimulationSlots(void)
+{
+    int i;
+    for(i = 0; i < IntCodeLen; i++) {
+        IntOp *a = &IntCode[i];
+        SimSlots *s = &OpSlots[i];
+        memset(s, 0, sizeof(*s));
+        rungNow = a->rung;
+
+        BOOL ok = TRUE;
+#define BIT_SLOT(f, name)       if((s->f = SingleBitSlot(name)) < 0) ok = FALSE
+#define VAR_SLOT(f, name, wr)   if((s->f = VariableSlot(name, wr)) < 0) ok = FALSE
+#define ADC_SLOT(name)          if((s->adc = AdcShadowSlot(name)) < 0) ok = FALSE
+#define RING(name, stages)      if((s->ring = SimRingFor(name, stages)) < 0) ok = FALSE
         switch(a->op) {
             case INT_SIMULATE_NODE_STATE:
-                if(*(a->poweredAfter) != SingleBitOn(a->name1))
-                    NeedRedraw = TRUE;
-                *(a->poweredAfter) = SingleBitOn(a->name1);
-                break;
-
             case INT_SET_BIT:
-                SetSingleBit(a->name1, TRUE);
-                break;
-
             case INT_CLEAR_BIT:
-                SetSingleBit(a->name1, FALSE);
+            case INT_IF_BIT_SET:
+            case INT_IF_BIT_CLEAR:
+            case INT_EEPROM_BUSY_CHECK:
+            case INT_UART_SEND_BUSY:
+            case INT_UART_RECV_AVAIL:
+                BIT_SLOT(bit1, a->name1);
                 break;
 
             case INT_COPY_BIT_TO_BIT:
-                SetSingleBit(a->name1, SingleBitOn(a->name2));
+                BIT_SLOT(bit1, a->name1);
+                BIT_SLOT(bit2, a->name2);
                 break;
 
             case INT_SET_VARIABLE_TO_LITERAL:
-                if(GetSimulationVariable(a->name1) !=
-                    a->literal && a->name1[0] != '$')
-                {
-                    NeedRedraw = TRUE;
-                }
-                SetSimulationVariable(a->name1, a->literal);
+            case INT_INCREMENT_VARIABLE:
+            case INT_DECREMENT_VARIABLE:
+                VAR_SLOT(var1, a->name1, TRUE);
                 break;
 
+            case INT_READ_ADC:
             case INT_READ_SFR_LITERAL:
-                SetSimulationVariable(a->name1, GetAdcShadow(a->name1));
+                VAR_SLOT(var1, a->name1, TRUE);
+                ADC_SLOT(a->name1);
                 break;
 
             case INT_READ_SFR_VARIABLE:
-                SetSimulationVariable(a->name2, GetAdcShadow(a->name2));
-                break;
-
-            case  INT_WRITE_SFR_LITERAL:
-            case  INT_SET_SFR_LITERAL:
-            case  INT_CLEAR_SFR_LITERAL:
-            case  INT_TEST_SFR_LITERAL:
-            case  INT_WRITE_SFR_VARIABLE:
-            case  INT_SET_SFR_VARIABLE:
-            case  INT_CLEAR_SFR_VARIABLE:
-            case  INT_TEST_SFR_VARIABLE:
-            case  INT_TEST_C_SFR_LITERAL:
-            case  INT_WRITE_SFR_LITERAL_L:
-            case  INT_WRITE_SFR_VARIABLE_L:
-            case  INT_SET_SFR_LITERAL_L:
-            case  INT_SET_SFR_VARIABLE_L:
-            case  INT_CLEAR_SFR_LITERAL_L:
-            case  INT_CLEAR_SFR_VARIABLE_L:
-            case  INT_TEST_SFR_LITERAL_L:
-            case  INT_TEST_SFR_VARIABLE_L:
-            case  INT_TEST_C_SFR_VARIABLE:
-            case  INT_TEST_C_SFR_LITERAL_L:
-            case  INT_TEST_C_SFR_VARIABLE_L:
+                VAR_SLOT(var2, a->name2, TRUE);
+                ADC_SLOT(a->name2);
                 break;
 
-            case INT_SET_BIN2BCD: {
+            case INT_SET_VARIABLE_TO_VARIABLE:
+            case INT_LOOK_UP_TABLE:
+            case INT_PIECEWISE_LINEAR:
+            case INT_SET_VARIABLE_NOT:
+            case INT_SET_VARIABLE_NEG:
+                VAR_SLOT(var1, a->name1, TRUE);
+                VAR_SLOT(var2, a->name2, FALSE);
                 break;
-            }
 
-            case INT_SET_BCD2BIN: {
+            case INT_SET_VARIABLE_ADD:
+            case INT_SET_VARIABLE_SUBTRACT:
+            case INT_SET_VARIABLE_MULTIPLY:
+            case INT_SET_VARIABLE_DIVIDE:
+            case INT_SET_VARIABLE_ROL:
+            case INT_SET_VARIABLE_ROR:
+            case INT_SET_VARIABLE_SR0:
+            case INT_SET_VARIABLE_SHL:
+            case INT_SET_VARIABLE_SHR:
+            case INT_SET_VARIABLE_AND:
+            case INT_SET_VARIABLE_OR:
+            case INT_SET_VARIABLE_XOR:
+                VAR_SLOT(var1, a->name1, TRUE);
+                VAR_SLOT(var2, a->name2, FALSE);
+                VAR_SLOT(var3, a->name3, FALSE);
                 break;
-            }
 
-            case INT_SET_SWAP: {
+            case INT_IF_VARIABLE_LES_LITERAL:
+            case INT_QUAD_ENCOD:
+            case INT_SET_NPULSE:
+            case INT_SET_PWM:
+                VAR_SLOT(var1, a->name1, FALSE);
                 break;
-            }
 
-            case INT_SET_VARIABLE_TO_VARIABLE:
-                if(GetSimulationVariable(a->name1) !=
-                    GetSimulationVariable(a->name2))
-                {
-                    NeedRedraw = TRUE;
-                }
-                SetSimulationVariable(a->name1,
-                    GetSimulationVariable(a->name2));
+            case INT_IF_VARIABLE_EQUALS_VARIABLE:
+            case INT_IF_VARIABLE_GRT_VARIABLE:
+                VAR_SLOT(var1, a->name1, FALSE);
+                VAR_SLOT(var2, a->name2, FALSE);
                 break;
 
-            case INT_INCREMENT_VARIABLE:
-                GetSimulationVariable(a->name1);
-                IncrementVariable(a->name1);
+            case INT_UART_SEND:
+                VAR_SLOT(var1, a->name1, FALSE);
+                BIT_SLOT(bit2, a->name2);
                 break;
 
-            case INT_DECREMENT_VARIABLE:
-                GetSimulationVariable(a->name1);
-                DecrementVariable(a->name1);
+            case INT_SHIFT_REGISTER:
+                RING(a->name1, a->literal);
                 break;
-            {
-                SDWORD v;
-                case INT_SET_VARIABLE_ROL:
-                    goto math;
-                case INT_SET_VARIABLE_ROR:
-                    goto math;
-                case INT_SET_VARIABLE_SR0:
-                    goto math;
-                case INT_SET_VARIABLE_SHL:
-                    goto math;
-                case INT_SET_VARIABLE_SHR:
-                    goto math;
-                case INT_SET_VARIABLE_AND:
-                    goto math;
-                case INT_SET_VARIABLE_OR:
-                    goto math;
-                case INT_SET_VARIABLE_XOR:
-                    goto math;
-                case INT_SET_VARIABLE_NOT:
-                    goto math;
-                case INT_SET_VARIABLE_NEG:
-                    goto math;
-                case INT_SET_VARIABLE_ADD:
-                    v = GetSimulationVariable(a->name2) +
-                        GetSimulationVariable(a->name3);
-                    goto math;
-                case INT_SET_VARIABLE_SUBTRACT:
-                    v = GetSimulationVariable(a->name2) -
-                        GetSimulationVariable(a->name3);
-                    goto math;
-                case INT_SET_VARIABLE_MULTIPLY:
-                    v = GetSimulationVariable(a->name2) *
-                        GetSimulationVariable(a->name3);
-                    goto math;
-                case INT_SET_VARIABLE_DIVIDE:
-                    if(GetSimulationVariable(a->name3) != 0) {
-                      if(a->op == INT_SET_VARIABLE_DIVIDE)
-                        v = GetSimulationVariable(a->name2) /
-                            GetSimulationVariable(a->name3);
-                      else
-                        v = GetSimulationVariable(a->name2) %
-                            GetSimulationVariable(a->name3);
-                    } else {
-                        v = 0;
-                        Error(_("Division by zero; halting simulation"));
-                        StopSimulation();
-                    }
-                    goto math;
-math:
-                    if(GetSimulationVariable(a->name1) != v) {
-                        NeedRedraw = TRUE;
-                        SetSimulationVariable(a->name1, v);
-                    }
-                    break;
-            }
 
-#define IF_BODY \
-    { \
-        IfConditionTrue(); \
-    } else { \
-        IfConditionFalse(); \
-    }
-            case INT_IF_BIT_SET:
-                if(SingleBitOn(a->name1))
-                    IF_BODY
+            case INT_RING_READ:
+                VAR_SLOT(var1, a->name1, TRUE);
+                RING(a->name2, a->literal2);
                 break;
 
-            case INT_IF_BIT_CLEAR:
-                if(!SingleBitOn(a->name1))
-                    IF_BODY
+            case INT_RING_WRITE:
+                RING(a->name1, a->literal2);
+                VAR_SLOT(var2, a->name2, FALSE);
                 break;
 
-            case INT_IF_VARIABLE_LES_LITERAL:
-                if(GetSimulationVariable(a->name1) < a->literal)
-                    IF_BODY
+            case INT_UART_RECV:
+                VAR_SLOT(var1, a->name1, TRUE);
+                BIT_SLOT(bit2, a->name2);
                 break;
 
-            case INT_IF_VARIABLE_EQUALS_VARIABLE:
-                if(GetSimulationVariable(a->name1) ==
-                    GetSimulationVariable(a->name2))
-                    IF_BODY
+            case INT_EEPROM_READ:
+            case INT_EEPROM_WRITE:
+                VAR_SLOT(var1, a->name1, a->op == INT_EEPROM_READ);
+                s->bytes = SizeOfVar(a->name1);
+                if(a->literal < 0 || s->bytes > (int)sizeof(Sim->eeprom.value)
+                    || a->literal + s->bytes > SIM_EEPROM_SIZE)
+                {
+                    Error(_("EEPROM address %d of '%s' is out of range for "
+                        "the simulator (rung %d)."), a->literal, a->name1,
+                        a->rung + 1);
+                    return FALSE;
+                }
                 break;
 
-            case INT_IF_VARIABLE_GRT_VARIABLE:
-                if(GetSimulationVariable(a->name1) >
-                    GetSimulationVariable(a->name2))
-                    IF_BODY
+            default:
+                // no operands that the simulator looks at
                 break;
+        }
+#undef BIT_SLOT
+#undef VAR_SLOT
+#undef ADC_SLOT
+#undef RING
+        if(!ok) {
+            Error(_("Internal limit exceeded (MAX_IO)"));
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
 
-            case INT_QUAD_ENCOD:
-            case INT_SET_NPULSE:
-            case INT_SET_PWM:
-                // Dummy call will cause a warning if no one ever assigned
-                // to that variable.
-                (void)GetSimulationVariable(a->name1);
-                break;
+//-----------------------------------------------------------------------------
+// The simulated UART. How far the line gets in one cycle, in bit-microseconds;
+// a byte every cycle if the baud rate or the cycle time is not set.
+//-----------------------------------------------------------------------------
+static long long UartLineRate(void)
+{
+    long long rate = (long long)Prog.baudRate * Prog.cycleTime;
+    return rate > 0 ? rate : UART_BYTE_COST;
+}
 
-            // Don't try to simulate the EEPROM stuff: just hold the EEPROM
-            // busy all the time, so that the program never does anything
-            // with it.
-            case INT_EEPROM_BUSY_CHECK:
-                SetSingleBit(a->name1, TRUE);
-                break;
+static void ResetUart(void)
+{
+    memset(&Sim->uart, 0, sizeof(Sim->uart));
+    Sim->uart.rxSize = 1;
+    Sim->uart.txSize = 1;
+}
+
+static inline BOOL UartTxFull(void)
+{
+    return Sim->uart.txCount >= Sim->uart.txSize;
+}
+
+static inline void UartTxPush(BYTE b)
+{
+    SimUart *u = &Sim->uart;
+    u->tx[(u->txHead + u->txCount++) % SIM_UART_FIFO_MAX] = b;
+}
+
+static inline BYTE UartRxPop(void)
+{
+    SimUart *u = &Sim->uart;
+    BYTE b = u->rx[u->rxHead];
+    u->rxHead = (u->rxHead + 1) % SIM_UART_FIFO_MAX;
+    u->rxCount--;
+    return b;
+}
+
+//-----------------------------------------------------------------------------
+// At the start of a cycle, send whatever the line got through since the last
+// one. A byte written to an idle UART takes a whole frame from then on.
+//-----------------------------------------------------------------------------
+static void UartTransmit(void)
+{
+    SimUart *u = &Sim->uart;
+    if(u->txCount == 0) {
+        u->txCredit = 0;
+        return;
+    }
+    u->txCredit += UartLineRate();
+    while(u->txCount > 0 && u->txCredit >= UART_BYTE_COST) {
+        UartSent(u->tx[u->txHead]);
+        u->txHead = (u->txHead + 1) % SIM_UART_FIFO_MAX;
+        u->txCount--;
+        u->txCredit -= UART_BYTE_COST;
+    }
+    if(u->txCount == 0) u->txCredit = 0;
+}
+
+//-----------------------------------------------------------------------------
+// The simulated EEPROM. A write takes about 3.4 ms per byte on the AVRs and
+// 4 ms on the PICs, so at least the rest of the cycle in which it started.
+//-----------------------------------------------------------------------------
+static int EepromWriteCycles(int bytes)
+{
+    long long us = bytes * ((Prog.mcu && Prog.mcu->whichIsa == ISA_AVR) ?
+        3400 : 4000);
+    if(Prog.cycleTime <= 0) return 1;
+    int cycles = (int)((us + Prog.cycleTime - 1) / Prog.cycleTime);
+    return cycles > 0 ? cycles : 1;
+}
+
+static inline void EepromRead(SimSlots *s, int addr)
+{
+    SDWORD v = 0;
+    int i;
+    for(i = s->bytes - 1; i >= 0; i--)
+        v = (v << 8) | Sim->eeprom.data[addr + i];
+    // sign-extend, like a variable of that many bytes
+    if(s->bytes < 4 && (v & (1 << (8*s->bytes - 1))))
+        v -= 1 << (8*s->bytes);
+    SetVarSlot(s->var1, v);
+}
+
+static inline void EepromWrite(SimSlots *s, int addr)
+{
+    SimEeprom *e = &Sim->eeprom;
+    if(e->busy) return; // ignored, as by the real thing
+    SDWORD v = Sim->varVal[s->var1];
+    int i;
+    for(i = 0; i < s->bytes; i++)
+        e->value[i] = (BYTE)(v >> (8*i));
+    e->addr = addr;
+    e->bytes = s->bytes;
+    e->busy = EepromWriteCycles(s->bytes);
+}
+
+//-----------------------------------------------------------------------------
+// At the start of a cycle, finish the EEPROM write in progress if its time is
+// up. For the GUI's instance the EEPROM is backed by a file, which gets the
+// new bytes and their wear too.
+//-----------------------------------------------------------------------------
+static void EepromCycle(void)
+{
+    SimEeprom *e = &Sim->eeprom;
+    if(e->busy == 0 || --e->busy > 0) return;
+
+    int i;
+    for(i = 0; i < e->bytes; i++) {
+        int a = e->addr + i;
+        e->data[a] = e->value[i];
+        e->writes[a]++;
+        if(EepromFile && Sim == &MainSim) {
+            EepromFile->data[a] = e->data[a];
+            EepromFile->writes[a] = e->writes[a];
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Shift a shift register that is in a ring: move the head back one, so that
+// each stage is now where the one before it was, and give the new stage 0
+// the value of the old one, which is now stage 1.
+//-----------------------------------------------------------------------------
+static void ShiftRing(SimRing *r)
+{
+    SDWORD head = Sim->varVal[r->head];
+    head = head ? head - 1 : r->stages - 1;
+    SetVarSlot(r->head, head);
+    SetVarSlot(RingCell(r, head, 0), Sim->varVal[RingCell(r, head, 1)]);
+}
+
+static inline int RingStageSlot(SimRing *r, int k)
+{
+    return RingCell(r, Sim->varVal[r->head], k);
+}
+
+//-----------------------------------------------------------------------------
+// The value of a piecewise linear table of count (x, y) points at x, from the
+// first segment that ends at or past x, found by a binary search. FALSE if x
+// is past the last point, where the table leaves its output alone.
+//-----------------------------------------------------------------------------
+static BOOL PiecewiseLinearAt(SDWORD *v, int count, SDWORD x, SDWORD *y)
+{
+    if(x > v[(count - 1)*2]) return FALSE;
+    int lo = 1, hi = count - 1;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(x <= v[mid*2])
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    SDWORD x0 = v[(lo - 1)*2], y0 = v[(lo - 1)*2 + 1];
+    *y = y0 + (x - x0)*(v[lo*2 + 1] - y0)/(v[lo*2] - x0);
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Evaluate a circuit, calling ourselves recursively to evaluate if/else
+// constructs. Updates the on/off state of all the leaf elements in our
+// internal tables. Returns when it reaches an end if or an else construct,
+// or at the end of the program.
+//-----------------------------------------------------------------------------
+static void SimulateIntCode(void)
+{
+    for(; Sim->pc < IntCodeLen; Sim->pc++) {
+        IntOp *a = &IntCode[Sim->pc];
+        SimSlots *s = &OpSlots[Sim->pc];
+        if(ProfilingSimulation) ProfileOp(Sim->pc);
+        switch(a->op) {
+            case INT_SIMULATE_NODE_STATE:
+                if(RunningInBatchMode) break; // no display to update
+                if(*(a->poweredAfter) != Sim->bitVal[s->bit1])
+                    MarkRungDirty(a->rung);
+                *(a->poweredAfter) = Sim->bitVal[s->bit1];
+                break;
+
+            case INT_SET_BIT:
+                SetBitSlot(s->bit1, TRUE);
+                break;
+
+            case INT_CLEAR_BIT:
+                SetBitSlot(s->bit1, FALSE);
+                break;
+
+            case INT_COPY_BIT_TO_BIT:
+                SetBitSlot(s->bit1, Sim->bitVal[s->bit2]);
+                break;
+
+            case INT_SET_VARIABLE_TO_LITERAL:
+                SetVarSlot(s->var1, a->literal);
+                break;
+
+            case INT_READ_SFR_LITERAL:
+                SetVarSlot(s->var1, Sim->adcVal[s->adc]);
+                break;
+
+            case INT_READ_SFR_VARIABLE:
+                SetVarSlot(s->var2, Sim->adcVal[s->adc]);
+                break;
+
+            case  INT_WRITE_SFR_LITERAL:
+            case  INT_SET_SFR_LITERAL:
+            case  INT_CLEAR_SFR_LITERAL:
+            case  INT_WRITE_SFR_VARIABLE:
+            case  INT_SET_SFR_VARIABLE:
+            case  INT_CLEAR_SFR_VARIABLE:
+            case  INT_WRITE_SFR_LITERAL_L:
+            case  INT_WRITE_SFR_VARIABLE_L:
+            case  INT_SET_SFR_LITERAL_L:
+            case  INT_SET_SFR_VARIABLE_L:
+            case  INT_CLEAR_SFR_LITERAL_L:
+            case  INT_CLEAR_SFR_VARIABLE_L:
+                break;
+
+            case INT_SET_BIN2BCD: {
+                break;
+            }
+
+            case INT_SET_BCD2BIN: {
+                break;
+            }
+
+            case INT_SET_SWAP: {
+                break;
+            }
+
+            case INT_SET_VARIABLE_TO_VARIABLE:
+                SetVarSlot(s->var1, Sim->varVal[s->var2]);
+                break;
+
+            case INT_SHIFT_REGISTER:
+                ShiftRing(&SimRings[s->ring]);
+                break;
+
+            case INT_RING_READ:
+                SetVarSlot(s->var1, Sim->varVal[RingStageSlot(&SimRings[s->ring],
+                    a->literal)]);
+                break;
+
+            case INT_RING_WRITE:
+                SetVarSlot(RingStageSlot(&SimRings[s->ring], a->literal),
+                    Sim->varVal[s->var2]);
+                break;
+
+            case INT_LOOK_UP_TABLE: {
+                SDWORD i = Sim->varVal[s->var2];
+                if(i >= 0 && i < a->literal)
+                    SetVarSlot(s->var1, a->data[i]);
+                break;
+            }
+
+            case INT_PIECEWISE_LINEAR: {
+                SDWORD y;
+                if(PiecewiseLinearAt(a->data, a->literal, Sim->varVal[s->var2], &y))
+                    SetVarSlot(s->var1, y);
+                break;
+            }
+
+            case INT_INCREMENT_VARIABLE:
+                IncrementVarSlot(s->var1);
+                break;
+
+            case INT_DECREMENT_VARIABLE:
+                SetVarSlot(s->var1, Sim->varVal[s->var1] - 1);
+                break;
+            {
+                SDWORD v;
+                case INT_SET_VARIABLE_ROL:
+                case INT_SET_VARIABLE_ROR:
+                case INT_SET_VARIABLE_SR0:
+                case INT_SET_VARIABLE_SHL:
+                case INT_SET_VARIABLE_SHR:
+                case INT_SET_VARIABLE_AND:
+                case INT_SET_VARIABLE_OR:
+                case INT_SET_VARIABLE_XOR:
+                case INT_SET_VARIABLE_NOT:
+                case INT_SET_VARIABLE_NEG:
+                    v = BitMathValue(a->op, Sim->varVal[s->var2],
+                        Sim->varVal[s->var3]);
+                    goto math;
+                case INT_SET_VARIABLE_ADD:
+                    v = Sim->varVal[s->var2] + Sim->varVal[s->var3];
+                    goto math;
+                case INT_SET_VARIABLE_SUBTRACT:
+                    v = Sim->varVal[s->var2] - Sim->varVal[s->var3];
+                    goto math;
+                case INT_SET_VARIABLE_MULTIPLY:
+                    v = Sim->varVal[s->var2] * Sim->varVal[s->var3];
+                    goto math;
+                case INT_SET_VARIABLE_DIVIDE:
+                    if(Sim->varVal[s->var3] != 0) {
+                      if(a->op == INT_SET_VARIABLE_DIVIDE)
+                        v = Sim->varVal[s->var2] / Sim->varVal[s->var3];
+                      else
+                        v = Sim->varVal[s->var2] % Sim->varVal[s->var3];
+                    } else {
+                        v = 0;
+                        DivisionByZero();
+                    }
+                    goto math;
+math:
+                    if(Sim->varVal[s->var1] != v)
+                        SetVarSlot(s->var1, v);
+                    break;
+            }
+
+#define IF_BODY \
+    { \
+        if(ProfilingSimulation) ProfileTaken[Sim->pc]++; \
+        IfConditionTrue(); \
+    } else { \
+        IfConditionFalse(); \
+    }
+            case INT_IF_BIT_SET:
+                if(Sim->bitVal[s->bit1])
+                    IF_BODY
+                break;
+
+            case INT_IF_BIT_CLEAR:
+                if(!Sim->bitVal[s->bit1])
+                    IF_BODY
+                break;
+
+            case INT_IF_VARIABLE_LES_LITERAL:
+                if(Sim->varVal[s->var1] < a->literal)
+                    IF_BODY
+                break;
+
+            case INT_IF_VARIABLE_EQUALS_VARIABLE:
+                if(Sim->varVal[s->var1] == Sim->varVal[s->var2])
+                    IF_BODY
+                break;
+
+            case INT_IF_VARIABLE_GRT_VARIABLE:
+                if(Sim->varVal[s->var1] > Sim->varVal[s->var2])
+                    IF_BODY
+                break;
+
+            // There are no SFRs in the simulator; they all read as zero, so a
+            // test for a set bit always fails and one for a clear bit holds.
+            case INT_TEST_SFR_LITERAL:
+            case INT_TEST_SFR_VARIABLE:
+            case INT_TEST_SFR_LITERAL_L:
+            case INT_TEST_SFR_VARIABLE_L:
+                IfConditionFalse();
+                break;
+
+            case INT_TEST_C_SFR_LITERAL:
+            case INT_TEST_C_SFR_VARIABLE:
+            case INT_TEST_C_SFR_LITERAL_L:
+            case INT_TEST_C_SFR_VARIABLE_L:
+                if(ProfilingSimulation) ProfileTaken[Sim->pc]++;
+                IfConditionTrue();
+                break;
+
+            case INT_QUAD_ENCOD:
+            case INT_SET_NPULSE:
+            case INT_SET_PWM:
+                // The slot was resolved only to warn if no one ever assigned
+                // to that variable.
+                break;
+
+            case INT_EEPROM_BUSY_CHECK:
+                SetBitSlot(s->bit1, Sim->eeprom.busy > 0);
+                break;
 
             case INT_EEPROM_READ:
+                EepromRead(s, a->literal);
+                break;
+
             case INT_EEPROM_WRITE:
-                oops();
+                EepromWrite(s, a->literal);
                 break;
 
             case INT_READ_ADC:
@@ -1117,86 +2568,1597 @@ math:
                 // the real device they will not be updated until an actual
                 // read is performed, which occurs only for a true rung-in
                 // condition there.
-                SetSimulationVariable(a->name1, GetAdcShadow(a->name1));
+                SetVarSlot(s->var1, Sim->adcVal[s->adc]);
+                break;
+
+            case INT_UART_SEND:
+                if(Sim->bitVal[s->bit2] && !UartTxFull()) {
+                    UartTxPush((BYTE)Sim->varVal[s->var1]);
+                }
+                SetBitSlot(s->bit2, UartTxFull());
+                break;
+
+            case INT_UART_SEND_BUSY:
+                SetBitSlot(s->bit1, UartTxFull());
+                break;
+
+            case INT_UART_RECV:
+                if(Sim->uart.rxCount > 0) {
+                    SetBitSlot(s->bit2, TRUE);
+                    SetVarSlot(s->var1, (SWORD)UartRxPop());
+                } else {
+                    SetBitSlot(s->bit2, FALSE);
+                }
+                break;
+
+            case INT_UART_RECV_AVAIL:
+                SetBitSlot(s->bit1, Sim->uart.rxCount > 0);
+                break;
+
+            case INT_END_IF:
+            case INT_ELSE:
+                return;
+
+            case INT_COMMENT:
+                break;
+
+            #ifdef NEW_FEATURE
+            case INT_AllocKnownAddr:
+            case INT_AllocFwdAddr:
+            case INT_FwdAddrIsNow:
+            case INT_GotoRung:
+                break;
+
+            case INT_PRINTF_STRING:
+                break;
+            #endif
+
+            #define SPINTF(buffer, format, args) sprintf(buffer, format, #args);
+            case INT_WRITE_STRING: {
+                break;
+            }
+            #ifdef NEW_FEATURE
+            case INT_FLASH_INIT:
+                break;
+
+            case INT_FLASH_READ:{
+                break;
+
+            case INT_RAM_READ:{
+                break;
+            #endif
+
+            default:
+                ooops("op=%d",a->op);
+                break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// The threaded engine. IntCode[] is decoded once into a flat stream of
+// instructions that carry their handler, their operand slots and, for the
+// if/else constructs, the instruction to continue at. Each handler returns
+// the next instruction to run, so an if/else costs one indirect call and
+// nothing recurses. Ops that do nothing in the simulator are left out of the
+// stream altogether.
+//-----------------------------------------------------------------------------
+BOOL ThreadedSimulation = FALSE;
+
+typedef struct ThreadedOpTag ThreadedOp;
+typedef ThreadedOp *(*ThreadedHandler)(ThreadedOp *t);
+
+struct ThreadedOpTag {
+    ThreadedHandler fn;
+    SimSlots        s;
+    SDWORD          literal;
+    BOOL           *poweredAfter;
+    ThreadedOp     *jump;           // IF false: past the ELSE or END IF;
+                                    // ELSE: past the END IF
+    int             pc;             // where in IntCode[] this came from
+};
+
+static ThreadedOp *ThreadedCode;    // OpTablesSize + 1 of them
+static int ThreadedCodeLen;
+
+static ThreadedOp *ThrNodeState(ThreadedOp *t)
+{
+    if(*(t->poweredAfter) != Sim->bitVal[t->s.bit1])
+        MarkRungDirty(IntCode[t->pc].rung);
+    *(t->poweredAfter) = Sim->bitVal[t->s.bit1];
+    return t + 1;
+}
+
+static ThreadedOp *ThrSetBit(ThreadedOp *t)
+{
+    SetBitSlot(t->s.bit1, TRUE);
+    return t + 1;
+}
+
+static ThreadedOp *ThrClearBit(ThreadedOp *t)
+{
+    SetBitSlot(t->s.bit1, FALSE);
+    return t + 1;
+}
+
+static ThreadedOp *ThrCopyBit(ThreadedOp *t)
+{
+    SetBitSlot(t->s.bit1, Sim->bitVal[t->s.bit2]);
+    return t + 1;
+}
+
+static ThreadedOp *ThrSetLiteral(ThreadedOp *t)
+{
+    SetVarSlot(t->s.var1, t->literal);
+    return t + 1;
+}
+
+static ThreadedOp *ThrCopyVar(ThreadedOp *t)
+{
+    SetVarSlot(t->s.var1, Sim->varVal[t->s.var2]);
+    return t + 1;
+}
+
+static ThreadedOp *ThrShiftRing(ThreadedOp *t)
+{
+    ShiftRing(&SimRings[t->s.ring]);
+    return t + 1;
+}
+
+static ThreadedOp *ThrRingRead(ThreadedOp *t)
+{
+    SetVarSlot(t->s.var1, Sim->varVal[RingStageSlot(&SimRings[t->s.ring],
+        t->literal)]);
+    return t + 1;
+}
+
+static ThreadedOp *ThrRingWrite(ThreadedOp *t)
+{
+    SetVarSlot(RingStageSlot(&SimRings[t->s.ring], t->literal),
+        Sim->varVal[t->s.var2]);
+    return t + 1;
+}
+
+static ThreadedOp *ThrLookUpTable(ThreadedOp *t)
+{
+    SDWORD i = Sim->varVal[t->s.var2];
+    if(i >= 0 && i < t->literal)
+        SetVarSlot(t->s.var1, IntCode[t->pc].data[i]);
+    return t + 1;
+}
+
+static ThreadedOp *ThrPiecewiseLinear(ThreadedOp *t)
+{
+    SDWORD y;
+    if(PiecewiseLinearAt(IntCode[t->pc].data, t->literal, Sim->varVal[t->s.var2], &y))
+        SetVarSlot(t->s.var1, y);
+    return t + 1;
+}
+
+static ThreadedOp *ThrReadAdc(ThreadedOp *t)
+{
+    SetVarSlot(t->s.var1, Sim->adcVal[t->s.adc]);
+    return t + 1;
+}
+
+static ThreadedOp *ThrIncrement(ThreadedOp *t)
+{
+    IncrementVarSlot(t->s.var1);
+    return t + 1;
+}
+
+static ThreadedOp *ThrDecrement(ThreadedOp *t)
+{
+    SetVarSlot(t->s.var1, Sim->varVal[t->s.var1] - 1);
+    return t + 1;
+}
+
+static ThreadedOp *ThrMathResult(ThreadedOp *t, SDWORD v)
+{
+    if(Sim->varVal[t->s.var1] != v)
+        SetVarSlot(t->s.var1, v);
+    return t + 1;
+}
+
+static ThreadedOp *ThrAdd(ThreadedOp *t)
+{
+    return ThrMathResult(t, Sim->varVal[t->s.var2] + Sim->varVal[t->s.var3]);
+}
+
+static ThreadedOp *ThrSubtract(ThreadedOp *t)
+{
+    return ThrMathResult(t, Sim->varVal[t->s.var2] - Sim->varVal[t->s.var3]);
+}
+
+static ThreadedOp *ThrMultiply(ThreadedOp *t)
+{
+    return ThrMathResult(t, Sim->varVal[t->s.var2] * Sim->varVal[t->s.var3]);
+}
+
+static ThreadedOp *ThrDivide(ThreadedOp *t)
+{
+    SDWORD v;
+    if(Sim->varVal[t->s.var3] != 0) {
+        v = Sim->varVal[t->s.var2] / Sim->varVal[t->s.var3];
+    } else {
+        v = 0;
+        DivisionByZero();
+    }
+    return ThrMathResult(t, v);
+}
+
+static ThreadedOp *ThrBitMath(ThreadedOp *t)
+{
+    return ThrMathResult(t, BitMathValue(IntCode[t->pc].op,
+        Sim->varVal[t->s.var2], Sim->varVal[t->s.var3]));
+}
+
+static ThreadedOp *ThrIfBitSet(ThreadedOp *t)
+{
+    return Sim->bitVal[t->s.bit1] ? t + 1 : t->jump;
+}
+
+static ThreadedOp *ThrIfBitClear(ThreadedOp *t)
+{
+    return !Sim->bitVal[t->s.bit1] ? t + 1 : t->jump;
+}
+
+static ThreadedOp *ThrIfLesLiteral(ThreadedOp *t)
+{
+    return (Sim->varVal[t->s.var1] < t->literal) ? t + 1 : t->jump;
+}
+
+static ThreadedOp *ThrIfEquals(ThreadedOp *t)
+{
+    return (Sim->varVal[t->s.var1] == Sim->varVal[t->s.var2]) ? t + 1 : t->jump;
+}
+
+static ThreadedOp *ThrIfGreater(ThreadedOp *t)
+{
+    return (Sim->varVal[t->s.var1] > Sim->varVal[t->s.var2]) ? t + 1 : t->jump;
+}
+
+// There are no SFRs in the simulator; they all read as zero.
+static ThreadedOp *ThrIfSfrSet(ThreadedOp *t)
+{
+    return t->jump;
+}
+
+static ThreadedOp *ThrIfSfrClear(ThreadedOp *t)
+{
+    return t + 1;
+}
+
+// Only reached at the end of the true branch, so skip the false one.
+static ThreadedOp *ThrElse(ThreadedOp *t)
+{
+    return t->jump;
+}
+
+static ThreadedOp *ThrEepromBusy(ThreadedOp *t)
+{
+    SetBitSlot(t->s.bit1, Sim->eeprom.busy > 0);
+    return t + 1;
+}
+
+static ThreadedOp *ThrEepromRead(ThreadedOp *t)
+{
+    EepromRead(&t->s, t->literal);
+    return t + 1;
+}
+
+static ThreadedOp *ThrEepromWrite(ThreadedOp *t)
+{
+    EepromWrite(&t->s, t->literal);
+    return t + 1;
+}
+
+static ThreadedOp *ThrUartSend(ThreadedOp *t)
+{
+    if(Sim->bitVal[t->s.bit2] && !UartTxFull()) {
+        UartTxPush((BYTE)Sim->varVal[t->s.var1]);
+    }
+    SetBitSlot(t->s.bit2, UartTxFull());
+    return t + 1;
+}
+
+static ThreadedOp *ThrUartSendBusy(ThreadedOp *t)
+{
+    SetBitSlot(t->s.bit1, UartTxFull());
+    return t + 1;
+}
+
+static ThreadedOp *ThrUartRecv(ThreadedOp *t)
+{
+    if(Sim->uart.rxCount > 0) {
+        SetBitSlot(t->s.bit2, TRUE);
+        SetVarSlot(t->s.var1, (SWORD)UartRxPop());
+    } else {
+        SetBitSlot(t->s.bit2, FALSE);
+    }
+    return t + 1;
+}
+
+static ThreadedOp *ThrUartRecvAvail(ThreadedOp *t)
+{
+    SetBitSlot(t->s.bit1, Sim->uart.rxCount > 0);
+    return t + 1;
+}
+
+// Same as the switch engine: complain only if the op is actually reached.
+static ThreadedOp *ThrUnknown(ThreadedOp *t)
+{
+    ooops("op=%d", IntCode[t->pc].op);
+    return t + 1;
+}
+
+static ThreadedOp *ThrEnd(ThreadedOp *t)
+{
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Decode IntCode[] (with its slots already resolved) into ThreadedCode[],
+// resolving the targets of the if/else constructs as we go.
+//-----------------------------------------------------------------------------
+static void DecodeThreadedCode(void)
+{
+    int *open = OpenIfs; // IFs and ELSEs still waiting for a target
+    int depth = 0;
+    int i;
+
+    ThreadedCodeLen = 0;
+    for(i = 0; i < IntCodeLen; i++) {
+        IntOp *a = &IntCode[i];
+        ThreadedOp *t = &ThreadedCode[ThreadedCodeLen];
+        ThreadedHandler fn = NULL;
+        BOOL opensBlock = FALSE;
+
+        switch(a->op) {
+            case INT_SIMULATE_NODE_STATE:
+                // This only feeds the display; in batch mode there is
+                // none, and several instances may be running at once.
+                if(RunningInBatchMode) continue;
+                fn = ThrNodeState;
+                break;
+
+            case INT_SET_BIT:                   fn = ThrSetBit; break;
+            case INT_CLEAR_BIT:                 fn = ThrClearBit; break;
+            case INT_COPY_BIT_TO_BIT:           fn = ThrCopyBit; break;
+            case INT_SET_VARIABLE_TO_LITERAL:   fn = ThrSetLiteral; break;
+            case INT_SET_VARIABLE_TO_VARIABLE:  fn = ThrCopyVar; break;
+            case INT_SHIFT_REGISTER:            fn = ThrShiftRing; break;
+            case INT_RING_READ:                 fn = ThrRingRead; break;
+            case INT_RING_WRITE:                fn = ThrRingWrite; break;
+            case INT_LOOK_UP_TABLE:             fn = ThrLookUpTable; break;
+            case INT_PIECEWISE_LINEAR:          fn = ThrPiecewiseLinear; break;
+            case INT_INCREMENT_VARIABLE:        fn = ThrIncrement; break;
+            case INT_DECREMENT_VARIABLE:        fn = ThrDecrement; break;
+            case INT_SET_VARIABLE_ADD:          fn = ThrAdd; break;
+            case INT_SET_VARIABLE_SUBTRACT:     fn = ThrSubtract; break;
+            case INT_SET_VARIABLE_MULTIPLY:     fn = ThrMultiply; break;
+            case INT_SET_VARIABLE_DIVIDE:       fn = ThrDivide; break;
+
+            case INT_SET_VARIABLE_ROL:
+            case INT_SET_VARIABLE_ROR:
+            case INT_SET_VARIABLE_SR0:
+            case INT_SET_VARIABLE_SHL:
+            case INT_SET_VARIABLE_SHR:
+            case INT_SET_VARIABLE_AND:
+            case INT_SET_VARIABLE_OR:
+            case INT_SET_VARIABLE_XOR:
+            case INT_SET_VARIABLE_NOT:
+            case INT_SET_VARIABLE_NEG:
+                fn = ThrBitMath;
+                break;
+            case INT_EEPROM_BUSY_CHECK:         fn = ThrEepromBusy; break;
+            case INT_EEPROM_READ:               fn = ThrEepromRead; break;
+            case INT_EEPROM_WRITE:              fn = ThrEepromWrite; break;
+            case INT_UART_SEND:                 fn = ThrUartSend; break;
+            case INT_UART_SEND_BUSY:            fn = ThrUartSendBusy; break;
+            case INT_UART_RECV:                 fn = ThrUartRecv; break;
+            case INT_UART_RECV_AVAIL:           fn = ThrUartRecvAvail; break;
+
+            case INT_READ_ADC:
+            case INT_READ_SFR_LITERAL:
+                fn = ThrReadAdc;
+                break;
+
+            case INT_READ_SFR_VARIABLE:
+                // same as a READ ADC, into var2
+                fn = ThrReadAdc;
+                break;
+
+            case INT_IF_BIT_SET:                fn = ThrIfBitSet; break;
+            case INT_IF_BIT_CLEAR:              fn = ThrIfBitClear; break;
+            case INT_IF_VARIABLE_LES_LITERAL:   fn = ThrIfLesLiteral; break;
+            case INT_IF_VARIABLE_EQUALS_VARIABLE: fn = ThrIfEquals; break;
+            case INT_IF_VARIABLE_GRT_VARIABLE:  fn = ThrIfGreater; break;
+
+            case INT_TEST_SFR_LITERAL:
+            case INT_TEST_SFR_VARIABLE:
+            case INT_TEST_SFR_LITERAL_L:
+            case INT_TEST_SFR_VARIABLE_L:
+                fn = ThrIfSfrSet;
+                opensBlock = TRUE;
+                break;
+
+            case INT_TEST_C_SFR_LITERAL:
+            case INT_TEST_C_SFR_VARIABLE:
+            case INT_TEST_C_SFR_LITERAL_L:
+            case INT_TEST_C_SFR_VARIABLE_L:
+                fn = ThrIfSfrClear;
+                opensBlock = TRUE;
+                break;
+
+            case INT_ELSE:
+                if(depth <= 0) oops();
+                ThreadedCode[open[depth - 1]].jump = t + 1;
+                open[depth - 1] = ThreadedCodeLen;
+                t->fn = ThrElse;
+                t->pc = i;
+                ThreadedCodeLen++;
+                continue;
+
+            case INT_END_IF:
+                if(depth <= 0) oops();
+                depth--;
+                ThreadedCode[open[depth]].jump = t;
+                continue;
+
+            case INT_COMMENT:
+            case INT_WRITE_SFR_LITERAL:
+            case INT_SET_SFR_LITERAL:
+            case INT_CLEAR_SFR_LITERAL:
+            case INT_WRITE_SFR_VARIABLE:
+            case INT_SET_SFR_VARIABLE:
+            case INT_CLEAR_SFR_VARIABLE:
+            case INT_WRITE_SFR_LITERAL_L:
+            case INT_WRITE_SFR_VARIABLE_L:
+            case INT_SET_SFR_LITERAL_L:
+            case INT_SET_SFR_VARIABLE_L:
+            case INT_CLEAR_SFR_LITERAL_L:
+            case INT_CLEAR_SFR_VARIABLE_L:
+            case INT_SET_BIN2BCD:
+            case INT_SET_BCD2BIN:
+            case INT_SET_SWAP:
+            case INT_QUAD_ENCOD:
+            case INT_SET_NPULSE:
+            case INT_SET_PWM:
+            case INT_WRITE_STRING:
+                continue;
+
+            default:
+                fn = ThrUnknown;
+                break;
+        }
+        if(INT_IF_GROUP(a->op))
+            opensBlock = TRUE;
+
+        t->fn = fn;
+        t->s = OpSlots[i];
+        if(a->op == INT_READ_SFR_VARIABLE)
+            t->s.var1 = t->s.var2;
+        t->literal = a->literal;
+        t->poweredAfter = a->poweredAfter;
+        t->jump = NULL;
+        t->pc = i;
+        if(opensBlock)
+            open[depth++] = ThreadedCodeLen;
+        ThreadedCodeLen++;
+    }
+    if(depth != 0) oops();
+
+    ThreadedCode[ThreadedCodeLen].fn = ThrEnd;
+    ThreadedCode[ThreadedCodeLen].pc = IntCodeLen;
+}
+
+//-----------------------------------------------------------------------------
+// Run one cycle of the decoded program.
+//-----------------------------------------------------------------------------
+static void SimulateThreadedCode(void)
+{
+    ThreadedOp *t = ThreadedCode;
+    while(t)
+        t = t->fn(t);
+}
+
+//-----------------------------------------------------------------------------
+// Breakpoints and watchpoints. A breakpoint stops the simulation just before
+// a given op (or the first op of a rung), if its condition, if any, is true.
+// A watchpoint stops it just after an op that changes a variable or a bit, or
+// that makes a condition like `Tdelay > 500 && Xstop' become true. Stopping
+// can be in the middle of a cycle; the next SimulateOneCycle() goes on from
+// there. In batch mode each hit is written to the trace instead, and the run
+// goes on.
+//
+// While any are set the cycle is run by SimulateDebugCode(), on the decoded
+// program, so the usual engines don't pay anything for them. It only stops
+// to look at the ops flagged in atOp[]: those with a breakpoint, and those
+// that write a slot that some watchpoint depends on.
+//-----------------------------------------------------------------------------
+#define MAX_BREAKPOINTS     16
+#define MAX_BREAK_EXPR      32
+
+#define DEBUG_BREAK         0x01
+#define DEBUG_WATCH         0x02
+
+// One step of a condition in reverse Polish: `b' a bit, `v' a variable, `k'
+// a constant, else an operator: ! & | < > = and l for <=, g for >=, n for !=.
+typedef struct SimExprOpTag {
+    char        op;
+    int         slot;
+    SDWORD      k;
+} SimExprOp;
+
+typedef struct SimBreakTag {
+    char        spec[MAX_COMMENT_LEN];
+    int         pc;         // a breakpoint: IntCode[] op to stop before;
+                            // a watchpoint: -1
+    int         at;         // a breakpoint: the threaded op it is on
+    SimExprOp   cond[MAX_BREAK_EXPR];
+    int         condLen;    // 0 for a breakpoint without a condition
+    int         watch;      // change slot of a `watch name', else -1
+    SDWORD      last;       // that slot, or whether cond was true, last time
+} SimBreak;
+
+struct SimDebugTag {
+    SimBreak    bp[MAX_BREAKPOINTS];
+    int         count;
+    BYTE       *atOp;       // DEBUG_ flags, by threaded op
+    int         skipBreak;  // threaded op we stopped before, so as not to
+                            // stop there again when we go on
+    BOOL        stopped;
+    char        hit[MAX_COMMENT_LEN + 64];
+
+    // What the watchpoints look at, for ArmBreakpoints(): indexed like the
+    // change slots, but with room for the literal slots that an op can name
+    // too, and by ring.
+    BOOL        watched[CHANGE_VAR + MAX_IO + MAX_LITERAL_SLOTS];
+    BOOL        ringWatched[MAX_IO];
+};
+
+typedef struct ExprParserTag {
+    char       *p;
+    SimBreak   *b;
+    BOOL        ok;
+    char        unknown[MAX_NAME_LEN];  // a name that isn't in the program
+} ExprParser;
+
+static void ExprEmit(ExprParser *e, char op, int slot, SDWORD k)
+{
+    if(e->b->condLen >= MAX_BREAK_EXPR) {
+        e->ok = FALSE;
+        return;
+    }
+    SimExprOp *x = &e->b->cond[e->b->condLen++];
+    x->op = op;
+    x->slot = slot;
+    x->k = k;
+}
+
+static BOOL ExprAccept(ExprParser *e, char *tok)
+{
+    while(isspace(*e->p)) e->p++;
+    if(strncmp(e->p, tok, strlen(tok)) != 0) return FALSE;
+    e->p += strlen(tok);
+    return TRUE;
+}
+
+static BOOL ExprKeyword(ExprParser *e, char *word)
+{
+    char *p = e->p;
+    if(ExprAccept(e, word) && (isspace(*e->p) || *e->p == '\0'))
+        return TRUE;
+    e->p = p;
+    return FALSE;
+}
+
+static void ExprOr(ExprParser *e);
+
+static void ExprOperand(ExprParser *e)
+{
+    while(isspace(*e->p)) e->p++;
+    if(ExprAccept(e, "!")) {
+        ExprOperand(e);
+        ExprEmit(e, '!', 0, 0);
+    } else if(ExprAccept(e, "(")) {
+        ExprOr(e);
+        if(!ExprAccept(e, ")")) e->ok = FALSE;
+    } else if(isdigit(*e->p) || *e->p == '-') {
+        char *end;
+        SDWORD k = strtol(e->p, &end, 0);
+        if(end == e->p) e->ok = FALSE;
+        e->p = end;
+        ExprEmit(e, 'k', 0, k);
+    } else if(isalpha(*e->p) || *e->p == '_' || *e->p == '$') {
+        char name[MAX_NAME_LEN];
+        int n = 0;
+        while((isalnum(*e->p) || *e->p == '_' || *e->p == '$') &&
+            n < MAX_NAME_LEN - 1)
+        {
+            name[n++] = *e->p++;
+        }
+        name[n] = '\0';
+        int slot = FindSingleBit(name);
+        if(slot >= 0) {
+            ExprEmit(e, 'b', slot, 0);
+        } else if((slot = FindVariable(name)) >= 0) {
+            ExprEmit(e, 'v', slot, 0);
+        } else {
+            strcpy(e->unknown, name);
+            e->ok = FALSE;
+        }
+    } else {
+        e->ok = FALSE;
+    }
+}
+
+static void ExprCompare(ExprParser *e)
+{
+    static const struct {
+        char   *tok;
+        char    op;
+    } Relations[] = {
+        { "<=", 'l' }, { ">=", 'g' }, { "==", '=' }, { "!=", 'n' },
+        { "<",  '<' }, { ">",  '>' }, { "=",  '=' },
+    };
+    ExprOperand(e);
+    int i;
+    for(i = 0; i < (int)(sizeof(Relations)/sizeof(Relations[0])); i++) {
+        if(ExprAccept(e, Relations[i].tok)) {
+            ExprOperand(e);
+            ExprEmit(e, Relations[i].op, 0, 0);
+            return;
+        }
+    }
+}
+
+static void ExprAnd(ExprParser *e)
+{
+    ExprCompare(e);
+    while(e->ok && ExprAccept(e, "&&")) {
+        ExprCompare(e);
+        ExprEmit(e, '&', 0, 0);
+    }
+}
+
+static void ExprOr(ExprParser *e)
+{
+    ExprAnd(e);
+    while(e->ok && ExprAccept(e, "||")) {
+        ExprAnd(e);
+        ExprEmit(e, '|', 0, 0);
+    }
+}
+
+static SDWORD EvalBreakCond(SimBreak *b)
+{
+    SDWORD st[MAX_BREAK_EXPR];
+    int n = 0;
+    int i;
+    for(i = 0; i < b->condLen; i++) {
+        SimExprOp *x = &b->cond[i];
+        SDWORD r;
+        switch(x->op) {
+            case 'b': st[n++] = Sim->bitVal[x->slot]; continue;
+            case 'v': st[n++] = Sim->varVal[StageSlot(x->slot)]; continue;
+            case 'k': st[n++] = x->k; continue;
+            case '!': st[n-1] = !st[n-1]; continue;
+        }
+        n--;
+        switch(x->op) {
+            case '&': r = st[n-1] && st[n]; break;
+            case '|': r = st[n-1] || st[n]; break;
+            case '<': r = st[n-1] <  st[n]; break;
+            case '>': r = st[n-1] >  st[n]; break;
+            case 'l': r = st[n-1] <= st[n]; break;
+            case 'g': r = st[n-1] >= st[n]; break;
+            case '=': r = st[n-1] == st[n]; break;
+            case 'n': r = st[n-1] != st[n]; break;
+            default: oops(); r = 0; break;
+        }
+        st[n-1] = r;
+    }
+    return st[0];
+}
+
+//-----------------------------------------------------------------------------
+// Work out which ops of the decoded program we have to look at.
+//-----------------------------------------------------------------------------
+static void ArmBreakpoints(SimDebug *d)
+{
+    BOOL *watched = d->watched;
+    BOOL *ringWatched = d->ringWatched;
+    memset(watched, 0, sizeof(d->watched));
+    memset(ringWatched, 0, SimRingCount * sizeof(BOOL));
+    memset(d->atOp, 0, ThreadedCodeLen + 1);
+
+    int i, j;
+    for(i = 0; i < d->count; i++) {
+        SimBreak *b = &d->bp[i];
+        if(b->pc >= 0) {
+            for(j = 0; j < ThreadedCodeLen && ThreadedCode[j].pc < b->pc; j++)
+                ;
+            b->at = j;
+            d->atOp[j] |= DEBUG_BREAK;
+            continue;
+        }
+        for(j = 0; j < b->condLen; j++) {
+            if(b->cond[j].op == 'b') watched[b->cond[j].slot] = TRUE;
+            if(b->cond[j].op == 'v') {
+                int v = b->cond[j].slot;
+                watched[CHANGE_VAR + v] = TRUE;
+                if(RingOfVar[v]) ringWatched[RingOfVar[v] - 1] = TRUE;
+            }
+        }
+    }
+
+    // An op can only write the slots that it names; a shift or a write to a
+    // ring can change any of its stages.
+    for(j = 0; j < ThreadedCodeLen; j++) {
+        IntOp *a = &IntCode[ThreadedCode[j].pc];
+        SimSlots *s = &ThreadedCode[j].s;
+        if(OpensBlock(a->op) || a->op == INT_SIMULATE_NODE_STATE ||
+            a->op == INT_ELSE)
+        {
+            continue;
+        }
+        if(watched[s->bit1] || watched[s->bit2] ||
+            watched[CHANGE_VAR + s->var1] || watched[CHANGE_VAR + s->var2] ||
+            watched[CHANGE_VAR + s->var3] ||
+            ((a->op == INT_SHIFT_REGISTER || a->op == INT_RING_WRITE) &&
+                ringWatched[s->ring]))
+        {
+            d->atOp[j] |= DEBUG_WATCH;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Add a breakpoint or watchpoint to the current instance:
+//
+//      rung <n> [if <cond>]    before the first op of rung n (from 1)
+//      op <n> [if <cond>]      before op n of the intermediate code
+//      watch <name>            after an op that changes the variable or bit
+//      watch <cond>            after an op that makes the condition true
+//
+// The condition is made of variables, bits and numbers, with the operators
+// of C: == != < > <= >= ! && || and parentheses. Returns FALSE, after an
+// error message, if the spec is bad.
+//-----------------------------------------------------------------------------
+BOOL AddSimBreakpoint(char *spec)
+{
+    if(!Sim->debug) {
+        Sim->debug = (SimDebug *)CheckMalloc(sizeof(SimDebug));
+        memset(Sim->debug, 0, sizeof(SimDebug));
+        Sim->debug->atOp = (BYTE *)CheckMalloc(ThreadedCodeLen + 1);
+        Sim->debug->skipBreak = -1;
+    }
+    SimDebug *d = Sim->debug;
+    if(d->count >= MAX_BREAKPOINTS) {
+        Error(_("Too many breakpoints (max %d)."), MAX_BREAKPOINTS);
+        return FALSE;
+    }
+    SimBreak *b = &d->bp[d->count];
+    memset(b, 0, sizeof(*b));
+    strncpy(b->spec, spec, sizeof(b->spec) - 1);
+    b->watch = -1;
+
+    ExprParser e;
+    e.p = spec;
+    e.b = b;
+    e.ok = TRUE;
+    e.unknown[0] = '\0';
+
+    BOOL isRung = ExprKeyword(&e, "rung");
+    if(isRung || ExprKeyword(&e, "op")) {
+        char *end;
+        int n = strtol(e.p, &end, 10);
+        if(end == e.p) e.ok = FALSE;
+        e.p = end;
+        if(isRung) {
+            for(b->pc = 0; b->pc < IntCodeLen; b->pc++)
+                if(IntCode[b->pc].rung == n - 1) break;
+        } else {
+            b->pc = n;
+        }
+        if(e.ok && (b->pc < 0 || b->pc >= IntCodeLen)) {
+            Error(isRung ? _("No rung %d in the program.") :
+                _("No op %d in the program."), n);
+            return FALSE;
+        }
+        if(ExprKeyword(&e, "if")) ExprOr(&e);
+    } else if(ExprKeyword(&e, "watch")) {
+        b->pc = -1;
+        ExprOr(&e);
+    } else {
+        e.ok = FALSE;
+    }
+    while(isspace(*e.p)) e.p++;
+    if(e.unknown[0]) {
+        Error(_("'%s' is not in the program."), e.unknown);
+        return FALSE;
+    }
+    if(!e.ok || *e.p != '\0' || (b->pc < 0 && b->condLen == 0)) {
+        Error(_("Bad breakpoint '%s'."), spec);
+        return FALSE;
+    }
+
+    if(b->pc < 0) {
+        if(b->condLen == 1 && b->cond[0].op != 'k') {
+            b->watch = (b->cond[0].op == 'b' ? 0 : CHANGE_VAR) +
+                b->cond[0].slot;
+            b->last = ChangeSlotShows(b->watch);
+        } else {
+            b->last = EvalBreakCond(b) != 0;
+        }
+    }
+    d->count++;
+    ArmBreakpoints(d);
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Remove all of the breakpoints and watchpoints of the current instance.
+//-----------------------------------------------------------------------------
+void ClearSimBreakpoints(void)
+{
+    if(Sim->debug) {
+        CheckFree(Sim->debug->atOp);
+        CheckFree(Sim->debug);
+    }
+    Sim->debug = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// What the last stop was for, or NULL if the simulation hasn't stopped at a
+// breakpoint since the last cycle.
+//-----------------------------------------------------------------------------
+char *SimulationBreakText(void)
+{
+    return (Sim->debug && Sim->debug->stopped) ? Sim->debug->hit : NULL;
+}
+
+//-----------------------------------------------------------------------------
+// A breakpoint or watchpoint was hit, at or after the given op. Returns TRUE
+// if we should stop there; in batch mode it is only written to the trace.
+//-----------------------------------------------------------------------------
+static BOOL BreakHit(SimDebug *d, SimBreak *b, int pc)
+{
+    if(pc < 0) {
+        sprintf(d->hit, "between cycles: %s", b->spec);
+    } else if(pc >= IntCodeLen) {
+        sprintf(d->hit, "end of cycle: %s", b->spec);
+    } else {
+        sprintf(d->hit, "rung %d, op %d: %s", IntCode[pc].rung + 1, pc,
+            b->spec);
+    }
+    if(Sim->batch) {
+        BatchBreak(Sim->batch, d->hit);
+        return FALSE;
+    }
+    d->stopped = TRUE;
+    return TRUE;
+}
+
+static BOOL CheckBreak(SimDebug *d, int at)
+{
+    int i;
+    BOOL stop = FALSE;
+    for(i = 0; i < d->count; i++) {
+        SimBreak *b = &d->bp[i];
+        if(b->pc < 0 || b->at != at) continue;
+        if(b->condLen == 0 || EvalBreakCond(b))
+            stop |= BreakHit(d, b, ThreadedCode[at].pc);
+    }
+    return stop;
+}
+
+static BOOL CheckWatches(SimDebug *d, int pc)
+{
+    int i;
+    BOOL stop = FALSE;
+    for(i = 0; i < d->count; i++) {
+        SimBreak *b = &d->bp[i];
+        if(b->pc >= 0) continue;
+        if(b->watch >= 0) {
+            SDWORD v = ChangeSlotShows(b->watch);
+            if(v == b->last) continue;
+            b->last = v;
+        } else {
+            SDWORD v = EvalBreakCond(b) != 0;
+            SDWORD was = b->last;
+            b->last = v;
+            if(!v || was) continue;
+        }
+        stop |= BreakHit(d, b, pc);
+    }
+    return stop;
+}
+
+//-----------------------------------------------------------------------------
+// Run the decoded program, looking at the breakpoints and watchpoints, from
+// where it stopped last time or from the start of a cycle. Returns FALSE if
+// it stopped in the middle of the cycle.
+//-----------------------------------------------------------------------------
+static BOOL SimulateDebugCode(void)
+{
+    SimDebug *d = Sim->debug;
+    ThreadedOp *t = ThreadedCode;
+
+    if(Sim->resumeAt > 0) {
+        t = &ThreadedCode[Sim->resumeAt - 1];
+    } else if(d && CheckWatches(d, -1)) {
+        // Something changed between cycles, e.g. an input.
+        d->skipBreak = -1;
+        Sim->resumeAt = 1;
+        return FALSE;
+    }
+
+    while(t) {
+        int i = t - ThreadedCode;
+        BYTE at = d ? d->atOp[i] : 0;
+        if(!at) {
+            t = t->fn(t);
+            continue;
+        }
+        if((at & DEBUG_BREAK) && i != d->skipBreak && CheckBreak(d, i)) {
+            d->skipBreak = i;
+            Sim->resumeAt = i + 1;
+            return FALSE;
+        }
+        d->skipBreak = -1;
+        int pc = t->pc;
+        t = t->fn(t);
+        if((at & DEBUG_WATCH) && CheckWatches(d, pc) && t) {
+            Sim->resumeAt = (t - ThreadedCode) + 1;
+            return FALSE;
+        }
+    }
+    Sim->resumeAt = 0;
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Bit-sliced simulation: SIM_LANES instances (lanes) of the program at once,
+// for trying every combination of some of its inputs. A single bit is held
+// as a mask with one bit per lane, so the boolean ops do every lane in a few
+// word operations, and an if becomes the mask of the lanes that take it
+// instead of a jump. The integer ops still go lane by lane, only for the
+// lanes that reach them. There is one set of lanes, for the main thread.
+//-----------------------------------------------------------------------------
+static LaneMask LaneBit[MAX_IO];
+static SDWORD LaneVar[MAX_IO + MAX_LITERAL_SLOTS][SIM_LANES];
+// For each if, where its else or end if is; for each else, its end if. We
+// only go there when no lane is left in the block.
+static int *LaneJump;
+// The lanes that were running when each open if was reached.
+static LaneMask *LaneOuter;
+
+#define LANE_ON(m, l) (((m).w[(l) >> 6] >> ((l) & 63)) & 1)
+#define FOR_EACH_LANE(m, l) for(l = 0; l < SIM_LANES; l++) if(LANE_ON(m, l))
+
+static BOOL LanesAny(LaneMask *m)
+{
+    int i;
+    for(i = 0; i < SIM_LANE_WORDS; i++)
+        if(m->w[i]) return TRUE;
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// Check that the program can be simulated in lanes, and work out the jumps.
+// Call after ClearSimulationData().
+//-----------------------------------------------------------------------------
+BOOL PrepareLaneSimulation(void)
+{
+    int *open = OpenIfs;
+    int depth = 0;
+    int i;
+    for(i = 0; i < IntCodeLen; i++) {
+        switch(IntCode[i].op) {
+            case INT_UART_SEND:
+            case INT_UART_SEND_BUSY:
+            case INT_UART_RECV:
+            case INT_UART_RECV_AVAIL:
+                Error(_("The UART can't be simulated in lanes (rung %d)."),
+                    IntCode[i].rung + 1);
+                return FALSE;
+
+            case INT_ELSE:
+                if(depth <= 0) oops();
+                LaneJump[open[depth - 1]] = i;
+                open[depth - 1] = i;
+                break;
+
+            case INT_END_IF:
+                if(depth <= 0) oops();
+                depth--;
+                LaneJump[open[depth]] = i;
+                break;
+
+            case INT_TEST_SFR_LITERAL:
+            case INT_TEST_SFR_VARIABLE:
+            case INT_TEST_SFR_LITERAL_L:
+            case INT_TEST_SFR_VARIABLE_L:
+            case INT_TEST_C_SFR_LITERAL:
+            case INT_TEST_C_SFR_VARIABLE:
+            case INT_TEST_C_SFR_LITERAL_L:
+            case INT_TEST_C_SFR_VARIABLE_L:
+            case INT_IF_BIT_SET:
+            case INT_IF_BIT_CLEAR:
+            case INT_IF_VARIABLE_LES_LITERAL:
+            case INT_IF_VARIABLE_EQUALS_VARIABLE:
+            case INT_IF_VARIABLE_GRT_VARIABLE:
+                open[depth++] = i;
+                break;
+
+            case INT_EEPROM_BUSY_CHECK:
+            case INT_EEPROM_READ:
+            case INT_EEPROM_WRITE:
+                Error(_("Persistent variables can't be simulated in lanes "
+                    "(rung %d)."), IntCode[i].rung + 1);
+                return FALSE;
+
+            // The rest of what SimulateLanesCycle() does.
+            case INT_SET_BIT:
+            case INT_CLEAR_BIT:
+            case INT_COPY_BIT_TO_BIT:
+            case INT_SET_VARIABLE_TO_LITERAL:
+            case INT_SET_VARIABLE_TO_VARIABLE:
+            case INT_SHIFT_REGISTER:
+            case INT_RING_READ:
+            case INT_RING_WRITE:
+            case INT_LOOK_UP_TABLE:
+            case INT_PIECEWISE_LINEAR:
+            case INT_INCREMENT_VARIABLE:
+            case INT_DECREMENT_VARIABLE:
+            case INT_SET_VARIABLE_ADD:
+            case INT_SET_VARIABLE_SUBTRACT:
+            case INT_SET_VARIABLE_MULTIPLY:
+            case INT_SET_VARIABLE_DIVIDE:
+            case INT_SET_VARIABLE_ROL:
+            case INT_SET_VARIABLE_ROR:
+            case INT_SET_VARIABLE_SR0:
+            case INT_SET_VARIABLE_SHL:
+            case INT_SET_VARIABLE_SHR:
+            case INT_SET_VARIABLE_AND:
+            case INT_SET_VARIABLE_OR:
+            case INT_SET_VARIABLE_XOR:
+            case INT_SET_VARIABLE_NOT:
+            case INT_SET_VARIABLE_NEG:
+            case INT_READ_ADC:
+            case INT_READ_SFR_LITERAL:
+            case INT_READ_SFR_VARIABLE:
+            case INT_SIMULATE_NODE_STATE:
+            case INT_COMMENT:
+            case INT_WRITE_SFR_LITERAL:
+            case INT_SET_SFR_LITERAL:
+            case INT_CLEAR_SFR_LITERAL:
+            case INT_WRITE_SFR_VARIABLE:
+            case INT_SET_SFR_VARIABLE:
+            case INT_CLEAR_SFR_VARIABLE:
+            case INT_WRITE_SFR_LITERAL_L:
+            case INT_WRITE_SFR_VARIABLE_L:
+            case INT_SET_SFR_LITERAL_L:
+            case INT_SET_SFR_VARIABLE_L:
+            case INT_CLEAR_SFR_LITERAL_L:
+            case INT_CLEAR_SFR_VARIABLE_L:
+            case INT_QUAD_ENCOD:
+            case INT_SET_NPULSE:
+            case INT_SET_PWM:
+            case INT_WRITE_STRING:
+                break;
+
+            default:
+                Error(_("Op %d can't be simulated in lanes (rung %d)."),
+                    IntCode[i].op, IntCode[i].rung + 1);
+                return FALSE;
+        }
+    }
+    if(depth != 0) oops();
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Put every lane where ClearSimulationData() left the main instance.
+//-----------------------------------------------------------------------------
+void ResetLanes(void)
+{
+    int i, l;
+    for(i = 0; i < SingleBitItemsCount; i++)
+        memset(&LaneBit[i], InitialSim.bitVal[i] ? 0xff : 0, sizeof(LaneMask));
+    for(i = 0; i < SimVariableCount; i++)
+        for(l = 0; l < SIM_LANES; l++)
+            LaneVar[i][l] = InitialSim.varVal[i];
+    for(i = MAX_IO; i < MAX_IO + LiteralCount; i++)
+        for(l = 0; l < SIM_LANES; l++)
+            LaneVar[i][l] = InitialSim.varVal[i];
+}
+
+//-----------------------------------------------------------------------------
+// The mask of a single bit, by its slot (see SimulationSlot()), to set
+// inputs or look at outputs between cycles.
+//-----------------------------------------------------------------------------
+LaneMask *LaneBitSlot(int slot)
+{
+    return &LaneBit[slot];
+}
+
+//-----------------------------------------------------------------------------
+// Run one cycle in every lane. Returns FALSE if the simulation had to halt.
+//-----------------------------------------------------------------------------
+BOOL SimulateLanesCycle(void)
+{
+    LaneMask run;
+    int depth = 0;
+    int pc, i, l;
+
+    memset(&run, 0xff, sizeof(run));
+    for(pc = 0; pc < IntCodeLen; pc++) {
+        IntOp *a = &IntCode[pc];
+        SimSlots *s = &OpSlots[pc];
+        LaneMask *b1 = &LaneBit[s->bit1];
+        LaneMask *b2 = &LaneBit[s->bit2];
+        SDWORD *v1 = LaneVar[s->var1];
+        SDWORD *v2 = LaneVar[s->var2];
+        SDWORD *v3 = LaneVar[s->var3];
+        LaneMask cond;
+
+        switch(a->op) {
+            case INT_SET_BIT:
+                for(i = 0; i < SIM_LANE_WORDS; i++)
+                    b1->w[i] |= run.w[i];
+                continue;
+
+            case INT_CLEAR_BIT:
+                for(i = 0; i < SIM_LANE_WORDS; i++)
+                    b1->w[i] &= ~run.w[i];
+                continue;
+
+            case INT_COPY_BIT_TO_BIT:
+                for(i = 0; i < SIM_LANE_WORDS; i++)
+                    b1->w[i] = (b1->w[i] & ~run.w[i]) | (b2->w[i] & run.w[i]);
+                continue;
+
+            case INT_SET_VARIABLE_TO_LITERAL:
+                FOR_EACH_LANE(run, l) v1[l] = a->literal;
+                continue;
+
+            case INT_SET_VARIABLE_TO_VARIABLE:
+                FOR_EACH_LANE(run, l) v1[l] = v2[l];
+                continue;
+
+            case INT_SHIFT_REGISTER: {
+                // as ShiftRing(), with a head for each lane
+                SimRing *r = &SimRings[s->ring];
+                SDWORD *head = LaneVar[r->head];
+                FOR_EACH_LANE(run, l) {
+                    head[l] = head[l] ? head[l] - 1 : r->stages - 1;
+                    LaneVar[RingCell(r, head[l], 0)][l] =
+                        LaneVar[RingCell(r, head[l], 1)][l];
+                }
+                continue;
+            }
+
+            case INT_RING_READ: {
+                SimRing *r = &SimRings[s->ring];
+                SDWORD *head = LaneVar[r->head];
+                FOR_EACH_LANE(run, l)
+                    v1[l] = LaneVar[RingCell(r, head[l], a->literal)][l];
+                continue;
+            }
+
+            case INT_RING_WRITE: {
+                SimRing *r = &SimRings[s->ring];
+                SDWORD *head = LaneVar[r->head];
+                FOR_EACH_LANE(run, l)
+                    LaneVar[RingCell(r, head[l], a->literal)][l] = v2[l];
+                continue;
+            }
+
+            case INT_LOOK_UP_TABLE:
+                FOR_EACH_LANE(run, l)
+                    if(v2[l] >= 0 && v2[l] < a->literal)
+                        v1[l] = a->data[v2[l]];
+                continue;
+
+            case INT_PIECEWISE_LINEAR:
+                FOR_EACH_LANE(run, l)
+                    PiecewiseLinearAt(a->data, a->literal, v2[l], &v1[l]);
+                continue;
+
+            case INT_INCREMENT_VARIABLE:
+                FOR_EACH_LANE(run, l) v1[l]++;
+                continue;
+
+            case INT_DECREMENT_VARIABLE:
+                FOR_EACH_LANE(run, l) v1[l]--;
+                continue;
+
+            case INT_SET_VARIABLE_ADD:
+                FOR_EACH_LANE(run, l) v1[l] = v2[l] + v3[l];
+                continue;
+
+            case INT_SET_VARIABLE_SUBTRACT:
+                FOR_EACH_LANE(run, l) v1[l] = v2[l] - v3[l];
+                continue;
+
+            case INT_SET_VARIABLE_MULTIPLY:
+                FOR_EACH_LANE(run, l) v1[l] = v2[l] * v3[l];
+                continue;
+
+            case INT_SET_VARIABLE_DIVIDE:
+                FOR_EACH_LANE(run, l) {
+                    if(v3[l] == 0) {
+                        Error(_("Division by zero; halting simulation"));
+                        return FALSE;
+                    }
+                    v1[l] = v2[l] / v3[l];
+                }
+                continue;
+
+            case INT_SET_VARIABLE_ROL:
+            case INT_SET_VARIABLE_ROR:
+            case INT_SET_VARIABLE_SR0:
+            case INT_SET_VARIABLE_SHL:
+            case INT_SET_VARIABLE_SHR:
+            case INT_SET_VARIABLE_AND:
+            case INT_SET_VARIABLE_OR:
+            case INT_SET_VARIABLE_XOR:
+            case INT_SET_VARIABLE_NOT:
+            case INT_SET_VARIABLE_NEG:
+                FOR_EACH_LANE(run, l) v1[l] = BitMathValue(a->op, v2[l], v3[l]);
+                continue;
+
+            case INT_READ_ADC:
+            case INT_READ_SFR_LITERAL:
+                FOR_EACH_LANE(run, l) v1[l] = InitialSim.adcVal[s->adc];
+                continue;
+
+            case INT_READ_SFR_VARIABLE:
+                FOR_EACH_LANE(run, l) v2[l] = InitialSim.adcVal[s->adc];
+                continue;
+
+            case INT_IF_BIT_SET:
+                cond = *b1;
+                break;
+
+            case INT_IF_BIT_CLEAR:
+                for(i = 0; i < SIM_LANE_WORDS; i++)
+                    cond.w[i] = ~b1->w[i];
+                break;
+
+            case INT_IF_VARIABLE_LES_LITERAL:
+            case INT_IF_VARIABLE_EQUALS_VARIABLE:
+            case INT_IF_VARIABLE_GRT_VARIABLE:
+                memset(&cond, 0, sizeof(cond));
+                FOR_EACH_LANE(run, l) {
+                    BOOL c;
+                    if(a->op == INT_IF_VARIABLE_LES_LITERAL)
+                        c = v1[l] < a->literal;
+                    else if(a->op == INT_IF_VARIABLE_EQUALS_VARIABLE)
+                        c = v1[l] == v2[l];
+                    else
+                        c = v1[l] > v2[l];
+                    if(c) cond.w[l >> 6] |= 1ull << (l & 63);
+                }
+                break;
+
+            // There are no SFRs in the simulator; they all read as zero.
+            case INT_TEST_SFR_LITERAL:
+            case INT_TEST_SFR_VARIABLE:
+            case INT_TEST_SFR_LITERAL_L:
+            case INT_TEST_SFR_VARIABLE_L:
+                memset(&cond, 0, sizeof(cond));
+                break;
+
+            case INT_TEST_C_SFR_LITERAL:
+            case INT_TEST_C_SFR_VARIABLE:
+            case INT_TEST_C_SFR_LITERAL_L:
+            case INT_TEST_C_SFR_VARIABLE_L:
+                memset(&cond, 0xff, sizeof(cond));
+                break;
+
+            case INT_ELSE:
+                // Nothing in the block changes which lanes run, so these are
+                // still the ones that took the if.
+                for(i = 0; i < SIM_LANE_WORDS; i++)
+                    run.w[i] = LaneOuter[depth - 1].w[i] & ~run.w[i];
+                if(!LanesAny(&run)) pc = LaneJump[pc] - 1;
+                continue;
+
+            case INT_END_IF:
+                run = LaneOuter[--depth];
+                continue;
+
+            case INT_SIMULATE_NODE_STATE:
+            case INT_COMMENT:
+            case INT_WRITE_SFR_LITERAL:
+            case INT_SET_SFR_LITERAL:
+            case INT_CLEAR_SFR_LITERAL:
+            case INT_WRITE_SFR_VARIABLE:
+            case INT_SET_SFR_VARIABLE:
+            case INT_CLEAR_SFR_VARIABLE:
+            case INT_WRITE_SFR_LITERAL_L:
+            case INT_WRITE_SFR_VARIABLE_L:
+            case INT_SET_SFR_LITERAL_L:
+            case INT_SET_SFR_VARIABLE_L:
+            case INT_CLEAR_SFR_LITERAL_L:
+            case INT_CLEAR_SFR_VARIABLE_L:
+            case INT_QUAD_ENCOD:
+            case INT_SET_NPULSE:
+            case INT_SET_PWM:
+            case INT_WRITE_STRING:
+                continue;
+
+            default:
+                ooops("op=%d", a->op);
+                continue;
+        }
+
+        // An if of some kind, with its condition in cond.
+        LaneOuter[depth++] = run;
+        for(i = 0; i < SIM_LANE_WORDS; i++)
+            run.w[i] &= cond.w[i];
+        if(!LanesAny(&run)) pc = LaneJump[pc] - 1;
+    }
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Fast-forward. A program that is waiting for a timer spends most of its
+// cycles doing exactly the same thing, except that the timer counts up by
+// one. When a cycle is like that we can work out how many more cycles will
+// go the same way, and do them all at once with the same result as if each
+// had been simulated.
+//-----------------------------------------------------------------------------
+BOOL FastForwardSimulation;
+
+// Timer variables that the program only counts up, sets to a literal, and
+// compares; nothing else depends on their value, so only the comparisons
+// can make one cycle differ from the next.
+static BOOL TimerSlot[MAX_IO];
+
+//-----------------------------------------------------------------------------
+// Find the timers that can be fast-forwarded, by looking at every op that
+// uses them.
+//-----------------------------------------------------------------------------
+static void FindTimerSlots(void)
+{
+    int i;
+    for(i = 0; i < SimVariableCount; i++) {
+        TimerSlot[i] = (Variables[i].usedFlags &
+            (VAR_FLAG_TON | VAR_FLAG_TOF | VAR_FLAG_RTO | VAR_FLAG_TCY)) != 0;
+        Sim->isRamping[i] = FALSE;
+    }
+    Sim->rampingCount = 0;
+
+#define NOT_TIMER(slot) if((slot) < MAX_IO) TimerSlot[slot] = FALSE
+    for(i = 0; i < IntCodeLen; i++) {
+        SimSlots *s = &OpSlots[i];
+        switch(IntCode[i].op) {
+            case INT_SET_VARIABLE_TO_LITERAL:
+            case INT_INCREMENT_VARIABLE:
+            case INT_IF_VARIABLE_LES_LITERAL:
+            case INT_IF_VARIABLE_EQUALS_VARIABLE:
+            case INT_IF_VARIABLE_GRT_VARIABLE:
                 break;
 
+            case INT_DECREMENT_VARIABLE:
+            case INT_READ_ADC:
+            case INT_READ_SFR_LITERAL:
+            case INT_QUAD_ENCOD:
+            case INT_SET_NPULSE:
+            case INT_SET_PWM:
             case INT_UART_SEND:
-                if(SingleBitOn(a->name2) && (SimulateUartTxCountdown == 0)) {
-                    SimulateUartTxCountdown = 2;
-                    AppendToUartSimulationTextControl(
-                        (BYTE)GetSimulationVariable(a->name1));
-                }
-                if(SimulateUartTxCountdown == 0) {
-                    SetSingleBit(a->name2, FALSE);
-                } else {
-                    SetSingleBit(a->name2, TRUE);
-                }
+            case INT_UART_RECV:
+            case INT_EEPROM_READ:
+                NOT_TIMER(s->var1);
                 break;
 
-            case INT_UART_SEND_BUSY:
-                if(SimulateUartTxCountdown == 0) {
-                    SetSingleBit(a->name1, FALSE);
-                } else {
-                    SetSingleBit(a->name1, TRUE);
-                }
+            case INT_READ_SFR_VARIABLE:
+                NOT_TIMER(s->var2);
                 break;
 
-            case INT_UART_RECV:
-                if(QueuedUartCharacter >= 0) {
-                    SetSingleBit(a->name2, TRUE);
-                    SetSimulationVariable(a->name1, (SWORD)QueuedUartCharacter);
-                    QueuedUartCharacter = -1;
-                } else {
-                    SetSingleBit(a->name2, FALSE);
-                }
+            case INT_SHIFT_REGISTER:
+            case INT_RING_WRITE: {
+                SimRing *r = &SimRings[s->ring];
+                int k;
+                for(k = 0; k < r->stages; k++)
+                    NOT_TIMER(RingCells[r->cells + k]);
                 break;
+            }
 
-            case INT_UART_RECV_AVAIL:
-                if(QueuedUartCharacter >= 0) {
-                    SetSingleBit(a->name1, TRUE);
-                } else {
-                    SetSingleBit(a->name1, FALSE);
-                }
+            case INT_RING_READ:
+                NOT_TIMER(s->var1);
                 break;
 
-            case INT_END_IF:
-            case INT_ELSE:
-                return;
-
-            case INT_COMMENT:
+            case INT_SET_VARIABLE_TO_VARIABLE:
+            case INT_LOOK_UP_TABLE:
+            case INT_PIECEWISE_LINEAR:
+            case INT_SET_VARIABLE_NOT:
+            case INT_SET_VARIABLE_NEG:
+                NOT_TIMER(s->var1);
+                NOT_TIMER(s->var2);
                 break;
 
-            #ifdef NEW_FEATURE
-            case INT_AllocKnownAddr:
-            case INT_AllocFwdAddr:
-            case INT_FwdAddrIsNow:
-            case INT_GotoRung:
+            case INT_SET_VARIABLE_ADD:
+            case INT_SET_VARIABLE_SUBTRACT:
+            case INT_SET_VARIABLE_MULTIPLY:
+            case INT_SET_VARIABLE_DIVIDE:
+            case INT_SET_VARIABLE_ROL:
+            case INT_SET_VARIABLE_ROR:
+            case INT_SET_VARIABLE_SR0:
+            case INT_SET_VARIABLE_SHL:
+            case INT_SET_VARIABLE_SHR:
+            case INT_SET_VARIABLE_AND:
+            case INT_SET_VARIABLE_OR:
+            case INT_SET_VARIABLE_XOR:
+                NOT_TIMER(s->var1);
+                NOT_TIMER(s->var2);
+                NOT_TIMER(s->var3);
                 break;
 
-            case INT_PRINTF_STRING:
+            default:
                 break;
-            #endif
+        }
+    }
+#undef NOT_TIMER
+}
 
-            #define SPINTF(buffer, format, args) sprintf(buffer, format, #args);
-            case INT_WRITE_STRING: {
-                break;
-            }
-            #ifdef NEW_FEATURE
-            case INT_FLASH_INIT:
+//-----------------------------------------------------------------------------
+// At the end of a cycle, see whether it was steady: no UART activity, and no
+// change except timers that went up by one through INT_INCREMENT_VARIABLE
+// alone. Then the next cycle starts from the same state except for those
+// timers, and will do the same thing unless a comparison comes out
+// differently.
+//-----------------------------------------------------------------------------
+static void CheckSteadyCycle(void)
+{
+    int i;
+    for(i = 0; i < Sim->rampingCount; i++) {
+        Sim->isRamping[Sim->ramping[i]] = FALSE;
+    }
+    Sim->rampingCount = 0;
+
+    Sim->steadyCycle = (Sim->uart.txCount == 0 && Sim->uart.rxCount == 0 &&
+        Sim->eeprom.busy == 0);
+    for(i = 0; i < Sim->dirtyCount && Sim->steadyCycle; i++) {
+        int w = Sim->dirtySlots[i];
+        SDWORD v = ChangeSlotValue(w);
+        if(v == Sim->slotBefore[w]) continue;
+
+        int slot = w - CHANGE_VAR;
+        if(slot >= 0 && TimerSlot[slot] && !Sim->varAssigned[slot] &&
+            v == Sim->slotBefore[w] + 1)
+        {
+            Sim->isRamping[slot] = TRUE;
+            Sim->ramping[Sim->rampingCount++] = slot;
+        } else {
+            Sim->steadyCycle = FALSE;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// A comparison against a ramping timer, whose value is now, comes out the
+// same for every value from now - 1 (what the last cycle may have seen) up
+// to but not including flip. Reduce the number of cycles that we may skip so
+// that the timer never gets there.
+//-----------------------------------------------------------------------------
+static void LimitSkip(DWORD *skip, SDWORD now, long long flip)
+{
+    long long n = flip - now - 1;
+    if(n < 0) n = 0;
+    if(n < (long long)*skip) *skip = (DWORD)n;
+}
+
+//-----------------------------------------------------------------------------
+// If the last cycle was steady, jump ahead by as many cycles as are sure to
+// go the same way, but at most max. Returns the number of cycles skipped.
+// Not while recording a waveform, which must see every value of a timer, or
+// while profiling, which must see every cycle.
+//-----------------------------------------------------------------------------
+DWORD FastForwardCycles(DWORD max)
+{
+    if(!Sim->steadyCycle || RecordingWaveform || ProfilingSimulation ||
+        Sim->debug)
+    {
+        return 0;
+    }
+
+    DWORD skip = max;
+    int i;
+    for(i = 0; i < IntCodeLen && skip > 0; i++) {
+        IntOp *a = &IntCode[i];
+        SimSlots *s = &OpSlots[i];
+        SDWORD x, c;
+        switch(a->op) {
+            case INT_IF_VARIABLE_LES_LITERAL:
+                // x < c
+                if(!Sim->isRamping[s->var1]) break;
+                x = Sim->varVal[s->var1];
+                c = a->literal;
+                if(x - 1 < c) LimitSkip(&skip, x, c);
                 break;
 
-            case INT_FLASH_READ:{
+            case INT_IF_VARIABLE_EQUALS_VARIABLE:
+                // Two timers that both ramp stay the same distance apart.
+                if(Sim->isRamping[s->var1] == Sim->isRamping[s->var2]) break;
+                if(Sim->isRamping[s->var1]) {
+                    x = Sim->varVal[s->var1];
+                    c = Sim->varVal[s->var2];
+                } else {
+                    x = Sim->varVal[s->var2];
+                    c = Sim->varVal[s->var1];
+                }
+                if(c == x - 1) LimitSkip(&skip, x, x);
+                else if(c >= x) LimitSkip(&skip, x, c);
                 break;
 
-            case INT_RAM_READ:{
+            case INT_IF_VARIABLE_GRT_VARIABLE:
+                if(Sim->isRamping[s->var1] == Sim->isRamping[s->var2]) break;
+                if(Sim->isRamping[s->var1]) {
+                    // x > c
+                    x = Sim->varVal[s->var1];
+                    c = Sim->varVal[s->var2];
+                    if(x - 1 <= c) LimitSkip(&skip, x, (long long)c + 1);
+                } else {
+                    // c > x
+                    x = Sim->varVal[s->var2];
+                    c = Sim->varVal[s->var1];
+                    if(c > x - 1) LimitSkip(&skip, x, c);
+                }
                 break;
-            #endif
 
             default:
-                ooops("op=%d",a->op);
                 break;
         }
     }
+
+    for(i = 0; i < Sim->rampingCount; i++) {
+        Sim->varVal[Sim->ramping[i]] += skip;
+    }
+    Sim->cycles += skip;
+    Sim->steadyCycle = FALSE;
+    return skip;
+}
+
+//-----------------------------------------------------------------------------
+// The simulation stopped at a breakpoint or watchpoint, maybe in the middle
+// of a cycle: stop running in real time, and show where it is and why. Only
+// the GUI's instance ever stops.
+//-----------------------------------------------------------------------------
+static void StopAtBreakpoint(void)
+{
+    StopSimulation();
+    RedrawChanges(TRUE);
+    FlushUartSimulationTextControl();
+}
+
+//-----------------------------------------------------------------------------
+// Replay samples recorded in a CSV file into the READ ADC shadows while the
+// GUI simulates, from the current cycle on; a NULL filename stops it. It
+// stops by itself at the end of the file. (In batch mode the stimulus file
+// does this, with an `adcfile' event.)
+//-----------------------------------------------------------------------------
+static AdcStim *ReplayAdc;
+
+BOOL ReplayAdcSamples(char *filename)
+{
+    if(ReplayAdc) CloseAdcStim(ReplayAdc);
+    ReplayAdc = NULL;
+    if(!filename) return TRUE;
+    ReplayAdc = OpenAdcStim(filename, NULL);
+    return ReplayAdc != NULL;
+}
+
+static void StepReplayAdc(void)
+{
+    if(!StepAdcStim(ReplayAdc) || AdcStimDone(ReplayAdc))
+        ReplayAdcSamples(NULL);
 }
 
 //-----------------------------------------------------------------------------
@@ -1209,6 +4171,7 @@ void CALLBACK PlcCycleTimer(HWND hwnd, UINT msg, UINT_PTR id, DWORD time)
     int i;
     for(i = 0; i < CyclesPerTimerTick; i++) {
         SimulateOneCycle(FALSE);
+        if(SimulationBreakText()) break;
         if(CyclesPerTimerTick > 1) {
             if(updateWindow < 0) {
                 updateWindow = CyclesPerTimerTick * rand() / RAND_MAX + (rand() & 1);
@@ -1216,6 +4179,7 @@ void CALLBACK PlcCycleTimer(HWND hwnd, UINT msg, UINT_PTR id, DWORD time)
                 updateWindow--;
         }
     }
+    FlushUartSimulationTextControl();
 }
 
 //-----------------------------------------------------------------------------
@@ -1229,37 +4193,60 @@ void SimulateOneCycle(BOOL forceRefresh)
     // event loop, and there is risk that we would go recursive. So let
     // us fix that. (Note that there are no concurrency issues; we really
     // would get called recursively, not just reentrantly.)
-    static BOOL Simulating = FALSE;
-
-    if(Simulating) return;
-    Simulating = TRUE;
-
-    NeedRedraw = FALSE;
+    if(Sim->simulating) return;
+    Sim->simulating = TRUE;
+
+    // Unless we are going on from a breakpoint in the middle of the cycle.
+    if(Sim->resumeAt == 0) {
+        UartTransmit();
+        EepromCycle();
+        if(ReplayAdc && !RunningInBatchMode) StepReplayAdc();
+    }
 
-    if(SimulateUartTxCountdown > 0) {
-        SimulateUartTxCountdown--;
+    if(Sim->debug || Sim->resumeAt) {
+        if(Sim->debug) Sim->debug->stopped = FALSE;
+        if(!SimulateDebugCode()) {
+            StopAtBreakpoint();
+            Sim->simulating = FALSE;
+            return;
+        }
+    } else if(ProfilingSimulation) {
+        ProfileStartCycle();
+        Sim->pc = 0;
+        SimulateIntCode();
+        ProfileEndCycle();
+    } else if(ThreadedSimulation) {
+        SimulateThreadedCode();
     } else {
-        SimulateUartTxCountdown = 0;
+        Sim->pc = 0;
+        SimulateIntCode();
     }
+    Sim->cycles++;
 
-    IntPc = 0;
-    SimulateIntCode();
-    CyclesCount++;
+    if(TrackingChanges) {
+        if(FastForwardSimulation) CheckSteadyCycle();
+        if(RecordingWaveform) RecordWaveChanges();
+        if(!RunningInBatchMode) NoteRedrawChanges();
+        ClearChanges();
+    }
 
-    if(NeedRedraw || SimulateRedrawAfterNextCycle || forceRefresh) {
+    // No window to redraw in batch mode, where we might also be one of
+    // several instances running at once. Otherwise refresh just the rungs
+    // and rows that changed; a coil that changes in this cycle may change
+    // how a contact above it is drawn in the next, but then that rung's
+    // power state changes too, and it is redrawn in the next cycle.
+    if(!RunningInBatchMode) {
         if((updateWindow == 0) && (forceRefresh == FALSE)) {
             UpdateWindow(MainWindow);
             updateWindow--;
-        } else
-            InvalidateRect(MainWindow, NULL, FALSE);
-        ListView_RedrawItems(IoList, 0, Prog.io.count - 1);
-        RefreshStatusBar();
+        }
+        RedrawChanges(SimulateRedrawAfterNextCycle || forceRefresh);
+        SimulateRedrawAfterNextCycle = FALSE;
+        if(forceRefresh) FlushUartSimulationTextControl();
     }
+    if(Sim->debug && Sim->debug->stopped) StopAtBreakpoint();
 
-    SimulateRedrawAfterNextCycle = FALSE;
-    if(NeedRedraw) SimulateRedrawAfterNextCycle = TRUE;
-
-    Simulating = FALSE;
+    Sim->simulating = FALSE;
 }
 
 //-----------------------------------------------------------------------------
@@ -1280,31 +4267,222 @@ void StartSimulationTimer(void)
     }
 }
 
+//-----------------------------------------------------------------------------
+// Map the file that backs the EEPROM of the GUI's instance, `src.eeprom' next
+// to the program, creating it (as a blank EEPROM) if need be. Without a file
+// (in batch mode, or before the program has been saved) the EEPROM starts
+// blank every time.
+//-----------------------------------------------------------------------------
+void CloseSimulationEeprom(void)
+{
+    if(EepromFile) UnmapViewOfFile(EepromFile);
+    if(EepromMapping) CloseHandle(EepromMapping);
+    if(EepromFileHandle) CloseHandle(EepromFileHandle);
+    EepromFile = NULL;
+    EepromMapping = NULL;
+    EepromFileHandle = NULL;
+}
+
+static void OpenEepromFile(void)
+{
+    char name[MAX_PATH];
+
+    CloseSimulationEeprom();
+    if(RunningInBatchMode || !EepromFunctionUsed() || !*CurrentSaveFile)
+        return;
+
+    SetExt(name, CurrentSaveFile, "eeprom");
+    EepromFileHandle = CreateFile(name, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+        OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(EepromFileHandle == INVALID_HANDLE_VALUE) {
+        EepromFileHandle = NULL;
+    } else {
+        EepromMapping = CreateFileMapping(EepromFileHandle, NULL,
+            PAGE_READWRITE, 0, sizeof(EepromImage), NULL);
+    }
+    if(EepromMapping) {
+        EepromFile = (EepromImage *)MapViewOfFile(EepromMapping,
+            FILE_MAP_WRITE, 0, 0, sizeof(EepromImage));
+    }
+    if(!EepromFile) {
+        Error(_("Couldn't open '%s'; the simulated EEPROM won't be kept."),
+            name);
+        CloseSimulationEeprom();
+        return;
+    }
+
+    // A new file comes out all zeros.
+    if(memcmp(EepromFile->magic, EEPROM_FILE_MAGIC,
+        sizeof(EEPROM_FILE_MAGIC)) != 0)
+    {
+        strcpy(EepromFile->magic, EEPROM_FILE_MAGIC);
+        memset(EepromFile->data, 0xff, sizeof(EepromFile->data));
+        memset(EepromFile->writes, 0, sizeof(EepromFile->writes));
+    }
+}
+
+static void ResetEeprom(void)
+{
+    SimEeprom *e = &Sim->eeprom;
+    memset(e, 0, sizeof(*e));
+    if(EepromFile) {
+        memcpy(e->data, EepromFile->data, sizeof(e->data));
+        memcpy(e->writes, EepromFile->writes, sizeof(e->writes));
+    } else {
+        memset(e->data, 0xff, sizeof(e->data));  // erased
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Write a report of the wear on the EEPROM of the current instance, one line
+// per persistent variable, most written first. The rate is over this run,
+// and from it the time until the variable's bytes reach the endurance of the
+// EEPROM; the count includes earlier runs if the EEPROM is backed by a file.
+//-----------------------------------------------------------------------------
+#define EEPROM_ENDURANCE 100000
+
+typedef struct EepromWearInfoTag {
+    int     addr;
+    int     bytes;
+    char   *name;
+    DWORD   writes;     // of its most written byte
+    DWORD   runWrites;  // of those, during this run
+} EepromWearInfo;
+
+static int CompareEepromWear(const void *a, const void *b)
+{
+    const EepromWearInfo *wa = (const EepromWearInfo *)a;
+    const EepromWearInfo *wb = (const EepromWearInfo *)b;
+    if(wa->writes != wb->writes) return wa->writes < wb->writes ? 1 : -1;
+    return wa->addr - wb->addr;
+}
+
+BOOL SaveEepromWear(char *filename)
+{
+    int i, j, n = 0;
+
+    EepromWearInfo *w = (EepromWearInfo *)CheckMalloc((IntCodeLen + 1) *
+        sizeof(EepromWearInfo));
+    if(!w) return FALSE;
+    for(i = 0; i < IntCodeLen; i++) {
+        if(IntCode[i].op != INT_EEPROM_WRITE) continue;
+        for(j = 0; j < n; j++)
+            if(w[j].addr == IntCode[i].literal) break;
+        if(j < n) continue;
+
+        w[n].addr = IntCode[i].literal;
+        w[n].bytes = OpSlots[i].bytes;
+        w[n].name = IntCode[i].name1;
+        w[n].writes = 0;
+        w[n].runWrites = 0;
+        for(j = w[n].addr; j < w[n].addr + w[n].bytes; j++) {
+            DWORD runWrites = Sim->eeprom.writes[j] -
+                InitialSim.eeprom.writes[j];
+            if(Sim->eeprom.writes[j] > w[n].writes)
+                w[n].writes = Sim->eeprom.writes[j];
+            if(runWrites > w[n].runWrites) w[n].runWrites = runWrites;
+        }
+        n++;
+    }
+    qsort(w, n, sizeof(w[0]), CompareEepromWear);
+
+    FILE *f = fopen(filename, "w");
+    if(!f) {
+        CheckFree(w);
+        return FALSE;
+    }
+    double hours = Sim->cycles * (double)Prog.cycleTime / 3.6e9;
+    fprintf(f, "EEPROM wear after %lu cycles, %.3f h of PLC time; endurance "
+        "%d writes\n\n", Sim->cycles, hours, EEPROM_ENDURANCE);
+    fprintf(f, "addr  bytes     writes    writes/h   worn out in  variable\n");
+    for(i = 0; i < n; i++) {
+        double perHour = hours > 0 ? w[i].runWrites / hours : 0;
+        char left[30];
+        if(w[i].writes >= EEPROM_ENDURANCE) {
+            strcpy(left, "now");
+        } else if(perHour <= 0) {
+            strcpy(left, "never");
+        } else {
+            sprintf(left, "%.1f h", (EEPROM_ENDURANCE - w[i].writes) / perHour);
+        }
+        fprintf(f, "%4d  %5d  %9lu  %10.1f  %12s  %s\n", w[i].addr, w[i].bytes,
+            w[i].writes, perHour, left, w[i].name);
+    }
+    CheckFree(w);
+
+    BOOL ok = !ferror(f);
+    if(fclose(f) != 0) ok = FALSE;
+    return ok;
+}
+
+//-----------------------------------------------------------------------------
+// Make the tables that have an entry for each op big enough for IntCode[]
+// as it is now. What is in them doesn't have to be kept: they are all filled
+// in again from IntCode[] after each compile.
+//-----------------------------------------------------------------------------
+static void SizeOpTables(void)
+{
+    if(IntCodeLen < OpTablesSize) return;
+
+    if(OpTablesSize) {
+        CheckFree(OpSlots);
+        CheckFree(OpenIfs);
+        CheckFree(SlotRungs);
+        CheckFree(ProfileExecuted);
+        CheckFree(ProfileTaken);
+        CheckFree(ThreadedCode);
+        CheckFree(LaneJump);
+        CheckFree(LaneOuter);
+    }
+    int n = OpTablesSize ? 2*OpTablesSize : 4096;
+    while(n <= IntCodeLen) n *= 2;
+    OpTablesSize = n;
+
+    OpSlots = (SimSlots *)CheckMalloc(n * sizeof(SimSlots));
+    OpenIfs = (int *)CheckMalloc(n * sizeof(int));
+    SlotRungs = (SlotRung *)CheckMalloc(3 * n * sizeof(SlotRung));
+    ProfileExecuted = (ULONGLONG *)CheckMalloc(n * sizeof(ULONGLONG));
+    ProfileTaken = (ULONGLONG *)CheckMalloc(n * sizeof(ULONGLONG));
+    ThreadedCode = (ThreadedOp *)CheckMalloc((n + 1) * sizeof(ThreadedOp));
+    LaneJump = (int *)CheckMalloc(n * sizeof(int));
+    LaneOuter = (LaneMask *)CheckMalloc(n * sizeof(LaneMask));
+}
+
 //-----------------------------------------------------------------------------
 // Clear out all the parameters relating to the previous simulation.
 //-----------------------------------------------------------------------------
 void ClrSimulationData(void)
 {
     int i;
-    for(i = 0; i < VariableCount; i++) {
-        Variables[i].val = 0;
+    for(i = 0; i < SimVariableCount; i++) {
+        Sim->varVal[i] = 0;
         Variables[i].usedFlags = 0;
         Variables[i].initedRung = -1;
         Variables[i].initedOp = 0;
-        strcpy(Variables[i].usedRungs,"");
+        memset(UsedRungs[i], 0, sizeof(UsedRungs[i]));
     }
 }
 BOOL ClearSimulationData(void)
 {
     ClrSimulationData();
+    // The ops that they are on are about to change.
+    ClearSimBreakpoints();
+    Sim->resumeAt = 0;
     SingleBitItemsCount = 0;
+    memset(SingleBitHash, 0, sizeof(SingleBitHash));
     AdcShadowsCount = 0;
-    QueuedUartCharacter = -1;
-    SimulateUartTxCountdown = 0;
-
-    VariableCount = 0;
-    CheckVariableNames(); // ??? moved to GenerateIntermediateCode()
-    CyclesCount = 0;
+    memset(AdcShadowHash, 0, sizeof(AdcShadowHash));
+    LiteralCount = 0;
+    SimRingCount = 0;
+    RingCellsCount = 0;
+    memset(RingOfVar, 0, sizeof(RingOfVar));
+    ResetUart();
+
+    // GenerateIntermediateCode() below checks the variable names, so no
+    // need to do it here too.
+    SimVariableCount = 0;
+    memset(VariableHash, 0, sizeof(VariableHash));
+    Sim->cycles = 0;
 
     CheckSingleBitNegate(); // Set normal closed inputs to 1 before simulating
 
@@ -1314,9 +4492,229 @@ BOOL ClearSimulationData(void)
         ToggleSimulationMode();
         return FALSE;
     }
+    UseShiftRegisterRings();
+    SizeOpTables();
+    if(!ResolveSimulationSlots()) {
+        ToggleSimulationMode();
+        return FALSE;
+    }
+    DecodeThreadedCode();
+    FindTimerSlots();
+    FindRedrawSlots();
+    ResetProfile();
+    OpenEepromFile();
+    ResetEeprom();
+
+    TrackingChanges = RecordingWaveform || FastForwardSimulation ||
+        !RunningInBatchMode;
+    ClearChanges();
+    Sim->steadyCycle = FALSE;
+    if(RecordingWaveform) StartWaveform();
+
+    InitialSim = MainSim;
     return TRUE;
 }
 
+//-----------------------------------------------------------------------------
+// Another instance of the program that ClearSimulationData() last set up,
+// starting from where it left the main one. It belongs to the given batch
+// run, which gets what it sends with UART SEND.
+//-----------------------------------------------------------------------------
+SimContext *NewSimContext(BatchRun *batch)
+{
+    SimContext *c = (SimContext *)CheckMalloc(sizeof(SimContext));
+    if(c) ResetSimContext(c, batch);
+    return c;
+}
+
+void ResetSimContext(SimContext *c, BatchRun *batch)
+{
+    memcpy(c, &InitialSim, sizeof(*c));
+    c->batch = batch;
+}
+
+void FreeSimContext(SimContext *c)
+{
+    CheckFree(c);
+}
+
+//-----------------------------------------------------------------------------
+// Make an instance the one that the calling thread simulates; NULL for the
+// main one. Each thread can run its own instance, as long as no one changes
+// the program or the name tables (ClearSimulationData(), or setting a value
+// by a name that the program does not use) in the meantime.
+//-----------------------------------------------------------------------------
+void UseSimContext(SimContext *c)
+{
+    Sim = c ? c : &MainSim;
+}
+
+//-----------------------------------------------------------------------------
+// How many cycles the current instance has simulated.
+//-----------------------------------------------------------------------------
+DWORD SimulationCycles(void)
+{
+    return Sim->cycles;
+}
+
+//-----------------------------------------------------------------------------
+// Snapshots. The whole state of the current instance can be saved to a file
+// and loaded later, into the same instance or any other, so that many runs
+// can start from a state that took a long time to reach. The file holds a
+// header, to check that it belongs to the program that is loaded, and then
+// just the slots that the program uses. The rung power states shown in the
+// GUI are copies of single bits, so they come back with those.
+//-----------------------------------------------------------------------------
+#define SNAPSHOT_MAGIC "LDSNAP3"
+
+typedef struct SnapshotHeaderTag {
+    char    magic[8];
+    DWORD   signature;
+    DWORD   bits;
+    DWORD   vars;
+    DWORD   adcs;
+    DWORD   cycles;
+} SnapshotHeader;
+
+//-----------------------------------------------------------------------------
+// A hash of the names and the intermediate code of the program, so that we
+// don't load a snapshot into a program that has changed since.
+//-----------------------------------------------------------------------------
+static DWORD Fnv(DWORD h, const void *p, int len)
+{
+    const BYTE *b = (const BYTE *)p;
+    while(len--) {
+        h ^= *b++;
+        h *= 16777619;
+    }
+    return h;
+}
+
+static DWORD ProgramSignature(void)
+{
+    DWORD h = 2166136261u;
+    int i;
+    for(i = 0; i < SingleBitItemsCount; i++)
+        h = Fnv(h, SingleBitItems[i].name, strlen(SingleBitItems[i].name) + 1);
+    for(i = 0; i < SimVariableCount; i++)
+        h = Fnv(h, Variables[i].name, strlen(Variables[i].name) + 1);
+    for(i = 0; i < AdcShadowsCount; i++)
+        h = Fnv(h, AdcShadows[i].name, strlen(AdcShadows[i].name) + 1);
+    for(i = 0; i < IntCodeLen; i++) {
+        h = Fnv(h, &IntCode[i].op, sizeof(IntCode[i].op));
+        h = Fnv(h, &OpSlots[i], sizeof(OpSlots[i]));
+        h = Fnv(h, &IntCode[i].literal, sizeof(IntCode[i].literal));
+    }
+    return h;
+}
+
+//-----------------------------------------------------------------------------
+// Save the state of the current instance. Returns FALSE if the file could not
+// be written.
+//-----------------------------------------------------------------------------
+BOOL SaveSimSnapshot(char *filename)
+{
+    SnapshotHeader h;
+    BYTE bits[MAX_IO];
+    int i;
+
+    FILE *f = fopen(filename, "wb");
+    if(!f) return FALSE;
+
+    memset(&h, 0, sizeof(h));
+    strcpy(h.magic, SNAPSHOT_MAGIC);
+    h.signature = ProgramSignature();
+    h.bits = SingleBitItemsCount;
+    h.vars = SimVariableCount;
+    h.adcs = AdcShadowsCount;
+    h.cycles = Sim->cycles;
+    for(i = 0; i < SingleBitItemsCount; i++)
+        bits[i] = Sim->bitVal[i] ? 1 : 0;
+
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(bits, 1, h.bits, f);
+    fwrite(Sim->varVal, sizeof(Sim->varVal[0]), h.vars, f);
+    fwrite(Sim->adcVal, sizeof(Sim->adcVal[0]), h.adcs, f);
+    fwrite(&Sim->uart, sizeof(Sim->uart), 1, f);
+    fwrite(&Sim->eeprom, sizeof(Sim->eeprom), 1, f);
+    BOOL ok = !ferror(f);
+    if(fclose(f) != 0) ok = FALSE;
+    return ok;
+}
+
+//-----------------------------------------------------------------------------
+// Load a snapshot into the current instance. The file is decoded into a
+// complete instance first, so that the state changes all at once, and only
+// if the file is good; returns FALSE (having said why) if it is not.
+//-----------------------------------------------------------------------------
+BOOL LoadSimSnapshot(char *filename)
+{
+    SnapshotHeader h;
+    BYTE bits[MAX_IO];
+    BOOL ok = FALSE;
+    int i;
+
+    FILE *f = fopen(filename, "rb");
+    if(!f) {
+        Error(_("Couldn't open '%s'."), filename);
+        return FALSE;
+    }
+    SimContext *c = (SimContext *)CheckMalloc(sizeof(SimContext));
+    if(!c) goto done;
+
+    if(fread(&h, sizeof(h), 1, f) != 1 ||
+        memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+    {
+        Error(_("'%s' is not a simulation snapshot."), filename);
+        goto done;
+    }
+    if(h.signature != ProgramSignature() ||
+        h.bits != (DWORD)SingleBitItemsCount ||
+        h.vars != (DWORD)SimVariableCount ||
+        h.adcs != (DWORD)AdcShadowsCount)
+    {
+        Error(_("'%s' is a snapshot of a different program."), filename);
+        goto done;
+    }
+
+    // Everything that is not in the file (the literals, and what is only
+    // kept for the current cycle) is as in a fresh instance.
+    memcpy(c, &InitialSim, sizeof(*c));
+    c->batch = Sim->batch;
+    c->debug = Sim->debug;
+    if(fread(bits, 1, h.bits, f) != h.bits ||
+        fread(c->varVal, sizeof(c->varVal[0]), h.vars, f) != h.vars ||
+        fread(c->adcVal, sizeof(c->adcVal[0]), h.adcs, f) != h.adcs ||
+        fread(&c->uart, sizeof(c->uart), 1, f) != 1 ||
+        fread(&c->eeprom, sizeof(c->eeprom), 1, f) != 1)
+    {
+        Error(_("'%s' is not a simulation snapshot."), filename);
+        goto done;
+    }
+    for(i = 0; i < SingleBitItemsCount; i++)
+        c->bitVal[i] = bits[i];
+    c->cycles = h.cycles;
+
+    memcpy(Sim, c, sizeof(*c));
+    ok = TRUE;
+
+    if(Sim == &MainSim) {
+        if(!RunningInBatchMode) {
+            for(i = 0; i < IntCodeLen; i++) {
+                if(IntCode[i].op == INT_SIMULATE_NODE_STATE)
+                    *(IntCode[i].poweredAfter) =
+                        Sim->bitVal[OpSlots[i].bit1];
+            }
+        }
+        if(RecordingWaveform) StartWaveform();
+    }
+
+done:
+    if(c) CheckFree(c);
+    fclose(f);
+    return ok;
+}
+
 //-----------------------------------------------------------------------------
 SDWORD SDWORD3(SDWORD v)
 {
@@ -1412,6 +4810,53 @@ void SimulationToggleContact(char *name)
     ListView_RedrawItems(IoList, 0, Prog.io.count - 1);
 }
 
+//-----------------------------------------------------------------------------
+// Hand a character to the program's UART RECV, as if it had just come in on
+// the line. Returns FALSE if the receive FIFO is full, in which case the
+// character is lost, as it would be in the real UART (an overrun).
+//-----------------------------------------------------------------------------
+BOOL QueueUartCharacter(BYTE b)
+{
+    SimUart *u = &Sim->uart;
+    if(u->rxCount >= u->rxSize) return FALSE;
+    u->rx[(u->rxHead + u->rxCount++) % SIM_UART_FIFO_MAX] = b;
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// How many of the given number of characters waiting to be sent to the
+// program get through the line during this cycle, at the baud rate. Call
+// once per cycle with everything that is waiting, then QueueUartCharacter()
+// that many of them.
+//-----------------------------------------------------------------------------
+int UartLineBytesDue(int waiting)
+{
+    SimUart *u = &Sim->uart;
+    if(waiting <= 0) {
+        // an idle line; the next character starts from scratch
+        u->rxCredit = 0;
+        return 0;
+    }
+    u->rxCredit += UartLineRate();
+    long long n = u->rxCredit / UART_BYTE_COST;
+    if(n > waiting) n = waiting;
+    u->rxCredit -= n*UART_BYTE_COST;
+    return (int)n;
+}
+
+//-----------------------------------------------------------------------------
+// Set the depths of the receive and transmit FIFOs of the current instance.
+// Returns FALSE if either is out of range.
+//-----------------------------------------------------------------------------
+BOOL SetUartFifoSizes(int rx, int tx)
+{
+    if(rx < 1 || rx > SIM_UART_FIFO_MAX || tx < 1 || tx > SIM_UART_FIFO_MAX)
+        return FALSE;
+    Sim->uart.rxSize = rx;
+    Sim->uart.txSize = tx;
+    return TRUE;
+}
+
 //-----------------------------------------------------------------------------
 // Dialog proc for the popup that lets you interact with the UART stuff.
 //-----------------------------------------------------------------------------
@@ -1489,7 +4934,7 @@ static LRESULT CALLBACK UartSimulationTextProc(HWND hwnd, UINT msg,
     }
 
     if(msg == WM_CHAR) {
-        QueuedUartCharacter = (BYTE)wParam;
+        QueueUartCharacter((BYTE)wParam);
         return 0;
     }
 
@@ -1602,9 +5047,12 @@ void DestroyUartSimulationWindow(void)
 }
 
 //-----------------------------------------------------------------------------
-// Append a received character to the terminal buffer.
+// Append a received character to the terminal buffer. The text control is
+// only updated by FlushUartSimulationTextControl(), once per timer tick, so
+// that a fast UART doesn't cost a redraw per character.
 //-----------------------------------------------------------------------------
 static SDWORD bPrev = 0;
+static BOOL UartTextPending;
 static void AppendToUartSimulationTextControl(BYTE b)
 {
     char append[50];
@@ -1620,8 +5068,11 @@ static void AppendToUartSimulationTextControl(BYTE b)
 
     if(fUART) fprintf(fUART, "%s", append);
 
-    SendMessage(UartSimulationTextControl, WM_GETTEXT, (WPARAM)(sizeof(buf)-1),
-        (LPARAM)buf);
+    if(!UartTextPending) {
+        SendMessage(UartSimulationTextControl, WM_GETTEXT,
+            (WPARAM)(sizeof(buf)-1), (LPARAM)buf);
+        UartTextPending = TRUE;
+    }
 
     // vvv // This patch only for simulation mode and for WC_EDIT control.
     // Compared with Windows HyperTerminal and Putty.
@@ -1677,11 +5128,29 @@ static void AppendToUartSimulationTextControl(BYTE b)
         memmove(buf, buf + overBy, strlen(buf));
     }
     strcat(buf, append);
+}
 
+static void FlushUartSimulationTextControl(void)
+{
+    if(!UartTextPending) return;
+    UartTextPending = FALSE;
 
     SendMessage(UartSimulationTextControl, WM_SETTEXT, 0, (LPARAM)buf);
     SendMessage(UartSimulationTextControl, EM_LINESCROLL, 0, (LPARAM)INT_MAX);
 }
+
+//-----------------------------------------------------------------------------
+// A byte that has gone out on the line: to the batch run that we belong to,
+// if any, else to the terminal window.
+//-----------------------------------------------------------------------------
+static void UartSent(BYTE b)
+{
+    if(Sim->batch) {
+        BatchUartSend(Sim->batch, b);
+    } else {
+        AppendToUartSimulationTextControl(b);
+    }
+}
 /*
 ------------------------------ ASCII Control Codes ---------------------------
 |Dec Hex Ctl  Name Control Meaning      |Dec Hex Ctl  Name Control Meaning
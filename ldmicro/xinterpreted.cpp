@@ -105,6 +105,17 @@ static BYTE AddrForVariable(char *name)
 
 void CompileXInterpreted(char *outFile)
 {
+    // ldxinterpret.c has no piecewise linear, ring or bit term ops, and its
+    // format is fixed; a ring would need an op that indexes the variables.
+    ExpandPiecewiseLinear();
+    ExpandShiftRegisters();
+    ExpandBitTerms();
+
+    if(IntCodeLen >= MAX_INT_OPS) {
+        Error(_("Program too long for an interpretable target (%d ops, max %d)."),
+            IntCodeLen, MAX_INT_OPS - 1);
+        return;
+    }
     FILE *f = fopen(outFile, "w");
     if(!f) {
         Error(_("Couldn't write to '%s'"), outFile);
@@ -161,6 +172,24 @@ void CompileXInterpreted(char *outFile)
 				OutProg[outPc++] = AddrForVariable(IntCode[ipc].name2);
                 break;
 
+            case INT_LOOK_UP_TABLE:
+                // op, dest, index, count, then the values, low byte first
+                if(outPc + 4 + 2*IntCode[ipc].literal >= MAX_INT_OPS) {
+                    Error(_("Program too long for an interpretable target (%d ops, max %d)."),
+                        outPc + 4 + 2*IntCode[ipc].literal, MAX_INT_OPS - 1);
+                    fclose(f);
+                    return;
+                }
+				OutProg[outPc++] = IntCode[ipc].op;
+				OutProg[outPc++] = AddrForVariable(IntCode[ipc].name1);
+				OutProg[outPc++] = AddrForVariable(IntCode[ipc].name2);
+				OutProg[outPc++] = CheckRange(IntCode[ipc].literal, "count");
+				for(int j = 0; j < IntCode[ipc].literal; j++) {
+					OutProg[outPc++] = IntCode[ipc].data[j] & 0xFF;
+					OutProg[outPc++] = IntCode[ipc].data[j] >> 8;
+				}
+                break;
+
             case INT_DECREMENT_VARIABLE:
             case INT_INCREMENT_VARIABLE:
 				OutProg[outPc++] = IntCode[ipc].op;